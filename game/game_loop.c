@@ -0,0 +1,265 @@
+// Game loop with decoupled simulation and render threads, see game_loop.h
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "game_loop.h"
+#include "triple_buffer.h"
+#include "frame_pacer.h"
+#include "thread_role.h"
+
+#define NS_PER_SEC	1000000000LL
+
+// every published state is prefixed with this, padded to a cache line so that
+// the game's state stays aligned
+struct snapshot
+{
+	uint64_t tick;
+	int64_t time;		// the simulated moment it shows, in CLOCK_MONOTONIC ns
+	int64_t published;	// when it was published, ditto
+};
+#define SNAPSHOT_HEADER_SIZE	TRIPLE_BUFFER_CACHE_LINE
+
+static struct
+{
+	struct game_loop_config cfg;
+	struct game_loop_hooks hooks;
+	struct triple_buffer buffer;
+	int64_t start;
+	int stop;
+	struct game_loop_stats sim_stats;	// the sim thread's part
+} g_loop;
+
+
+// ============================================================================
+
+
+static inline void *snapshot_state(void *snapshot)
+{
+	return (char *)snapshot + SNAPSHOT_HEADER_SIZE;
+}
+
+static inline void stage_add(struct game_loop_stage *stage, int64_t ns)
+{
+	++stage->count;
+	stage->sum += ns;
+	if (ns > stage->max)
+		stage->max = ns;
+}
+
+static void *sim_thread(void *arg)
+{
+	(void)arg;
+	const struct game_loop_config *cfg = &g_loop.cfg;
+	struct game_loop_stats *stats = &g_loop.sim_stats;
+	pthread_setname_np(pthread_self(), "sim");
+	if (cfg->sim_role >= 0)
+		thread_role_apply(cfg->sim_role, NULL);
+
+	struct frame_pacer pacer;
+	frame_pacer_init(&pacer, cfg->tick_period);
+	// tick n simulates [start + n * period, start + (n + 1) * period], so it
+	// runs once the end of that has come
+	int64_t next = g_loop.start;
+	uint64_t tick = 0;
+	int catchup = 0;
+	while (!__atomic_load_n(&g_loop.stop, __ATOMIC_RELAXED))
+	{
+		int64_t due = next + cfg->tick_period;
+		int64_t now = frame_pacer_now();
+		if (now < due)
+		{
+			frame_pacer_wait_until(&pacer, due);
+			catchup = 0;
+		}
+		else if (catchup < cfg->max_catchup)
+		{
+			++catchup;
+			++stats->catchup_ticks;
+		}
+		else
+		{
+			// too far behind to catch up: skip the missed time rather than
+			// spiral, ticking ever more to make up for ticks that took too long
+			int64_t skipped = (now - next) / cfg->tick_period;
+			stats->dropped_ticks += skipped;
+			next += skipped * cfg->tick_period;
+			catchup = 0;
+			continue;
+		}
+
+		struct snapshot *snapshot = (struct snapshot *)triple_buffer_back(&g_loop.buffer);
+		int64_t start = frame_pacer_now();
+		g_loop.hooks.tick(g_loop.hooks.user, tick, cfg->tick_period,
+			snapshot_state(snapshot));
+		int64_t end = frame_pacer_now();
+		stage_add(&stats->tick, end - start);
+		snapshot->tick = tick++;
+		snapshot->time = due;
+		snapshot->published = end;
+		triple_buffer_publish(&g_loop.buffer);
+		next = due;
+	}
+	return NULL;
+}
+
+
+// ============================================================================
+
+
+void game_loop_default_config(struct game_loop_config *cfg)
+{
+	cfg->tick_period = NS_PER_SEC / 60;
+	cfg->frame_period = 0;
+	cfg->max_catchup = 4;
+	cfg->sim_role = THREAD_ROLE_MAIN;
+	cfg->render_role = THREAD_ROLE_RENDER;
+}
+
+int game_loop_run(const struct game_loop_config *cfg,
+	const struct game_loop_hooks *hooks, struct game_loop_stats *stats)
+{
+	if (!hooks->tick || !hooks->render || cfg->tick_period <= 0 || cfg->frame_period < 0)
+	{
+		printf("[GameLoop] Invalid configuration\n");
+		return -1;
+	}
+	size_t snapshot_size = SNAPSHOT_HEADER_SIZE + hooks->state_size;
+	// the render thread keeps copies of the last two states, so that it only
+	// ever holds on to the front slot for the duration of the copy
+	char *prev = NULL, *curr = NULL, *out = NULL;
+	if (posix_memalign((void **)&prev, TRIPLE_BUFFER_CACHE_LINE, snapshot_size) != 0
+		|| posix_memalign((void **)&curr, TRIPLE_BUFFER_CACHE_LINE, snapshot_size) != 0
+		|| posix_memalign((void **)&out, TRIPLE_BUFFER_CACHE_LINE, snapshot_size) != 0
+		|| triple_buffer_init(&g_loop.buffer, snapshot_size) != 0)
+	{
+		printf("[GameLoop] Out of memory\n");
+		free(prev);
+		free(curr);
+		free(out);
+		return -1;
+	}
+
+	g_loop.cfg = *cfg;
+	g_loop.hooks = *hooks;
+	memset(&g_loop.sim_stats, 0, sizeof(g_loop.sim_stats));
+	memset(stats, 0, sizeof(*stats));
+	__atomic_store_n(&g_loop.stop, 0, __ATOMIC_RELAXED);
+	g_loop.start = frame_pacer_now();
+
+	pthread_t sim;
+	if (pthread_create(&sim, NULL, sim_thread, NULL) != 0)
+	{
+		printf("[GameLoop] Failed to start the simulation thread\n");
+		triple_buffer_destroy(&g_loop.buffer);
+		free(prev);
+		free(curr);
+		free(out);
+		return -1;
+	}
+
+	if (cfg->render_role >= 0)
+		thread_role_apply(cfg->render_role, NULL);
+	struct frame_pacer pacer;
+	if (cfg->frame_period > 0)
+		frame_pacer_init(&pacer, cfg->frame_period);
+	int have = 0;	// states we hold, up to 2
+	uint64_t frame = 0;
+	while (!__atomic_load_n(&g_loop.stop, __ATOMIC_RELAXED))
+	{
+		if (cfg->frame_period > 0)
+			frame_pacer_wait(&pacer);
+
+		int fresh;
+		const void *front = triple_buffer_read(&g_loop.buffer, &fresh);
+		int64_t start = frame_pacer_now();
+		if (fresh)
+		{
+			char *tmp = prev;
+			prev = curr;
+			curr = tmp;
+			memcpy(curr, front, snapshot_size);
+			if (have < 2)
+				++have;
+		}
+		else if (have)
+			++stats->stale_frames;
+		if (!have)
+		{
+			// nothing to show before the first tick
+			struct timespec ts = {0, cfg->tick_period / 8};
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		const struct snapshot *current = (const struct snapshot *)curr;
+		const void *state = snapshot_state(curr);
+		if (hooks->interpolate && have == 2)
+		{
+			// we show the moment a tick period ago, which falls between the
+			// last two states unless the simulation is lagging
+			const struct snapshot *previous = (const struct snapshot *)prev;
+			int64_t span = current->time - previous->time;
+			float alpha = span > 0
+				? (float)(start - cfg->tick_period - previous->time) / span : 1;
+			alpha = alpha < 0 ? 0 : alpha > 1 ? 1 : alpha;
+			hooks->interpolate(hooks->user, snapshot_state(prev), state, alpha,
+				snapshot_state(out));
+			state = snapshot_state(out);
+			int64_t end = frame_pacer_now();
+			stage_add(&stats->interpolate, end - start);
+			start = end;
+		}
+		stage_add(&stats->age, start - current->published);
+		hooks->render(hooks->user, state, frame++);
+		stage_add(&stats->render, frame_pacer_now() - start);
+	}
+
+	pthread_join(sim, NULL);
+	stats->duration = frame_pacer_now() - g_loop.start;
+	stats->tick = g_loop.sim_stats.tick;
+	stats->catchup_ticks = g_loop.sim_stats.catchup_ticks;
+	stats->dropped_ticks = g_loop.sim_stats.dropped_ticks;
+	stats->unseen_states = triple_buffer_overwritten(&g_loop.buffer);
+	triple_buffer_destroy(&g_loop.buffer);
+	free(prev);
+	free(curr);
+	free(out);
+	return 0;
+}
+
+void game_loop_stop(void)
+{
+	__atomic_store_n(&g_loop.stop, 1, __ATOMIC_RELAXED);
+}
+
+static void print_stage(const char *label, const struct game_loop_stage *stage)
+{
+	if (!stage->count)
+		return;
+	printf("  %-12s avg %7.3f  max %7.3f ms\n", label,
+		(double)stage->sum / stage->count / 1e6, stage->max / 1e6);
+}
+
+void game_loop_print_stats(const struct game_loop_stats *stats)
+{
+	double seconds = stats->duration / 1e9;
+	printf("[GameLoop] %llu ticks and %llu frames in %.2f s (%.1f Hz simulation, "
+		"%.1f Hz rendering)\n", (unsigned long long)stats->tick.count,
+		(unsigned long long)stats->render.count, seconds,
+		seconds > 0 ? stats->tick.count / seconds : 0,
+		seconds > 0 ? stats->render.count / seconds : 0);
+	print_stage("tick", &stats->tick);
+	print_stage("interpolate", &stats->interpolate);
+	print_stage("render", &stats->render);
+	print_stage("state age", &stats->age);
+	printf("  %llu catch-up and %llu dropped ticks, %llu frames reusing a state, "
+		"%llu states never rendered\n", (unsigned long long)stats->catchup_ticks,
+		(unsigned long long)stats->dropped_ticks,
+		(unsigned long long)stats->stale_frames,
+		(unsigned long long)stats->unseen_states);
+}
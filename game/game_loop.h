@@ -0,0 +1,88 @@
+// Game loop with the simulation and rendering decoupled on their own threads
+// The simulation ticks at a fixed rate on a thread of its own, and publishes
+// every tick's state through a triple buffer (see triple_buffer.h); the
+// renderer runs on the calling thread at whatever rate it can or is asked to,
+// always picks up the latest complete state without ever waiting for the
+// simulation, and interpolates between the last two states it got so that
+// motion stays smooth whatever the ratio of the two rates
+// Rendering is one tick behind the simulation: the frame shows where things
+// were a tick period ago, which is what lets it interpolate rather than
+// extrapolate
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// what the game plugs in; everything but interpolate is required
+struct game_loop_hooks
+{
+	void *user;			// passed to every hook
+	size_t state_size;	// bytes of state published per tick
+	// sim thread: advances the simulation by dt ns and writes the resulting
+	// state, in full, to state
+	void (*tick)(void *user, uint64_t tick, int64_t dt, void *state);
+	// render thread: blends prev and curr by alpha in [0, 1] into out; if
+	// NULL, curr gets rendered as is
+	void (*interpolate)(void *user, const void *prev, const void *curr,
+		float alpha, void *out);
+	// render thread: renders a state
+	void (*render)(void *user, const void *state, uint64_t frame);
+};
+
+struct game_loop_config
+{
+	int64_t tick_period;	// in ns
+	int64_t frame_period;	// in ns; 0 to render as fast as possible
+	// ticks the simulation may run back to back to catch up after falling
+	// behind; past that, the missed time is dropped and the game slows down
+	int max_catchup;
+	// thread roles from priority/thread_role.h, or -1 to leave them alone
+	int sim_role;
+	int render_role;
+};
+
+// timing of one stage, in ns
+struct game_loop_stage
+{
+	uint64_t count;
+	int64_t sum;
+	int64_t max;
+};
+
+struct game_loop_stats
+{
+	struct game_loop_stage tick;		// tick hook
+	struct game_loop_stage interpolate;	// interpolate hook
+	struct game_loop_stage render;		// render hook
+	struct game_loop_stage age;			// from publishing to rendering a state
+	uint64_t catchup_ticks;		// ticks run late to catch up
+	uint64_t dropped_ticks;		// ticks skipped over after falling behind
+	uint64_t stale_frames;		// frames rendered without a new state
+	uint64_t unseen_states;		// states overwritten before rendering
+	int64_t duration;			// wall time, in ns
+};
+
+// fills in the defaults: 60 Hz ticks rendered as fast as possible, up to 4
+// catch-up ticks, and the main and render roles
+void game_loop_default_config(struct game_loop_config *cfg);
+
+// starts the simulation thread and runs the render loop on the calling thread
+// until game_loop_stop(); returns 0 once stopped, -1 if it failed to start
+int game_loop_run(const struct game_loop_config *cfg,
+	const struct game_loop_hooks *hooks, struct game_loop_stats *stats);
+
+// makes game_loop_run() return after the current frame; any thread, including
+// from within the hooks
+void game_loop_stop(void);
+
+// prints the stats with the [GameLoop] prefix
+void game_loop_print_stats(const struct game_loop_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,80 @@
+// Per-thread heaps on dlmalloc's mspaces, see heap.h
+
+#define _GNU_SOURCE
+#include <stdio.h>
+
+#include "heap.h"
+
+// dlmalloc, built for mspaces only so that it doesn't replace malloc(), and
+// without locks since every heap has a single owner
+#define MSPACES			1
+#define ONLY_MSPACES	1
+#define USE_LOCKS		0
+#include "../valgrind/malloc.c"
+
+struct heap
+{
+	mspace space;
+	char name[32];
+	uint64_t allocs;
+	uint64_t frees;
+};
+
+
+// ============================================================================
+
+
+struct heap *heap_create(const char *name, size_t capacity)
+{
+	mspace space = create_mspace(capacity, 0);
+	if (!space)
+		return NULL;
+	// the bookkeeping lives in the heap itself
+	struct heap *heap = mspace_malloc(space, sizeof(*heap));
+	if (!heap)
+	{
+		destroy_mspace(space);
+		return NULL;
+	}
+	heap->space = space;
+	snprintf(heap->name, sizeof(heap->name), "%s", name);
+	heap->allocs = 0;
+	heap->frees = 0;
+	return heap;
+}
+
+void heap_destroy(struct heap *heap)
+{
+	destroy_mspace(heap->space);
+}
+
+void *heap_alloc(struct heap *heap, size_t size)
+{
+	++heap->allocs;
+	return mspace_malloc(heap->space, size);
+}
+
+void heap_free(struct heap *heap, void *ptr)
+{
+	if (!ptr)
+		return;
+	++heap->frees;
+	mspace_free(heap->space, ptr);
+}
+
+void heap_get_stats(struct heap *heap, struct heap_stats *stats)
+{
+	struct mallinfo info = mspace_mallinfo(heap->space);
+	stats->footprint = mspace_footprint(heap->space);
+	stats->max_footprint = mspace_max_footprint(heap->space);
+	stats->in_use = info.uordblks;
+	stats->free = info.fordblks;
+	stats->mmapped = info.hblkhd;
+	stats->allocs = heap->allocs;
+	stats->frees = heap->frees;
+}
+
+const char *heap_name(const struct heap *heap)
+{
+	return heap->name;
+}
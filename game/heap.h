@@ -0,0 +1,44 @@
+// Per-thread heaps on dlmalloc's mspaces (../valgrind/malloc.c)
+// Each heap is an independent mspace without locks, so it must only ever be
+// used by one thread at a time; in exchange, allocating is a handful of
+// instructions with no atomics, and heaps of different threads never share
+// cache lines or fragment each other
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct heap;
+
+struct heap_stats
+{
+	size_t footprint;		// bytes obtained from the system
+	size_t max_footprint;
+	size_t in_use;			// bytes in allocated chunks
+	size_t free;			// bytes in free chunks
+	size_t mmapped;			// of the footprint, in large direct mmaps
+	uint64_t allocs;
+	uint64_t frees;
+};
+
+// creates a heap that starts with capacity bytes (0 for the default) and grows
+// as needed; name is only kept for reporting
+struct heap *heap_create(const char *name, size_t capacity);
+
+// frees everything allocated from the heap, and the heap itself
+void heap_destroy(struct heap *heap);
+
+void *heap_alloc(struct heap *heap, size_t size);
+void heap_free(struct heap *heap, void *ptr);
+
+void heap_get_stats(struct heap *heap, struct heap_stats *stats);
+const char *heap_name(const struct heap *heap);
+
+#ifdef __cplusplus
+}
+#endif
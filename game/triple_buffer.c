@@ -0,0 +1,83 @@
+// Lock-free triple buffer, see triple_buffer.h
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "triple_buffer.h"
+
+#define TRIPLE_BUFFER_FRESH	4
+#define TRIPLE_BUFFER_INDEX	3
+
+
+// ============================================================================
+
+
+int triple_buffer_init(struct triple_buffer *buffer, size_t size)
+{
+	memset(buffer, 0, sizeof(*buffer));
+	// rounded up so that neighbouring slots never share a cache line
+	buffer->size = size;
+	size = (size + TRIPLE_BUFFER_CACHE_LINE - 1) & ~(size_t)(TRIPLE_BUFFER_CACHE_LINE - 1);
+	for (int i = 0; i < 3; ++i)
+	{
+		if (posix_memalign(&buffer->slots[i], TRIPLE_BUFFER_CACHE_LINE, size) != 0)
+		{
+			triple_buffer_destroy(buffer);
+			return -1;
+		}
+		memset(buffer->slots[i], 0, size);
+	}
+	buffer->back = 0;
+	buffer->middle = 1;
+	buffer->front = 2;
+	return 0;
+}
+
+void triple_buffer_destroy(struct triple_buffer *buffer)
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		free(buffer->slots[i]);
+		buffer->slots[i] = NULL;
+	}
+}
+
+void *triple_buffer_back(struct triple_buffer *buffer)
+{
+	return buffer->slots[buffer->back];
+}
+
+void triple_buffer_publish(struct triple_buffer *buffer)
+{
+	// release for our writes to the slot, acquire for the reader's reads of
+	// the one we get back being done
+	unsigned old = __atomic_exchange_n(&buffer->middle,
+		(unsigned)buffer->back | TRIPLE_BUFFER_FRESH, __ATOMIC_ACQ_REL);
+	buffer->back = old & TRIPLE_BUFFER_INDEX;
+	__atomic_store_n(&buffer->published, buffer->published + 1, __ATOMIC_RELAXED);
+}
+
+const void *triple_buffer_read(struct triple_buffer *buffer, int *fresh)
+{
+	// only exchange if there's something new, so that a reader faster than
+	// the writer doesn't bounce the cache line for nothing
+	int is_fresh = (__atomic_load_n(&buffer->middle, __ATOMIC_RELAXED) & TRIPLE_BUFFER_FRESH) != 0;
+	if (is_fresh)
+	{
+		unsigned old = __atomic_exchange_n(&buffer->middle, (unsigned)buffer->front,
+			__ATOMIC_ACQ_REL);
+		buffer->front = old & TRIPLE_BUFFER_INDEX;
+		__atomic_store_n(&buffer->taken, buffer->taken + 1, __ATOMIC_RELAXED);
+	}
+	if (fresh)
+		*fresh = is_fresh;
+	return buffer->slots[buffer->front];
+}
+
+uint64_t triple_buffer_overwritten(const struct triple_buffer *buffer)
+{
+	uint64_t published = __atomic_load_n(&buffer->published, __ATOMIC_RELAXED);
+	uint64_t taken = __atomic_load_n(&buffer->taken, __ATOMIC_RELAXED);
+	return published > taken ? published - taken : 0;
+}
@@ -0,0 +1,56 @@
+// Lock-free triple buffer for handing the latest state from one thread to
+// another
+// The writer fills its back slot and swaps it with the middle one in a single
+// atomic exchange; the reader swaps the middle slot with its front one when
+// there's something new in it. Neither side ever waits for the other, the
+// reader always gets the most recent complete state, and states the reader
+// was too slow to see are simply overwritten, which is exactly what a renderer
+// wants from a simulation running at a different rate
+// NOTE: one writer and one reader thread only
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRIPLE_BUFFER_CACHE_LINE	64
+
+struct triple_buffer
+{
+	// index of the middle slot, plus TRIPLE_BUFFER_FRESH if it holds a state
+	// the reader hasn't taken yet
+	unsigned middle __attribute__((aligned(TRIPLE_BUFFER_CACHE_LINE)));
+	int back __attribute__((aligned(TRIPLE_BUFFER_CACHE_LINE)));	// writer's
+	uint64_t published;		// writer's count of states
+	int front __attribute__((aligned(TRIPLE_BUFFER_CACHE_LINE)));	// reader's
+	uint64_t taken;			// reader's count of states
+	size_t size;
+	void *slots[3];
+};
+
+// returns 0 on success; slots are zeroed and cache line aligned
+int triple_buffer_init(struct triple_buffer *buffer, size_t size);
+void triple_buffer_destroy(struct triple_buffer *buffer);
+
+// writer only; the slot to fill in next, it keeps its contents from whenever
+// it was last published, so it has to be written in full
+void *triple_buffer_back(struct triple_buffer *buffer);
+// writer only; makes the back slot the latest state
+void triple_buffer_publish(struct triple_buffer *buffer);
+
+// reader only; takes the latest state if there's a new one, and returns the
+// front slot; it stays valid and unchanged until the next call; fresh, if
+// not NULL, is set to non-zero if the state is new
+const void *triple_buffer_read(struct triple_buffer *buffer, int *fresh);
+
+// states published but never read, because newer ones replaced them first;
+// only exact once the writer is done
+uint64_t triple_buffer_overwritten(const struct triple_buffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
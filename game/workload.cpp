@@ -0,0 +1,628 @@
+// Synthetic game workload: a fixed-timestep simulation thread fanning out
+// worker jobs, a render submission thread one frame behind it, an audio
+// thread mixing on its own period, allocation churn on per-thread dlmalloc
+// heaps and periodic streaming reads, all under the crash handler and the
+// watchdog; meant as a reproducible end-to-end benchmark for allocator,
+// scheduling and crash path changes
+// To build:	make
+// To grant capabilities – as root:	setcap cap_sys_nice+ep ./workload
+// To run:	./workload [-n frames] [-r sim Hz] [-j jobs per frame]
+//		[-a allocations per frame] [-i I/O interval in ms] [-s seed]
+//		[-c frame to crash at] [-p] [-l]
+// -p applies the thread roles from priority/thread_role.h to the game's own
+// threads (the job workers always run under theirs), and pins them and the
+// job workers according to priority/topology.h
+// -l locks and prefaults memory with priority/memory_lock.h; it needs
+// cap_ipc_lock (or an unlimited RLIMIT_MEMLOCK) to lock anything
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>			// for PATH_MAX
+#include <fcntl.h>			// for open() and posix_fadvise()
+#include <pthread.h>
+#include <unistd.h>			// for getopt() and readlink()
+#include <time.h>
+#include <sys/resource.h>	// for getrusage()
+#include <algorithm>		// for std::sort
+
+#include "heap.h"
+#include "jobs.h"
+#include "wait.h"
+#include "async_read.h"
+#include "frame_pacer.h"
+#include "thread_role.h"
+#include "memory_lock.h"
+#include "topology.h"
+#include "sighandler.h"
+#include "watchdog.h"		// for WATCHDOG_PATH_ENV
+
+// allocations a thread may keep alive across ticks
+#define CHURN_MAX_LIVE		4096
+// allocations per tick, at most
+#define CHURN_MAX_TEMP		16384
+// every so many allocations gets timed
+#define CHURN_TIME_EVERY	16
+
+#define AUDIO_PERIOD		5333333		// 256 samples at 48 kHz, in ns
+#define IO_FILE				"workload.dat"
+#define IO_FILE_SIZE		(32 << 20)
+#define IO_STREAM_SIZE		(1 << 20)	// background read per interval
+#define IO_LOAD_SIZE		(64 << 10)	// normal-priority read per interval
+// every so many frames, a spawn wave brings many more allocations
+#define SPAWN_WAVE_EVERY	120
+
+struct workload_config
+{
+	int frames;
+	int sim_hz;
+	int jobs;			// per frame
+	int allocs;			// per frame on the sim thread; others scale off it
+	int io_ms;
+	unsigned seed;
+	int crash_frame;	// -1 for never
+	bool roles;
+	bool lock_memory;
+};
+
+static struct workload_config g_cfg = {600, 60, 16, 2000, 100, 1, -1, false, false};
+
+// a thread's allocation churn on its own heap
+struct churn
+{
+	struct heap *heap;
+	uint64_t rng;
+	uint64_t tick;
+	int num_live;
+	struct
+	{
+		void *ptr;
+		uint64_t expires;	// tick
+	} live[CHURN_MAX_LIVE];
+	void *temp[CHURN_MAX_TEMP];
+	// allocation latency, sampled
+	uint64_t timed;
+	uint64_t time_sum;
+	uint64_t time_max;
+	struct churn *next;
+};
+
+static pthread_mutex_t g_churn_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct churn *g_churns = NULL;
+static __thread struct churn *t_churn = NULL;
+// the one jobs use, kept apart since the sim thread runs jobs too
+static __thread struct churn *t_job_churn = NULL;
+
+static volatile bool g_exit = false;
+static struct wait_sem g_render_ready = WAIT_SEM_INIT(0);
+static struct wait_sem g_render_slots = WAIT_SEM_INIT(2);	// frames in flight
+static uint64_t g_frames_rendered = 0;
+static uint64_t g_audio_mixes = 0;
+static uint64_t g_audio_underruns = 0;
+static volatile int g_crash_job = -1;
+static volatile unsigned g_sink;
+static struct topology_placement g_place;
+static bool g_placed = false;			// g_place is valid
+
+
+// ============================================================================
+// helpers
+
+
+static int64_t now_ns()
+{
+	return frame_pacer_now();
+}
+
+// xorshift64*, seeded per thread for reproducible runs
+static uint64_t rng_next(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static uint64_t rng_range(uint64_t *state, uint64_t min, uint64_t max)
+{
+	return min + rng_next(state) % (max - min + 1);
+}
+
+// CPU-bound busy work, standing in for the actual game code
+static void work_us(int us)
+{
+	int64_t until = now_ns() + us * 1000LL;
+	unsigned x = g_sink | 1;
+	while (now_ns() < until)
+	{
+		for (int i = 0; i < 64; ++i)
+		{
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+		}
+	}
+	g_sink = x;
+}
+
+static double thread_cpu_ms(pthread_t thread)
+{
+	clockid_t clock;
+	struct timespec ts;
+	if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &ts) != 0)
+		return 0;
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+
+// ============================================================================
+// allocation churn
+
+
+static struct churn *churn_create(const char *name, uint64_t seed)
+{
+	struct churn *c = (struct churn *)calloc(1, sizeof(*c));
+	if (c)
+		c->heap = heap_create(name, 0);
+	if (!c || !c->heap)
+	{
+		printf("[Workload] Failed to create the %s heap\n", name);
+		exit(1);
+	}
+	c->rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+	pthread_mutex_lock(&g_churn_lock);
+	c->next = g_churns;
+	g_churns = c;
+	pthread_mutex_unlock(&g_churn_lock);
+	return c;
+}
+
+// the size mix of a typical game: mostly small nodes and strings, some
+// component arrays, the odd mesh or texture staging buffer
+static size_t churn_size(uint64_t *rng)
+{
+	unsigned roll = rng_next(rng) % 1000;
+	if (roll < 700)
+		return rng_range(rng, 16, 256);
+	if (roll < 950)
+		return rng_range(rng, 257, 16 << 10);
+	if (roll < 999)
+		return rng_range(rng, (16 << 10) + 1, 256 << 10);
+	return rng_range(rng, 1 << 20, 4 << 20);
+}
+
+// one tick (a frame, or a job) worth of allocations: most only live until the
+// end of the tick, some for a couple of seconds, a few for a minute
+static void churn_tick(struct churn *c, int count)
+{
+	// expire what's due
+	for (int i = 0; i < c->num_live; )
+	{
+		if (c->live[i].expires > c->tick)
+		{
+			++i;
+			continue;
+		}
+		heap_free(c->heap, c->live[i].ptr);
+		c->live[i] = c->live[--c->num_live];
+	}
+	
+	int num_temp = 0;
+	count = std::min(count, CHURN_MAX_TEMP);
+	for (int i = 0; i < count; ++i)
+	{
+		size_t size = churn_size(&c->rng);
+		bool timed = i % CHURN_TIME_EVERY == 0;
+		int64_t start = timed ? now_ns() : 0;
+		char *p = (char *)heap_alloc(c->heap, size);
+		if (timed)
+		{
+			uint64_t elapsed = now_ns() - start;
+			++c->timed;
+			c->time_sum += elapsed;
+			c->time_max = std::max(c->time_max, elapsed);
+		}
+		if (!p)
+			continue;
+		// touch it like a constructor would
+		p[0] = p[size - 1] = (char)i;
+		
+		unsigned roll = rng_next(&c->rng) % 100;
+		if (roll < 80 || c->num_live == CHURN_MAX_LIVE)
+			c->temp[num_temp++] = p;
+		else
+		{
+			c->live[c->num_live].ptr = p;
+			c->live[c->num_live].expires = c->tick
+				+ (roll < 98 ? rng_range(&c->rng, 1, 120) : rng_range(&c->rng, 600, 3600));
+			++c->num_live;
+		}
+	}
+	
+	for (int i = 0; i < num_temp; ++i)
+		heap_free(c->heap, c->temp[i]);
+	++c->tick;
+}
+
+
+// ============================================================================
+// threads
+
+
+static void sim_job(void *arg)
+{
+	int index = (int)(size_t)arg;
+	if (!t_job_churn)
+	{
+		static int num_job_churns = 0;
+		t_job_churn = churn_create("jobs", g_cfg.seed * 1000 + 16
+			+ __atomic_fetch_add(&num_job_churns, 1, __ATOMIC_RELAXED));
+	}
+	if (index == g_crash_job)
+	{
+		printf("[Workload] Crashing in job %d as requested\n", index);
+		fflush(stdout);
+		*(volatile int *)0xabad1dea = 0;
+	}
+	work_us((int)rng_range(&t_job_churn->rng, 50, 250));
+	churn_tick(t_job_churn, g_cfg.allocs / 8);
+}
+
+static void *render_thread(void *arg)
+{
+	(void)arg;
+	pthread_setname_np(pthread_self(), "render");
+	memory_lock_prefault_stack(0);
+	if (g_cfg.roles)
+		thread_role_apply(THREAD_ROLE_RENDER, NULL);
+	if (g_placed)
+		topology_apply(&g_place, THREAD_ROLE_RENDER, 0);
+	t_churn = churn_create("render", g_cfg.seed * 1000 + 1);
+	for (;;)
+	{
+		wait_sem_wait(&g_render_ready);
+		if (g_exit)
+			break;
+		// building and submitting command buffers
+		work_us((int)rng_range(&t_churn->rng, 2000, 4000));
+		churn_tick(t_churn, g_cfg.allocs / 2);
+		++g_frames_rendered;
+		wait_sem_post(&g_render_slots, 1);
+	}
+	return NULL;
+}
+
+static void *audio_thread(void *arg)
+{
+	(void)arg;
+	pthread_setname_np(pthread_self(), "audio");
+	memory_lock_prefault_stack(0);
+	// NOTE: there is no audio role, so it borrows the render one for being as
+	// latency-critical, but stays off the render core, where it would only
+	// delay the submissions
+	if (g_cfg.roles)
+		thread_role_apply(THREAD_ROLE_RENDER, NULL);
+	t_churn = churn_create("audio", g_cfg.seed * 1000 + 2);
+	struct frame_pacer pacer;
+	frame_pacer_init(&pacer, AUDIO_PERIOD);
+	while (!g_exit)
+	{
+		frame_pacer_wait(&pacer);
+		// mixing the next buffer; it has to be done before the device
+		// wants it, i.e. by the next deadline
+		work_us((int)rng_range(&t_churn->rng, 300, 600));
+		churn_tick(t_churn, 16);
+		++g_audio_mixes;
+		if (now_ns() > pacer.deadline)
+			++g_audio_underruns;
+	}
+	return NULL;
+}
+
+// creates the file the streaming reads come from, and drops it from the page
+// cache so that they actually hit the disk; returns its descriptor
+static int io_prepare(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	static char block[1 << 16];
+	for (size_t i = 0; i < sizeof(block); ++i)
+		block[i] = (char)(i * 131);
+	for (int i = 0; i < IO_FILE_SIZE / (int)sizeof(block); ++i)
+	{
+		if (write(fd, block, sizeof(block)) != (ssize_t)sizeof(block))
+		{
+			close(fd);
+			return -1;
+		}
+	}
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	return fd;
+}
+
+// finds the watchdog executable in the sighandler directory, unless told
+// otherwise in the environment
+static void locate_watchdog()
+{
+	if (getenv(WATCHDOG_PATH_ENV))
+		return;
+	char path[PATH_MAX];
+	ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (len <= 0)
+		return;
+	path[len] = 0;
+	char *slash = strrchr(path, '/');
+	if (!slash)
+		return;
+	snprintf(slash + 1, sizeof(path) - (slash + 1 - path), "../sighandler/%s",
+		WATCHDOG_EXE);
+	setenv(WATCHDOG_PATH_ENV, path, 0);
+}
+
+// pins the calling (game) thread according to the CPU topology; the render
+// thread and the job workers follow once g_placed is set, and the watchdog
+// already sits on the housekeeping CPUs, see sighandler_install()
+static void place_threads()
+{
+	static struct topology topo;
+	if (topology_discover(&topo) != 0)
+	{
+		printf("[Workload] Failed to discover the CPU topology\n");
+		return;
+	}
+	topology_place(&topo, &g_place);
+	g_placed = true;
+	if (topology_apply(&g_place, THREAD_ROLE_MAIN, 0) != 0)
+		printf("[Workload] Failed to pin the game thread: %s\n", strerror(errno));
+}
+
+
+// ============================================================================
+// reporting
+
+
+static void print_percentiles(const char *label, int64_t *samples, int count)
+{
+	if (count <= 0)
+		return;
+	std::sort(samples, samples + count);
+	printf("  %-14s p50 %6.2f  p90 %6.2f  p99 %6.2f  p99.9 %6.2f  max %6.2f ms\n",
+		label, samples[count / 2] / 1e6, samples[count * 90 / 100] / 1e6,
+		samples[count * 99 / 100] / 1e6, samples[count * 999 / 1000] / 1e6,
+		samples[count - 1] / 1e6);
+}
+
+static void print_heaps()
+{
+	printf("[Workload] Heaps:\n");
+	pthread_mutex_lock(&g_churn_lock);
+	for (struct churn *c = g_churns; c; c = c->next)
+	{
+		struct heap_stats stats;
+		heap_get_stats(c->heap, &stats);
+		printf("  %-8s %9llu allocs, %6.1f MiB in use, footprint %6.1f MiB "
+			"(max %6.1f), alloc avg %5.0f ns max %7.1f us\n", heap_name(c->heap),
+			(unsigned long long)stats.allocs, stats.in_use / 1048576.0,
+			stats.footprint / 1048576.0, stats.max_footprint / 1048576.0,
+			c->timed ? (double)c->time_sum / c->timed : 0, c->time_max / 1e3);
+	}
+	pthread_mutex_unlock(&g_churn_lock);
+}
+
+static void print_io()
+{
+	static const char *names[ASYNC_READ_NUM_PRIORITIES] = {"urgent", "normal", "background"};
+	struct async_read_stats stats;
+	async_read_get_stats(&stats);
+	printf("[Workload] I/O:\n");
+	for (int i = 0; i < ASYNC_READ_NUM_PRIORITIES; ++i)
+	{
+		if (!stats.completed[i])
+			continue;
+		printf("  %-10s %5llu reads, %7.1f MiB, latency avg %7.2f max %7.2f ms\n",
+			names[i], (unsigned long long)stats.completed[i],
+			stats.bytes[i] / 1048576.0,
+			stats.latency_sum[i] / 1e6 / stats.completed[i],
+			stats.latency_max[i] / 1e6);
+	}
+}
+
+
+// ============================================================================
+
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:j:a:i:s:c:pl")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': g_cfg.frames = atoi(optarg); break;
+			case 'r': g_cfg.sim_hz = atoi(optarg); break;
+			case 'j': g_cfg.jobs = atoi(optarg); break;
+			case 'a': g_cfg.allocs = atoi(optarg); break;
+			case 'i': g_cfg.io_ms = atoi(optarg); break;
+			case 's': g_cfg.seed = (unsigned)atoi(optarg); break;
+			case 'c': g_cfg.crash_frame = atoi(optarg); break;
+			case 'p': g_cfg.roles = true; break;
+			case 'l': g_cfg.lock_memory = true; break;
+			default:
+				fprintf(stderr, "Usage: %s [-n frames] [-r sim Hz] [-j jobs per frame] "
+					"[-a allocations per frame] [-i I/O interval in ms] [-s seed] "
+					"[-c frame to crash at] [-p] [-l]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (g_cfg.frames <= 0 || g_cfg.sim_hz <= 0 || g_cfg.jobs < 0 || g_cfg.allocs < 0
+		|| g_cfg.io_ms <= 0)
+	{
+		fprintf(stderr, "[Workload] Invalid arguments\n");
+		return 1;
+	}
+	
+	// set up signal handling as the very first thing after start!
+	locate_watchdog();
+	if (sighandler_install() != 0)
+	{
+		printf("[Workload] Failed to set up the signal handler!\n");
+		return 1;
+	}
+	
+	if (g_cfg.roles)
+	{
+		thread_role_init();
+		thread_role_apply(THREAD_ROLE_MAIN, NULL);
+		place_threads();
+	}
+	// before any other thread starts, so that they all prefault their stacks;
+	// the churn heaps are dlmalloc's rather than the main arena, so no headroom
+	if (g_cfg.lock_memory)
+		memory_lock_init(0);
+	pthread_setname_np(pthread_self(), "sim");
+	
+	int io_fd = io_prepare(IO_FILE);
+	if (io_fd < 0)
+	{
+		printf("[Workload] Failed to create %s: %s\n", IO_FILE, strerror(errno));
+		return 1;
+	}
+	async_read_init(2);
+	struct jobs_config jobs_cfg;
+	jobs_default_config(&jobs_cfg);
+	jobs_cfg.placement = g_placed ? &g_place : NULL;
+	if (jobs_init(&jobs_cfg) != 0)
+	{
+		printf("[Workload] Failed to start the job system\n");
+		return 1;
+	}
+	
+	struct rusage usage_start;
+	getrusage(RUSAGE_SELF, &usage_start);
+	pthread_t render, audio;
+	pthread_create(&render, NULL, render_thread, NULL);
+	pthread_create(&audio, NULL, audio_thread, NULL);
+	
+	printf("[Workload] %d frames at %d Hz, %d jobs and %d allocations per frame, "
+		"%d frame workers, seed %u\n", g_cfg.frames, g_cfg.sim_hz, g_cfg.jobs,
+		g_cfg.allocs, jobs_num_workers(JOB_LANE_FRAME), g_cfg.seed);
+	
+	t_churn = churn_create("sim", g_cfg.seed * 1000);
+	int64_t *intervals = (int64_t *)malloc(g_cfg.frames * sizeof(int64_t));
+	int64_t *work = (int64_t *)malloc(g_cfg.frames * sizeof(int64_t));
+	static char stream_buf[IO_STREAM_SIZE], load_buf[IO_LOAD_SIZE];
+	struct async_read stream, load;
+	memset(&stream, 0, sizeof(stream));
+	memset(&load, 0, sizeof(load));
+	stream.state = load.state = ASYNC_READ_DONE;
+	uint64_t io_skipped = 0;
+	
+	struct frame_pacer pacer;
+	frame_pacer_init(&pacer, 1000000000LL / g_cfg.sim_hz);
+	int64_t wall_start = now_ns(), last_start = wall_start;
+	int64_t next_io = wall_start;
+	for (int frame = 0; frame < g_cfg.frames; ++frame)
+	{
+		int64_t start = now_ns();
+		intervals[frame] = start - last_start;
+		last_start = start;
+		
+		// input and game logic
+		work_us((int)rng_range(&t_churn->rng, 100, 300));
+		churn_tick(t_churn, frame % SPAWN_WAVE_EVERY == 0 ? g_cfg.allocs * 4 : g_cfg.allocs);
+		
+		// animation, physics and the like fan out to the workers while we
+		// carry on with the rest of the simulation
+		struct job_counter counter = JOB_COUNTER_INIT;
+		if (frame == g_cfg.crash_frame)
+			g_crash_job = g_cfg.jobs / 2;
+		for (int j = 0; j < g_cfg.jobs; ++j)
+			jobs_run(JOB_LANE_FRAME, sim_job, (void *)(size_t)j, &counter);
+		work_us((int)rng_range(&t_churn->rng, 1000, 3000));
+		jobs_wait(&counter);
+		
+		// level streaming: a chunk in the background, and a smaller load the
+		// game wants soon-ish; skipped if the previous one isn't done yet
+		if (start >= next_io)
+		{
+			next_io += g_cfg.io_ms * 1000000LL;
+			if (async_read_is_done(&stream) && async_read_is_done(&load))
+			{
+				stream.fd = load.fd = io_fd;
+				stream.offset = rng_range(&t_churn->rng, 0,
+					IO_FILE_SIZE / IO_STREAM_SIZE - 1) * IO_STREAM_SIZE;
+				stream.size = IO_STREAM_SIZE;
+				stream.buffer = stream_buf;
+				stream.priority = ASYNC_READ_BACKGROUND;
+				load.offset = rng_range(&t_churn->rng, 0,
+					IO_FILE_SIZE / IO_LOAD_SIZE - 1) * IO_LOAD_SIZE;
+				load.size = IO_LOAD_SIZE;
+				load.buffer = load_buf;
+				load.priority = ASYNC_READ_NORMAL;
+				async_read_submit(&stream);
+				async_read_submit(&load);
+			}
+			else
+				++io_skipped;
+		}
+		
+		// hand the frame over to render, at most two frames ahead of it
+		wait_sem_wait(&g_render_slots);
+		wait_sem_post(&g_render_ready, 1);
+		
+		work[frame] = now_ns() - start;
+		frame_pacer_wait(&pacer);
+	}
+	int64_t wall = now_ns() - wall_start;
+	
+	double cpu_sim = thread_cpu_ms(pthread_self());
+	double cpu_render = thread_cpu_ms(render);
+	double cpu_audio = thread_cpu_ms(audio);
+	g_exit = true;
+	wait_sem_post(&g_render_ready, 1);
+	pthread_join(render, NULL);
+	pthread_join(audio, NULL);
+	async_read_wait(&stream);
+	async_read_wait(&load);
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	
+	printf("[Workload] Frame times:\n");
+	// the first interval is from startup, not a frame
+	print_percentiles("interval", intervals + 1, g_cfg.frames - 1);
+	print_percentiles("sim work", work, g_cfg.frames);
+	printf("  %llu deadlines missed, %llu frames rendered, %llu audio buffers "
+		"with %llu underruns\n", (unsigned long long)pacer.stats.missed,
+		(unsigned long long)g_frames_rendered, (unsigned long long)g_audio_mixes,
+		(unsigned long long)g_audio_underruns);
+	print_heaps();
+	print_io();
+	printf("  %llu intervals skipped, the previous reads still running\n",
+		(unsigned long long)io_skipped);
+	
+	double user = (usage.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) * 1e3
+		+ (usage.ru_utime.tv_usec - usage_start.ru_utime.tv_usec) / 1e3;
+	double sys = (usage.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) * 1e3
+		+ (usage.ru_stime.tv_usec - usage_start.ru_stime.tv_usec) / 1e3;
+	printf("[Workload] CPU: %.2f cores (user %.0f ms, sys %.0f ms over %.0f ms); "
+		"sim %.0f ms, render %.0f ms, audio %.0f ms\n", (user + sys) / (wall / 1e6),
+		user, sys, wall / 1e6, cpu_sim, cpu_render, cpu_audio);
+	printf("  %ld minor and %ld major faults, %ld voluntary and %ld involuntary "
+		"context switches\n", usage.ru_minflt - usage_start.ru_minflt,
+		usage.ru_majflt - usage_start.ru_majflt, usage.ru_nvcsw - usage_start.ru_nvcsw,
+		usage.ru_nivcsw - usage_start.ru_nivcsw);
+	
+	jobs_shutdown();
+	async_read_shutdown();
+	close(io_fd);
+	unlink(IO_FILE);
+	free(intervals);
+	free(work);
+	sighandler_cleanup();
+	return 0;
+}
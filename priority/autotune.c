@@ -0,0 +1,407 @@
+// Scheduling auto-tuner driven by measured frame times, see autotune.h
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "autotune.h"
+
+static const char *g_action_names[] =
+{
+	"timer slack",
+	"demote",
+	"promote",
+	"isolate"
+};
+
+
+// ============================================================================
+
+
+static int compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// run time, run queue wait time, both in ns, and the number of timeslices
+static int read_schedstat(pid_t tid, uint64_t *run, uint64_t *wait, uint64_t *slices)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", tid);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -1;
+	unsigned long long r, w, s;
+	int n = fscanf(f, "%llu %llu %llu", &r, &w, &s);
+	fclose(f);
+	if (n != 3)
+		return -1;
+	*run = r;
+	*wait = w;
+	*slices = s;
+	return 0;
+}
+
+// NOTE: PR_SET_TIMERSLACK only works on the calling thread; this works on any
+// thread of ours, but needs CAP_SYS_NICE for ones other than the caller
+static long read_slack(pid_t tid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/timerslack_ns", tid);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -1;
+	long slack = -1;
+	if (fscanf(f, "%ld", &slack) != 1)
+		slack = -1;
+	fclose(f);
+	return slack;
+}
+
+static int write_slack(pid_t tid, long slack)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/timerslack_ns", tid);
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return -1;
+	int retval = fprintf(f, "%ld", slack) > 0 ? 0 : -1;
+	if (fclose(f) != 0)
+		retval = -1;
+	return retval;
+}
+
+// the CPU the thread last ran on, field 39 of stat
+static int last_cpu(pid_t tid)
+{
+	char path[64], buf[1024];
+	snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -1;
+	size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = 0;
+	// skip past the command name, which may contain spaces
+	char *p = strrchr(buf, ')');
+	if (!p)
+		return -1;
+	int cpu = -1, field = 2;
+	for (p = strtok(p + 1, " "); p; p = strtok(NULL, " "))
+		if (++field == 39)
+		{
+			cpu = atoi(p);
+			break;
+		}
+	return cpu;
+}
+
+static void log_step(const struct autotune *tuner, const struct autotune_thread *t,
+	const char *verb, const char *what, long from, long to)
+{
+	printf("[Autotune] p99 %.2f ms (budget %.2f ms): %s %s of %s (%d): %ld -> %ld\n",
+		tuner->p99 / 1e6, tuner->config.target / 1e6, verb, what, t->name,
+		t->tid, from, to);
+}
+
+static int set_nice(struct autotune *tuner, int index, int action, int value)
+{
+	struct autotune_thread *t = &tuner->threads[index];
+	if (setpriority(PRIO_PROCESS, t->tid, value) != 0)
+	{
+		printf("[Autotune] Failed to set niceness of %s (%d) to %d: %s\n",
+			t->name, t->tid, value, strerror(errno));
+		t->failed |= 1 << action;
+		return -1;
+	}
+	struct autotune_step *step = &tuner->steps[tuner->num_steps++];
+	step->action = action;
+	step->thread = index;
+	step->previous = t->nice;
+	step->cpu = -1;
+	log_step(tuner, t, "tightening", "niceness", t->nice, value);
+	t->nice = value;
+	return 0;
+}
+
+// one step towards more CPU for the critical threads; returns 1 if taken
+static int tighten(struct autotune *tuner)
+{
+	const struct autotune_config *cfg = &tuner->config;
+	if (tuner->num_steps >= (int)(sizeof(tuner->steps) / sizeof(tuner->steps[0])))
+		return 0;
+
+	// the critical thread that waited on the run queue the most
+	int worst = -1;
+	for (int i = 0; i < tuner->num_threads; ++i)
+		if (tuner->threads[i].critical && (worst < 0
+			|| tuner->threads[i].wait_per_frame > tuner->threads[worst].wait_per_frame))
+			worst = i;
+	if (worst < 0)
+		return 0;
+	struct autotune_thread *c = &tuner->threads[worst];
+
+	// 1. wake it up on time
+	if (c->slack > (long)cfg->min_slack && !(c->failed & (1 << AUTOTUNE_SLACK)))
+	{
+		if (write_slack(c->tid, cfg->min_slack) == 0)
+		{
+			struct autotune_step *step = &tuner->steps[tuner->num_steps++];
+			step->action = AUTOTUNE_SLACK;
+			step->thread = worst;
+			step->previous = c->slack;
+			step->cpu = -1;
+			log_step(tuner, c, "tightening", "timer slack", c->slack, cfg->min_slack);
+			c->slack = cfg->min_slack;
+			return 1;
+		}
+		printf("[Autotune] Failed to set timer slack of %s (%d): %s\n", c->name,
+			c->tid, strerror(errno));
+		c->failed |= 1 << AUTOTUNE_SLACK;
+	}
+
+	// 2. take CPU away from the hungriest background thread
+	int hungriest = -1;
+	for (int i = 0; i < tuner->num_threads; ++i)
+	{
+		struct autotune_thread *t = &tuner->threads[i];
+		if (!t->critical && t->nice < cfg->max_nice
+			&& !(t->failed & (1 << AUTOTUNE_DEMOTE))
+			&& (hungriest < 0 || t->run_per_frame > tuner->threads[hungriest].run_per_frame))
+			hungriest = i;
+	}
+	if (hungriest >= 0)
+	{
+		int value = tuner->threads[hungriest].nice + cfg->nice_step;
+		if (set_nice(tuner, hungriest, AUTOTUNE_DEMOTE,
+			value > cfg->max_nice ? cfg->max_nice : value) == 0)
+			return 1;
+	}
+
+	// 3. give more to the critical one
+	if (c->nice > cfg->min_nice && !(c->failed & (1 << AUTOTUNE_PROMOTE)))
+	{
+		int value = c->nice - cfg->nice_step;
+		if (set_nice(tuner, worst, AUTOTUNE_PROMOTE,
+			value < cfg->min_nice ? cfg->min_nice : value) == 0)
+			return 1;
+	}
+
+	// 4. keep the background threads off its CPU altogether
+	if (cfg->allow_affinity && !(c->failed & (1 << AUTOTUNE_ISOLATE)))
+	{
+		for (int i = 0; i < tuner->num_steps; ++i)
+			if (tuner->steps[i].action == AUTOTUNE_ISOLATE)
+				return 0;	// once is enough
+		int cpu = last_cpu(c->tid);
+		int changed = 0;
+		for (int i = 0; cpu >= 0 && i < tuner->num_threads; ++i)
+		{
+			struct autotune_thread *t = &tuner->threads[i];
+			if (t->critical)
+				continue;
+			cpu_set_t mask = t->initial_affinity;
+			CPU_CLR(cpu, &mask);
+			if (CPU_COUNT(&mask) == 0
+				|| sched_setaffinity(t->tid, sizeof(mask), &mask) != 0)
+				continue;
+			t->restricted = 1;
+			changed = 1;
+		}
+		if (changed)
+		{
+			struct autotune_step *step = &tuner->steps[tuner->num_steps++];
+			step->action = AUTOTUNE_ISOLATE;
+			step->thread = worst;
+			step->previous = 0;
+			step->cpu = cpu;
+			log_step(tuner, c, "tightening", "background threads off the CPU",
+				-1, cpu);
+			return 1;
+		}
+		c->failed |= 1 << AUTOTUNE_ISOLATE;
+	}
+	return 0;
+}
+
+// undoes the most recent step; it stays on the stack if that fails, so that
+// the next relax() tries again rather than skipping over it
+static int relax(struct autotune *tuner)
+{
+	if (tuner->num_steps == 0)
+		return 0;
+	struct autotune_step *step = &tuner->steps[tuner->num_steps - 1];
+	struct autotune_thread *t = &tuner->threads[step->thread];
+	int retval = 0;
+	switch (step->action)
+	{
+		case AUTOTUNE_SLACK:
+			retval = write_slack(t->tid, step->previous);
+			if (retval == 0)
+			{
+				log_step(tuner, t, "relaxing", "timer slack", t->slack, step->previous);
+				t->slack = step->previous;
+			}
+			break;
+		case AUTOTUNE_DEMOTE:
+		case AUTOTUNE_PROMOTE:
+			// NOTE: raising niceness back always works; lowering it back
+			// after a demotion needs the same rights as the initial value
+			retval = setpriority(PRIO_PROCESS, t->tid, (int)step->previous);
+			if (retval == 0)
+			{
+				log_step(tuner, t, "relaxing", "niceness", t->nice, step->previous);
+				t->nice = (int)step->previous;
+			}
+			break;
+		case AUTOTUNE_ISOLATE:
+			for (int i = 0; i < tuner->num_threads; ++i)
+			{
+				struct autotune_thread *b = &tuner->threads[i];
+				if (!b->restricted)
+					continue;
+				if (sched_setaffinity(b->tid, sizeof(b->initial_affinity),
+					&b->initial_affinity) != 0)
+				{
+					retval = -1;
+					continue;
+				}
+				b->restricted = 0;
+			}
+			if (retval == 0)
+				log_step(tuner, t, "relaxing", "background threads off the CPU",
+					step->cpu, -1);
+			break;
+	}
+	if (retval != 0)
+	{
+		printf("[Autotune] Failed to undo %s of %s (%d): %s\n",
+			g_action_names[step->action], t->name, t->tid, strerror(errno));
+		return 0;
+	}
+	--tuner->num_steps;
+	return 1;
+}
+
+static int evaluate(struct autotune *tuner)
+{
+	const struct autotune_config *cfg = &tuner->config;
+	int n = tuner->num_frames;
+	qsort(tuner->frames, n, sizeof(tuner->frames[0]), compare_int64);
+	tuner->p50 = tuner->frames[n / 2];
+	tuner->p99 = tuner->frames[(n * 99) / 100];
+	tuner->num_frames = 0;
+
+	for (int i = 0; i < tuner->num_threads; ++i)
+	{
+		struct autotune_thread *t = &tuner->threads[i];
+		uint64_t run, wait, slices;
+		if (read_schedstat(t->tid, &run, &wait, &slices) != 0)
+			continue;
+		t->wait_per_frame = (int64_t)(wait - t->wait_time) / n;
+		t->run_per_frame = (int64_t)(run - t->run_time) / n;
+		t->run_time = run;
+		t->wait_time = wait;
+		t->timeslices = slices;
+	}
+
+	if (tuner->p99 > cfg->target * cfg->tighten_above)
+	{
+		++tuner->over;
+		tuner->under = 0;
+	}
+	else if (tuner->p99 < cfg->target * cfg->relax_below)
+	{
+		++tuner->under;
+		tuner->over = 0;
+	}
+	else
+		tuner->over = tuner->under = 0;
+
+	if (!tuner->enabled)
+		return 0;
+	int changed = 0;
+	if (tuner->over >= cfg->hysteresis)
+		changed = tighten(tuner);
+	else if (tuner->under >= cfg->hysteresis)
+		changed = relax(tuner);
+	// give the change a full streak of windows to show its effect
+	if (changed)
+		tuner->over = tuner->under = 0;
+	return changed;
+}
+
+
+// ============================================================================
+
+
+void autotune_default_config(struct autotune_config *config, int64_t target)
+{
+	config->target = target;
+	config->window = 120;
+	config->hysteresis = 3;
+	config->tighten_above = 1.0;
+	config->relax_below = 0.7;
+	config->min_nice = -10;
+	config->max_nice = 19;
+	config->nice_step = 5;
+	config->min_slack = 1;
+	config->allow_affinity = 1;
+}
+
+void autotune_init(struct autotune *tuner, const struct autotune_config *config)
+{
+	memset(tuner, 0, sizeof(*tuner));
+	tuner->config = *config;
+	if (tuner->config.window < 1)
+		tuner->config.window = 1;
+	else if (tuner->config.window > AUTOTUNE_MAX_WINDOW)
+		tuner->config.window = AUTOTUNE_MAX_WINDOW;
+	if (tuner->config.nice_step < 1)
+		tuner->config.nice_step = 1;
+	tuner->enabled = 1;
+}
+
+int autotune_add_thread(struct autotune *tuner, pid_t tid, const char *name,
+	int critical)
+{
+	if (tuner->num_threads >= AUTOTUNE_MAX_THREADS)
+		return -1;
+	int index = tuner->num_threads;
+	struct autotune_thread *t = &tuner->threads[index];
+	memset(t, 0, sizeof(*t));
+	t->tid = tid;
+	t->name = name;
+	t->critical = critical;
+	errno = 0;
+	t->nice = t->initial_nice = getpriority(PRIO_PROCESS, tid);
+	if (errno != 0)
+		return -1;
+	t->slack = t->initial_slack = read_slack(tid);
+	if (sched_getaffinity(tid, sizeof(t->initial_affinity), &t->initial_affinity) != 0)
+		return -1;
+	read_schedstat(tid, &t->run_time, &t->wait_time, &t->timeslices);
+	++tuner->num_threads;
+	return index;
+}
+
+int autotune_frame(struct autotune *tuner, int64_t frame_time)
+{
+	tuner->frames[tuner->num_frames++] = frame_time;
+	if (tuner->num_frames < tuner->config.window)
+		return 0;
+	return evaluate(tuner);
+}
+
+void autotune_reset(struct autotune *tuner)
+{
+	while (relax(tuner))
+		;
+	tuner->over = tuner->under = 0;
+}
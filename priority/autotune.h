@@ -0,0 +1,114 @@
+// Scheduling auto-tuner driven by measured frame times
+// Rather than picking niceness values by hand (as niceness.c expects), the
+// tuner watches frame time percentiles and how long each registered thread
+// waited on the run queue (from /proc/self/task/<tid>/schedstat), and adjusts
+// niceness, timer slack and affinity within configured bounds: when frames
+// keep running over budget, frame-critical threads get more of the CPU and
+// background ones less, one step at a time; when there's been plenty of room
+// for a while, the steps are undone in reverse order
+// Hysteresis keeps it from oscillating: the frame time has to stay past a
+// threshold for several evaluation windows in a row before anything changes,
+// and every change resets the count. Every change gets logged
+
+#pragma once
+
+#include <stdint.h>
+#include <sched.h>		// for cpu_set_t, with _GNU_SOURCE
+#include <sys/types.h>	// for pid_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AUTOTUNE_MAX_THREADS	32
+#define AUTOTUNE_MAX_WINDOW		1024
+
+struct autotune_config
+{
+	int64_t target;			// frame time budget, in ns
+	int window;				// frames per evaluation, up to AUTOTUNE_MAX_WINDOW
+	int hysteresis;			// windows in a row past a threshold before acting
+	double tighten_above;	// act when p99 > target * this
+	double relax_below;		// undo a step when p99 < target * this
+	// bounds; critical threads go no lower than min_nice, background ones no
+	// higher than max_nice
+	int min_nice;
+	int max_nice;
+	int nice_step;
+	unsigned long min_slack;	// timer slack for critical threads, in ns
+	int allow_affinity;		// may keep background threads off a critical CPU
+};
+
+// the knobs we turned, per thread
+struct autotune_thread
+{
+	pid_t tid;
+	const char *name;
+	int critical;			// non-zero for frame-critical threads
+	int initial_nice;
+	int nice;
+	long initial_slack;		// -1 if unknown
+	long slack;
+	int restricted;			// non-zero if we changed its affinity
+	cpu_set_t initial_affinity;
+	// schedstat at the start of the window
+	uint64_t run_time;
+	uint64_t wait_time;
+	uint64_t timeslices;
+	// over the last window, in ns
+	int64_t wait_per_frame;	// run queue delay
+	int64_t run_per_frame;	// CPU time
+	int failed;				// bit per action the kernel refused us
+};
+
+// one tuning step, kept so that it can be undone
+enum autotune_action
+{
+	AUTOTUNE_SLACK,		// lowered a critical thread's timer slack
+	AUTOTUNE_DEMOTE,	// raised a background thread's niceness
+	AUTOTUNE_PROMOTE,	// lowered a critical thread's niceness
+	AUTOTUNE_ISOLATE	// kept background threads off a critical thread's CPU
+};
+
+struct autotune_step
+{
+	int action;
+	int thread;			// index into threads
+	long previous;		// niceness or slack before the step
+	int cpu;			// for AUTOTUNE_ISOLATE
+};
+
+struct autotune
+{
+	struct autotune_config config;
+	struct autotune_thread threads[AUTOTUNE_MAX_THREADS];
+	int num_threads;
+	int64_t frames[AUTOTUNE_MAX_WINDOW];
+	int num_frames;
+	int over;			// windows in a row over the tighten threshold
+	int under;			// windows in a row under the relax threshold
+	struct autotune_step steps[AUTOTUNE_MAX_THREADS * 4];
+	int num_steps;
+	int64_t p50, p99;	// of the last window
+	int enabled;		// non-zero to act, else just measure
+};
+
+// sensible defaults for given frame time budget
+void autotune_default_config(struct autotune_config *config, int64_t target);
+
+void autotune_init(struct autotune *tuner, const struct autotune_config *config);
+
+// registers a thread of ours; returns its index, or -1 if full
+int autotune_add_thread(struct autotune *tuner, pid_t tid, const char *name,
+	int critical);
+
+// feeds a frame time, in ns; every window frames, evaluates and possibly
+// takes or undoes a step; returns 1 if something changed
+int autotune_frame(struct autotune *tuner, int64_t frame_time);
+
+// undoes all steps, e.g. at shutdown; stops at the first one that fails
+void autotune_reset(struct autotune *tuner);
+
+#ifdef __cplusplus
+}
+#endif
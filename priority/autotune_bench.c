@@ -0,0 +1,141 @@
+// Benchmark of the scheduling auto-tuner under synthetic load
+// A paced frame loop with a fixed amount of work competes with CPU hogs; the
+// frame times are measured untuned, while the tuner converges, and frozen
+// after it
+// To build:				make
+// To grant capabilities – as root:	setcap cap_sys_resource,cap_sys_nice+eip autotune_bench
+// To run:				./autotune_bench [hogs] [seconds per phase]
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "autotune.h"
+#include "frame_pacer.h"
+
+#define FRAME_PERIOD	16666667	// 60 Hz
+#define FRAME_WORK		4000000		// how long the work takes on an idle CPU
+#define FRAME_BUDGET	6000000
+
+static int g_quit = 0;
+static unsigned long g_work_iterations;
+
+static void *hog_thread(void *arg)
+{
+	pid_t *tid = (pid_t *)arg;
+	__atomic_store_n(tid, (pid_t)syscall(SYS_gettid), __ATOMIC_RELEASE);
+	volatile unsigned x = 1;
+	while (!__atomic_load_n(&g_quit, __ATOMIC_RELAXED))
+		x = x * 1103515245 + 12345;
+	return NULL;
+}
+
+static void work(unsigned long iterations)
+{
+	volatile unsigned x = 1;
+	for (unsigned long i = 0; i < iterations; ++i)
+		x = x * 1103515245 + 12345;
+}
+
+// how many iterations take FRAME_WORK on this CPU, without contention
+static unsigned long calibrate(void)
+{
+	unsigned long iterations = 100000;
+	for (;;)
+	{
+		int64_t start = frame_pacer_now();
+		work(iterations);
+		int64_t elapsed = frame_pacer_now() - start;
+		if (elapsed > FRAME_WORK / 4)
+			return (unsigned long)((double)iterations * FRAME_WORK / elapsed);
+		iterations *= 2;
+	}
+}
+
+static void phase(const char *name, struct autotune *tuner, int enabled, int seconds)
+{
+	struct frame_pacer pacer;
+	frame_pacer_init(&pacer, FRAME_PERIOD);
+	tuner->enabled = enabled;
+	int frames = seconds * 1000000000LL / FRAME_PERIOD;
+	int64_t *times = (int64_t *)malloc(frames * sizeof(int64_t));
+	int over = 0;
+	for (int i = 0; i < frames; ++i)
+	{
+		frame_pacer_wait(&pacer);
+		int64_t start = frame_pacer_now();
+		work(g_work_iterations);
+		times[i] = frame_pacer_now() - start;
+		if (times[i] > FRAME_BUDGET)
+			++over;
+		autotune_frame(tuner, times[i]);
+	}
+
+	int64_t sum = 0;
+	for (int i = 0; i < frames; ++i)
+		sum += times[i];
+	// insertion sort, there are only a few hundred
+	for (int i = 1; i < frames; ++i)
+		for (int j = i; j > 0 && times[j - 1] > times[j]; --j)
+		{
+			int64_t t = times[j];
+			times[j] = times[j - 1];
+			times[j - 1] = t;
+		}
+	printf("[Autotune] %-8s avg %6.2f ms, p50 %6.2f ms, p99 %6.2f ms, "
+		"%d of %d frames over budget\n", name, sum / 1e6 / frames,
+		times[frames / 2] / 1e6, times[(frames * 99) / 100] / 1e6, over, frames);
+	free(times);
+}
+
+int main(int argc, char *argv[])
+{
+	cpu_set_t allowed;
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	int num_hogs = argc > 1 ? atoi(argv[1]) : 2 * CPU_COUNT(&allowed);
+	int seconds = argc > 2 ? atoi(argv[2]) : 5;
+	if (num_hogs < 0 || num_hogs > AUTOTUNE_MAX_THREADS - 1 || seconds < 1)
+	{
+		printf("Usage: %s [hogs, up to %d] [seconds per phase]\n", argv[0],
+			AUTOTUNE_MAX_THREADS - 1);
+		return 1;
+	}
+	g_work_iterations = calibrate();
+
+	struct autotune_config config;
+	autotune_default_config(&config, FRAME_BUDGET);
+	config.window = 30;
+	struct autotune tuner;
+	autotune_init(&tuner, &config);
+	autotune_add_thread(&tuner, (pid_t)syscall(SYS_gettid), "frame", 1);
+
+	pthread_t *hogs = (pthread_t *)calloc(num_hogs ? num_hogs : 1, sizeof(pthread_t));
+	pid_t *tids = (pid_t *)calloc(num_hogs ? num_hogs : 1, sizeof(pid_t));
+	for (int i = 0; i < num_hogs; ++i)
+	{
+		if (pthread_create(&hogs[i], NULL, hog_thread, &tids[i]) != 0)
+			return 1;
+		while (!__atomic_load_n(&tids[i], __ATOMIC_ACQUIRE))
+			sched_yield();
+		autotune_add_thread(&tuner, tids[i], "hog", 0);
+	}
+	printf("[Autotune] %.2f ms of work per %.2f ms frame, budget %.2f ms, %d hogs\n",
+		FRAME_WORK / 1e6, FRAME_PERIOD / 1e6, FRAME_BUDGET / 1e6, num_hogs);
+
+	phase("untuned", &tuner, 0, seconds);
+	phase("tuning", &tuner, 1, seconds);
+	phase("tuned", &tuner, 0, seconds);
+	autotune_reset(&tuner);
+
+	__atomic_store_n(&g_quit, 1, __ATOMIC_RELAXED);
+	for (int i = 0; i < num_hogs; ++i)
+		pthread_join(hogs[i], NULL);
+	free(hogs);
+	free(tids);
+	return 0;
+}
@@ -0,0 +1,160 @@
+// Client side of the priority broker, see broker.h
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>			// for offsetof()
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "broker.h"
+
+
+// ============================================================================
+
+
+static struct broker_request *add(struct broker_batch *batch, int op, pid_t tid)
+{
+	if (batch->count >= BROKER_MAX_BATCH)
+		return NULL;
+	struct broker_request *request = &batch->requests[batch->count++];
+	memset(request, 0, sizeof(*request));
+	request->op = op;
+	request->tid = tid;
+	return request;
+}
+
+
+// ============================================================================
+
+
+int broker_connect(const char *path)
+{
+	if (!path)
+		path = getenv(BROKER_SOCKET_ENV);
+	if (!path)
+		path = BROKER_SOCKET;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	// NOTE: SOCK_SEQPACKET keeps the message boundaries, so a batch is a
+	// single send() and a single recv()
+	// NOTE: CLOEXEC, since whoever holds the socket gets our credentials
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+void broker_close(int fd)
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+void broker_batch_init(struct broker_batch *batch)
+{
+	batch->magic = BROKER_MAGIC;
+	batch->count = 0;
+}
+
+int broker_add_scheduler(struct broker_batch *batch, pid_t tid, int policy,
+	int rt_priority)
+{
+	struct broker_request *request = add(batch, BROKER_OP_SCHEDULER, tid);
+	if (!request)
+		return -1;
+	request->arg1 = policy;
+	request->arg2 = rt_priority;
+	return 0;
+}
+
+int broker_add_nice(struct broker_batch *batch, pid_t tid, int nice_value)
+{
+	struct broker_request *request = add(batch, BROKER_OP_NICE, tid);
+	if (!request)
+		return -1;
+	request->arg1 = nice_value;
+	return 0;
+}
+
+int broker_add_io_priority(struct broker_batch *batch, pid_t tid, int io_class,
+	int io_level)
+{
+	struct broker_request *request = add(batch, BROKER_OP_IO_PRIORITY, tid);
+	if (!request)
+		return -1;
+	request->arg1 = io_class;
+	request->arg2 = io_level;
+	return 0;
+}
+
+int broker_add_affinity(struct broker_batch *batch, pid_t tid, const cpu_set_t *cpus)
+{
+	struct broker_request *request = add(batch, BROKER_OP_AFFINITY, tid);
+	if (!request)
+		return -1;
+	request->cpus = *cpus;
+	return 0;
+}
+
+int broker_add_memlock(struct broker_batch *batch, uint64_t bytes)
+{
+	struct broker_request *request = add(batch, BROKER_OP_MEMLOCK, 0);
+	if (!request)
+		return -1;
+	request->bytes = bytes;
+	return 0;
+}
+
+int broker_submit(int fd, const struct broker_batch *batch, int *status)
+{
+	// only send as much of the batch as is filled in
+	size_t size = offsetof(struct broker_batch, requests)
+		+ batch->count * sizeof(struct broker_request);
+	ssize_t n;
+	do
+		n = send(fd, batch, size, MSG_NOSIGNAL);
+	while (n < 0 && errno == EINTR);
+	if (n != (ssize_t)size)
+		return -1;
+
+	struct broker_reply reply;
+	do
+		n = recv(fd, &reply, sizeof(reply), 0);
+	while (n < 0 && errno == EINTR);
+	if (n < (ssize_t)offsetof(struct broker_reply, status)
+		|| reply.magic != BROKER_MAGIC || reply.count != batch->count)
+	{
+		if (n >= 0)
+			errno = EPROTO;
+		return -1;
+	}
+
+	int failed = 0;
+	for (uint32_t i = 0; i < reply.count; ++i)
+	{
+		if (status)
+			status[i] = reply.status[i];
+		if (reply.status[i] != 0)
+			++failed;
+	}
+	return failed;
+}
@@ -0,0 +1,85 @@
+// Client side of the priority broker, see prio_broker.c
+// Rather than granting capabilities to the whole game (as niceness.c asks for),
+// a small privileged daemon applies scheduling policies, niceness, I/O
+// priority, affinity and RLIMIT_MEMLOCK on the game's behalf. Requests go over
+// a Unix domain socket, where the daemon authenticates the peer with
+// SO_PEERCRED, checks every request against its policy file, and only ever
+// touches threads of the requesting process
+// Requests are batched, so that e.g. all of the startup priority setup takes
+// a single round trip
+
+#pragma once
+
+#include <stdint.h>
+#include <sched.h>		// for cpu_set_t, with _GNU_SOURCE
+#include <sys/types.h>	// for pid_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// where the daemon listens unless told otherwise; clients also honour the
+// PRIO_BROKER_SOCKET environment variable
+#define BROKER_SOCKET		"/run/prio-broker.sock"
+#define BROKER_SOCKET_ENV	"PRIO_BROKER_SOCKET"
+
+#define BROKER_MAGIC		0x50524f42	// "PROB"
+#define BROKER_MAX_BATCH	32
+
+enum broker_op
+{
+	BROKER_OP_SCHEDULER,	// policy, and RT priority for SCHED_FIFO/SCHED_RR
+	BROKER_OP_NICE,
+	BROKER_OP_IO_PRIORITY,	// I/O class and level, see thread_role.h
+	BROKER_OP_AFFINITY,
+	BROKER_OP_MEMLOCK		// RLIMIT_MEMLOCK of the whole process
+};
+
+struct broker_request
+{
+	uint32_t op;
+	int32_t tid;		// a thread of the requesting process; unused for memlock
+	int32_t arg1;		// policy, niceness or I/O class
+	int32_t arg2;		// RT priority or I/O level
+	uint64_t bytes;		// for memlock; UINT64_MAX for unlimited
+	cpu_set_t cpus;		// for affinity
+};
+
+struct broker_batch
+{
+	uint32_t magic;
+	uint32_t count;
+	struct broker_request requests[BROKER_MAX_BATCH];
+};
+
+struct broker_reply
+{
+	uint32_t magic;
+	uint32_t count;
+	int32_t status[BROKER_MAX_BATCH];	// 0 on success, else an errno value
+};
+
+// connects to the daemon; path may be NULL for the environment variable or
+// the default; returns the socket, or -1
+int broker_connect(const char *path);
+void broker_close(int fd);
+
+void broker_batch_init(struct broker_batch *batch);
+// each returns 0, or -1 if the batch is full
+int broker_add_scheduler(struct broker_batch *batch, pid_t tid, int policy,
+	int rt_priority);
+int broker_add_nice(struct broker_batch *batch, pid_t tid, int nice_value);
+int broker_add_io_priority(struct broker_batch *batch, pid_t tid, int io_class,
+	int io_level);
+int broker_add_affinity(struct broker_batch *batch, pid_t tid, const cpu_set_t *cpus);
+int broker_add_memlock(struct broker_batch *batch, uint64_t bytes);
+
+// sends the batch and waits for the reply; status gets an errno value (or 0)
+// per request and may be NULL
+// returns the number of failed requests, or -1 if the daemon couldn't be
+// reached (with errno set)
+int broker_submit(int fd, const struct broker_batch *batch, int *status);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,182 @@
+// SCHED_DEADLINE reservations for periodic threads, see deadline.h
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>			// for syscall()
+#include <sys/syscall.h>	// for SYS_gettid and SYS_sched_setattr
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "deadline.h"
+#include "thread_role.h"
+
+#define NS_PER_SEC	1000000000LL
+
+// not in glibc 2.36's headers; see linux/sched.h and linux/sched/types.h, which
+// we can't include next to sched.h
+#ifndef SCHED_FLAG_RESET_ON_FORK
+	#define SCHED_FLAG_RESET_ON_FORK	0x01
+#endif
+#ifndef SCHED_FLAG_DL_OVERRUN
+	#define SCHED_FLAG_DL_OVERRUN	0x04
+#endif
+
+struct deadline_sched_attr
+{
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static unsigned long g_overruns = 0;		// bumped by the signal handler
+static unsigned long g_overruns_seen = 0;	// as of the last deadline_poll()
+static deadline_overrun_func g_overrun_func = NULL;
+static void *g_overrun_arg = NULL;
+
+
+// ============================================================================
+
+
+static void deadline_signal_handler(int signum)
+{
+	(void)signum;
+	__atomic_add_fetch(&g_overruns, 1, __ATOMIC_RELAXED);
+}
+
+static int64_t now_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+
+// ============================================================================
+
+
+int deadline_init(void)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = deadline_signal_handler;
+	// don't make clock_nanosleep() and friends in the overrunning thread fail
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGXCPU, &action, NULL) != 0)
+	{
+		printf("[Deadline] Failed to install the SIGXCPU handler: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int deadline_apply(const struct deadline_params *params, struct deadline_state *state)
+{
+	return deadline_apply_tid((pid_t)syscall(SYS_gettid), params, state);
+}
+
+int deadline_apply_tid(pid_t tid, const struct deadline_params *params,
+	struct deadline_state *state)
+{
+	memset(state, 0, sizeof(*state));
+	state->runtime = params->runtime;
+	state->period = params->period;
+	state->next = now_ns(CLOCK_MONOTONIC) + params->period;
+	state->tick_cpu = now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+	struct deadline_sched_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	// NOTE: without SCHED_FLAG_RESET_ON_FORK, deadline threads can't fork at
+	// all (e.g. for snapshots); with it, the child starts out on SCHED_OTHER
+	attr.sched_flags = SCHED_FLAG_RESET_ON_FORK | SCHED_FLAG_DL_OVERRUN;
+	attr.sched_runtime = params->runtime;
+	attr.sched_deadline = params->deadline ? params->deadline : params->period;
+	attr.sched_period = params->period;
+	int retval = (int)syscall(SYS_sched_setattr, tid, &attr, 0);
+	if (retval != 0 && errno == EINVAL)
+	{
+		// kernels before 4.16 don't know about overrun signalling; we still
+		// count overruns per thread in deadline_wait() without it
+		attr.sched_flags &= ~SCHED_FLAG_DL_OVERRUN;
+		retval = (int)syscall(SYS_sched_setattr, tid, &attr, 0);
+	}
+	if (retval == 0)
+	{
+		state->policy = SCHED_DEADLINE;
+		state->signalled = (attr.sched_flags & SCHED_FLAG_DL_OVERRUN) != 0;
+		return 0;
+	}
+
+	// EBUSY means admission control said no: the reservations would add up
+	// to more than the CPUs can guarantee
+	printf("[Deadline] thread %d: %llu/%llu/%llu us reservation refused (%s), "
+		"falling back to the %s role\n", tid,
+		(unsigned long long)(params->runtime / 1000),
+		(unsigned long long)(attr.sched_deadline / 1000),
+		(unsigned long long)(params->period / 1000), strerror(errno),
+		thread_role_name(params->fallback_role));
+	state->degraded = 1;
+	struct thread_role_state role;
+	retval = thread_role_apply_tid(tid, params->fallback_role, &role);
+	state->policy = role.policy;
+	return retval;
+}
+
+void deadline_wait(struct deadline_state *state)
+{
+	int64_t cpu = now_ns(CLOCK_THREAD_CPUTIME_ID);
+	if (cpu - state->tick_cpu > (int64_t)state->runtime)
+		++state->overruns;
+	++state->ticks;
+
+	if (state->policy == SCHED_DEADLINE)
+		// the thread is throttled until its next period starts
+		sched_yield();
+	else
+	{
+		struct timespec ts;
+		ts.tv_sec = state->next / NS_PER_SEC;
+		ts.tv_nsec = state->next % NS_PER_SEC;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+		state->next += state->period;
+		// if we fell more than a period behind, start over rather than
+		// running the missed ticks back to back
+		int64_t now = now_ns(CLOCK_MONOTONIC);
+		if (now > state->next)
+			state->next = now + state->period;
+	}
+	state->tick_cpu = now_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void deadline_set_overrun_callback(deadline_overrun_func func, void *arg)
+{
+	g_overrun_arg = arg;
+	g_overrun_func = func;
+}
+
+unsigned long deadline_overruns(void)
+{
+	return __atomic_load_n(&g_overruns, __ATOMIC_RELAXED);
+}
+
+unsigned long deadline_poll(void)
+{
+	unsigned long overruns = __atomic_load_n(&g_overruns, __ATOMIC_RELAXED);
+	unsigned long fresh = overruns - g_overruns_seen;
+	g_overruns_seen = overruns;
+	if (fresh && g_overrun_func)
+		g_overrun_func(fresh, g_overrun_arg);
+	return fresh;
+}
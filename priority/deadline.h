@@ -0,0 +1,86 @@
+// SCHED_DEADLINE reservations for periodic threads
+// A thread that runs on a fixed tick with a known compute budget (simulation,
+// render submission) can ask the kernel for exactly that: runtime ns of CPU
+// every period ns, done within deadline ns of the start of each period. The
+// kernel admits the reservation only if it can guarantee it, and then the
+// thread's tick jitter is bounded by the scheduler rather than by load
+// If the reservation is refused (no CAP_SYS_NICE, admission control, an old
+// kernel), the thread falls back to a role from thread_role.h, i.e. SCHED_FIFO
+// or a nice level, and deadline_wait() paces it with absolute sleeps instead
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>	// for pid_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef SCHED_DEADLINE
+	#define SCHED_DEADLINE	6
+#endif
+
+struct deadline_params
+{
+	uint64_t runtime;	// CPU time budget per period, in ns
+	uint64_t deadline;	// relative to the start of the period, in ns; 0 for period
+	uint64_t period;	// in ns
+	int fallback_role;	// thread role to apply if the reservation is refused
+};
+
+// what got applied to a thread, plus its pacing and overrun bookkeeping
+struct deadline_state
+{
+	int policy;			// SCHED_DEADLINE, or whatever the fallback role got
+	int degraded;		// non-zero if we had to fall back
+	int signalled;		// non-zero if the kernel reports overruns, see deadline_init()
+	uint64_t runtime;
+	uint64_t period;
+	int64_t next;		// start of the next period, CLOCK_MONOTONIC ns (fallback)
+	int64_t tick_cpu;	// thread CPU time at the start of the current tick
+	uint64_t ticks;
+	uint64_t overruns;	// ticks that used more CPU than the budget
+};
+
+// called from deadline_poll() with the number of overruns the kernel reported
+// since the last call
+typedef void (*deadline_overrun_func)(unsigned long overruns, void *arg);
+
+// installs the SIGXCPU handler the kernel's overrun notifications go to;
+// call once at startup, after sighandler_install() if that's used
+// NOTE: SIGXCPU is process-wide, so it can't tell which thread overran; see
+// the per-thread overruns in struct deadline_state for that. It's also what
+// RLIMIT_CPU sends, which we don't use
+// returns 0 on success
+int deadline_init(void);
+
+// requests the reservation for the calling thread, falling back to the role
+// in params; state may not be NULL
+// returns 0 on success, even if degraded; -1 if nothing could be applied
+int deadline_apply(const struct deadline_params *params, struct deadline_state *state);
+
+// same as above, for any thread of ours, given its TID
+// NOTE: only the calling thread can pace itself with deadline_wait()
+int deadline_apply_tid(pid_t tid, const struct deadline_params *params,
+	struct deadline_state *state);
+
+// ends the current tick: under SCHED_DEADLINE, gives up the rest of the
+// runtime until the next period; otherwise sleeps until the next period
+// also checks the tick's CPU time against the budget
+void deadline_wait(struct deadline_state *state);
+
+// sets the callback for kernel-reported overruns; may be NULL
+void deadline_set_overrun_callback(deadline_overrun_func func, void *arg);
+
+// total overruns reported by the kernel so far
+unsigned long deadline_overruns(void);
+
+// calls the overrun callback if there were new overruns since the last call;
+// call regularly from a normal (non-signal) context, e.g. once per frame
+// returns the number of new overruns
+unsigned long deadline_poll(void);
+
+#ifdef __cplusplus
+}
+#endif
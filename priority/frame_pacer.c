@@ -0,0 +1,143 @@
+// High-precision frame pacing, see frame_pacer.h
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/prctl.h>
+
+#include "frame_pacer.h"
+
+#define NS_PER_SEC	1000000000LL
+
+// the margin follows wakeup latency spikes right away, but only shrinks by
+// 1/FRAME_PACER_MARGIN_DECAY of the difference per frame, so that a single
+// quiet frame doesn't make us overshoot on the next spike
+#define FRAME_PACER_MARGIN_DECAY	64
+// extra room on top of the worst wakeup latency seen recently
+#define FRAME_PACER_MARGIN_HEADROOM	2000
+
+
+// ============================================================================
+
+
+static inline void cpu_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+static inline struct timespec to_timespec(int64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec = ns / NS_PER_SEC;
+	ts.tv_nsec = ns % NS_PER_SEC;
+	return ts;
+}
+
+static void update_margin(struct frame_pacer *pacer, int64_t wakeup)
+{
+	int64_t wanted = wakeup + FRAME_PACER_MARGIN_HEADROOM;
+	if (wanted > pacer->margin)
+		pacer->margin = wanted;
+	else
+		pacer->margin -= (pacer->margin - wanted) / FRAME_PACER_MARGIN_DECAY;
+
+	if (pacer->margin < FRAME_PACER_MIN_MARGIN)
+		pacer->margin = FRAME_PACER_MIN_MARGIN;
+	else if (pacer->margin > FRAME_PACER_MAX_MARGIN)
+		pacer->margin = FRAME_PACER_MAX_MARGIN;
+}
+
+
+// ============================================================================
+
+
+int64_t frame_pacer_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+int frame_pacer_set_slack(unsigned long slack)
+{
+	return prctl(PR_SET_TIMERSLACK, slack ? slack : 1UL, 0, 0, 0);
+}
+
+long frame_pacer_get_slack(void)
+{
+	return prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+}
+
+void frame_pacer_init(struct frame_pacer *pacer, int64_t period)
+{
+	memset(pacer, 0, sizeof(*pacer));
+	pacer->period = period;
+	pacer->margin = FRAME_PACER_INITIAL_MARGIN;
+	pacer->spin = 1;
+	frame_pacer_reset_stats(pacer);
+	frame_pacer_set_slack(0);
+	pacer->deadline = frame_pacer_now() + period;
+}
+
+void frame_pacer_reset_stats(struct frame_pacer *pacer)
+{
+	memset(&pacer->stats, 0, sizeof(pacer->stats));
+	pacer->stats.overshoot_min = INT64_MAX;
+}
+
+int64_t frame_pacer_wait_until(struct frame_pacer *pacer, int64_t deadline)
+{
+	struct frame_pacer_stats *stats = &pacer->stats;
+	int64_t now = frame_pacer_now();
+	if (now >= deadline)
+		++stats->missed;
+	else
+	{
+		int64_t wake = pacer->spin ? deadline - pacer->margin : deadline;
+		if (now < wake)
+		{
+			struct timespec ts = to_timespec(wake);
+			// absolute, so that neither signals nor our own overhead add up
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+			now = frame_pacer_now();
+			int64_t wakeup = now - wake;
+			if (wakeup > stats->wakeup_max)
+				stats->wakeup_max = wakeup;
+			if (pacer->spin)
+				update_margin(pacer, wakeup);
+		}
+		if (pacer->spin && now < deadline)
+		{
+			int64_t spin_start = now;
+			while ((now = frame_pacer_now()) < deadline)
+				cpu_pause();
+			stats->spin_sum += now - spin_start;
+		}
+	}
+
+	int64_t overshoot = now - deadline;
+	++stats->frames;
+	stats->overshoot_sum += overshoot;
+	if (overshoot < stats->overshoot_min)
+		stats->overshoot_min = overshoot;
+	if (overshoot > stats->overshoot_max)
+		stats->overshoot_max = overshoot;
+	return overshoot;
+}
+
+int64_t frame_pacer_wait(struct frame_pacer *pacer)
+{
+	int64_t overshoot = frame_pacer_wait_until(pacer, pacer->deadline);
+	pacer->deadline += pacer->period;
+	// a hitch (or a debugger) made us miss whole frames; rather than
+	// rushing through them, start over
+	if (overshoot > pacer->period)
+		pacer->deadline = frame_pacer_now() + pacer->period;
+	return overshoot;
+}
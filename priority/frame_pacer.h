@@ -0,0 +1,73 @@
+// High-precision frame pacing
+// usleep() and relative sleeps drift, and every wakeup is late by the thread's
+// timer slack (50 us by default) plus scheduling latency. The pacer lowers the
+// timer slack of the calling thread, sleeps on absolute CLOCK_MONOTONIC
+// deadlines until shortly before the frame is due, and spins the rest with
+// pause. The margin left for spinning adapts to the wakeup latencies actually
+// observed, so that we spin as little as possible without overshooting
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bounds of the spin margin, in ns
+#define FRAME_PACER_MIN_MARGIN	5000
+#define FRAME_PACER_MAX_MARGIN	2000000
+// what we start with, before we've seen any wakeups
+#define FRAME_PACER_INITIAL_MARGIN	100000
+
+struct frame_pacer_stats
+{
+	uint64_t frames;
+	uint64_t missed;		// deadlines we were already past when asked to wait
+	int64_t overshoot_min;	// how late we returned after the deadline, in ns
+	int64_t overshoot_max;
+	int64_t overshoot_sum;
+	int64_t wakeup_max;		// worst lateness of the sleep itself, in ns
+	int64_t spin_sum;		// CPU time burned spinning, in ns
+};
+
+struct frame_pacer
+{
+	int64_t period;		// in ns
+	int64_t deadline;	// the next one, absolute CLOCK_MONOTONIC ns
+	int64_t margin;		// how much earlier than the deadline we wake up
+	int spin;			// non-zero to spin the margin, else plain sleep
+	struct frame_pacer_stats stats;
+};
+
+// current CLOCK_MONOTONIC time in ns
+int64_t frame_pacer_now(void);
+
+// sets the timer slack of the calling thread, in ns; 0 means the minimum of
+// 1 ns (for prctl() itself 0 would mean the default inherited at thread
+// creation); returns 0 on success
+int frame_pacer_set_slack(unsigned long slack);
+
+// the calling thread's current timer slack in ns, or -1 on error
+long frame_pacer_get_slack(void);
+
+// initializes the pacer with the first deadline one period from now, and
+// drops the calling thread's timer slack to the minimum
+// NOTE: the slack is per thread, so call it from the thread that will wait
+void frame_pacer_init(struct frame_pacer *pacer, int64_t period);
+
+// waits until the next deadline and schedules the one after it; returns how
+// late we returned, in ns; if we're more than a whole period late, the
+// schedule restarts from now rather than trying to catch up
+int64_t frame_pacer_wait(struct frame_pacer *pacer);
+
+// waits until an absolute CLOCK_MONOTONIC deadline in ns, using and updating
+// the pacer's margin and stats; returns how late we returned, in ns
+int64_t frame_pacer_wait_until(struct frame_pacer *pacer, int64_t deadline);
+
+// resets the stats, e.g. between measurements
+void frame_pacer_reset_stats(struct frame_pacer *pacer);
+
+#ifdef __cplusplus
+}
+#endif
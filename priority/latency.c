@@ -0,0 +1,225 @@
+// Scheduling latency harness in the style of cyclictest
+// Runs a measurement thread under each scheduling configuration in turn, pinned
+// and unpinned; the thread wakes up on absolute deadlines and records how late
+// it woke up into a histogram. Optionally keeps CPUs busy with hog threads, so
+// that the configurations are compared under load rather than on an idle box
+// To build:				make
+// To grant capabilities – as root:	setcap cap_sys_resource,cap_sys_nice+eip latency
+// To run:				./latency [-i interval us] [-n loops] [-l hogs] [-c cpu] [-h histogram file]
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "frame_pacer.h"	// for the timer slack and the clock
+
+// 1 us buckets; anything later goes into the last one
+#define LATENCY_BUCKETS	10000
+
+static const struct
+{
+	const char *name;
+	int policy;
+	int rt_priority;
+	int nice;
+} g_configs[] =
+{
+	{"other nice 0",	SCHED_OTHER,	0,	0},
+	{"other nice -10",	SCHED_OTHER,	0,	-10},
+	{"other nice 19",	SCHED_OTHER,	0,	19},
+	{"batch",			SCHED_BATCH,	0,	0},
+	{"fifo 50",			SCHED_FIFO,		50,	0},
+	{"rr 50",			SCHED_RR,		50,	0}
+};
+#define NUM_CONFIGS	(sizeof(g_configs) / sizeof(g_configs[0]))
+
+struct latency_run
+{
+	int config;
+	int cpu;			// -1 for unpinned
+	int applied;
+	unsigned histogram[LATENCY_BUCKETS];
+	int64_t min, max, sum;
+	int count;
+};
+
+static int64_t g_interval = 1000000;
+static int g_loops = 1000;
+static int g_quit_hogs = 0;
+
+
+// ============================================================================
+
+
+static void *hog_thread(void *arg)
+{
+	(void)arg;
+	volatile unsigned x = 1;
+	while (!__atomic_load_n(&g_quit_hogs, __ATOMIC_RELAXED))
+		x = x * 1103515245 + 12345;
+	return NULL;
+}
+
+static void *measure_thread(void *arg)
+{
+	struct latency_run *run = (struct latency_run *)arg;
+	int c = run->config;
+
+	if (run->cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(run->cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) != 0)
+			return NULL;
+	}
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = g_configs[c].rt_priority;
+	if (sched_setscheduler(0, g_configs[c].policy, &param) != 0)
+		return NULL;
+	if (g_configs[c].nice != 0 && setpriority(PRIO_PROCESS,
+		(pid_t)syscall(SYS_gettid), g_configs[c].nice) != 0)
+		return NULL;
+	run->applied = 1;
+	// we measure the scheduler, not the timer slack
+	frame_pacer_set_slack(0);
+
+	run->min = INT64_MAX;
+	int64_t next = frame_pacer_now() + g_interval;
+	for (int i = 0; i < g_loops; ++i)
+	{
+		struct timespec ts;
+		ts.tv_sec = next / 1000000000LL;
+		ts.tv_nsec = next % 1000000000LL;
+		if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+			continue;
+		int64_t latency = frame_pacer_now() - next;
+		next += g_interval;
+
+		int64_t bucket = latency / 1000;
+		++run->histogram[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1];
+		if (latency < run->min)
+			run->min = latency;
+		if (latency > run->max)
+			run->max = latency;
+		run->sum += latency;
+		++run->count;
+	}
+	return run;
+}
+
+// upper bound of the bucket holding given percentile, in us
+static int percentile(const struct latency_run *run, int percent)
+{
+	unsigned wanted = ((unsigned)run->count * percent + 99) / 100, seen = 0;
+	for (int i = 0; i < LATENCY_BUCKETS; ++i)
+	{
+		seen += run->histogram[i];
+		if (seen >= wanted)
+			return i + 1;
+	}
+	return LATENCY_BUCKETS;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-i interval us] [-n loops] [-l hogs] [-c cpu] "
+		"[-h histogram file]\n", name);
+}
+
+
+// ============================================================================
+
+
+int main(int argc, char *argv[])
+{
+	int num_hogs = 0, cpu = 0, opt;
+	const char *histogram_path = NULL;
+	while ((opt = getopt(argc, argv, "i:n:l:c:h:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'i':	g_interval = atoll(optarg) * 1000;	break;
+			case 'n':	g_loops = atoi(optarg);				break;
+			case 'l':	num_hogs = atoi(optarg);			break;
+			case 'c':	cpu = atoi(optarg);					break;
+			case 'h':	histogram_path = optarg;			break;
+			default:	usage(argv[0]);						return 1;
+		}
+	}
+	if (g_interval <= 0 || g_loops < 1 || num_hogs < 0 || cpu < 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	FILE *histogram = NULL;
+	if (histogram_path && !(histogram = fopen(histogram_path, "w")))
+	{
+		printf("[Latency] Failed to open %s: %s\n", histogram_path, strerror(errno));
+		return 1;
+	}
+
+	pthread_t *hogs = (pthread_t *)calloc(num_hogs ? num_hogs : 1, sizeof(pthread_t));
+	for (int i = 0; i < num_hogs; ++i)
+		if (pthread_create(&hogs[i], NULL, hog_thread, NULL) != 0)
+			num_hogs = i;
+
+	printf("[Latency] %d wakeups every %lld us per configuration, %d hog threads\n",
+		g_loops, (long long)(g_interval / 1000), num_hogs);
+	printf("%-16s %-8s %8s %8s %8s %8s\n", "config", "cpu", "min", "avg", "p99",
+		"max");
+
+	// a thread per run, since we can't always get back to a previous policy
+	struct latency_run *run = (struct latency_run *)malloc(sizeof(*run));
+	for (size_t c = 0; c < NUM_CONFIGS; ++c)
+		for (int pinned = 0; pinned < 2; ++pinned)
+		{
+			memset(run, 0, sizeof(*run));
+			run->config = (int)c;
+			run->cpu = pinned ? cpu : -1;
+			char where[16];
+			snprintf(where, sizeof(where), pinned ? "%d" : "any", cpu);
+
+			pthread_t thread;
+			if (pthread_create(&thread, NULL, measure_thread, run) != 0)
+				continue;
+			pthread_join(thread, NULL);
+			if (!run->applied || run->count == 0)
+			{
+				printf("%-16s %-8s not permitted\n", g_configs[c].name, where);
+				continue;
+			}
+			printf("%-16s %-8s %8.1f %8.1f %8d %8.1f\n", g_configs[c].name, where,
+				run->min / 1000.0, run->sum / 1000.0 / run->count,
+				percentile(run, 99), run->max / 1000.0);
+
+			if (histogram)
+			{
+				// one column per run, gnuplot-friendly
+				fprintf(histogram, "# %s, cpu %s\n", g_configs[c].name, where);
+				for (int i = 0; i < LATENCY_BUCKETS; ++i)
+					if (run->histogram[i])
+						fprintf(histogram, "%d %u\n", i, run->histogram[i]);
+				fprintf(histogram, "\n\n");
+			}
+		}
+	free(run);
+
+	__atomic_store_n(&g_quit_hogs, 1, __ATOMIC_RELAXED);
+	for (int i = 0; i < num_hogs; ++i)
+		pthread_join(hogs[i], NULL);
+	free(hogs);
+	if (histogram)
+		fclose(histogram);
+	return 0;
+}
@@ -0,0 +1,176 @@
+// Memory locking and prefaulting at startup, see memory_lock.h
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memory_lock.h"
+
+#define CAP_IPC_LOCK_BIT	14	// see linux/capability.h
+// what memory_lock_prefault_stack() leaves untouched at the end of the stack,
+// for the frames the thread goes on to call and for signal handlers
+#define STACK_RESERVE		(32 * 1024)
+
+static int g_enabled = 0;	// memory_lock_init() was called
+
+
+// ============================================================================
+
+
+// checks the effective capability set; we can't use libcap here
+static int has_ipc_lock(void)
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	if (!f)
+		return 0;
+	char line[256];
+	unsigned long long caps = 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "CapEff: %llx", &caps) == 1)
+			break;
+	fclose(f);
+	return (caps >> CAP_IPC_LOCK_BIT) & 1;
+}
+
+// like niceness.c does for RLIMIT_NICE: ask for everything, and settle for the
+// hard limit if we lack CAP_SYS_RESOURCE; returns the resulting soft limit
+static rlim_t raise_memlock_limit(void)
+{
+	struct rlimit rlim;
+	rlim.rlim_cur = RLIM_INFINITY;
+	rlim.rlim_max = RLIM_INFINITY;
+	if (setrlimit(RLIMIT_MEMLOCK, &rlim) == 0)
+		return RLIM_INFINITY;
+
+	if (getrlimit(RLIMIT_MEMLOCK, &rlim) != 0)
+		return 0;
+	rlim.rlim_cur = rlim.rlim_max;
+	setrlimit(RLIMIT_MEMLOCK, &rlim);
+	getrlimit(RLIMIT_MEMLOCK, &rlim);
+	return rlim.rlim_cur;
+}
+
+// NOTE: noinline, so that the array really is below the caller's frame
+static __attribute__((noinline)) void touch_stack(size_t size)
+{
+	volatile char *stack = (volatile char *)alloca(size);
+	long page = sysconf(_SC_PAGESIZE);
+	// top down, in the order the stack grows
+	for (size_t offset = size; offset >= (size_t)page; offset -= page)
+		stack[offset - 1] = 0;
+	stack[0] = 0;
+}
+
+
+// ============================================================================
+
+
+int memory_lock_init(size_t heap_headroom)
+{
+	__atomic_store_n(&g_enabled, 1, __ATOMIC_RELAXED);
+	int retval = 0;
+	rlim_t limit = raise_memlock_limit();
+	if (limit != RLIM_INFINITY && !has_ipc_lock())
+	{
+		printf("[Memory] RLIMIT_MEMLOCK is %llu kB, not locking memory\n"
+			"Grant the capability by running as root:\n"
+			"# setcap cap_sys_resource,cap_ipc_lock+eip <binary>\n",
+			(unsigned long long)(limit / 1024));
+		retval = -1;
+	}
+	else if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0)
+	{
+		// EINVAL on kernels older than 4.4, which lack MCL_ONFAULT; locking
+		// everything mapped instead would commit every thread's whole stack
+		printf("[Memory] mlockall() failed: %s\n", strerror(errno));
+		retval = -1;
+	}
+
+	// keep freed heap memory around rather than returning it to the kernel,
+	// and keep large allocations on the heap, where the headroom is
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if (heap_headroom > 0)
+	{
+		void *headroom = malloc(heap_headroom);
+		if (headroom)
+		{
+			memory_lock_prefault(headroom, heap_headroom);
+			free(headroom);
+		}
+	}
+	memory_lock_prefault_stack(0);
+	return retval;
+}
+
+void memory_lock_prefault_stack(size_t size)
+{
+	if (!__atomic_load_n(&g_enabled, __ATOMIC_RELAXED))
+		return;
+	if (size == 0)
+		size = MEMORY_LOCK_STACK_PREFAULT;
+	// threads may have been created with a much smaller stack than that
+	pthread_attr_t attr;
+	void *stack;
+	size_t stack_size;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0)
+		return;
+	int retval = pthread_attr_getstack(&attr, &stack, &stack_size);
+	pthread_attr_destroy(&attr);
+	if (retval != 0)
+		return;
+	char here;
+	size_t left = (size_t)(&here - (char *)stack);
+	if (left <= STACK_RESERVE)
+		return;
+	if (size > left - STACK_RESERVE)
+		size = left - STACK_RESERVE;
+	touch_stack(size);
+}
+
+void memory_lock_prefault(void *ptr, size_t size)
+{
+	if (size == 0)
+		return;
+	char *p = (char *)ptr;
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	// NOTE: a write, since a read of an untouched anonymous page just maps
+	// the shared zero page; an atomic add of 0 writes without changing
+	// anything, even if another thread writes to the region meanwhile
+	__atomic_fetch_add(p, 0, __ATOMIC_RELAXED);
+	// then the start of every further page, up to the one with the last byte
+	uintptr_t first = ((uintptr_t)p & ~(page - 1)) + page;
+	for (uintptr_t at = first; at < (uintptr_t)p + size; at += page)
+		__atomic_fetch_add((char *)at, 0, __ATOMIC_RELAXED);
+}
+
+void memory_lock_sample_faults(struct memory_lock_faults *sample)
+{
+	struct timespec ts;
+	struct rusage usage;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	getrusage(RUSAGE_SELF, &usage);
+	sample->time = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	sample->minor = usage.ru_minflt;
+	sample->major = usage.ru_majflt;
+}
+
+void memory_lock_fault_rates(const struct memory_lock_faults *from,
+	const struct memory_lock_faults *to, double *minor_per_minute,
+	double *major_per_minute)
+{
+	double minutes = (to->time - from->time) / 60e9;
+	if (minutes <= 0)
+		minutes = 1.0 / 60e9;
+	*minor_per_minute = (to->minor - from->minor) / minutes;
+	*major_per_minute = (to->major - from->major) / minutes;
+}
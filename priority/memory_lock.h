@@ -0,0 +1,64 @@
+// Memory locking and prefaulting at startup
+// Page faults on the first touch of code, data, heap and stacks show up as
+// frame spikes during the first minutes of play. mlockall() with MCL_ONFAULT
+// keeps whatever we've touched resident from then on, without committing to
+// memory we've only mapped; and prefaulting touches the heap headroom and
+// thread stacks up front, so that they don't fault in the middle of a frame
+// Call once at startup, right after sighandler_install() and the priority
+// setup (thread_role_init())
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// how much of its stack memory_lock_prefault_stack() touches by default
+#define MEMORY_LOCK_STACK_PREFAULT	(256 * 1024)
+
+// raises RLIMIT_MEMLOCK as far as we're allowed to, locks all current and
+// future pages as they're faulted in, and prefaults heap_headroom bytes of the
+// heap and the calling thread's stack
+// NOTE: to keep the headroom, this turns off heap trimming and serving large
+// allocations with mmap() (M_TRIM_THRESHOLD and M_MMAP_MAX); the sighandler's
+// config reloads override the former if they set malloc_trim_threshold
+// NOTE: only the main arena gets the headroom; other threads' arenas fault in
+// as usual (set M_ARENA_MAX to 1 if that matters)
+// without CAP_IPC_LOCK or an unlimited RLIMIT_MEMLOCK we don't lock anything,
+// since MCL_FUTURE would make allocations fail past the limit; we still
+// prefault, though
+// returns 0 if memory got locked, -1 otherwise
+int memory_lock_init(size_t heap_headroom);
+
+// touches size bytes of the calling thread's stack below the current frame,
+// or as much as the stack has left; 0 means the default
+// call first thing in every long-lived thread; does nothing unless
+// memory_lock_init() was called, so threads can call it unconditionally
+void memory_lock_prefault_stack(size_t size);
+
+// touches every page of a region, e.g. a freshly allocated pool; leaves the
+// contents alone, so it's fine on memory in use
+void memory_lock_prefault(void *ptr, size_t size);
+
+// page fault counts of the whole process at a point in time
+struct memory_lock_faults
+{
+	int64_t time;	// CLOCK_MONOTONIC ns
+	long minor;		// faults served without I/O, e.g. first touch
+	long major;		// faults that had to wait for I/O
+};
+
+// takes a sample of the process's fault counts
+void memory_lock_sample_faults(struct memory_lock_faults *sample);
+
+// fault rates per minute between two samples
+void memory_lock_fault_rates(const struct memory_lock_faults *from,
+	const struct memory_lock_faults *to, double *minor_per_minute,
+	double *major_per_minute);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,172 @@
+// Benchmark of frame pacing jitter: usleep() against absolute sleeps with the
+// default and the minimum timer slack, and against the spinning frame pacer,
+// each under a few scheduling policies
+// To build:				make
+// To grant capabilities – as root:	setcap cap_sys_resource,cap_sys_nice+eip pacing_bench
+// To run:				./pacing_bench [period in us] [frames]
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "frame_pacer.h"
+
+enum pacing_mode
+{
+	MODE_USLEEP,		// what game.cpp does
+	MODE_ABSOLUTE,		// clock_nanosleep(TIMER_ABSTIME), default timer slack
+	MODE_NO_SLACK,		// same, with the minimum timer slack
+	MODE_PACER,			// the frame pacer, sleep and spin
+	NUM_MODES
+};
+
+static const char *g_mode_names[NUM_MODES] =
+{
+	"usleep",
+	"abs sleep",
+	"abs, 1ns slack",
+	"pacer"
+};
+
+static const struct
+{
+	const char *name;
+	int policy;
+	int rt_priority;
+	int nice;
+} g_configs[] =
+{
+	{"other nice 0",	SCHED_OTHER,	0,	0},
+	{"other nice -10",	SCHED_OTHER,	0,	-10},
+	{"other nice 19",	SCHED_OTHER,	0,	19},
+	{"batch",			SCHED_BATCH,	0,	0},
+	{"idle",			SCHED_IDLE,		0,	19},
+	{"fifo 10",			SCHED_FIFO,		10,	0}
+};
+#define NUM_CONFIGS	(sizeof(g_configs) / sizeof(g_configs[0]))
+
+static int64_t g_period = 2000000;
+static int g_frames = 500;
+
+struct bench_result
+{
+	int applied;
+	int64_t avg[NUM_MODES];
+	int64_t p99[NUM_MODES];
+	int64_t max[NUM_MODES];
+	int64_t spin[NUM_MODES];	// CPU time spun per frame
+};
+
+static int compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run_mode(int mode, int64_t *samples, struct bench_result *result)
+{
+	long default_slack = frame_pacer_get_slack();
+	struct frame_pacer pacer;
+	frame_pacer_init(&pacer, g_period);
+	pacer.spin = mode == MODE_PACER;
+	// frame_pacer_init() dropped the slack, put it back for the other modes
+	if (mode == MODE_USLEEP || mode == MODE_ABSOLUTE)
+		frame_pacer_set_slack(default_slack);
+
+	for (int i = 0; i < g_frames; ++i)
+	{
+		if (mode == MODE_USLEEP)
+		{
+			// sleep for whatever is left of the frame, as a naive loop would
+			int64_t left = pacer.deadline - frame_pacer_now();
+			if (left > 0)
+				usleep(left / 1000);
+			samples[i] = frame_pacer_now() - pacer.deadline;
+			pacer.deadline += pacer.period;
+		}
+		else
+			samples[i] = frame_pacer_wait(&pacer);
+	}
+	frame_pacer_set_slack(default_slack);
+
+	int64_t sum = 0;
+	for (int i = 0; i < g_frames; ++i)
+		sum += samples[i];
+	qsort(samples, g_frames, sizeof(samples[0]), compare_int64);
+	result->avg[mode] = sum / g_frames;
+	result->p99[mode] = samples[(g_frames * 99) / 100];
+	result->max[mode] = samples[g_frames - 1];
+	result->spin[mode] = pacer.stats.spin_sum / g_frames;
+}
+
+static void *bench_thread(void *arg)
+{
+	int c = (int)(size_t)arg;
+	static struct bench_result results[NUM_CONFIGS];
+	struct bench_result *result = &results[c];
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = g_configs[c].rt_priority;
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	if (sched_setscheduler(0, g_configs[c].policy, &param) != 0
+		|| (g_configs[c].policy != SCHED_FIFO
+			&& setpriority(PRIO_PROCESS, tid, g_configs[c].nice) != 0))
+		return NULL;
+	result->applied = 1;
+
+	int64_t *samples = (int64_t *)malloc(g_frames * sizeof(int64_t));
+	for (int mode = 0; mode < NUM_MODES; ++mode)
+		run_mode(mode, samples, result);
+	free(samples);
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		g_period = atoll(argv[1]) * 1000;
+	if (argc > 2)
+		g_frames = atoi(argv[2]);
+	if (g_period <= 0 || g_frames < 1)
+	{
+		printf("Usage: %s [period in us] [frames]\n", argv[0]);
+		return 1;
+	}
+
+	printf("[Pacing] %d frames of %lld us, default timer slack %ld ns\n",
+		g_frames, (long long)(g_period / 1000), frame_pacer_get_slack());
+	printf("[Pacing] overshoot past the deadline in us: avg / p99 / max, "
+		"and spin per frame\n");
+	printf("%-16s %-16s %8s %8s %8s %8s\n", "config", "mode", "avg", "p99",
+		"max", "spin");
+
+	for (size_t c = 0; c < NUM_CONFIGS; ++c)
+	{
+		// a thread per config, since we can't always get back from e.g.
+		// SCHED_IDLE or a lower niceness
+		pthread_t thread;
+		void *retval = NULL;
+		if (pthread_create(&thread, NULL, bench_thread, (void *)c) != 0)
+			return 1;
+		pthread_join(thread, &retval);
+		struct bench_result *result = (struct bench_result *)retval;
+		if (!result)
+		{
+			printf("%-16s not permitted\n", g_configs[c].name);
+			continue;
+		}
+		for (int mode = 0; mode < NUM_MODES; ++mode)
+			printf("%-16s %-16s %8.1f %8.1f %8.1f %8.1f\n", g_configs[c].name,
+				g_mode_names[mode], result->avg[mode] / 1000.0,
+				result->p99[mode] / 1000.0, result->max[mode] / 1000.0,
+				result->spin[mode] / 1000.0);
+	}
+	return 0;
+}
@@ -0,0 +1,33 @@
+// Example of CPU topology discovery and automatic thread placement
+// To build:	make
+// To run:	./placement	# or e.g. taskset -c 2-7 ./placement to see the cpuset respected
+
+#define _GNU_SOURCE
+#include <stdio.h>
+
+#include "topology.h"
+
+int main(void)
+{
+	static struct topology topo;
+	static struct topology_placement place;
+
+	if (topology_discover(&topo) != 0)
+	{
+		printf("[Placement] Failed to discover the CPU topology\n");
+		return 1;
+	}
+	topology_place(&topo, &place);
+	topology_print(&topo, &place);
+
+	// pin ourselves as the game thread; worker threads would call
+	// topology_apply(&place, THREAD_ROLE_WORKER, <worker index>), and
+	// sighandler_install() puts the watchdog on place.housekeeping by itself
+	if (topology_apply(&place, THREAD_ROLE_MAIN, 0) != 0)
+	{
+		printf("[Placement] Failed to pin the main thread\n");
+		return 1;
+	}
+	printf("[Placement] Main thread pinned\n");
+	return 0;
+}
@@ -0,0 +1,95 @@
+// Example of locking and prefaulting memory at startup
+// Runs a toy frame loop that allocates, recurses and spawns short-lived
+// threads, once as is and once after memory_lock_init(), and compares the page
+// fault rates
+// To build:				make
+// To grant capabilities – as root:	setcap cap_sys_resource,cap_ipc_lock+eip prefault
+// To run:				./prefault [seconds per phase] [headroom in MiB]
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory_lock.h"
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static __attribute__((noinline)) int recurse(int depth)
+{
+	volatile char frame[1024];
+	frame[0] = (char)depth;
+	return depth > 0 ? recurse(depth - 1) + frame[0] : 0;
+}
+
+static void *helper_thread(void *arg)
+{
+	(void)arg;
+	memory_lock_prefault_stack(0);
+	recurse(64);
+	return NULL;
+}
+
+// one "frame": a handful of allocations of up to 4 MiB, some stack depth,
+// and now and then a helper thread
+static void frame(int index)
+{
+	void *blocks[16];
+	for (int i = 0; i < 16; ++i)
+	{
+		size_t size = (size_t)(rand() % (4 << 20)) + 1;
+		blocks[i] = malloc(size);
+		if (blocks[i])
+			memset(blocks[i], index, size);
+	}
+	for (int i = 0; i < 16; ++i)
+		free(blocks[i]);
+	recurse(rand() % 128);
+	if (index % 50 == 0)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, helper_thread, NULL) == 0)
+			pthread_join(thread, NULL);
+	}
+}
+
+static void phase(const char *name, int seconds)
+{
+	struct memory_lock_faults before, after;
+	memory_lock_sample_faults(&before);
+	int64_t end = now_ns() + seconds * 1000000000LL;
+	int frames = 0;
+	while (now_ns() < end)
+		frame(frames++);
+	memory_lock_sample_faults(&after);
+
+	double minor, major;
+	memory_lock_fault_rates(&before, &after, &minor, &major);
+	printf("[Memory] %-8s %6d frames, %10.0f minor and %6.0f major faults per minute\n",
+		name, frames, minor, major);
+}
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : 3;
+	size_t headroom = (size_t)(argc > 2 ? atoi(argv[2]) : 128) << 20;
+	if (seconds < 1)
+	{
+		printf("Usage: %s [seconds per phase] [headroom in MiB]\n", argv[0]);
+		return 1;
+	}
+
+	phase("before", seconds);
+	if (memory_lock_init(headroom) == 0)
+		printf("[Memory] Locked, with %zu MiB of heap headroom prefaulted\n",
+			headroom >> 20);
+	phase("after", seconds);
+	return 0;
+}
@@ -0,0 +1,514 @@
+// Priority broker daemon
+// Applies scheduling policies, niceness, I/O priority, affinity and
+// RLIMIT_MEMLOCK on behalf of unprivileged clients (see broker.h), so that only
+// this small program needs the capabilities, not the whole game
+// To build:				make
+// To grant capabilities – as root:	setcap cap_sys_nice,cap_sys_resource+eip prio_broker
+// To run:				./prio_broker [-s socket] [-p policy file]	# e.g. -p broker.conf
+// Send SIGHUP to reload the policy file
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stddef.h>		// for offsetof()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "broker.h"
+#include "thread_role.h"	// for the I/O classes
+#include "topology.h"		// for TOPOLOGY_MAX_CPUS
+
+#define MAX_CLIENTS		64
+// so that a single user can't take all the slots and lock everyone else out
+#define MAX_CLIENTS_PER_UID	8
+#define MAX_POLICIES	64
+#define ANY_UID			((uid_t)-1)
+
+// what a user may ask for
+struct broker_policy
+{
+	uid_t uid;				// ANY_UID for the "*" entry
+	int max_rt_priority;	// 0 forbids SCHED_FIFO/SCHED_RR
+	int min_nice;
+	int allow_io_rt;		// the real-time I/O class
+	uint64_t max_memlock;	// UINT64_MAX for unlimited
+	cpu_set_t cpus;			// affinity must stay within these
+};
+
+struct client
+{
+	int fd;
+	struct ucred cred;		// as of connect(), from SO_PEERCRED
+	// when cred.pid started, read at accept(), so that we notice if it exits
+	// and its PID gets reused later on; a PID reused between connect() and
+	// accept() still has to belong to cred.uid, see owns_thread()
+	unsigned long long start_time;
+	const struct broker_policy *policy;
+};
+
+static struct broker_policy g_policies[MAX_POLICIES];
+static int g_num_policies = 0;
+static struct client g_clients[MAX_CLIENTS];
+static int g_num_clients = 0;
+static volatile sig_atomic_t g_reload = 0;
+static volatile sig_atomic_t g_quit = 0;
+
+
+// ============================================================================
+
+
+static int parse_cpus(const char *list, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+	if (strcmp(list, "all") == 0)
+	{
+		for (int i = 0; i < TOPOLOGY_MAX_CPUS; ++i)
+			CPU_SET(i, set);
+		return 0;
+	}
+	const char *p = list;
+	while (*p)
+	{
+		char *end;
+		long first = strtol(p, &end, 10), last = first;
+		if (end == p)
+			return -1;
+		if (*end == '-')
+		{
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p)
+				return -1;
+		}
+		if (first < 0 || last >= TOPOLOGY_MAX_CPUS || first > last)
+			return -1;
+		for (long cpu = first; cpu <= last; ++cpu)
+			CPU_SET(cpu, set);
+		p = *end == ',' ? end + 1 : end;
+		if (*end && *end != ',')
+			return -1;
+	}
+	return 0;
+}
+
+// lines of the form:
+// <user or uid or *> <max rt priority> <min nice> <io rt: yes/no> <max memlock MiB or unlimited> <cpus or all>
+static int load_policies(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+	{
+		printf("[Broker] Failed to open policy file %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	struct broker_policy policies[MAX_POLICIES];
+	int count = 0, lineno = 0, retval = 0;
+	char line[512], user[64], io_rt[8], memlock[32], cpus[256];
+	int max_rt, min_nice;
+	while (fgets(line, sizeof(line), f))
+	{
+		++lineno;
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+		int n = sscanf(line, "%63s %d %d %7s %31s %255s", user, &max_rt, &min_nice,
+			io_rt, memlock, cpus);
+		if (n <= 0)
+			continue;	// blank line
+
+		struct broker_policy *policy = &policies[count];
+		memset(policy, 0, sizeof(*policy));
+		int ok = n == 6 && count < MAX_POLICIES && max_rt >= 0 && max_rt <= 99
+			&& min_nice >= -20 && min_nice <= 19
+			&& (strcmp(io_rt, "yes") == 0 || strcmp(io_rt, "no") == 0)
+			&& parse_cpus(cpus, &policy->cpus) == 0;
+		if (ok)
+		{
+			struct passwd *pw;
+			char *end;
+			if (strcmp(user, "*") == 0)
+				policy->uid = ANY_UID;
+			else if ((pw = getpwnam(user)))
+				policy->uid = pw->pw_uid;
+			else
+			{
+				policy->uid = (uid_t)strtoul(user, &end, 10);
+				if (*end != 0)
+				{
+					// not fatal, the file may be shared between machines
+					printf("[Broker] %s:%d: no such user %s, skipping\n", path,
+						lineno, user);
+					continue;
+				}
+			}
+			if (strcmp(memlock, "unlimited") == 0)
+				policy->max_memlock = UINT64_MAX;
+			else
+			{
+				policy->max_memlock = strtoull(memlock, &end, 10) << 20;
+				ok = ok && *end == 0;
+			}
+		}
+		if (!ok)
+		{
+			printf("[Broker] %s:%d: expected <user> <max rt priority> <min nice> "
+				"<io rt: yes/no> <max memlock MiB or unlimited> <cpus or all>\n",
+				path, lineno);
+			retval = -1;
+			break;
+		}
+		policy->max_rt_priority = max_rt;
+		policy->min_nice = min_nice;
+		policy->allow_io_rt = strcmp(io_rt, "yes") == 0;
+		++count;
+	}
+	fclose(f);
+
+	if (retval == 0)
+	{
+		memcpy(g_policies, policies, count * sizeof(policies[0]));
+		g_num_policies = count;
+		printf("[Broker] Loaded %d policies from %s\n", count, path);
+	}
+	return retval;
+}
+
+// an exact uid match wins over "*"; NULL means the user may do nothing
+static const struct broker_policy *find_policy(uid_t uid)
+{
+	const struct broker_policy *any = NULL;
+	for (int i = 0; i < g_num_policies; ++i)
+	{
+		if (g_policies[i].uid == uid)
+			return &g_policies[i];
+		if (g_policies[i].uid == ANY_UID)
+			any = &g_policies[i];
+	}
+	return any;
+}
+
+// start time of a thread, in clock ticks since boot, from field 22 of its
+// stat file; 0 on failure
+static unsigned long long start_time(pid_t pid, pid_t tid)
+{
+	char path[64], buffer[1024];
+	snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return 0;
+	size_t size = fread(buffer, 1, sizeof(buffer) - 1, f);
+	fclose(f);
+	buffer[size] = 0;
+	// the command name may contain anything, including spaces and parens
+	char *p = strrchr(buffer, ')');
+	if (!p)
+		return 0;
+	unsigned long long value = 0;
+	// after the name: the state is field 3, and we want field 22
+	if (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d "
+		"%*d %*d %*d %*d %*d %llu", &value) != 1)
+		return 0;
+	return value;
+}
+
+// real UID of a thread from its status file, or -1
+static uid_t real_uid(pid_t pid, pid_t tid)
+{
+	char path[64], line[256];
+	snprintf(path, sizeof(path), "/proc/%d/task/%d/status", pid, tid);
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return (uid_t)-1;
+	uid_t uid = (uid_t)-1;
+	unsigned value;
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "Uid: %u", &value) == 1)
+		{
+			uid = (uid_t)value;
+			break;
+		}
+	}
+	fclose(f);
+	return uid;
+}
+
+// the thread has to belong to the very process that connected, and to its
+// user; the connection alone proves neither, as its fd outlives the process
+// through fork() or SCM_RIGHTS, and the PID may have been reused since
+static int owns_thread(const struct client *client, pid_t tid)
+{
+	pid_t pid = client->cred.pid;
+	if (tid <= 0 || !client->start_time)
+		return 0;
+	if (start_time(pid, pid) != client->start_time)
+		return 0;
+	return real_uid(pid, tid) == client->cred.uid;
+}
+
+// returns 0 or an errno value
+static int apply(const struct client *client, const struct broker_request *request)
+{
+	const struct broker_policy *policy = client->policy;
+	if (!policy)
+		return EPERM;
+	if (!owns_thread(client, request->op == BROKER_OP_MEMLOCK
+		? client->cred.pid : request->tid))
+		return ESRCH;
+
+	switch (request->op)
+	{
+		case BROKER_OP_SCHEDULER:
+		{
+			int policy_id = request->arg1 & ~SCHED_RESET_ON_FORK;
+			struct sched_param param;
+			memset(&param, 0, sizeof(param));
+			if (policy_id == SCHED_FIFO || policy_id == SCHED_RR)
+			{
+				if (request->arg2 < 1 || request->arg2 > policy->max_rt_priority)
+					return EPERM;
+				param.sched_priority = request->arg2;
+			}
+			else if (policy_id != SCHED_OTHER && policy_id != SCHED_BATCH
+				&& policy_id != SCHED_IDLE)
+				return EINVAL;
+			// NOTE: always reset on fork: whatever the game forks didn't go
+			// through us
+			return sched_setscheduler(request->tid, policy_id | SCHED_RESET_ON_FORK,
+				&param) == 0 ? 0 : errno;
+		}
+		case BROKER_OP_NICE:
+			if (request->arg1 < policy->min_nice || request->arg1 > 19)
+				return EPERM;
+			return setpriority(PRIO_PROCESS, request->tid, request->arg1) == 0
+				? 0 : errno;
+		case BROKER_OP_IO_PRIORITY:
+			if (request->arg1 == IO_CLASS_RT && !policy->allow_io_rt)
+				return EPERM;
+			return thread_role_set_io_priority(request->tid, request->arg1,
+				request->arg2) == 0 ? 0 : errno;
+		case BROKER_OP_AFFINITY:
+		{
+			cpu_set_t outside;
+			CPU_XOR(&outside, &request->cpus, &policy->cpus);
+			CPU_AND(&outside, &outside, &request->cpus);
+			if (CPU_COUNT(&outside) > 0 || CPU_COUNT(&request->cpus) == 0)
+				return EPERM;
+			return sched_setaffinity(request->tid, sizeof(request->cpus),
+				&request->cpus) == 0 ? 0 : errno;
+		}
+		case BROKER_OP_MEMLOCK:
+		{
+			if (request->bytes > policy->max_memlock)
+				return EPERM;
+			struct rlimit rlim;
+			rlim.rlim_cur = rlim.rlim_max = request->bytes == UINT64_MAX
+				? RLIM_INFINITY : (rlim_t)request->bytes;
+			return prlimit(client->cred.pid, RLIMIT_MEMLOCK, &rlim, NULL) == 0
+				? 0 : errno;
+		}
+	}
+	return EINVAL;
+}
+
+static void serve(struct client *client)
+{
+	struct broker_batch batch;
+	ssize_t n = recv(client->fd, &batch, sizeof(batch), 0);
+	if (n <= 0)
+	{
+		if (n < 0 && errno == EINTR)
+			return;
+		// hung up
+		close(client->fd);
+		client->fd = -1;
+		return;
+	}
+
+	struct broker_reply reply;
+	memset(&reply, 0, sizeof(reply));
+	reply.magic = BROKER_MAGIC;
+	if (n < (ssize_t)offsetof(struct broker_batch, requests)
+		|| batch.magic != BROKER_MAGIC || batch.count > BROKER_MAX_BATCH
+		|| (size_t)n < offsetof(struct broker_batch, requests)
+			+ batch.count * sizeof(struct broker_request))
+	{
+		printf("[Broker] Malformed request from PID %d, dropping it\n",
+			client->cred.pid);
+		close(client->fd);
+		client->fd = -1;
+		return;
+	}
+
+	reply.count = batch.count;
+	int failed = 0;
+	for (uint32_t i = 0; i < batch.count; ++i)
+	{
+		reply.status[i] = apply(client, &batch.requests[i]);
+		if (reply.status[i] != 0)
+		{
+			++failed;
+			printf("[Broker] PID %d (UID %d): request %u (op %u, TID %d) "
+				"denied: %s\n", client->cred.pid, client->cred.uid, i,
+				batch.requests[i].op, batch.requests[i].tid,
+				strerror(reply.status[i]));
+		}
+	}
+	printf("[Broker] PID %d (UID %d): %u requests, %d denied\n", client->cred.pid,
+		client->cred.uid, batch.count, failed);
+	// a client that doesn't read its replies mustn't stall everyone else
+	if (send(client->fd, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL)
+		!= (ssize_t)sizeof(reply))
+	{
+		printf("[Broker] Cannot reply to PID %d (%s), dropping it\n",
+			client->cred.pid, strerror(errno));
+		close(client->fd);
+		client->fd = -1;
+	}
+}
+
+static int count_clients(uid_t uid)
+{
+	int count = 0;
+	for (int i = 0; i < g_num_clients; ++i)
+		if (g_clients[i].cred.uid == uid)
+			++count;
+	return count;
+}
+
+static void signal_handler(int signum)
+{
+	if (signum == SIGHUP)
+		g_reload = 1;
+	else
+		g_quit = 1;
+}
+
+
+// ============================================================================
+
+
+int main(int argc, char *argv[])
+{
+	const char *socket_path = BROKER_SOCKET, *policy_path = "broker.conf";
+	int opt;
+	while ((opt = getopt(argc, argv, "s:p:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's':	socket_path = optarg;	break;
+			case 'p':	policy_path = optarg;	break;
+			default:
+				printf("Usage: %s [-s socket] [-p policy file]\n", argv[0]);
+				return 1;
+		}
+	}
+	if (load_policies(policy_path) != 0)
+		return 1;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = signal_handler;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGHUP, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+	{
+		printf("[Broker] Socket path too long\n");
+		return 1;
+	}
+	strcpy(addr.sun_path, socket_path);
+	int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	unlink(socket_path);
+	if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0
+		|| listen(listener, 16) != 0)
+	{
+		printf("[Broker] Failed to listen on %s: %s\n", socket_path, strerror(errno));
+		return 1;
+	}
+	// anyone may connect; the policy file decides what they get
+	chmod(socket_path, 0666);
+	printf("[Broker] Listening on %s\n", socket_path);
+
+	while (!g_quit)
+	{
+		if (g_reload)
+		{
+			g_reload = 0;
+			// keep the old policies if the new file is broken
+			if (load_policies(policy_path) == 0)
+				for (int i = 0; i < g_num_clients; ++i)
+					g_clients[i].policy = find_policy(g_clients[i].cred.uid);
+		}
+
+		struct pollfd fds[MAX_CLIENTS + 1];
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for (int i = 0; i < g_num_clients; ++i)
+		{
+			fds[i + 1].fd = g_clients[i].fd;
+			fds[i + 1].events = POLLIN;
+		}
+		if (poll(fds, g_num_clients + 1, -1) < 0)
+			continue;	// EINTR, i.e. a signal
+
+		for (int i = 0; i < g_num_clients; ++i)
+			if (fds[i + 1].revents)
+				serve(&g_clients[i]);
+		// drop the ones that hung up
+		int kept = 0;
+		for (int i = 0; i < g_num_clients; ++i)
+			if (g_clients[i].fd >= 0)
+				g_clients[kept++] = g_clients[i];
+		g_num_clients = kept;
+
+		if (fds[0].revents & POLLIN)
+		{
+			int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+			if (fd < 0)
+				continue;
+			struct client *client = &g_clients[g_num_clients];
+			socklen_t len = sizeof(client->cred);
+			if (g_num_clients >= MAX_CLIENTS
+				|| getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &client->cred, &len) != 0)
+			{
+				close(fd);
+				continue;
+			}
+			if (count_clients(client->cred.uid) >= MAX_CLIENTS_PER_UID)
+			{
+				printf("[Broker] PID %d (UID %d) refused, too many connections "
+					"from that user\n", client->cred.pid, client->cred.uid);
+				close(fd);
+				continue;
+			}
+			client->fd = fd;
+			client->start_time = start_time(client->cred.pid, client->cred.pid);
+			client->policy = find_policy(client->cred.uid);
+			++g_num_clients;
+			printf("[Broker] PID %d (UID %d) connected%s\n", client->cred.pid,
+				client->cred.uid, client->policy ? "" : ", no policy for it");
+		}
+	}
+
+	for (int i = 0; i < g_num_clients; ++i)
+		close(g_clients[i].fd);
+	close(listener);
+	unlink(socket_path);
+	return 0;
+}
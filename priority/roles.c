@@ -0,0 +1,59 @@
+// Example of scheduling threads by role rather than the whole process
+// To build:				make
+// To grant capabilities – as root:	setcap cap_sys_resource,cap_sys_nice+eip roles
+// To run:				./roles [role table]	# e.g. ./roles roles.conf
+// Or without capabilities, through the priority broker (see prio_broker.c):
+//					PRIO_BROKER_SOCKET=/run/prio-broker.sock ./roles roles.conf
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>	// for getenv()
+
+#include "thread_role.h"
+#include "broker.h"
+
+static void *role_thread(void *arg)
+{
+	int role = (int)(size_t)arg;
+	struct thread_role_state state;
+	if (thread_role_apply(role, &state) == 0)
+		printf("[Roles] %-10s policy %-6s rt priority %2d nice %3d io %-4s %d%s\n",
+			thread_role_name(role), thread_role_policy_name(state.policy),
+			state.rt_priority, state.nice, thread_role_io_class_name(state.io_class),
+			state.io_level, state.degraded ? " (degraded)" : "");
+	else
+		printf("[Roles] %-10s failed to apply\n", thread_role_name(role));
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && thread_role_load(argv[1]) != 0)
+		return 1;
+
+	// missing capabilities aren't fatal, roles just degrade; unless there's
+	// a broker to do it for us
+	thread_role_init();
+	int broker = -1;
+	if (getenv(BROKER_SOCKET_ENV))
+	{
+		broker = broker_connect(NULL);
+		if (broker >= 0)
+			thread_role_use_broker(broker);
+		else
+			perror("[Roles] Failed to connect to the broker");
+	}
+
+	// one thread per role; in a game these would be the actual game, render,
+	// worker etc. threads applying their role as the first thing they do
+	pthread_t threads[THREAD_ROLE_COUNT];
+	for (int i = 0; i < THREAD_ROLE_COUNT; ++i)
+	{
+		if (pthread_create(&threads[i], NULL, role_thread, (void *)(size_t)i) != 0)
+			return 1;
+		// keep the output in order
+		pthread_join(threads[i], NULL);
+	}
+	broker_close(broker);
+	return 0;
+}
@@ -0,0 +1,386 @@
+// Per-thread scheduling by role, see thread_role.h
+
+#define _GNU_SOURCE			// for SCHED_BATCH, SCHED_IDLE and SCHED_RESET_ON_FORK
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>			// for syscall()
+#include <sys/syscall.h>	// for SYS_gettid
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "thread_role.h"
+#include "broker.h"
+
+struct thread_role_config g_thread_roles[THREAD_ROLE_COUNT] =
+{
+	// policy		rt prio	nice	io class		io level
+	{SCHED_FIFO,	20,		-10,	IO_CLASS_BE,	0},	// main
+	{SCHED_FIFO,	10,		-10,	IO_CLASS_BE,	0},	// render
+	{SCHED_OTHER,	0,		0,		IO_CLASS_BE,	4},	// worker
+	{SCHED_BATCH,	0,		10,		IO_CLASS_BE,	7},	// cooker
+	{SCHED_IDLE,	0,		19,		IO_CLASS_IDLE,	0}	// telemetry
+};
+
+static const char *g_role_names[THREAD_ROLE_COUNT] =
+{
+	"main",
+	"render",
+	"worker",
+	"cooker",
+	"telemetry"
+};
+
+static const struct
+{
+	const char *name;
+	int policy;
+} g_policies[] =
+{
+	{"other",	SCHED_OTHER},
+	{"fifo",	SCHED_FIFO},
+	{"rr",		SCHED_RR},
+	{"batch",	SCHED_BATCH},
+	{"idle",	SCHED_IDLE}
+};
+#define NUM_POLICIES	(sizeof(g_policies) / sizeof(g_policies[0]))
+
+static const char *g_io_class_names[] =
+{
+	"none",
+	"rt",
+	"be",
+	"idle"
+};
+#define NUM_IO_CLASSES	(sizeof(g_io_class_names) / sizeof(g_io_class_names[0]))
+
+// glibc has no wrapper for ioprio_set(); see linux/ioprio.h
+#define IOPRIO_WHO_PROCESS		1
+#define IOPRIO_CLASS_SHIFT		13
+#define IOPRIO_PRIO_VALUE(class, level)	(((class) << IOPRIO_CLASS_SHIFT) | (level))
+
+// lowest niceness we're allowed to set, as per RLIMIT_NICE; the formula for
+// allowed niceness is 20 - rlim_cur (see niceness.c)
+static int g_min_nice = 0;
+
+// socket of the priority broker, -1 if we don't use it
+static int g_broker_fd = -1;
+// held for a request and its reply, so that concurrent callers don't read
+// each other's replies off the shared socket
+static pthread_mutex_t g_broker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// ============================================================================
+
+
+static int is_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+// asks the broker to do what we weren't allowed to; returns 0 on success,
+// -1 with errno set otherwise
+static int via_broker(int op, pid_t tid, int arg1, int arg2)
+{
+	if (g_broker_fd < 0)
+		return -1;
+	struct broker_batch batch;
+	broker_batch_init(&batch);
+	if (op == BROKER_OP_SCHEDULER)
+		broker_add_scheduler(&batch, tid, arg1, arg2);
+	else if (op == BROKER_OP_NICE)
+		broker_add_nice(&batch, tid, arg1);
+	else
+		broker_add_io_priority(&batch, tid, arg1, arg2);
+	int status = 0;
+	pthread_mutex_lock(&g_broker_lock);
+	int retval = broker_submit(g_broker_fd, &batch, &status);
+	pthread_mutex_unlock(&g_broker_lock);
+	if (retval > 0)
+		errno = status;
+	return retval == 0 ? 0 : -1;
+}
+
+// raises the soft limit of given resource to wanted; tries to raise the hard
+// limit too, which needs CAP_SYS_RESOURCE, and otherwise settles for the hard
+// limit; returns the resulting soft limit
+static rlim_t raise_limit(int resource, rlim_t wanted)
+{
+	struct rlimit rlim;
+	if (getrlimit(resource, &rlim) != 0)
+		return 0;
+	if (rlim.rlim_cur != RLIM_INFINITY && rlim.rlim_cur >= wanted)
+		return rlim.rlim_cur;
+	if (rlim.rlim_cur == RLIM_INFINITY)
+		return wanted;
+
+	struct rlimit want;
+	want.rlim_cur = wanted;
+	want.rlim_max = rlim.rlim_max == RLIM_INFINITY || rlim.rlim_max >= wanted
+		? rlim.rlim_max : wanted;
+	if (setrlimit(resource, &want) == 0)
+		return wanted;
+
+	// no capability, so go as far as the hard limit allows us
+	rlim.rlim_cur = rlim.rlim_max == RLIM_INFINITY || rlim.rlim_max >= wanted
+		? wanted : rlim.rlim_max;
+	if (setrlimit(resource, &rlim) != 0)
+		getrlimit(resource, &rlim);
+	return rlim.rlim_cur;
+}
+
+// sets niceness of a single thread, clamping to what RLIMIT_NICE allows if
+// need be; returns the niceness actually set
+static int set_thread_nice(pid_t tid, int nice_value, int *degraded)
+{
+	// in Linux, PRIO_PROCESS with a TID only affects that single thread
+	if (setpriority(PRIO_PROCESS, tid, nice_value) == 0
+		|| ((errno == EACCES || errno == EPERM)
+			&& via_broker(BROKER_OP_NICE, tid, nice_value, 0) == 0))
+		return nice_value;
+	// only retry if the limit lets us get at least part of the way
+	if ((errno == EACCES || errno == EPERM) && nice_value < g_min_nice
+		&& g_min_nice < 0)
+	{
+		*degraded = 1;
+		if (setpriority(PRIO_PROCESS, tid, g_min_nice) == 0)
+			return g_min_nice;
+	}
+	*degraded = 1;
+	errno = 0;
+	int current = getpriority(PRIO_PROCESS, tid);
+	return errno == 0 ? current : 0;
+}
+
+
+// ============================================================================
+
+
+int thread_role_load(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+	{
+		printf("[Priority] Failed to open role table %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	// parse into a copy, so that a bad file doesn't leave us half-way
+	struct thread_role_config roles[THREAD_ROLE_COUNT];
+	memcpy(roles, g_thread_roles, sizeof(roles));
+
+	char line[256], role_name[32], policy_name[32], io_class_name[32];
+	int rt_priority, nice_value, io_level, lineno = 0, retval = 0;
+	while (retval == 0 && fgets(line, sizeof(line), f))
+	{
+		++lineno;
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+		int n = sscanf(line, "%31s %31s %d %d %31s %d", role_name, policy_name,
+			&rt_priority, &nice_value, io_class_name, &io_level);
+		if (n <= 0)
+			continue;	// blank line
+
+		// the I/O columns are optional, the defaults stay if they're missing
+		int role = -1, policy = -1, io_class = -1;
+		if (n < 6)
+			io_level = 0;
+		for (size_t i = 0; n == 6 && i < NUM_IO_CLASSES; ++i)
+			if (strcmp(io_class_name, g_io_class_names[i]) == 0)
+				io_class = (int)i;
+		for (int i = 0; i < THREAD_ROLE_COUNT; ++i)
+			if (strcmp(role_name, g_role_names[i]) == 0)
+				role = i;
+		for (size_t i = 0; i < NUM_POLICIES; ++i)
+			if (strcmp(policy_name, g_policies[i].name) == 0)
+				policy = g_policies[i].policy;
+
+		if ((n != 4 && n != 6) || role < 0 || policy < 0 || (n == 6 && io_class < 0)
+			|| (is_rt_policy(policy) && (rt_priority < 1 || rt_priority > 99))
+			|| nice_value < -20 || nice_value > 19 || io_level < 0 || io_level > 7)
+		{
+			printf("[Priority] %s:%d: expected <role> <policy> <rt priority> <nice> "
+				"[<io class> <io level>]\n", path, lineno);
+			retval = -1;
+			break;
+		}
+		roles[role].policy = policy;
+		roles[role].rt_priority = is_rt_policy(policy) ? rt_priority : 0;
+		roles[role].nice = nice_value;
+		if (n == 6)
+		{
+			roles[role].io_class = io_class;
+			roles[role].io_level = io_class == IO_CLASS_RT || io_class == IO_CLASS_BE
+				? io_level : 0;
+		}
+	}
+	fclose(f);
+
+	if (retval == 0)
+		memcpy(g_thread_roles, roles, sizeof(roles));
+	return retval;
+}
+
+int thread_role_init(void)
+{
+	int max_rt = 0, min_nice = 19;
+	for (int i = 0; i < THREAD_ROLE_COUNT; ++i)
+	{
+		if (is_rt_policy(g_thread_roles[i].policy)
+			&& g_thread_roles[i].rt_priority > max_rt)
+			max_rt = g_thread_roles[i].rt_priority;
+		// the nice value is also the fallback for refused RT policies
+		if (g_thread_roles[i].nice < min_nice)
+			min_nice = g_thread_roles[i].nice;
+	}
+
+	int retval = 0;
+	if (max_rt > 0)
+	{
+		rlim_t rtprio = raise_limit(RLIMIT_RTPRIO, max_rt);
+		if (rtprio < (rlim_t)max_rt)
+		{
+			printf("[Priority] RLIMIT_RTPRIO is %d, real-time roles will degrade "
+				"unless we have CAP_SYS_NICE\n"
+				"Grant the capability by running as root:\n"
+				"# setcap cap_sys_resource,cap_sys_nice+eip <binary>\n",
+				(int)rtprio);
+			retval = -1;
+		}
+	}
+
+	rlim_t nice_limit = raise_limit(RLIMIT_NICE, 20 - min_nice);
+	g_min_nice = 20 - (int)(nice_limit > 40 ? 40 : nice_limit);
+	if (g_min_nice > min_nice)
+	{
+		printf("[Priority] RLIMIT_NICE only allows niceness down to %d, "
+			"unless we have CAP_SYS_NICE\n", g_min_nice > 19 ? 19 : g_min_nice);
+		retval = -1;
+	}
+	return retval;
+}
+
+int thread_role_apply(int role, struct thread_role_state *state)
+{
+	return thread_role_apply_tid((pid_t)syscall(SYS_gettid), role, state);
+}
+
+int thread_role_apply_tid(pid_t tid, int role, struct thread_role_state *state)
+{
+	if (role < 0 || role >= THREAD_ROLE_COUNT)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	const struct thread_role_config *cfg = &g_thread_roles[role];
+	struct thread_role_state s = {SCHED_OTHER, 0, 0, IO_CLASS_NONE, 0, 0};
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	int policy = cfg->policy;
+
+	if (is_rt_policy(policy))
+	{
+		param.sched_priority = cfg->rt_priority;
+		// NOTE: SCHED_RESET_ON_FORK keeps processes forked from RT threads
+		// (e.g. snapshot writers) from inheriting the RT policy
+		if (sched_setscheduler(tid, policy | SCHED_RESET_ON_FORK, &param) == 0
+			|| (errno == EPERM && via_broker(BROKER_OP_SCHEDULER, tid, policy,
+				cfg->rt_priority) == 0))
+		{
+			s.policy = policy;
+			s.rt_priority = cfg->rt_priority;
+			goto done;
+		}
+		printf("[Priority] %s thread %d: %s refused (%s), falling back to nice %d\n",
+			g_role_names[role], tid, thread_role_policy_name(policy),
+			strerror(errno), cfg->nice);
+		s.degraded = 1;
+		policy = SCHED_OTHER;
+		param.sched_priority = 0;
+	}
+
+	// SCHED_OTHER, SCHED_BATCH and SCHED_IDLE all need a static priority of 0;
+	// moving to any of them is unprivileged, unless we're leaving an RT policy
+	if (sched_setscheduler(tid, policy, &param) == 0
+		|| (errno == EPERM && via_broker(BROKER_OP_SCHEDULER, tid, policy, 0) == 0))
+		s.policy = policy;
+	else
+	{
+		printf("[Priority] %s thread %d: %s refused (%s)\n", g_role_names[role],
+			tid, thread_role_policy_name(policy), strerror(errno));
+		s.degraded = 1;
+		s.policy = sched_getscheduler(tid) & ~SCHED_RESET_ON_FORK;
+		if (s.policy < 0)
+		{
+			if (state)
+				*state = s;
+			return -1;
+		}
+	}
+
+	// niceness is ignored by SCHED_IDLE, but set it anyway so that the thread
+	// stays in the background if it's ever moved back to SCHED_OTHER
+	s.nice = set_thread_nice(tid, cfg->nice, &s.degraded);
+
+done:
+	// NOTE: unlike the CPU policy, an I/O class other than none sticks even
+	// if the niceness changes later
+	if (thread_role_set_io_priority(tid, cfg->io_class, cfg->io_level) == 0
+		|| (errno == EPERM && via_broker(BROKER_OP_IO_PRIORITY, tid,
+			cfg->io_class, cfg->io_level) == 0))
+	{
+		s.io_class = cfg->io_class;
+		s.io_level = cfg->io_level;
+	}
+	else
+	{
+		printf("[Priority] %s thread %d: I/O class %s refused (%s)\n",
+			g_role_names[role], tid, thread_role_io_class_name(cfg->io_class),
+			strerror(errno));
+		s.degraded = 1;
+	}
+
+	if (state)
+		*state = s;
+	return 0;
+}
+
+void thread_role_use_broker(int fd)
+{
+	g_broker_fd = fd;
+}
+
+int thread_role_set_io_priority(pid_t tid, int io_class, int io_level)
+{
+	if (io_class < IO_CLASS_NONE || io_class > IO_CLASS_IDLE
+		|| io_level < 0 || io_level > 7)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	return syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+		IOPRIO_PRIO_VALUE(io_class, io_level)) == 0 ? 0 : -1;
+}
+
+const char *thread_role_name(int role)
+{
+	return role >= 0 && role < THREAD_ROLE_COUNT ? g_role_names[role] : "?";
+}
+
+const char *thread_role_policy_name(int policy)
+{
+	for (size_t i = 0; i < NUM_POLICIES; ++i)
+		if (g_policies[i].policy == policy)
+			return g_policies[i].name;
+	return "?";
+}
+
+const char *thread_role_io_class_name(int io_class)
+{
+	return io_class >= 0 && io_class < (int)NUM_IO_CLASSES
+		? g_io_class_names[io_class] : "?";
+}
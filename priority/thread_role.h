@@ -0,0 +1,102 @@
+// Per-thread scheduling by role
+// Unlike nice() in niceness.c, which affects the whole process, this applies a
+// scheduling policy, RT priority and niceness to single threads according to
+// the role they play, so that latency-critical threads stop competing with
+// background work; likewise for I/O priority, so that background reads and
+// writes stop competing with foreground loads for disk bandwidth
+
+#pragma once
+
+#include <sys/types.h>	// for pid_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum thread_role
+{
+	THREAD_ROLE_MAIN,		// game thread
+	THREAD_ROLE_RENDER,		// render submission
+	THREAD_ROLE_WORKER,		// job system workers
+	THREAD_ROLE_COOKER,		// asset cooking/decompression
+	THREAD_ROLE_TELEMETRY,	// stats, logging, uploads
+	THREAD_ROLE_COUNT
+};
+
+// I/O scheduling classes, as in the kernel's IOPRIO_CLASS_*; they're only
+// honoured by I/O schedulers that support priorities (BFQ, and CFQ back in the
+// day), but setting them elsewhere is harmless
+enum io_class
+{
+	IO_CLASS_NONE,		// derived from the CPU niceness
+	IO_CLASS_RT,		// needs CAP_SYS_ADMIN
+	IO_CLASS_BE,		// best-effort, levels [0, 7] with 0 the highest
+	IO_CLASS_IDLE		// only gets the disk when nobody else wants it
+};
+
+// one entry of the role table
+struct thread_role_config
+{
+	int policy;			// SCHED_FIFO, SCHED_RR, SCHED_OTHER, SCHED_BATCH or SCHED_IDLE
+	int rt_priority;	// [1, 99], only used for SCHED_FIFO and SCHED_RR
+	int nice;			// [-20, 19], used for SCHED_OTHER and SCHED_BATCH, and as
+						// the fallback when a real-time policy is refused
+	int io_class;		// one of the IO_CLASS_* values
+	int io_level;		// [0, 7], only used for IO_CLASS_RT and IO_CLASS_BE
+};
+
+// what actually got applied to a thread
+struct thread_role_state
+{
+	int policy;
+	int rt_priority;
+	int nice;
+	int io_class;
+	int io_level;
+	int degraded;		// non-zero if we had to settle for less than configured
+};
+
+// the role table; starts out with sensible defaults:
+// main and render on SCHED_FIFO, workers on SCHED_OTHER, cookers on
+// SCHED_BATCH and telemetry on SCHED_IDLE; I/O-wise, best-effort with the
+// highest level for main and render, the lowest for cookers, and the idle
+// class for telemetry
+extern struct thread_role_config g_thread_roles[THREAD_ROLE_COUNT];
+
+// overrides entries of the role table from a text file with lines of the form
+// <role> <policy> <rt priority> <nice> [<io class> <io level>], e.g.
+// "render fifo 10 -10" or "cooker batch 0 10 be 7"
+// returns 0 on success, -1 on error (the table is left untouched then)
+int thread_role_load(const char *path);
+
+// raises RLIMIT_RTPRIO and RLIMIT_NICE as far as the table needs and we're
+// allowed to; without CAP_SYS_RESOURCE only up to the hard limits
+// call once at startup, before thread_role_apply()
+// returns 0 if the limits cover the whole table, -1 if some roles will degrade
+int thread_role_init(void);
+
+// applies the role to the calling thread; state may be NULL
+// returns 0 on success, even if degraded; -1 if nothing could be applied
+int thread_role_apply(int role, struct thread_role_state *state);
+
+// same as above, but for any thread of ours, given its TID
+int thread_role_apply_tid(pid_t tid, int role, struct thread_role_state *state);
+
+// routes whatever we aren't allowed to do ourselves (RT policies, negative
+// niceness, the real-time I/O class) through the priority broker on given
+// socket, see broker.h; -1 to stop
+void thread_role_use_broker(int fd);
+
+// sets the I/O priority of a single thread; in Linux, ioprio_set() with
+// IOPRIO_WHO_PROCESS and a TID only affects that thread
+// returns 0 on success
+int thread_role_set_io_priority(pid_t tid, int io_class, int io_level);
+
+// role, policy and I/O class names, for logging
+const char *thread_role_name(int role);
+const char *thread_role_policy_name(int policy);
+const char *thread_role_io_class_name(int io_class);
+
+#ifdef __cplusplus
+}
+#endif
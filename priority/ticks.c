@@ -0,0 +1,111 @@
+// Example of a fixed-tick simulation thread on a SCHED_DEADLINE reservation
+// To build:				make
+// To grant capabilities – as root:	setcap cap_sys_resource,cap_sys_nice+eip ticks
+// To run:				./ticks [runtime us] [period us] [ticks]
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "deadline.h"
+#include "thread_role.h"
+
+static struct deadline_params g_params =
+{
+	3000000,			// runtime
+	0,					// deadline, i.e. the period
+	10000000,			// period
+	THREAD_ROLE_MAIN	// fallback
+};
+static int g_ticks = 200;
+static int g_done = 0;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void burn(int64_t ns)
+{
+	int64_t end = now_ns() + ns;
+	while (now_ns() < end)
+		;
+}
+
+static void on_overrun(unsigned long overruns, void *arg)
+{
+	(void)arg;
+	printf("[Deadline] kernel reported %lu overruns\n", overruns);
+}
+
+static void *simulation_thread(void *arg)
+{
+	(void)arg;
+	struct deadline_state state;
+	if (deadline_apply(&g_params, &state) != 0)
+		return NULL;
+	printf("[Deadline] simulation on %s%s%s\n", state.policy == SCHED_DEADLINE ? "deadline"
+		: thread_role_policy_name(state.policy), state.degraded ? " (degraded)" : "",
+		state.policy == SCHED_DEADLINE && !state.signalled ? " (no overrun signals)" : "");
+
+	// how far apart the ticks actually start, compared to the period
+	int64_t last = now_ns(), jitter_max = 0, jitter_sum = 0;
+	for (int i = 0; i < g_ticks; ++i)
+	{
+		// a third of the budget normally, and every 50th tick blows it
+		burn(i % 50 == 49 ? g_params.runtime * 3 / 2 : g_params.runtime / 3);
+		deadline_wait(&state);
+
+		int64_t now = now_ns();
+		int64_t jitter = llabs(now - last - (int64_t)g_params.period);
+		last = now;
+		jitter_sum += jitter;
+		if (jitter > jitter_max)
+			jitter_max = jitter;
+	}
+	printf("[Deadline] %llu ticks, jitter avg %.1f us max %.1f us, "
+		"%llu over budget\n", (unsigned long long)state.ticks,
+		jitter_sum / 1000.0 / g_ticks, jitter_max / 1000.0,
+		(unsigned long long)state.overruns);
+	__atomic_store_n(&g_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1)
+		g_params.runtime = atoll(argv[1]) * 1000;
+	if (argc > 2)
+		g_params.period = atoll(argv[2]) * 1000;
+	if (argc > 3)
+		g_ticks = atoi(argv[3]);
+	if (g_params.runtime == 0 || g_params.runtime > g_params.period || g_ticks < 1)
+	{
+		printf("Usage: %s [runtime us] [period us] [ticks]\n", argv[0]);
+		return 1;
+	}
+
+	thread_role_init();
+	deadline_init();
+	deadline_set_overrun_callback(on_overrun, NULL);
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, simulation_thread, NULL) != 0)
+		return 1;
+	// the main thread plays telemetry here
+	while (!__atomic_load_n(&g_done, __ATOMIC_ACQUIRE))
+	{
+		struct timespec ts = {0, 100000000};
+		nanosleep(&ts, NULL);
+		deadline_poll();
+	}
+	pthread_join(thread, NULL);
+	deadline_poll();
+	printf("[Deadline] %lu overruns reported by the kernel in total\n",
+		deadline_overruns());
+	return 0;
+}
@@ -0,0 +1,366 @@
+// CPU topology discovery and thread placement, see topology.h
+
+#define _GNU_SOURCE			// for cpu_set_t and sched_getaffinity()
+#include <sched.h>
+#include <unistd.h>			// for syscall()
+#include <sys/syscall.h>	// for SYS_gettid
+#include <stdio.h>
+#include <stdlib.h>			// for strtol()
+#include <string.h>
+#include <errno.h>
+
+#include "topology.h"
+
+#ifndef TOPOLOGY_SYSFS
+	#define TOPOLOGY_SYSFS	"/sys/devices/system/cpu"
+#endif
+
+// we need at least this many physical cores for dedicated ones: housekeeping,
+// game, render, and at least one for the workers
+#define TOPOLOGY_MIN_DEDICATED_CORES	4
+
+
+// ============================================================================
+
+
+// reads a small sysfs file into buf; returns 0 on success
+static int read_sysfs(const char *path, char *buf, size_t size)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -1;
+	int retval = fgets(buf, size, f) ? 0 : -1;
+	fclose(f);
+	return retval;
+}
+
+static int read_sysfs_int(const char *path, int fallback)
+{
+	char buf[32];
+	return read_sysfs(path, buf, sizeof(buf)) == 0 ? atoi(buf) : fallback;
+}
+
+// parses the kernel's cpulist format, e.g. "0-3,8-11"
+static int parse_cpulist(const char *list, cpu_set_t *set)
+{
+	CPU_ZERO(set);
+	const char *p = list;
+	while (*p && *p != '\n')
+	{
+		char *end;
+		long first = strtol(p, &end, 10);
+		if (end == p)
+			return -1;
+		long last = first;
+		p = end;
+		if (*p == '-')
+		{
+			last = strtol(p + 1, &end, 10);
+			if (end == p + 1)
+				return -1;
+			p = end;
+		}
+		for (long cpu = first; cpu <= last && cpu < TOPOLOGY_MAX_CPUS; ++cpu)
+			CPU_SET(cpu, set);
+		if (*p == ',')
+			++p;
+	}
+	return 0;
+}
+
+// lowest CPU number in the cpulist file, or -1
+static int read_sysfs_lowest(const char *path)
+{
+	char buf[1024];
+	cpu_set_t set;
+	if (read_sysfs(path, buf, sizeof(buf)) != 0 || parse_cpulist(buf, &set) != 0)
+		return -1;
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; ++cpu)
+		if (CPU_ISSET(cpu, &set))
+			return cpu;
+	return -1;
+}
+
+// finds the cache of given level (data or unified) and returns the lowest CPU
+// number sharing it, which makes for a nice domain identifier
+static int read_cache_domain(int cpu, int level)
+{
+	char path[256], type[32];
+	for (int index = 0; ; ++index)
+	{
+		snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu%d/cache/index%d/level",
+			cpu, index);
+		int l = read_sysfs_int(path, -1);
+		if (l < 0)
+			return -1;
+		snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu%d/cache/index%d/type",
+			cpu, index);
+		if (l != level || read_sysfs(path, type, sizeof(type)) != 0
+			|| strncmp(type, "Instruction", 11) == 0)
+			continue;
+		snprintf(path, sizeof(path),
+			TOPOLOGY_SYSFS "/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+		return read_sysfs_lowest(path);
+	}
+}
+
+static void mask_to_string(const cpu_set_t *set, char *buf, size_t size)
+{
+	size_t len = 0;
+	buf[0] = 0;
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS && len < size; ++cpu)
+	{
+		if (!CPU_ISSET(cpu, set))
+			continue;
+		int last = cpu;
+		while (last + 1 < TOPOLOGY_MAX_CPUS && CPU_ISSET(last + 1, set))
+			++last;
+		len += snprintf(buf + len, size - len, last > cpu ? "%s%d-%d" : "%s%d",
+			len ? "," : "", cpu, last);
+		cpu = last;
+	}
+}
+
+
+// ============================================================================
+
+
+int topology_discover(struct topology *topo)
+{
+	memset(topo, 0, sizeof(*topo));
+
+	char buf[1024];
+	cpu_set_t online, allowed;
+	if (read_sysfs(TOPOLOGY_SYSFS "/online", buf, sizeof(buf)) != 0
+		|| parse_cpulist(buf, &online) != 0)
+	{
+		printf("[Topology] Failed to read the online CPU mask\n");
+		return -1;
+	}
+	// our affinity mask is already restricted to our cpuset, so this is how
+	// we respect it
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+	{
+		printf("[Topology] Failed to get the affinity mask: %s\n", strerror(errno));
+		return -1;
+	}
+	CPU_AND(&allowed, &allowed, &online);
+
+	char path[256];
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; ++cpu)
+	{
+		struct topology_cpu *c = &topo->cpus[cpu];
+		c->core = c->l2 = c->l3 = -1;
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		topo->num_cpus = cpu + 1;
+		c->present = 1;
+		++topo->num_present;
+
+		snprintf(path, sizeof(path),
+			TOPOLOGY_SYSFS "/cpu%d/topology/physical_package_id", cpu);
+		c->package = read_sysfs_int(path, 0);
+		snprintf(path, sizeof(path),
+			TOPOLOGY_SYSFS "/cpu%d/topology/thread_siblings_list", cpu);
+		c->core = read_sysfs_lowest(path);
+		if (c->core < 0)
+			c->core = cpu;	// no SMT info, assume a core of its own
+		c->l2 = read_cache_domain(cpu, 2);
+		c->l3 = read_cache_domain(cpu, 3);
+	}
+	if (topo->num_present == 0)
+		return -1;
+
+	// count the distinct cores and L3 domains among the usable CPUs
+	for (int cpu = 0; cpu < topo->num_cpus; ++cpu)
+	{
+		const struct topology_cpu *c = &topo->cpus[cpu];
+		if (!c->present)
+			continue;
+		int new_core = 1, new_l3 = 1;
+		for (int other = 0; other < cpu; ++other)
+		{
+			if (!topo->cpus[other].present)
+				continue;
+			if (topo->cpus[other].core == c->core)
+				new_core = 0;
+			if (topo->cpus[other].l3 == c->l3)
+				new_l3 = 0;
+		}
+		topo->num_cores += new_core;
+		topo->num_l3 += new_l3;
+	}
+	return 0;
+}
+
+void topology_place(const struct topology *topo, struct topology_placement *place)
+{
+	memset(place, 0, sizeof(*place));
+
+	// the first CPU of every usable core, in order
+	int cores[TOPOLOGY_MAX_CPUS], num_cores = 0;
+	for (int cpu = 0; cpu < topo->num_cpus; ++cpu)
+		if (topo->cpus[cpu].present && topo->cpus[cpu].core == cpu)
+			cores[num_cores++] = cpu;
+	// it's possible for the lowest sibling to be outside our cpuset
+	if (num_cores < topo->num_cores)
+	{
+		num_cores = 0;
+		for (int cpu = 0; cpu < topo->num_cpus; ++cpu)
+		{
+			int seen = 0;
+			for (int i = 0; i < num_cores; ++i)
+				seen |= topo->cpus[cores[i]].core == topo->cpus[cpu].core;
+			if (topo->cpus[cpu].present && !seen)
+				cores[num_cores++] = cpu;
+		}
+	}
+
+	cpu_set_t workers;
+	CPU_ZERO(&workers);
+	int next_core = 0;
+	if (num_cores >= TOPOLOGY_MIN_DEDICATED_CORES - 1)
+	{
+		// the lowest core goes to housekeeping: CPU 0 tends to get most of the
+		// interrupts anyway; with one core fewer, we do without it
+		int housekeeping_core = -1;
+		if (num_cores >= TOPOLOGY_MIN_DEDICATED_CORES)
+			housekeeping_core = topo->cpus[cores[next_core++]].core;
+		// the game and render threads get a single hardware thread each, and
+		// their SMT siblings are left idle so that they get all of the core's
+		// L1/L2 and execution units
+		int game = cores[next_core++];
+		int render = cores[next_core++];
+		CPU_SET(game, &place->roles[THREAD_ROLE_MAIN]);
+		CPU_SET(render, &place->roles[THREAD_ROLE_RENDER]);
+
+		for (int cpu = 0; cpu < topo->num_cpus; ++cpu)
+		{
+			const struct topology_cpu *c = &topo->cpus[cpu];
+			if (!c->present || c->core == topo->cpus[game].core
+				|| c->core == topo->cpus[render].core)
+				continue;
+			if (c->core == housekeeping_core)
+				CPU_SET(cpu, &place->housekeeping);
+			else
+				CPU_SET(cpu, &workers);
+		}
+		if (housekeeping_core < 0)
+			place->housekeeping = workers;
+	}
+	else
+	{
+		// not enough cores to go around, so everyone shares everything
+		place->shared = 1;
+		for (int cpu = 0; cpu < topo->num_cpus; ++cpu)
+			if (topo->cpus[cpu].present)
+				CPU_SET(cpu, &workers);
+		place->roles[THREAD_ROLE_MAIN] = workers;
+		place->roles[THREAD_ROLE_RENDER] = workers;
+		place->housekeeping = workers;
+	}
+	place->roles[THREAD_ROLE_WORKER] = workers;
+	place->roles[THREAD_ROLE_COOKER] = workers;
+	place->roles[THREAD_ROLE_TELEMETRY] = place->housekeeping;
+
+	// split the workers into L3 domains, so that a worker never migrates to a
+	// CPU with a cold L3
+	for (int cpu = 0; cpu < topo->num_cpus; ++cpu)
+	{
+		if (!CPU_ISSET(cpu, &workers))
+			continue;
+		int domain;
+		for (domain = 0; domain < place->num_worker_domains; ++domain)
+		{
+			int first = -1;
+			for (int other = 0; other < cpu && first < 0; ++other)
+				if (CPU_ISSET(other, &place->worker_domains[domain]))
+					first = other;
+			if (first >= 0 && topo->cpus[first].l3 == topo->cpus[cpu].l3)
+				break;
+		}
+		if (domain == place->num_worker_domains)
+		{
+			if (domain == TOPOLOGY_MAX_DOMAINS)
+				domain = TOPOLOGY_MAX_DOMAINS - 1;
+			else
+				CPU_ZERO(&place->worker_domains[place->num_worker_domains++]);
+		}
+		CPU_SET(cpu, &place->worker_domains[domain]);
+	}
+}
+
+const cpu_set_t *topology_worker_mask(const struct topology_placement *place,
+	int index)
+{
+	if (place->num_worker_domains == 0)
+		return &place->roles[THREAD_ROLE_WORKER];
+	// pack: fill up the first L3 domain with as many workers as it has CPUs,
+	// then move on to the next one, and wrap around if there are more workers
+	// than CPUs
+	int total = CPU_COUNT(&place->roles[THREAD_ROLE_WORKER]);
+	index %= total;
+	for (int domain = 0; domain < place->num_worker_domains; ++domain)
+	{
+		int count = CPU_COUNT(&place->worker_domains[domain]);
+		if (index < count)
+			return &place->worker_domains[domain];
+		index -= count;
+	}
+	return &place->worker_domains[0];
+}
+
+int topology_apply(const struct topology_placement *place, int role, int index)
+{
+	if (role < 0 || role >= THREAD_ROLE_COUNT)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	const cpu_set_t *mask = role == THREAD_ROLE_WORKER
+		? topology_worker_mask(place, index) : &place->roles[role];
+	return topology_apply_tid((pid_t)syscall(SYS_gettid), mask);
+}
+
+int topology_apply_tid(pid_t tid, const cpu_set_t *mask)
+{
+	if (CPU_COUNT(mask) == 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	// like setpriority(), sched_setaffinity() takes a TID and only affects that
+	// single thread
+	return sched_setaffinity(tid, sizeof(*mask), mask);
+}
+
+void topology_print(const struct topology *topo,
+	const struct topology_placement *place)
+{
+	char buf[1024];
+	printf("[Topology] %d usable CPUs, %d physical cores, %d L3 domains\n",
+		topo->num_present, topo->num_cores, topo->num_l3);
+	for (int cpu = 0; cpu < topo->num_cpus; ++cpu)
+	{
+		const struct topology_cpu *c = &topo->cpus[cpu];
+		if (c->present)
+			printf("[Topology] CPU %3d: package %d core %3d L2 %3d L3 %3d\n",
+				cpu, c->package, c->core, c->l2, c->l3);
+	}
+	if (!place)
+		return;
+	if (place->shared)
+		printf("[Topology] Too few cores for dedicated placement, sharing\n");
+	for (int role = 0; role < THREAD_ROLE_COUNT; ++role)
+	{
+		mask_to_string(&place->roles[role], buf, sizeof(buf));
+		printf("[Topology] %-12s %s\n", thread_role_name(role), buf);
+	}
+	mask_to_string(&place->housekeeping, buf, sizeof(buf));
+	printf("[Topology] %-12s %s\n", "housekeeping", buf);
+	for (int domain = 0; domain < place->num_worker_domains; ++domain)
+	{
+		mask_to_string(&place->worker_domains[domain], buf, sizeof(buf));
+		printf("[Topology] L3 domain %d  %s\n", domain, buf);
+	}
+}
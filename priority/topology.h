@@ -0,0 +1,80 @@
+// CPU topology discovery and thread placement
+// Parses /sys/devices/system/cpu for physical cores, SMT siblings and cache
+// domains, and works out CPU masks per thread role: the game and render
+// threads get physical cores of their own with the SMT siblings left idle,
+// workers are packed per L3 domain, and housekeeping (the watchdog, telemetry)
+// goes on a CPU of its own if there are enough of them
+
+#pragma once
+
+// NOTE: cpu_set_t needs _GNU_SOURCE defined before any system header
+#include <sched.h>
+#include <sys/types.h>	// for pid_t
+
+#include "thread_role.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TOPOLOGY_MAX_CPUS	CPU_SETSIZE
+#define TOPOLOGY_MAX_DOMAINS	64
+
+struct topology_cpu
+{
+	int present;	// online, and in our affinity mask (i.e. our cpuset)
+	int package;	// physical_package_id
+	int core;		// lowest CPU number among the SMT siblings
+	int l2;			// lowest CPU number sharing the L2, or -1 if unknown
+	int l3;			// lowest CPU number sharing the L3, or -1 if unknown
+};
+
+struct topology
+{
+	int num_cpus;		// highest CPU number + 1
+	int num_present;	// usable CPUs
+	int num_cores;		// usable physical cores
+	int num_l3;			// usable L3 domains
+	struct topology_cpu cpus[TOPOLOGY_MAX_CPUS];
+};
+
+// CPU masks per role
+struct topology_placement
+{
+	cpu_set_t roles[THREAD_ROLE_COUNT];
+	// the watchdog and other odds and ends
+	cpu_set_t housekeeping;
+	// workers are placed on the L3 domains in turn, see topology_worker_mask()
+	int num_worker_domains;
+	cpu_set_t worker_domains[TOPOLOGY_MAX_DOMAINS];
+	// non-zero if there weren't enough cores for dedicated ones
+	int shared;
+};
+
+// reads the topology of the CPUs we're allowed to run on; the affinity mask
+// we inherited reflects the cgroup cpuset we're running in, so we respect it
+// returns 0 on success
+int topology_discover(struct topology *topo);
+
+// works out the placement of the thread roles
+void topology_place(const struct topology *topo, struct topology_placement *place);
+
+// mask for the index-th worker thread: the L3 domain it's packed into
+const cpu_set_t *topology_worker_mask(const struct topology_placement *place,
+	int index);
+
+// pins the calling thread according to its role; index is only used for
+// workers; returns 0 on success
+int topology_apply(const struct topology_placement *place, int role, int index);
+
+// pins any thread or process, e.g. the watchdog:
+// topology_apply_tid(sighandler_watchdog_pid(), &place.housekeeping)
+int topology_apply_tid(pid_t tid, const cpu_set_t *mask);
+
+// prints the topology and placement, for diagnostics
+void topology_print(const struct topology *topo,
+	const struct topology_placement *place);
+
+#ifdef __cplusplus
+}
+#endif
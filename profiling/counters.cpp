@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>			// for read() and syscall()
+#include <sys/mman.h>		// for mmap()
+#include <sys/syscall.h>	// for SYS_gettid and SYS_perf_event_open
+#include <linux/perf_event.h>
+
+#include "counters.h"
+
+static_assert(COUNTER_NUM <= PROFILE_MAX_COUNTERS, "raise PROFILE_MAX_COUNTERS");
+
+struct counters_group
+{
+	int leader;			// -1 if the group couldn't be opened
+	int num_events;
+	int ids[COUNTER_NUM];	// counter_id of each event, in group order
+	int fds[COUNTER_NUM];
+	// mapped control pages of the hardware events, for rdpmc
+	struct perf_event_mmap_page *pages[COUNTER_NUM];
+};
+
+struct counters_thread
+{
+	int tid;
+	int role;
+	struct counters_group hardware, software;
+	struct counter_values last;		// as of the previous frame
+	int num_zones;
+	struct counters_zone_stats zones[COUNTERS_MAX_ZONES];
+};
+
+static const struct
+{
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+} g_counters_events[COUNTER_NUM] =
+{
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, "cache-references"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, "branches"},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock"},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+	{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations"}
+};
+
+// the threads' structs are allocated once and never move, so that the owning
+// threads can keep a pointer to theirs
+static pthread_mutex_t g_counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct counters_thread g_counters_threads[COUNTERS_MAX_THREADS];
+static bool g_counters_used[COUNTERS_MAX_THREADS];
+static bool g_counters_hardware = false;
+static bool g_counters_warned = false;
+static uint64_t g_counters_frame = 0;
+static uint64_t g_counters_begin = 0;
+
+static __thread struct counters_thread *t_counters = NULL;
+
+
+// ============================================================================
+
+
+static int counters_gettid()
+{
+	return (int)syscall(SYS_gettid);
+}
+
+// opens the events of the given class as a group; events the PMU doesn't
+// have (e.g. cache misses on some ARM cores) are simply left out
+static void counters_open_group(struct counters_group *group, int tid,
+	uint32_t type)
+{
+	memset(group, 0, sizeof(*group));
+	group->leader = -1;
+	for (int i = 0; i < COUNTER_NUM; ++i)
+	{
+		if (g_counters_events[i].type != type)
+			continue;
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = g_counters_events[i].config;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+			| PERF_FORMAT_TOTAL_TIME_RUNNING;
+		// the software events happen in the kernel, on behalf of the thread,
+		// e.g. context switches; perf_event_paranoid 2 only lets us count them
+		// in user space though, which still leaves task-clock and faults
+		attr.exclude_kernel = type == PERF_TYPE_HARDWARE;
+		attr.exclude_hv = 1;
+		int fd = (int)syscall(SYS_perf_event_open, &attr, tid, -1, group->leader,
+			PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0 && errno == EACCES && !attr.exclude_kernel)
+		{
+			attr.exclude_kernel = 1;
+			fd = (int)syscall(SYS_perf_event_open, &attr, tid, -1, group->leader,
+				PERF_FLAG_FD_CLOEXEC);
+		}
+		if (fd < 0)
+		{
+			if (!g_counters_warned)
+				printf("[Counters] No %s counter: %s\n", g_counters_events[i].name,
+					strerror(errno));
+			// the PMU is all or nothing, so one missing is enough to know
+			if (type == PERF_TYPE_HARDWARE && group->leader < 0)
+				break;
+			continue;
+		}
+		if (group->leader < 0)
+			group->leader = fd;
+		group->ids[group->num_events] = i;
+		group->fds[group->num_events] = fd;
+		if (type == PERF_TYPE_HARDWARE)
+		{
+			void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+				fd, 0);
+			if (page != MAP_FAILED)
+				group->pages[group->num_events] = (struct perf_event_mmap_page *)page;
+		}
+		++group->num_events;
+	}
+}
+
+static void counters_close_group(struct counters_group *group)
+{
+	for (int i = 0; i < group->num_events; ++i)
+	{
+		if (group->pages[i])
+			munmap(group->pages[i], sysconf(_SC_PAGESIZE));
+		close(group->fds[i]);
+	}
+	group->num_events = 0;
+	group->leader = -1;
+}
+
+// a single read() for the whole group, scaled up if the group only got part
+// of the time on the PMU (i.e. it was multiplexed with other users)
+static int counters_read_group(const struct counters_group *group,
+	struct counter_values *values)
+{
+	if (group->leader < 0)
+		return 0;
+	uint64_t buf[3 + COUNTER_NUM];	// nr, time_enabled, time_running, values
+	ssize_t size = (3 + group->num_events) * sizeof(uint64_t);
+	if (read(group->leader, buf, size) != size || buf[0] != (uint64_t)group->num_events)
+		return -1;
+	double scale = buf[2] > 0 && buf[2] < buf[1] ? (double)buf[1] / buf[2] : 1.0;
+	for (int i = 0; i < group->num_events; ++i)
+	{
+		values->values[group->ids[i]] = (uint64_t)(buf[3 + i] * scale);
+		values->valid |= 1u << group->ids[i];
+	}
+	return 0;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static inline uint64_t counters_rdpmc(uint32_t counter)
+{
+	uint32_t lo, hi;
+	__asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+	return lo | (uint64_t)hi << 32;
+}
+
+static inline uint64_t counters_rdtsc()
+{
+	uint32_t lo, hi;
+	__asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return lo | (uint64_t)hi << 32;
+}
+
+// the seqlock protocol from linux/perf_event.h; returns false if the counter
+// isn't currently available to rdpmc (e.g. it's not scheduled in)
+// the value is scaled like counters_read_group() does, with the enabled and
+// running times brought up to date from the TSC
+static bool counters_read_mapped(const struct perf_event_mmap_page *page,
+	uint64_t *value)
+{
+	uint32_t seq;
+	bool ok;
+	uint64_t count = 0, enabled, running, cycles;
+	uint64_t time_offset = 0;
+	uint32_t time_mult = 0;
+	uint16_t time_shift = 0;
+	do
+	{
+		seq = __atomic_load_n(&page->lock, __ATOMIC_ACQUIRE);
+		enabled = page->time_enabled;
+		running = page->time_running;
+		cycles = 0;
+		if (page->cap_user_time && enabled != running)
+		{
+			cycles = counters_rdtsc();
+			time_offset = page->time_offset;
+			time_mult = page->time_mult;
+			time_shift = page->time_shift;
+		}
+		uint32_t index = page->index;
+		ok = page->cap_user_rdpmc && index != 0;
+		if (ok)
+		{
+			int64_t pmc = counters_rdpmc(index - 1);
+			int width = page->pmc_width;
+			pmc <<= 64 - width;	// sign-extend to the counter's width
+			pmc >>= 64 - width;
+			count = page->offset + pmc;
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&page->lock, __ATOMIC_RELAXED) != seq);
+	if (!ok)
+		return false;
+	
+	if (cycles)
+	{
+		// it's scheduled in (we just read it), so both times have advanced
+		uint64_t quot = cycles >> time_shift;
+		uint64_t rem = cycles & (((uint64_t)1 << time_shift) - 1);
+		uint64_t delta = time_offset + quot * time_mult + ((rem * time_mult) >> time_shift);
+		enabled += delta;
+		running += delta;
+	}
+	double scale = running > 0 && running < enabled ? (double)enabled / running : 1.0;
+	*value = (uint64_t)(count * scale);
+	return true;
+}
+#endif
+
+// rdpmc the hardware counters if they're all mapped, else read() them
+static int counters_read_hardware(const struct counters_group *group,
+	struct counter_values *values)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	uint64_t read[COUNTER_NUM];
+	int i = 0;
+	while (i < group->num_events && group->pages[i]
+		&& counters_read_mapped(group->pages[i], &read[i]))
+		++i;
+	if (group->num_events > 0 && i == group->num_events)
+	{
+		for (i = 0; i < group->num_events; ++i)
+		{
+			values->values[group->ids[i]] = read[i];
+			values->valid |= 1u << group->ids[i];
+		}
+		return 0;
+	}
+#endif
+	return counters_read_group(group, values);
+}
+
+static void counters_add(struct counter_values *sum, const struct counter_values *a,
+	const struct counter_values *b)
+{
+	// only what's valid in both a and the one it's compared against
+	uint32_t valid = a->valid & b->valid;
+	for (int i = 0; i < COUNTER_NUM; ++i)
+	{
+		if (valid & (1u << i))
+			sum->values[i] += a->values[i] - b->values[i];
+	}
+	sum->valid |= valid;
+}
+
+static double counters_ratio(const struct counter_values *values, int a, int b)
+{
+	if (!(values->valid & (1u << a)) || !(values->valid & (1u << b))
+		|| values->values[b] == 0)
+		return 0;
+	return (double)values->values[a] / values->values[b];
+}
+
+
+// ============================================================================
+
+
+int counters_register(int role)
+{
+	if (role < 0 || role >= THREAD_ROLE_COUNT)
+		return -1;
+	if (t_counters)
+	{
+		t_counters->role = role;
+		return 0;
+	}
+	
+	pthread_mutex_lock(&g_counters_lock);
+	int slot = 0;
+	while (slot < COUNTERS_MAX_THREADS && g_counters_used[slot])
+		++slot;
+	if (slot == COUNTERS_MAX_THREADS)
+	{
+		pthread_mutex_unlock(&g_counters_lock);
+		printf("[Counters] Too many threads, raise COUNTERS_MAX_THREADS\n");
+		return -1;
+	}
+	struct counters_thread *t = &g_counters_threads[slot];
+	memset(t, 0, sizeof(*t));
+	t->tid = counters_gettid();
+	t->role = role;
+	counters_open_group(&t->hardware, t->tid, PERF_TYPE_HARDWARE);
+	counters_open_group(&t->software, t->tid, PERF_TYPE_SOFTWARE);
+	if (!g_counters_warned && t->hardware.leader < 0)
+		printf("[Counters] Only software counters available\n");
+	g_counters_warned = true;
+	g_counters_hardware |= t->hardware.leader >= 0;
+	counters_read_group(&t->hardware, &t->last);
+	counters_read_group(&t->software, &t->last);
+	g_counters_used[slot] = true;
+	pthread_mutex_unlock(&g_counters_lock);
+	
+	t_counters = t;
+	return 0;
+}
+
+void counters_unregister()
+{
+	struct counters_thread *t = t_counters;
+	if (!t)
+		return;
+	pthread_mutex_lock(&g_counters_lock);
+	counters_close_group(&t->hardware);
+	counters_close_group(&t->software);
+	g_counters_used[t - g_counters_threads] = false;
+	pthread_mutex_unlock(&g_counters_lock);
+	t_counters = NULL;
+}
+
+bool counters_have_hardware()
+{
+	return g_counters_hardware;
+}
+
+int counters_read(struct counter_values *values)
+{
+	struct counters_thread *t = t_counters;
+	values->valid = 0;
+	if (!t)
+		return -1;
+	if (counters_read_hardware(&t->hardware, values) != 0
+		|| counters_read_group(&t->software, values) != 0)
+		return -1;
+	return 0;
+}
+
+int counters_end_frame(struct counters_frame *frame)
+{
+	static char buf[sizeof(struct profile_counters_record)
+		+ THREAD_ROLE_COUNT * sizeof(struct profile_counters_entry)];
+	struct profile_counters_record *record = (struct profile_counters_record *)buf;
+	struct counters_frame sums;
+	memset(&sums, 0, sizeof(sums));
+	
+	pthread_mutex_lock(&g_counters_lock);
+	uint64_t now = tsc_ticks();
+	sums.frame = g_counters_frame++;
+	sums.begin = g_counters_begin ? g_counters_begin : now;
+	sums.end = now;
+	g_counters_begin = now;
+	for (int i = 0; i < COUNTERS_MAX_THREADS; ++i)
+	{
+		if (!g_counters_used[i])
+			continue;
+		struct counters_thread *t = &g_counters_threads[i];
+		struct counter_values values;
+		values.valid = 0;
+		// NOTE: rdpmc would read *our* PMU, so other threads take read()
+		if (counters_read_group(&t->hardware, &values) != 0
+			|| counters_read_group(&t->software, &values) != 0)
+			continue;
+		counters_add(&sums.roles[t->role], &values, &t->last);
+		++sums.num_threads[t->role];
+		t->last = values;
+	}
+	pthread_mutex_unlock(&g_counters_lock);
+	
+	record->frame = sums.frame;
+	record->begin = sums.begin;
+	record->end = sums.end;
+	record->count = 0;
+	record->padding = 0;
+	for (int role = 0; role < THREAD_ROLE_COUNT; ++role)
+	{
+		if (!sums.num_threads[role])
+			continue;
+		struct profile_counters_entry *entry = &record->roles[record->count++];
+		memset(entry, 0, sizeof(*entry));
+		entry->role = role;
+		entry->valid = sums.roles[role].valid;
+		memcpy(entry->values, sums.roles[role].values, sizeof(sums.roles[role].values));
+	}
+	profile_send(PROFILE_RECORD_COUNTERS, record,
+		sizeof(*record) + record->count * sizeof(record->roles[0]));
+	if (frame)
+		*frame = sums;
+	return 0;
+}
+
+void counters_print(const char *label, const struct counter_values *values)
+{
+	printf("  %-16s", label);
+	if (values->valid & (1u << COUNTER_INSTRUCTIONS))
+		printf(" %6.2f IPC, %5.2f%% cache miss, %5.2f%% branch miss,",
+			counters_ipc(values), counters_cache_miss_rate(values) * 100,
+			counters_branch_miss_rate(values) * 100);
+	if (values->valid & (1u << COUNTER_TASK_CLOCK))
+		printf(" %8.3f ms on CPU", values->values[COUNTER_TASK_CLOCK] / 1e6);
+	if (values->valid & (1u << COUNTER_PAGE_FAULTS))
+		printf(", %llu faults, %llu switches, %llu migrations",
+			(unsigned long long)values->values[COUNTER_PAGE_FAULTS],
+			(unsigned long long)values->values[COUNTER_CONTEXT_SWITCHES],
+			(unsigned long long)values->values[COUNTER_MIGRATIONS]);
+	printf("\n");
+}
+
+void counters_print_frame(const struct counters_frame *frame)
+{
+	printf("[Counters] Frame %llu, %.2f ms:\n", (unsigned long long)frame->frame,
+		tsc_delta_to_ns(frame->end - frame->begin) / 1e6);
+	for (int role = 0; role < THREAD_ROLE_COUNT; ++role)
+	{
+		if (frame->num_threads[role])
+			counters_print(thread_role_name(role), &frame->roles[role]);
+	}
+}
+
+double counters_ipc(const struct counter_values *values)
+{
+	return counters_ratio(values, COUNTER_INSTRUCTIONS, COUNTER_CYCLES);
+}
+
+double counters_cache_miss_rate(const struct counter_values *values)
+{
+	return counters_ratio(values, COUNTER_CACHE_MISSES, COUNTER_CACHE_REFERENCES);
+}
+
+double counters_branch_miss_rate(const struct counter_values *values)
+{
+	return counters_ratio(values, COUNTER_BRANCH_MISSES, COUNTER_BRANCHES);
+}
+
+const char *counters_name(int counter)
+{
+	return counter >= 0 && counter < COUNTER_NUM ? g_counters_events[counter].name : "?";
+}
+
+void counters_zone_add(const char *name, const struct counter_values *begin)
+{
+	struct counters_thread *t = t_counters;
+	struct counter_values end;
+	if (!t || counters_read(&end) != 0)
+		return;
+	int num_zones = __atomic_load_n(&t->num_zones, __ATOMIC_RELAXED);
+	int i = 0;
+	while (i < num_zones && t->zones[i].name != name)
+		++i;
+	if (i == COUNTERS_MAX_ZONES)
+		return;
+	struct counters_zone_stats *zone = &t->zones[i];
+	if (i == num_zones)
+	{
+		memset(zone, 0, sizeof(*zone));
+		zone->name = name;
+		// NOTE: the reporting thread may be reading the zones as we go; it
+		// only looks at the ones up to num_zones
+		__atomic_store_n(&t->num_zones, i + 1, __ATOMIC_RELEASE);
+	}
+	++zone->calls;
+	counters_add(&zone->sum, &end, begin);
+}
+
+int counters_zone_report(struct counters_zone_stats *zones, int max_zones,
+	bool reset)
+{
+	int num_zones = 0;
+	pthread_mutex_lock(&g_counters_lock);
+	for (int i = 0; i < COUNTERS_MAX_THREADS; ++i)
+	{
+		if (!g_counters_used[i])
+			continue;
+		struct counters_thread *t = &g_counters_threads[i];
+		int thread_zones = __atomic_load_n(&t->num_zones, __ATOMIC_ACQUIRE);
+		for (int j = 0; j < thread_zones; ++j)
+		{
+			// zones of the same name from different threads add up
+			int k = 0;
+			while (k < num_zones && zones[k].name != t->zones[j].name)
+				++k;
+			if (k == max_zones)
+				continue;
+			if (k == num_zones)
+			{
+				memset(&zones[k], 0, sizeof(zones[k]));
+				zones[k].name = t->zones[j].name;
+				++num_zones;
+			}
+			zones[k].calls += t->zones[j].calls;
+			for (int c = 0; c < COUNTER_NUM; ++c)
+				zones[k].sum.values[c] += t->zones[j].sum.values[c];
+			zones[k].sum.valid |= t->zones[j].sum.valid;
+		}
+		// NOTE: racy against a zone ending right now, which merely loses it
+		if (reset)
+			__atomic_store_n(&t->num_zones, 0, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&g_counters_lock);
+	return num_zones;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "profile.h"		// for PROFILE_MAX_COUNTERS
+#include "thread_role.h"	// for THREAD_ROLE_COUNT
+
+// perf_event counters per thread, summed up per thread role: IPC, cache and
+// branch miss rates of the main loop without running perf by hand
+// each registered thread gets a group of hardware counters, if the kernel and
+// the (virtual) machine give us a PMU, and a group of software ones always;
+// groups are scheduled onto the PMU all or nothing, so ratios within a group
+// are always consistent
+// a thread reads its own hardware counters with rdpmc, straight from user
+// space, whenever the kernel maps them for us; everything else takes a
+// grouped read(), i.e. a syscall per group
+
+enum counter_id
+{
+	// hardware
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_CACHE_REFERENCES,
+	COUNTER_CACHE_MISSES,
+	COUNTER_BRANCHES,
+	COUNTER_BRANCH_MISSES,
+	// software
+	COUNTER_TASK_CLOCK,		// ns on the CPU
+	COUNTER_PAGE_FAULTS,
+	COUNTER_CONTEXT_SWITCHES,
+	COUNTER_MIGRATIONS,
+	COUNTER_NUM
+};
+
+#define COUNTER_HARDWARE_MASK	((1u << COUNTER_TASK_CLOCK) - 1)
+
+#define COUNTERS_MAX_THREADS	64
+#define COUNTERS_MAX_ZONES		64
+
+struct counter_values
+{
+	uint32_t valid;		// bit per counter_id we have a value for
+	uint64_t values[COUNTER_NUM];
+};
+
+struct counters_frame
+{
+	uint64_t frame;
+	uint64_t begin, end;	// in ticks, see tsc.h
+	int num_threads[THREAD_ROLE_COUNT];
+	struct counter_values roles[THREAD_ROLE_COUNT];
+};
+
+struct counters_zone_stats
+{
+	const char *name;
+	uint64_t calls;
+	struct counter_values sum;
+};
+
+// opens the counters of the calling thread and accounts them to given role
+// (from thread_role.h); returns 0 on success, even if only the software
+// counters could be opened
+int counters_register(int role);
+
+// closes the calling thread's counters; must happen before it exits
+void counters_unregister();
+
+// non-zero if hardware counters could be opened for registered threads
+bool counters_have_hardware();
+
+// reads the calling thread's counters; cheap (rdpmc) for hardware ones if
+// they're mapped, a syscall per group otherwise
+// returns 0 on success, -1 if the thread isn't registered
+int counters_read(struct counter_values *values);
+
+// samples all registered threads and fills frame (if not NULL) with the
+// deltas since the previous call, summed up per role; the record also goes
+// into the trace, if profiling is on (see profile.h)
+// meant to be called by the thread driving the frames, once per frame
+int counters_end_frame(struct counters_frame *frame);
+
+// prints given values with the derived rates, e.g. for a role or a zone
+void counters_print(const char *label, const struct counter_values *values);
+
+// per-role lines of a frame
+void counters_print_frame(const struct counters_frame *frame);
+
+// derived rates; 0 if the inputs weren't available
+double counters_ipc(const struct counter_values *values);
+double counters_cache_miss_rate(const struct counter_values *values);
+double counters_branch_miss_rate(const struct counter_values *values);
+
+const char *counters_name(int counter);
+
+// ============================================================================
+// zones
+// COUNTERS_ZONE("name") reads the thread's counters at the start and end of
+// the scope, and adds up the difference per zone name; unlike ZONE() from
+// profile.h, it costs a couple of syscalls when rdpmc isn't available, so it's
+// meant for coarse scopes, e.g. subsystems within a frame
+
+// adds a zone's counters to the calling thread's totals
+void counters_zone_add(const char *name, const struct counter_values *begin);
+
+// sums the zones of all threads, and resets them if asked to; returns the
+// number of zones filled in
+int counters_zone_report(struct counters_zone_stats *zones, int max_zones,
+	bool reset);
+
+struct counters_zone
+{
+	const char *name;
+	struct counter_values begin;
+	
+	counters_zone(const char *name)
+	{
+		this->name = name;
+		if (counters_read(&begin) != 0)
+			begin.valid = 0;
+	}
+	
+	~counters_zone()
+	{
+		if (begin.valid)
+			counters_zone_add(name, &begin);
+	}
+};
+
+#ifndef PROFILE_DISABLED
+	#define COUNTERS_ZONE(name)	\
+		counters_zone PROFILE_CONCAT(counters_zone_, __LINE__)(name)
+#else
+	#define COUNTERS_ZONE(name)	do {} while (0)
+#endif
@@ -0,0 +1,157 @@
+// perf_event counters demo: the main thread and two workers run workloads
+// with very different IPC and miss rates, in zones of their own
+// To build:	make
+// To run:	./counters_demo [trace.prof] && ./profile_convert trace.prof trace.json
+// NOTE: hardware counters need a PMU, which many VMs don't expose; with
+// perf_event_paranoid > 2, not even the software ones are available
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "counters.h"
+
+#define NUM_FRAMES		5
+#define CHASE_NODES		(1 << 20)	// 8 MiB of pointers, well past the L2
+#define NUM_READS		100000
+
+static volatile bool g_exit = false;
+static volatile uint64_t g_sink;
+static pthread_barrier_t g_frame_start, g_frame_end;
+static size_t *g_chase;
+
+
+// ============================================================================
+
+
+// dependent loads all over memory: low IPC, lots of cache misses
+static void pointer_chase(int steps)
+{
+	size_t i = 0;
+	for (int n = 0; n < steps; ++n)
+		i = g_chase[i];
+	g_sink = i;
+}
+
+// data-dependent branches on random bits: lots of branch misses
+static void random_branches(int steps)
+{
+	uint64_t x = 88172645463325252ULL, sum = 0;
+	for (int n = 0; n < steps; ++n)
+	{
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		if (x & 1)
+			sum += x;
+		else
+			sum -= x >> 3;
+	}
+	g_sink = sum;
+}
+
+// independent arithmetic: high IPC
+static void arithmetic(int steps)
+{
+	uint64_t a = 1, b = 2, c = 3, d = 4;
+	for (int n = 0; n < steps; ++n)
+	{
+		a = a * 3 + 1;
+		b = b * 5 + 2;
+		c = c * 7 + 3;
+		d = d * 9 + 4;
+	}
+	g_sink = a + b + c + d;
+}
+
+static void *worker(void *arg)
+{
+	int index = (int)(size_t)arg;
+	counters_register(THREAD_ROLE_WORKER);
+	for (;;)
+	{
+		pthread_barrier_wait(&g_frame_start);
+		if (g_exit)
+			break;
+		if (index == 0)
+		{
+			COUNTERS_ZONE("pointer chase");
+			pointer_chase(2000000);
+		}
+		else
+		{
+			COUNTERS_ZONE("random branches");
+			random_branches(20000000);
+		}
+		pthread_barrier_wait(&g_frame_end);
+	}
+	counters_unregister();
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : "trace.prof";
+	if (profile_init_file(path, PROFILE_CAT_ALL, 50) != 0)
+		return 1;
+	if (counters_register(THREAD_ROLE_MAIN) != 0)
+		return 1;
+	
+	// a random cycle through the chase array (Sattolo's algorithm)
+	g_chase = (size_t *)malloc(CHASE_NODES * sizeof(*g_chase));
+	for (size_t i = 0; i < CHASE_NODES; ++i)
+		g_chase[i] = i;
+	for (size_t i = CHASE_NODES - 1; i > 0; --i)
+	{
+		size_t j = (size_t)rand() % i;
+		size_t tmp = g_chase[i];
+		g_chase[i] = g_chase[j];
+		g_chase[j] = tmp;
+	}
+	
+	// cost of reading our own counters
+	struct counter_values values;
+	uint64_t start = tsc_ticks();
+	for (int i = 0; i < NUM_READS; ++i)
+		counters_read(&values);
+	printf("counters_read(): %.1f ns (%s)\n",
+		tsc_delta_to_ns(tsc_ticks() - start) / (double)NUM_READS,
+		counters_have_hardware() ? "hardware and software" : "software only");
+	
+	pthread_barrier_init(&g_frame_start, NULL, 3);
+	pthread_barrier_init(&g_frame_end, NULL, 3);
+	pthread_t threads[2];
+	for (int i = 0; i < 2; ++i)
+		pthread_create(&threads[i], NULL, worker, (void *)(size_t)i);
+	
+	counters_end_frame(NULL);	// starts the first frame
+	for (int frame = 0; frame < NUM_FRAMES; ++frame)
+	{
+		pthread_barrier_wait(&g_frame_start);
+		{
+			COUNTERS_ZONE("arithmetic");
+			arithmetic(20000000);
+		}
+		pthread_barrier_wait(&g_frame_end);
+		struct counters_frame stats;
+		counters_end_frame(&stats);
+		counters_print_frame(&stats);
+	}
+	
+	// before the workers go away, and their zones with them
+	struct counters_zone_stats zones[COUNTERS_MAX_ZONES];
+	int num_zones = counters_zone_report(zones, COUNTERS_MAX_ZONES, false);
+	printf("[Counters] Zones:\n");
+	for (int i = 0; i < num_zones; ++i)
+		counters_print(zones[i].name, &zones[i].sum);
+	
+	g_exit = true;
+	pthread_barrier_wait(&g_frame_start);
+	for (int i = 0; i < 2; ++i)
+		pthread_join(threads[i], NULL);
+	
+	counters_unregister();
+	profile_shutdown();
+	free(g_chase);
+	return 0;
+}
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>			// for open()
+#include <pthread.h>
+#include <unistd.h>			// for pread() and syscall()
+#include <sys/resource.h>	// for getrusage()
+#include <sys/syscall.h>	// for SYS_gettid and SYS_perf_event_open
+#include <linux/perf_event.h>
+
+#include "frame_stats.h"
+
+// software events we count per thread, if allowed to
+enum frame_stats_counter
+{
+	FRAME_STATS_MINOR_FAULTS,
+	FRAME_STATS_MAJOR_FAULTS,
+	FRAME_STATS_MIGRATIONS,
+	FRAME_STATS_NUM_COUNTERS
+};
+
+static const uint64_t g_frame_stats_events[FRAME_STATS_NUM_COUNTERS] =
+{
+	PERF_COUNT_SW_PAGE_FAULTS_MIN,
+	PERF_COUNT_SW_PAGE_FAULTS_MAJ,
+	PERF_COUNT_SW_CPU_MIGRATIONS
+};
+
+// cumulative counters of a thread, as last sampled
+struct frame_stats_totals
+{
+	uint64_t minor_faults, major_faults;
+	uint64_t voluntary_switches, involuntary_switches;
+	uint64_t migrations;
+	uint64_t cpu_ns;
+};
+
+struct frame_stats_thread
+{
+	int tid;
+	clockid_t clock;	// the thread's CPU-time clock
+	int stat_fd;		// /proc/self/task/<tid>/stat
+	int status_fd;		// /proc/self/task/<tid>/status
+	int perf_fd;		// group leader, or -1
+	bool migrations;	// whether perf counts them, see frame_stats_open_perf()
+	struct frame_stats_totals last;
+};
+
+static pthread_mutex_t g_frame_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct frame_stats_thread g_frame_stats_threads[FRAME_STATS_MAX_THREADS];
+static int g_frame_stats_num_threads = 0;
+static uint64_t g_frame_stats_frame = 0;
+static uint64_t g_frame_stats_begin = 0;
+static bool g_frame_stats_perf_warned = false;
+
+
+// ============================================================================
+
+
+static int frame_stats_gettid()
+{
+	return (int)syscall(SYS_gettid);
+}
+
+static uint64_t frame_stats_clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	if (clock_gettime(clock, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// opens the software counters of given thread as a group, so that a single
+// read() gets all of them; returns the leader, or -1 if perf isn't available
+// migrations happen in the kernel, so they only get counted if perf lets us
+// include kernel events; kernel tells whether it did
+static int frame_stats_open_perf(int tid, bool *kernel)
+{
+	int leader = -1;
+	*kernel = true;
+	for (int i = 0; i < FRAME_STATS_NUM_COUNTERS; ++i)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = g_frame_stats_events[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		// faults are attributed to the user space code that took them, so
+		// perf_event_paranoid 2 still counts those; migrations read 0 then
+		attr.exclude_kernel = !*kernel;
+		attr.exclude_hv = 1;
+		int fd = (int)syscall(SYS_perf_event_open, &attr, tid, -1, leader,
+			PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0 && (errno == EACCES || errno == EPERM) && *kernel)
+		{
+			*kernel = false;
+			attr.exclude_kernel = 1;
+			fd = (int)syscall(SYS_perf_event_open, &attr, tid, -1, leader,
+				PERF_FLAG_FD_CLOEXEC);
+		}
+		if (fd < 0)
+		{
+			if (!g_frame_stats_perf_warned)
+				printf("[FrameStats] No perf events (%s), using /proc instead\n",
+					strerror(errno));
+			g_frame_stats_perf_warned = true;
+			if (leader >= 0)
+				close(leader);	// closes the whole group
+			return -1;
+		}
+		if (leader < 0)
+			leader = fd;
+	}
+	return leader;
+}
+
+static int frame_stats_read_file(int fd, char *buf, size_t size)
+{
+	ssize_t len = pread(fd, buf, size - 1, 0);
+	if (len <= 0)
+		return -1;
+	buf[len] = 0;
+	return 0;
+}
+
+static void frame_stats_read_perf(struct frame_stats_thread *t,
+	struct frame_stats_totals *totals)
+{
+	uint64_t values[1 + FRAME_STATS_NUM_COUNTERS];
+	if (t->perf_fd < 0
+		|| read(t->perf_fd, values, sizeof(values)) != (ssize_t)sizeof(values))
+		return;
+	totals->minor_faults = values[1 + FRAME_STATS_MINOR_FAULTS];
+	totals->major_faults = values[1 + FRAME_STATS_MAJOR_FAULTS];
+	totals->migrations = values[1 + FRAME_STATS_MIGRATIONS];
+}
+
+// reads the cumulative counters of a thread other than the calling one
+static void frame_stats_read_other(struct frame_stats_thread *t,
+	struct frame_stats_totals *totals)
+{
+	char buf[2048];
+	*totals = t->last;
+	totals->cpu_ns = frame_stats_clock_ns(t->clock);
+	
+	if (t->perf_fd >= 0)
+		frame_stats_read_perf(t, totals);
+	else if (frame_stats_read_file(t->stat_fd, buf, sizeof(buf)) == 0)
+	{
+		// the name in parentheses may contain anything, so skip past it; then
+		// minflt and majflt are the 8th and 10th fields
+		const char *p = strrchr(buf, ')');
+		unsigned long long minflt, majflt;
+		if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %llu %*u %llu",
+			&minflt, &majflt) == 2)
+		{
+			totals->minor_faults = minflt;
+			totals->major_faults = majflt;
+		}
+	}
+	
+	if (frame_stats_read_file(t->status_fd, buf, sizeof(buf)) == 0)
+	{
+		const char *p = strstr(buf, "\nvoluntary_ctxt_switches:");
+		if (p)
+			totals->voluntary_switches = strtoull(strchr(p, ':') + 1, NULL, 10);
+		p = strstr(buf, "\nnonvoluntary_ctxt_switches:");
+		if (p)
+			totals->involuntary_switches = strtoull(strchr(p, ':') + 1, NULL, 10);
+	}
+}
+
+// the calling thread can do without /proc
+static void frame_stats_read_self(struct frame_stats_thread *t,
+	struct frame_stats_totals *totals)
+{
+	struct rusage usage;
+	*totals = t->last;
+	totals->cpu_ns = frame_stats_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+	if (getrusage(RUSAGE_THREAD, &usage) == 0)
+	{
+		totals->minor_faults = usage.ru_minflt;
+		totals->major_faults = usage.ru_majflt;
+		totals->voluntary_switches = usage.ru_nvcsw;
+		totals->involuntary_switches = usage.ru_nivcsw;
+	}
+	// NOTE: the perf counters start at zero, so where we have them, they
+	// have to be the source of the faults for other threads and ourselves alike
+	frame_stats_read_perf(t, totals);
+}
+
+static void frame_stats_sample(struct frame_stats_thread *t,
+	struct frame_stats_totals *totals)
+{
+	if (t->tid == frame_stats_gettid())
+		frame_stats_read_self(t, totals);
+	else
+		frame_stats_read_other(t, totals);
+}
+
+static void frame_stats_close(struct frame_stats_thread *t)
+{
+	if (t->stat_fd >= 0)
+		close(t->stat_fd);
+	if (t->status_fd >= 0)
+		close(t->status_fd);
+	if (t->perf_fd >= 0)
+		close(t->perf_fd);
+}
+
+
+// ============================================================================
+
+
+int frame_stats_register()
+{
+	struct frame_stats_thread t;
+	memset(&t, 0, sizeof(t));
+	t.tid = frame_stats_gettid();
+	if (pthread_getcpuclockid(pthread_self(), &t.clock) != 0)
+		return -1;
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/task/%d/stat", t.tid);
+	t.stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+	snprintf(path, sizeof(path), "/proc/self/task/%d/status", t.tid);
+	t.status_fd = open(path, O_RDONLY | O_CLOEXEC);
+	t.perf_fd = frame_stats_open_perf(t.tid, &t.migrations);
+	
+	pthread_mutex_lock(&g_frame_stats_lock);
+	if (g_frame_stats_num_threads >= FRAME_STATS_MAX_THREADS)
+	{
+		pthread_mutex_unlock(&g_frame_stats_lock);
+		frame_stats_close(&t);
+		printf("[FrameStats] Too many threads, raise FRAME_STATS_MAX_THREADS\n");
+		return -1;
+	}
+	frame_stats_read_self(&t, &t.last);
+	g_frame_stats_threads[g_frame_stats_num_threads++] = t;
+	pthread_mutex_unlock(&g_frame_stats_lock);
+	return 0;
+}
+
+void frame_stats_unregister()
+{
+	int tid = frame_stats_gettid();
+	pthread_mutex_lock(&g_frame_stats_lock);
+	for (int i = 0; i < g_frame_stats_num_threads; ++i)
+	{
+		if (g_frame_stats_threads[i].tid != tid)
+			continue;
+		frame_stats_close(&g_frame_stats_threads[i]);
+		g_frame_stats_threads[i] = g_frame_stats_threads[--g_frame_stats_num_threads];
+		break;
+	}
+	pthread_mutex_unlock(&g_frame_stats_lock);
+}
+
+int frame_stats_end_frame(struct frame_stats *stats)
+{
+	static char buf[sizeof(struct profile_frame_record)
+		+ FRAME_STATS_MAX_THREADS * sizeof(struct profile_thread_stats)];
+	struct profile_frame_record *record = (struct profile_frame_record *)buf;
+	
+	pthread_mutex_lock(&g_frame_stats_lock);
+	uint64_t now = tsc_ticks();
+	record->frame = g_frame_stats_frame++;
+	record->begin = g_frame_stats_begin ? g_frame_stats_begin : now;
+	record->end = now;
+	record->count = g_frame_stats_num_threads;
+	record->padding = 0;
+	g_frame_stats_begin = now;
+	for (int i = 0; i < g_frame_stats_num_threads; ++i)
+	{
+		struct frame_stats_thread *t = &g_frame_stats_threads[i];
+		struct profile_thread_stats *out = &record->threads[i];
+		struct frame_stats_totals totals;
+		frame_stats_sample(t, &totals);
+		out->tid = t->tid;
+		out->minor_faults = (uint32_t)(totals.minor_faults - t->last.minor_faults);
+		out->major_faults = (uint32_t)(totals.major_faults - t->last.major_faults);
+		out->voluntary_switches =
+			(uint32_t)(totals.voluntary_switches - t->last.voluntary_switches);
+		out->involuntary_switches =
+			(uint32_t)(totals.involuntary_switches - t->last.involuntary_switches);
+		out->migrations = t->perf_fd >= 0 && t->migrations
+			? (uint32_t)(totals.migrations - t->last.migrations) : UINT32_MAX;
+		out->cpu_ns = totals.cpu_ns - t->last.cpu_ns;
+		t->last = totals;
+	}
+	pthread_mutex_unlock(&g_frame_stats_lock);
+	
+	// the trace is optional, so failing to write it is no failure here
+	profile_send(PROFILE_RECORD_FRAME, record,
+		sizeof(*record) + record->count * sizeof(record->threads[0]));
+	if (stats)
+	{
+		stats->frame = record->frame;
+		stats->begin = record->begin;
+		stats->end = record->end;
+		stats->num_threads = record->count;
+		memcpy(stats->threads, record->threads,
+			record->count * sizeof(record->threads[0]));
+	}
+	return 0;
+}
+
+void frame_stats_print(const struct frame_stats *stats)
+{
+	printf("[FrameStats] Frame %llu, %.2f ms:\n", (unsigned long long)stats->frame,
+		tsc_delta_to_ns(stats->end - stats->begin) / 1e6);
+	for (int i = 0; i < stats->num_threads; ++i)
+	{
+		const struct profile_thread_stats *t = &stats->threads[i];
+		printf("  tid %6d: cpu %7.3f ms, faults %4u minor %2u major, "
+			"switches %3u vol %3u invol", t->tid, t->cpu_ns / 1e6,
+			t->minor_faults, t->major_faults, t->voluntary_switches,
+			t->involuntary_switches);
+		if (t->migrations != UINT32_MAX)
+			printf(", %u migrations", t->migrations);
+		printf("\n");
+	}
+}
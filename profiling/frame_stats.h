@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "profile.h"	// for struct profile_thread_stats
+
+// per-frame resource accounting: at every frame boundary, samples how many
+// page faults, context switches and how much CPU time each registered thread
+// took during the frame, so that a spike can be told apart as faulting,
+// preemption or plain work
+// the sampling thread reads its own counters with getrusage(RUSAGE_THREAD);
+// other threads' CPU time comes from their CPU-time clocks, and their faults
+// and switches from /proc/self/task/<tid>, or from software perf events where
+// perf_event_paranoid lets us open them (which also gives us migrations, if
+// it allows kernel events as well)
+
+#define FRAME_STATS_MAX_THREADS	64
+
+struct frame_stats
+{
+	uint64_t frame;
+	uint64_t begin, end;	// in ticks, see tsc.h
+	int num_threads;
+	struct profile_thread_stats threads[FRAME_STATS_MAX_THREADS];
+};
+
+// registers the calling thread for sampling; returns 0 on success
+int frame_stats_register();
+
+// drops the calling thread; must happen before it exits
+void frame_stats_unregister();
+
+// samples all registered threads and fills stats (if not NULL) with what they
+// used since the previous call; the record also goes into the trace, if
+// profiling is on (see profile.h)
+// meant to be called by the thread driving the frames, once per frame
+// returns 0 on success
+int frame_stats_end_frame(struct frame_stats *stats);
+
+// one line per thread
+void frame_stats_print(const struct frame_stats *stats);
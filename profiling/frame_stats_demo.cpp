@@ -0,0 +1,133 @@
+// Per-frame resource accounting demo: a worker that faults in fresh memory
+// every few frames, a thread that keeps blocking, and an unregistered CPU hog
+// preempting them, so that each shows up in its own column
+// To build:	make
+// To run:	./frame_stats_demo [trace.prof] && ./profile_convert trace.prof trace.json
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>	// for mmap()
+
+#include "frame_stats.h"
+
+#define NUM_FRAMES		20
+#define FRAME_MS		16
+#define FAULT_SIZE		(8 << 20)
+
+static volatile bool g_exit = false;
+static volatile unsigned g_sink;
+
+
+// ============================================================================
+
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+	nanosleep(&ts, NULL);
+}
+
+static void busy_ms(int ms)
+{
+	struct timespec start, now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do
+	{
+		++g_sink;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 < ms);
+}
+
+// touches fresh memory every 5th time round: every page of it faults (with
+// transparent huge pages off, else it would only be a handful of faults)
+static void *faulting_worker(void *arg)
+{
+	(void)arg;
+	profile_thread_name("faulting");
+	frame_stats_register();
+	for (int i = 0; !g_exit; ++i)
+	{
+		if (i % 5 == 0)
+		{
+			char *p = (char *)mmap(NULL, FAULT_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p != MAP_FAILED)
+			{
+				madvise(p, FAULT_SIZE, MADV_NOHUGEPAGE);
+				memset(p, i, FAULT_SIZE);
+				g_sink = p[FAULT_SIZE / 2];
+				munmap(p, FAULT_SIZE);
+			}
+		}
+		busy_ms(2);
+		sleep_ms(FRAME_MS - 2);
+	}
+	frame_stats_unregister();
+	return NULL;
+}
+
+// keeps going to sleep: voluntary switches
+static void *blocking_worker(void *arg)
+{
+	(void)arg;
+	profile_thread_name("blocking");
+	frame_stats_register();
+	while (!g_exit)
+		sleep_ms(1);
+	frame_stats_unregister();
+	return NULL;
+}
+
+// competes for the CPU without being accounted for: involuntary switches
+static void *hog(void *arg)
+{
+	(void)arg;
+	while (!g_exit)
+		++g_sink;
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : "trace.prof";
+	if (profile_init_file(path, PROFILE_CAT_ALL, 50) != 0)
+		return 1;
+	profile_thread_name("main");
+	frame_stats_register();
+	
+	pthread_t threads[3];
+	pthread_create(&threads[0], NULL, faulting_worker, NULL);
+	pthread_create(&threads[1], NULL, blocking_worker, NULL);
+	pthread_create(&threads[2], NULL, hog, NULL);
+	
+	frame_stats_end_frame(NULL);	// starts the first frame
+	struct frame_stats stats;
+	uint64_t sample_ns = UINT64_MAX;
+	for (int frame = 0; frame < NUM_FRAMES; ++frame)
+	{
+		{
+			ZONE_CAT("frame", PROFILE_CAT_FRAME);
+			busy_ms(FRAME_MS / 2);
+			sleep_ms(FRAME_MS / 2);
+		}
+		uint64_t start = tsc_ticks();
+		frame_stats_end_frame(&stats);
+		uint64_t ns = tsc_delta_to_ns(tsc_ticks() - start);
+		sample_ns = ns < sample_ns ? ns : sample_ns;
+		frame_stats_print(&stats);
+	}
+	// the best case, as the hog preempts us at times
+	printf("Sampling cost: %.1f us per frame for %d threads\n", sample_ns / 1e3,
+		stats.num_threads);
+	
+	g_exit = true;
+	for (int i = 0; i < 3; ++i)
+		pthread_join(threads[i], NULL);
+	frame_stats_unregister();
+	profile_shutdown();
+	printf("Trace written to %s\n", path);
+	return 0;
+}
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>			// for open()
+#include <pthread.h>
+#include <unistd.h>			// for write() and syscall()
+#include <sys/syscall.h>	// for SYS_gettid
+
+#include "profile.h"
+
+// events converted per write()
+#define PROFILE_WRITE_BATCH		1024
+
+// zone names already sent; open addressing on the name pointer
+#define PROFILE_MAX_NAMES		4096
+
+uint32_t g_profile_categories = 0;
+__thread struct profile_buffer *t_profile_buffer = NULL;
+
+// guards everything below, and serializes flushes
+static pthread_mutex_t g_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct profile_buffer *g_profile_buffers = NULL;
+static int g_profile_fd = -1;
+static uint64_t g_profile_dropped = 0;
+static const char *g_profile_names[PROFILE_MAX_NAMES];
+static int g_profile_num_names = 0;
+
+// flush thread
+static pthread_t g_profile_thread;
+static bool g_profile_thread_running = false;
+static volatile bool g_profile_exit = false;
+static int g_profile_flush_ms = 0;
+
+// marks the buffer of an exiting thread for disposal
+static pthread_key_t g_profile_key;
+static pthread_once_t g_profile_key_once = PTHREAD_ONCE_INIT;
+
+static const char *g_category_names[PROFILE_NUM_CATEGORIES] =
+{
+	"frame", "jobs", "render", "streaming", "user"
+};
+
+
+// ============================================================================
+
+
+static int profile_write(const void *data, size_t size)
+{
+	const char *p = (const char *)data;
+	while (size > 0)
+	{
+		ssize_t written = write(g_profile_fd, p, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += written;
+		size -= written;
+	}
+	return 0;
+}
+
+static int profile_write_record(uint32_t type, const void *payload, size_t size)
+{
+	struct profile_record_header header = {type, (uint32_t)size};
+	if (profile_write(&header, sizeof(header)) != 0)
+		return -1;
+	return profile_write(payload, size);
+}
+
+// sends the name the first time we see it; returns -1 on a write error
+static int profile_send_name(const char *name)
+{
+	size_t slot = ((uintptr_t)name >> 3) % PROFILE_MAX_NAMES;
+	for (size_t i = 0; i < PROFILE_MAX_NAMES; ++i, slot = (slot + 1) % PROFILE_MAX_NAMES)
+	{
+		if (g_profile_names[slot] == name)
+			return 0;
+		if (!g_profile_names[slot])
+			break;
+	}
+	// when full, we simply keep resending names, the converter doesn't mind
+	if (g_profile_num_names < PROFILE_MAX_NAMES * 3 / 4)
+	{
+		g_profile_names[slot] = name;
+		++g_profile_num_names;
+	}
+	
+	char buf[sizeof(struct profile_name_record) + 256];
+	struct profile_name_record *record = (struct profile_name_record *)buf;
+	record->id = (uintptr_t)name;
+	size_t len = strnlen(name, 255);
+	memcpy(record->name, name, len);
+	record->name[len] = 0;
+	return profile_write_record(PROFILE_RECORD_NAME, buf,
+		sizeof(*record) + len + 1);
+}
+
+static int profile_send_thread(struct profile_buffer *buf)
+{
+	struct profile_thread_record record;
+	memset(&record, 0, sizeof(record));
+	record.tid = buf->tid;
+	memcpy(record.name, buf->name, sizeof(record.name));
+	return profile_write_record(PROFILE_RECORD_THREAD, &record, sizeof(record));
+}
+
+// drains one buffer; returns the number of events written, or -1
+static int profile_drain(struct profile_buffer *buf)
+{
+	static char chunk[sizeof(struct profile_events_record)
+		+ PROFILE_WRITE_BATCH * sizeof(((struct profile_events_record *)0)->events[0])];
+	struct profile_events_record *record = (struct profile_events_record *)chunk;
+	int total = 0;
+	
+	uint64_t tail = buf->tail;
+	uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+	uint64_t dropped = __atomic_exchange_n(&buf->dropped, 0, __ATOMIC_RELAXED);
+	g_profile_dropped += dropped;
+	while (tail != head || dropped)
+	{
+		record->tid = buf->tid;
+		record->dropped = dropped;
+		record->count = 0;
+		dropped = 0;
+		for (; tail != head && record->count < PROFILE_WRITE_BATCH; ++tail)
+		{
+			const struct profile_event *event = &buf->events[tail % PROFILE_BUFFER_EVENTS];
+			if (profile_send_name(event->name) != 0)
+				return -1;
+			record->events[record->count].name_id = (uintptr_t)event->name;
+			record->events[record->count].category = event->category;
+			record->events[record->count].padding = 0;
+			record->events[record->count].begin = event->begin;
+			record->events[record->count].end = event->end;
+			++record->count;
+		}
+		// hand the slots back before the (possibly slow) write
+		__atomic_store_n(&buf->tail, tail, __ATOMIC_RELEASE);
+		if (profile_write_record(PROFILE_RECORD_EVENTS, record,
+			sizeof(*record) + record->count * sizeof(record->events[0])) != 0)
+			return -1;
+		total += record->count;
+	}
+	return total;
+}
+
+static void profile_thread_exit(void *arg)
+{
+	struct profile_buffer *buf = (struct profile_buffer *)arg;
+	pthread_mutex_lock(&g_profile_lock);
+	__atomic_store_n(&buf->exited, true, __ATOMIC_RELEASE);
+	bool output = g_profile_fd >= 0;
+	pthread_mutex_unlock(&g_profile_lock);
+	// without an output there may be nobody flushing anymore to free it
+	if (!output)
+		profile_flush();
+}
+
+static void profile_create_key()
+{
+	pthread_key_create(&g_profile_key, profile_thread_exit);
+}
+
+static void *profile_flush_thread(void *arg)
+{
+	(void)arg;
+	pthread_setname_np(pthread_self(), "profile");
+	while (!g_profile_exit)
+	{
+		struct timespec ts = {g_profile_flush_ms / 1000,
+			(g_profile_flush_ms % 1000) * 1000000L};
+		nanosleep(&ts, NULL);
+		if (profile_flush() < 0)
+		{
+			printf("[Profile] Failed to write the trace: %s\n", strerror(errno));
+			break;
+		}
+	}
+	return NULL;
+}
+
+// ============================================================================
+
+
+struct profile_buffer *profile_register_thread()
+{
+	pthread_once(&g_profile_key_once, profile_create_key);
+	
+	struct profile_buffer *buf = (struct profile_buffer *)calloc(1, sizeof(*buf));
+	if (!buf)
+		abort();
+	// prefault it, page faults are way more expensive than the zones themselves
+	memset(buf, 0, sizeof(*buf));
+	buf->tid = (int)syscall(SYS_gettid);
+	pthread_getname_np(pthread_self(), buf->name, sizeof(buf->name));
+	pthread_setspecific(g_profile_key, buf);
+	
+	pthread_mutex_lock(&g_profile_lock);
+	buf->next = g_profile_buffers;
+	g_profile_buffers = buf;
+	if (g_profile_fd >= 0)
+		profile_send_thread(buf);
+	pthread_mutex_unlock(&g_profile_lock);
+	
+	t_profile_buffer = buf;
+	return buf;
+}
+
+int profile_init(int fd, uint32_t categories, int flush_ms)
+{
+	pthread_mutex_lock(&g_profile_lock);
+	if (g_profile_fd >= 0)
+	{
+		pthread_mutex_unlock(&g_profile_lock);
+		errno = EBUSY;
+		return -1;
+	}
+	
+	struct profile_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PROFILE_MAGIC, sizeof(header.magic));
+	tsc_init();
+	header.ticks_per_us = g_tsc.ticks_per_ns * 1000;
+	header.base_ticks = profile_ticks();
+	header.pid = getpid();
+	g_profile_fd = fd;
+	if (profile_write(&header, sizeof(header)) != 0)
+	{
+		g_profile_fd = -1;
+		pthread_mutex_unlock(&g_profile_lock);
+		return -1;
+	}
+	// threads that registered before (say, across a restart of profiling)
+	memset(g_profile_names, 0, sizeof(g_profile_names));
+	g_profile_num_names = 0;
+	for (struct profile_buffer *buf = g_profile_buffers; buf; buf = buf->next)
+		profile_send_thread(buf);
+	pthread_mutex_unlock(&g_profile_lock);
+	
+	printf("[Profile] Tracing at %.1f ticks/us, categories 0x%x\n",
+		header.ticks_per_us, categories);
+	profile_enable(categories);
+	
+	if (flush_ms > 0)
+	{
+		g_profile_flush_ms = flush_ms;
+		g_profile_exit = false;
+		g_profile_thread_running =
+			pthread_create(&g_profile_thread, NULL, profile_flush_thread, NULL) == 0;
+		if (!g_profile_thread_running)
+			printf("[Profile] Failed to start the flush thread, "
+				"call profile_flush() yourself\n");
+	}
+	return 0;
+}
+
+int profile_init_file(const char *path, uint32_t categories, int flush_ms)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		printf("[Profile] Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (profile_init(fd, categories, flush_ms) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+void profile_shutdown()
+{
+	profile_enable(0);
+	if (g_profile_thread_running)
+	{
+		g_profile_exit = true;
+		pthread_join(g_profile_thread, NULL);
+		g_profile_thread_running = false;
+	}
+	profile_flush();
+	
+	pthread_mutex_lock(&g_profile_lock);
+	if (g_profile_fd >= 0)
+		close(g_profile_fd);
+	g_profile_fd = -1;
+	if (g_profile_dropped)
+		printf("[Profile] %llu events dropped, flush more often\n",
+			(unsigned long long)g_profile_dropped);
+	pthread_mutex_unlock(&g_profile_lock);
+}
+
+void profile_enable(uint32_t categories)
+{
+	__atomic_store_n(&g_profile_categories, categories, __ATOMIC_RELAXED);
+}
+
+int profile_flush()
+{
+	pthread_mutex_lock(&g_profile_lock);
+	// without an output, the events are dropped, but exited threads' buffers
+	// still need freeing
+	bool output = g_profile_fd >= 0;
+	int total = 0;
+	struct profile_buffer **link = &g_profile_buffers;
+	while (*link)
+	{
+		struct profile_buffer *buf = *link;
+		// check before draining, so that nothing recorded before exiting is lost
+		bool exited = __atomic_load_n(&buf->exited, __ATOMIC_ACQUIRE);
+		int count = output ? profile_drain(buf) : 0;
+		if (count < 0)
+		{
+			total = -1;
+			break;
+		}
+		total += count;
+		if (exited)
+		{
+			*link = buf->next;
+			free(buf);
+		}
+		else
+			link = &buf->next;
+	}
+	pthread_mutex_unlock(&g_profile_lock);
+	return total;
+}
+
+int profile_send(uint32_t type, const void *payload, size_t size)
+{
+	pthread_mutex_lock(&g_profile_lock);
+	int retval = g_profile_fd >= 0 ? profile_write_record(type, payload, size) : -1;
+	pthread_mutex_unlock(&g_profile_lock);
+	return retval;
+}
+
+void profile_thread_name(const char *name)
+{
+	struct profile_buffer *buf = t_profile_buffer;
+	if (!buf)
+		buf = profile_register_thread();
+	pthread_mutex_lock(&g_profile_lock);
+	snprintf(buf->name, sizeof(buf->name), "%s", name);
+	if (g_profile_fd >= 0)
+		profile_send_thread(buf);
+	pthread_mutex_unlock(&g_profile_lock);
+}
+
+uint64_t profile_dropped()
+{
+	pthread_mutex_lock(&g_profile_lock);
+	uint64_t dropped = g_profile_dropped;
+	for (struct profile_buffer *buf = g_profile_buffers; buf; buf = buf->next)
+		dropped += __atomic_load_n(&buf->dropped, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&g_profile_lock);
+	return dropped;
+}
+
+const char *profile_category_name(uint32_t category)
+{
+	for (int i = 0; i < PROFILE_NUM_CATEGORIES; ++i)
+	{
+		if (category & (1u << i))
+			return g_category_names[i];
+	}
+	return "unknown";
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <stddef.h>	// for size_t
+#include <stdint.h>
+
+#include "tsc.h"
+
+// hot path instrumentation: ZONE("name") at the top of a scope records when
+// the scope was entered and left into a buffer of the calling thread, which
+// profile_flush() drains into a file or a pipe; profile_convert turns that
+// into Chrome Trace Event JSON, for chrome://tracing or ui.perfetto.dev
+// recording a zone is two TSC reads and a store into a thread-local ring, with
+// no locks or atomic read-modify-writes; a disabled zone costs one predictable
+// branch on each end, and defining PROFILE_DISABLED compiles them out entirely
+
+// events buffered per thread between flushes; on overflow, new events get
+// dropped (and counted) rather than blocking the thread
+#define PROFILE_BUFFER_EVENTS	16384
+
+// max length of a thread name, as per pthread_setname_np()
+#define PROFILE_THREAD_NAME		16
+
+// zone categories, for filtering with profile_enable()
+enum profile_category
+{
+	PROFILE_CAT_FRAME		= 1 << 0,	// the game loop itself
+	PROFILE_CAT_JOBS		= 1 << 1,
+	PROFILE_CAT_RENDER		= 1 << 2,
+	PROFILE_CAT_STREAMING	= 1 << 3,
+	PROFILE_CAT_USER		= 1 << 4,	// anything else
+	PROFILE_NUM_CATEGORIES	= 5,
+	PROFILE_CAT_ALL			= (1 << PROFILE_NUM_CATEGORIES) - 1
+};
+
+// a single completed zone
+struct profile_event
+{
+	const char *name;	// must be a string literal, or live as long
+	uint32_t category;
+	uint32_t padding;
+	uint64_t begin, end;	// in ticks, see profile_ticks()
+};
+
+// per-thread single producer, single consumer ring
+struct profile_buffer
+{
+	uint64_t head;		// written by the owning thread only
+	uint64_t tail;		// written by profile_flush() only
+	uint64_t dropped;
+	int tid;
+	bool exited;		// the buffer goes away once drained
+	char name[PROFILE_THREAD_NAME];
+	struct profile_buffer *next;
+	struct profile_event events[PROFILE_BUFFER_EVENTS];
+};
+
+// mask of enabled categories; 0 while profiling is off
+extern uint32_t g_profile_categories;
+
+extern __thread struct profile_buffer *t_profile_buffer;
+
+// ============================================================================
+// file format
+// a profile_file_header, followed by records, each a profile_record_header and
+// size bytes of payload; all little-endian, as written by the game
+
+#define PROFILE_MAGIC		"ZONEPRF1"
+
+struct profile_file_header
+{
+	char magic[8];
+	double ticks_per_us;
+	uint64_t base_ticks;	// ticks at profile_init(), i.e. time 0 in the trace
+	int32_t pid;
+	uint32_t padding;
+};
+
+enum profile_record_type
+{
+	PROFILE_RECORD_THREAD = 1,	// struct profile_thread_record
+	PROFILE_RECORD_NAME,		// struct profile_name_record
+	PROFILE_RECORD_EVENTS,		// struct profile_events_record
+	PROFILE_RECORD_FRAME,		// struct profile_frame_record, see frame_stats.h
+	PROFILE_RECORD_COUNTERS		// struct profile_counters_record, see counters.h
+};
+
+struct profile_record_header
+{
+	uint32_t type;
+	uint32_t size;
+};
+
+struct profile_thread_record
+{
+	int32_t tid;
+	char name[PROFILE_THREAD_NAME];
+};
+
+// each zone name is sent once, the first time an event refers to it
+struct profile_name_record
+{
+	uint64_t id;
+	char name[];	// NUL-terminated
+};
+
+struct profile_events_record
+{
+	int32_t tid;
+	uint32_t count;
+	uint64_t dropped;	// since the last record of this thread
+	struct
+	{
+		uint64_t name_id;
+		uint32_t category;
+		uint32_t padding;
+		uint64_t begin, end;
+	} events[];
+};
+
+// resource usage of a thread over a frame
+struct profile_thread_stats
+{
+	int32_t tid;
+	uint32_t minor_faults;
+	uint32_t major_faults;
+	uint32_t voluntary_switches;	// blocked, e.g. on I/O or a lock
+	uint32_t involuntary_switches;	// preempted
+	uint32_t migrations;			// UINT32_MAX if unknown
+	uint64_t cpu_ns;
+};
+
+struct profile_frame_record
+{
+	uint64_t frame;
+	uint64_t begin, end;	// in ticks
+	uint32_t count;
+	uint32_t padding;
+	struct profile_thread_stats threads[];
+};
+
+// perf counters of all threads of a role over a frame, indexed by enum
+// counter_id; valid has a bit set for each counter that could be opened
+#define PROFILE_MAX_COUNTERS	16
+
+struct profile_counters_entry
+{
+	int32_t role;
+	uint32_t valid;
+	uint64_t values[PROFILE_MAX_COUNTERS];
+};
+
+struct profile_counters_record
+{
+	uint64_t frame;
+	uint64_t begin, end;	// in ticks
+	uint32_t count;
+	uint32_t padding;
+	struct profile_counters_entry roles[];
+};
+
+// ============================================================================
+
+// initializes profiling (and the clock, see tsc_init()) into given file
+// descriptor (a file, or a pipe to another process that stores or converts the
+// trace) with given categories enabled; the descriptor is ours until
+// profile_shutdown()
+// flush_ms > 0 starts a thread that flushes every so often; otherwise call
+// profile_flush() yourself, e.g. once a frame
+// returns 0 on success
+int profile_init(int fd, uint32_t categories, int flush_ms);
+
+// opens (truncating) path and profiles into it
+int profile_init_file(const char *path, uint32_t categories, int flush_ms);
+
+// flushes what's left, stops the flush thread and closes the descriptor
+void profile_shutdown();
+
+// runtime switch and filter; 0 turns profiling off
+void profile_enable(uint32_t categories);
+
+// writes out all buffered events; safe to call from any thread
+// returns the number of events written, or -1 on a write error
+int profile_flush();
+
+// writes a record of given type into the trace, e.g. PROFILE_RECORD_FRAME;
+// returns 0 on success, -1 if profiling is off or on a write error
+int profile_send(uint32_t type, const void *payload, size_t size);
+
+// names the calling thread in the trace; by default, the pthread name is used
+void profile_thread_name(const char *name);
+
+// total number of events dropped because a buffer was full
+uint64_t profile_dropped();
+
+const char *profile_category_name(uint32_t category);
+
+// ============================================================================
+// hot path
+
+// raw timestamp, see tsc.h
+static inline uint64_t profile_ticks()
+{
+	return tsc_ticks();
+}
+
+// allocates and registers the calling thread's buffer
+struct profile_buffer *profile_register_thread();
+
+static inline void profile_record(const char *name, uint32_t category,
+	uint64_t begin, uint64_t end)
+{
+	struct profile_buffer *buf = t_profile_buffer;
+	if (__builtin_expect(!buf, 0))
+		buf = profile_register_thread();
+	uint64_t head = buf->head;
+	if (head - __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE) >= PROFILE_BUFFER_EVENTS)
+	{
+		__atomic_add_fetch(&buf->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	struct profile_event *event = &buf->events[head % PROFILE_BUFFER_EVENTS];
+	event->name = name;
+	event->category = category;
+	event->begin = begin;
+	event->end = end;
+	__atomic_store_n(&buf->head, head + 1, __ATOMIC_RELEASE);
+}
+
+struct profile_zone
+{
+	const char *name;
+	uint32_t category;
+	uint64_t begin;	// 0 if the category was off when we entered
+	
+	profile_zone(const char *name, uint32_t category)
+	{
+		if (!(g_profile_categories & category))
+		{
+			begin = 0;
+			return;
+		}
+		this->name = name;
+		this->category = category;
+		begin = profile_ticks();
+	}
+	
+	~profile_zone()
+	{
+		if (begin)
+			profile_record(name, category, begin, profile_ticks());
+	}
+};
+
+#define PROFILE_CONCAT2(a, b)	a##b
+#define PROFILE_CONCAT(a, b)	PROFILE_CONCAT2(a, b)
+
+#ifndef PROFILE_DISABLED
+	#define ZONE_CAT(name, category)	\
+		profile_zone PROFILE_CONCAT(profile_zone_, __LINE__)(name, category)
+#else
+	#define ZONE_CAT(name, category)	do {} while (0)
+#endif
+#define ZONE(name)	ZONE_CAT(name, PROFILE_CAT_USER)
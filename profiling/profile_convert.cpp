@@ -0,0 +1,319 @@
+// Converts a trace written by profile_init() into Chrome Trace Event JSON,
+// which chrome://tracing and ui.perfetto.dev both open
+// To build:	make
+// To run:	./profile_convert trace.prof trace.json
+// Either file may be -, for stdin or stdout, e.g. to convert a trace streamed
+// through a pipe as the game runs
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "profile.h"
+#include "counters.h"	// for enum counter_id
+
+#define MAX_NAMES		65536	// power of two
+#define MAX_NAME_LENGTH	256
+#define MAX_THREADS		1024
+
+struct name_entry
+{
+	uint64_t id;
+	char name[MAX_NAME_LENGTH];
+};
+
+struct thread_entry
+{
+	int tid;
+	char name[PROFILE_THREAD_NAME + 1];
+};
+
+static struct name_entry g_names[MAX_NAMES];
+static struct thread_entry g_threads[MAX_THREADS];
+static int g_num_threads = 0;
+static double g_ticks_per_us;
+static uint64_t g_base_ticks;
+static int g_pid;
+static bool g_first = true;
+static unsigned long long g_num_events = 0;
+static unsigned long long g_num_dropped = 0;
+static unsigned long long g_num_frames = 0;
+
+
+// ============================================================================
+
+
+static struct name_entry *find_name(uint64_t id, bool insert)
+{
+	size_t slot = (id >> 3) & (MAX_NAMES - 1);
+	for (size_t i = 0; i < MAX_NAMES; ++i, slot = (slot + 1) & (MAX_NAMES - 1))
+	{
+		if (g_names[slot].id == id)
+			return &g_names[slot];
+		if (!g_names[slot].id)
+		{
+			if (!insert)
+				return NULL;
+			g_names[slot].id = id;
+			return &g_names[slot];
+		}
+	}
+	return NULL;
+}
+
+// name of the thread for counter tracks, or its tid if we don't know it
+static const char *thread_name(int tid, char *buf, size_t size)
+{
+	for (int i = 0; i < g_num_threads; ++i)
+	{
+		if (g_threads[i].tid == tid && g_threads[i].name[0])
+			return g_threads[i].name;
+	}
+	snprintf(buf, size, "%d", tid);
+	return buf;
+}
+
+static void print_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; ++s)
+	{
+		if (*s == '"' || *s == '\\')
+			fprintf(out, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(out, "\\u%04x", *s);
+		else
+			fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+static void begin_event(FILE *out)
+{
+	fputs(g_first ? "\n" : ",\n", out);
+	g_first = false;
+}
+
+static void convert_thread(FILE *out, const struct profile_thread_record *thread)
+{
+	char name[PROFILE_THREAD_NAME + 1];
+	memcpy(name, thread->name, PROFILE_THREAD_NAME);
+	name[PROFILE_THREAD_NAME] = 0;
+	int i = 0;
+	while (i < g_num_threads && g_threads[i].tid != thread->tid)
+		++i;
+	if (i < MAX_THREADS)
+	{
+		g_threads[i].tid = thread->tid;
+		memcpy(g_threads[i].name, name, sizeof(name));
+		if (i == g_num_threads)
+			++g_num_threads;
+	}
+	begin_event(out);
+	fprintf(out, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+		"\"tid\": %d, \"args\": {\"name\": ", g_pid, thread->tid);
+	print_string(out, name[0] ? name : "unnamed");
+	fputs("}}", out);
+}
+
+static void convert_events(FILE *out, const struct profile_events_record *record,
+	size_t size)
+{
+	size_t count = (size - sizeof(*record)) / sizeof(record->events[0]);
+	if (count > record->count)
+		count = record->count;
+	if (record->dropped)
+	{
+		g_num_dropped += record->dropped;
+		// mark where the gap is
+		double ts = count ? (record->events[0].begin - g_base_ticks) / g_ticks_per_us : 0;
+		begin_event(out);
+		fprintf(out, "{\"name\": \"%llu events dropped\", \"ph\": \"i\", "
+			"\"s\": \"t\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+			(unsigned long long)record->dropped, ts, g_pid, record->tid);
+	}
+	for (size_t i = 0; i < count; ++i)
+	{
+		const struct name_entry *name = find_name(record->events[i].name_id, false);
+		begin_event(out);
+		fputs("{\"name\": ", out);
+		print_string(out, name ? name->name : "?");
+		fprintf(out, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+			"\"dur\": %.3f, \"pid\": %d, \"tid\": %d}",
+			profile_category_name(record->events[i].category),
+			(record->events[i].begin - g_base_ticks) / g_ticks_per_us,
+			(record->events[i].end - record->events[i].begin) / g_ticks_per_us,
+			g_pid, record->tid);
+	}
+	g_num_events += count;
+}
+
+// starts a counter event, up to the opening brace of its values
+static void begin_counter(FILE *out, const char *thread, const char *counter,
+	double ts)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "%s %s", thread, counter);
+	begin_event(out);
+	fputs("{\"name\": ", out);
+	print_string(out, name);
+	fprintf(out, ", \"ph\": \"C\", \"ts\": %.3f, \"pid\": %d, \"args\": {",
+		ts, g_pid);
+}
+
+// per-thread counter tracks, with the values of the frame
+static void convert_frame(FILE *out, const struct profile_frame_record *record,
+	size_t size)
+{
+	size_t count = (size - sizeof(*record)) / sizeof(record->threads[0]);
+	if (count > record->count)
+		count = record->count;
+	double ts = (record->begin - g_base_ticks) / g_ticks_per_us;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const struct profile_thread_stats *t = &record->threads[i];
+		char buf[16];
+		const char *thread = thread_name(t->tid, buf, sizeof(buf));
+		begin_counter(out, thread, "cpu ms", ts);
+		fprintf(out, "\"cpu\": %.3f}}", t->cpu_ns / 1e6);
+		begin_counter(out, thread, "faults", ts);
+		fprintf(out, "\"minor\": %u, \"major\": %u}}", t->minor_faults,
+			t->major_faults);
+		begin_counter(out, thread, "switches", ts);
+		fprintf(out, "\"voluntary\": %u, \"involuntary\": %u",
+			t->voluntary_switches, t->involuntary_switches);
+		if (t->migrations != UINT32_MAX)
+			fprintf(out, ", \"migrations\": %u", t->migrations);
+		fputs("}}", out);
+	}
+	++g_num_frames;
+}
+
+// per-role counter tracks: IPC, miss rates and time on the CPU
+static void convert_counters(FILE *out, const struct profile_counters_record *record,
+	size_t size)
+{
+	size_t count = (size - sizeof(*record)) / sizeof(record->roles[0]);
+	if (count > record->count)
+		count = record->count;
+	double ts = (record->begin - g_base_ticks) / g_ticks_per_us;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const struct profile_counters_entry *entry = &record->roles[i];
+		struct counter_values values;
+		values.valid = entry->valid;
+		memcpy(values.values, entry->values, sizeof(values.values));
+		const char *role = thread_role_name(entry->role);
+		if (values.valid & (1u << COUNTER_INSTRUCTIONS))
+		{
+			begin_counter(out, role, "ipc", ts);
+			fprintf(out, "\"ipc\": %.3f}}", counters_ipc(&values));
+			begin_counter(out, role, "miss %", ts);
+			fprintf(out, "\"cache\": %.3f, \"branch\": %.3f}}",
+				counters_cache_miss_rate(&values) * 100,
+				counters_branch_miss_rate(&values) * 100);
+		}
+		if (values.valid & (1u << COUNTER_TASK_CLOCK))
+		{
+			begin_counter(out, role, "task ms", ts);
+			fprintf(out, "\"task\": %.3f}}", values.values[COUNTER_TASK_CLOCK] / 1e6);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "Usage: %s <trace.prof|-> <trace.json|->\n", argv[0]);
+		return 1;
+	}
+	FILE *in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+	if (!in)
+	{
+		fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	FILE *out = strcmp(argv[2], "-") == 0 ? stdout : fopen(argv[2], "w");
+	if (!out)
+	{
+		fprintf(stderr, "Failed to open %s: %s\n", argv[2], strerror(errno));
+		return 1;
+	}
+	
+	struct profile_file_header header;
+	if (fread(&header, sizeof(header), 1, in) != 1
+		|| memcmp(header.magic, PROFILE_MAGIC, sizeof(header.magic)) != 0
+		|| header.ticks_per_us <= 0)
+	{
+		fprintf(stderr, "%s is not a trace\n", argv[1]);
+		return 1;
+	}
+	g_ticks_per_us = header.ticks_per_us;
+	g_base_ticks = header.base_ticks;
+	g_pid = header.pid;
+	
+	fputs("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [", out);
+	
+	// the largest record is an events one, see PROFILE_WRITE_BATCH in profile.cpp
+	size_t capacity = 1 << 16;
+	char *payload = (char *)malloc(capacity);
+	struct profile_record_header record;
+	while (fread(&record, sizeof(record), 1, in) == 1)
+	{
+		if (record.size > capacity)
+		{
+			capacity = record.size;
+			payload = (char *)realloc(payload, capacity);
+		}
+		// a truncated record means the game died mid-write; keep what we have
+		if (fread(payload, 1, record.size, in) != record.size)
+			break;
+		
+		switch (record.type)
+		{
+			case PROFILE_RECORD_THREAD:
+				if (record.size >= sizeof(struct profile_thread_record))
+					convert_thread(out, (const struct profile_thread_record *)payload);
+				break;
+			case PROFILE_RECORD_NAME:
+				if (record.size > sizeof(struct profile_name_record))
+				{
+					const struct profile_name_record *name =
+						(const struct profile_name_record *)payload;
+					struct name_entry *entry = find_name(name->id, true);
+					if (entry)
+						snprintf(entry->name, sizeof(entry->name), "%.*s",
+							(int)(record.size - sizeof(*name)), name->name);
+				}
+				break;
+			case PROFILE_RECORD_EVENTS:
+				if (record.size >= sizeof(struct profile_events_record))
+					convert_events(out, (const struct profile_events_record *)payload,
+						record.size);
+				break;
+			case PROFILE_RECORD_FRAME:
+				if (record.size >= sizeof(struct profile_frame_record))
+					convert_frame(out, (const struct profile_frame_record *)payload,
+						record.size);
+				break;
+			case PROFILE_RECORD_COUNTERS:
+				if (record.size >= sizeof(struct profile_counters_record))
+					convert_counters(out,
+						(const struct profile_counters_record *)payload, record.size);
+				break;
+			default:
+				// newer record types are skipped
+				break;
+		}
+	}
+	free(payload);
+	
+	fputs("\n]}\n", out);
+	if (out != stdout)
+		fclose(out);
+	fprintf(stderr, "%llu events and %llu frames converted, %llu events dropped\n",
+		g_num_events, g_num_frames, g_num_dropped);
+	return 0;
+}
@@ -0,0 +1,152 @@
+// Instrumentation zones demo: measures the cost of a zone, then records a few
+// frames of a make-believe game with a couple of worker threads
+// To build:	make
+// To run:	./profile_demo [trace.prof] && ./profile_convert trace.prof trace.json
+// and open trace.json in chrome://tracing or ui.perfetto.dev
+
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "profile.h"
+
+#define NUM_WORKERS		2
+#define NUM_FRAMES		60
+#define COST_ZONES		100000
+
+static volatile unsigned g_sink;
+static volatile bool g_exit = false;
+static pthread_barrier_t g_frame_start, g_frame_end;
+
+
+// ============================================================================
+
+
+static double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void busy(int us)
+{
+	double until = now_ns() + us * 1000.0;
+	while (now_ns() < until)
+		++g_sink;
+}
+
+// cost of a timestamp, which is the bulk of a zone; reading the TSC takes
+// about 7 ns on bare metal, but may well be several times that in a VM
+static double ticks_cost()
+{
+	uint64_t sum = 0;
+	double start = now_ns();
+	for (int i = 0; i < COST_ZONES; ++i)
+		sum += profile_ticks();
+	g_sink = (unsigned)sum;
+	return (now_ns() - start) / COST_ZONES;
+}
+
+// average cost of an empty zone, in ns
+static double zone_cost()
+{
+	double elapsed = 0;
+	for (int batch = 0; batch < COST_ZONES / 10000; ++batch)
+	{
+		double start = now_ns();
+		for (int i = 0; i < 10000; ++i)
+		{
+			ZONE_CAT("empty", PROFILE_CAT_USER);
+			++g_sink;
+		}
+		elapsed += now_ns() - start;
+		// keep the buffer from overflowing, outside of the measurement
+		profile_flush();
+	}
+	return elapsed / COST_ZONES;
+}
+
+static void *worker(void *arg)
+{
+	char name[16];
+	snprintf(name, sizeof(name), "worker %d", (int)(size_t)arg);
+	profile_thread_name(name);
+	for (;;)
+	{
+		pthread_barrier_wait(&g_frame_start);
+		if (g_exit)
+			break;
+		{
+			ZONE_CAT("animation", PROFILE_CAT_JOBS);
+			for (int i = 0; i < 4; ++i)
+			{
+				ZONE_CAT("skin", PROFILE_CAT_JOBS);
+				busy(300);
+			}
+		}
+		pthread_barrier_wait(&g_frame_end);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : "trace.prof";
+	if (profile_init_file(path, PROFILE_CAT_ALL, 10) != 0)
+		return 1;
+	
+	printf("Timestamp:     %.1f ns\n", ticks_cost());
+	profile_enable(0);
+	double cost = 0;
+	for (int i = 0; i < 5; ++i)
+		cost += zone_cost() / 5;
+	printf("Disabled zone: %.1f ns\n", cost);
+	profile_enable(PROFILE_CAT_ALL);
+	cost = 0;
+	for (int i = 0; i < 5; ++i)
+		cost += zone_cost() / 5;
+	printf("Enabled zone:  %.1f ns\n", cost);
+	profile_enable(PROFILE_CAT_ALL & ~PROFILE_CAT_USER);
+	cost = 0;
+	for (int i = 0; i < 5; ++i)
+		cost += zone_cost() / 5;
+	printf("Filtered zone: %.1f ns\n", cost);
+	
+	// now a few frames worth of a timeline
+	profile_thread_name("main");
+	pthread_barrier_init(&g_frame_start, NULL, NUM_WORKERS + 1);
+	pthread_barrier_init(&g_frame_end, NULL, NUM_WORKERS + 1);
+	pthread_t workers[NUM_WORKERS];
+	for (int i = 0; i < NUM_WORKERS; ++i)
+		pthread_create(&workers[i], NULL, worker, (void *)(size_t)i);
+	for (int frame = 0; frame < NUM_FRAMES; ++frame)
+	{
+		ZONE_CAT("frame", PROFILE_CAT_FRAME);
+		{
+			ZONE_CAT("input", PROFILE_CAT_FRAME);
+			busy(200);
+		}
+		pthread_barrier_wait(&g_frame_start);
+		{
+			ZONE_CAT("simulation", PROFILE_CAT_FRAME);
+			busy(1500);
+		}
+		{
+			ZONE_CAT("wait for workers", PROFILE_CAT_FRAME);
+			pthread_barrier_wait(&g_frame_end);
+		}
+		{
+			ZONE_CAT("render", PROFILE_CAT_RENDER);
+			busy(2000);
+		}
+	}
+	g_exit = true;
+	pthread_barrier_wait(&g_frame_start);
+	for (int i = 0; i < NUM_WORKERS; ++i)
+		pthread_join(workers[i], NULL);
+	
+	profile_shutdown();
+	printf("Trace written to %s\n", path);
+	return 0;
+}
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>			// for cpu_set_t
+#if defined(__x86_64__)
+	#include <cpuid.h>		// for __get_cpuid()
+#endif
+
+#include "tsc.h"
+#include "topology.h"
+
+// interval between the two calibration samples
+#define TSC_CALIBRATION_MS	50
+// how long each CPU keeps checking for warps
+#define TSC_WARP_CHECK_MS	20
+// number of tries to get a sample with a tight TSC bracket
+#define TSC_SAMPLE_TRIES	8
+
+struct tsc_clock g_tsc =
+{
+	TSC_SOURCE_CLOCK_GETTIME, 0, 1ULL << TSC_SHIFT, 1ULL << TSC_SHIFT, 1.0, 0, 0
+};
+
+// CLOCK_MONOTONIC_RAW at calibration, for tsc_drift_ppm()
+static uint64_t g_tsc_base_raw_ns = 0;
+static bool g_tsc_initialized = false;
+
+// shared by the warp check threads
+static struct topology g_tsc_topology;
+static int g_tsc_lock = 0;
+static uint64_t g_tsc_last = 0;
+static int64_t g_tsc_max_warp = 0;
+
+static const char *g_tsc_source_names[] = {"clock_gettime", "tsc"};
+
+
+// ============================================================================
+
+
+static uint64_t tsc_raw_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__x86_64__)
+// invariant TSC, as advertised in CPUID leaf 0x80000007
+static bool tsc_invariant()
+{
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+		return false;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 8)) != 0;
+}
+
+// the kernel drops the TSC from the available clock sources once its own
+// checks find it unstable, e.g. after a warp between sockets
+static bool tsc_kernel_trusts()
+{
+	FILE *f = fopen("/sys/devices/system/clocksource/clocksource0/"
+		"available_clocksource", "r");
+	if (!f)
+		return true;	// no sysfs, take the CPU's word for it
+	char buf[256];
+	bool found = false;
+	if (fgets(buf, sizeof(buf), f))
+	{
+		for (char *tok = strtok(buf, " \n"); tok; tok = strtok(NULL, " \n"))
+			found |= strcmp(tok, "tsc") == 0;
+	}
+	fclose(f);
+	return found;
+}
+
+// takes a pair of simultaneous readings, retrying until the clock_gettime()
+// call is tightly bracketed by the TSC reads (i.e. we weren't preempted)
+static void tsc_sample(uint64_t *ticks, uint64_t *ns)
+{
+	uint64_t best = UINT64_MAX;
+	for (int i = 0; i < TSC_SAMPLE_TRIES; ++i)
+	{
+		uint64_t before = __rdtsc();
+		uint64_t now = tsc_raw_ns();
+		uint64_t after = __rdtsc();
+		if (after - before < best)
+		{
+			best = after - before;
+			*ticks = before + (after - before) / 2;
+			*ns = now;
+		}
+	}
+}
+
+// every CPU in turn takes the lock, reads the TSC and compares it against the
+// last reading from whichever CPU held the lock before; as the lock orders the
+// reads, any decrease is a warp between the two CPUs
+static void *tsc_warp_thread(void *arg)
+{
+	(void)arg;
+	uint64_t end = tsc_raw_ns() + TSC_WARP_CHECK_MS * 1000000ULL;
+	while (tsc_raw_ns() < end)
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			while (__atomic_exchange_n(&g_tsc_lock, 1, __ATOMIC_ACQUIRE))
+				__builtin_ia32_pause();
+			uint64_t now = __rdtsc();
+			if (now < g_tsc_last && (int64_t)(g_tsc_last - now) > g_tsc_max_warp)
+				g_tsc_max_warp = g_tsc_last - now;
+			g_tsc_last = now;
+			__atomic_store_n(&g_tsc_lock, 0, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+// runs the warp check on all CPUs we may run on; returns the number of them
+static int tsc_check_warps()
+{
+	if (topology_discover(&g_tsc_topology) != 0)
+		return 0;
+	pthread_t threads[TOPOLOGY_MAX_CPUS];
+	int num_threads = 0;
+	g_tsc_last = 0;
+	g_tsc_max_warp = 0;
+	for (int cpu = 0; cpu < g_tsc_topology.num_cpus; ++cpu)
+	{
+		if (!g_tsc_topology.cpus[cpu].present)
+			continue;
+		pthread_attr_t attr;
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		CPU_SET(cpu, &mask);
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(mask), &mask);
+		if (pthread_create(&threads[num_threads], &attr, tsc_warp_thread, NULL) == 0)
+			++num_threads;
+		pthread_attr_destroy(&attr);
+	}
+	for (int i = 0; i < num_threads; ++i)
+		pthread_join(threads[i], NULL);
+	return num_threads;
+}
+#endif	// __x86_64__
+
+
+// ============================================================================
+
+
+int tsc_init()
+{
+	if (g_tsc_initialized)
+		return g_tsc.source;
+	g_tsc_initialized = true;
+	g_tsc.base_ticks = tsc_ticks();
+
+#if defined(__x86_64__)
+	if (!tsc_invariant())
+	{
+		printf("[TSC] Not invariant, falling back to clock_gettime()\n");
+		return g_tsc.source;
+	}
+	if (!tsc_kernel_trusts())
+	{
+		printf("[TSC] Marked unstable by the kernel, falling back to "
+			"clock_gettime()\n");
+		return g_tsc.source;
+	}
+	
+	g_tsc.num_cpus_checked = tsc_check_warps();
+	g_tsc.max_warp = g_tsc_max_warp;
+	if (g_tsc.max_warp > 0)
+	{
+		printf("[TSC] Goes back by up to %lld ticks between CPUs, falling back "
+			"to clock_gettime()\n", (long long)g_tsc.max_warp);
+		return g_tsc.source;
+	}
+	
+	uint64_t ticks0, ns0, ticks1, ns1;
+	tsc_sample(&ticks0, &ns0);
+	struct timespec ts = {0, TSC_CALIBRATION_MS * 1000000L};
+	while (nanosleep(&ts, &ts) != 0)
+		;
+	tsc_sample(&ticks1, &ns1);
+	
+	g_tsc.ticks_per_ns = (double)(ticks1 - ticks0) / (ns1 - ns0);
+	g_tsc.mult = (uint64_t)((double)(1ULL << TSC_SHIFT) / g_tsc.ticks_per_ns + 0.5);
+	g_tsc.inv_mult = (uint64_t)((double)(1ULL << TSC_SHIFT) * g_tsc.ticks_per_ns + 0.5);
+	g_tsc.base_ticks = ticks1;
+	g_tsc_base_raw_ns = ns1;
+	// NOTE: threads already timing things in the meantime would get their
+	// units mixed up, hence tsc_init() belongs at startup
+	__atomic_store_n(&g_tsc.source, (int)TSC_SOURCE_TSC, __ATOMIC_RELEASE);
+	printf("[TSC] %.3f GHz, synchronized across %d CPUs\n", g_tsc.ticks_per_ns,
+		g_tsc.num_cpus_checked);
+#else
+	printf("[TSC] Unsupported architecture, using clock_gettime()\n");
+#endif
+	return g_tsc.source;
+}
+
+double tsc_drift_ppm()
+{
+	if (g_tsc.source != TSC_SOURCE_TSC)
+		return 0;
+#if defined(__x86_64__)
+	uint64_t ticks, ns;
+	tsc_sample(&ticks, &ns);
+	double expected = (double)(ns - g_tsc_base_raw_ns);
+	return expected > 0 ? (tsc_to_ns(ticks) - expected) / expected * 1e6 : 0;
+#else
+	return 0;
+#endif
+}
+
+const char *tsc_source_name(int source)
+{
+	return source >= 0 && source <= TSC_SOURCE_TSC ? g_tsc_source_names[source] : "?";
+}
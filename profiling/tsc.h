@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>		// for clock_gettime()
+#if defined(__x86_64__)
+	#include <x86intrin.h>	// for __rdtsc()
+#endif
+
+// cheap clock for fine-grained timing, built on the TSC: a read is a single
+// instruction rather than a trip through the vDSO, and converting to
+// nanoseconds is a multiply and a shift
+// the TSC is only used if it's invariant (constant rate regardless of power
+// states), the kernel still trusts it as a clock source, and it doesn't go
+// backwards when a thread hops between CPUs; otherwise the clock falls back to
+// clock_gettime(CLOCK_MONOTONIC), which is still a vDSO call and no syscall
+
+// fixed-point precision of the ticks to nanoseconds conversion
+#define TSC_SHIFT	32
+
+enum tsc_source
+{
+	TSC_SOURCE_CLOCK_GETTIME,	// not initialized yet, or the TSC is unusable
+	TSC_SOURCE_TSC
+};
+
+struct tsc_clock
+{
+	int source;				// enum tsc_source
+	uint64_t base_ticks;	// ticks at calibration; tsc_to_ns() counts from here
+	uint64_t mult;			// ns = (ticks * mult) >> TSC_SHIFT
+	uint64_t inv_mult;		// ticks = (ns * inv_mult) >> TSC_SHIFT
+	double ticks_per_ns;
+	int64_t max_warp;		// worst backwards step seen across CPUs, in ticks
+	int num_cpus_checked;
+};
+
+extern struct tsc_clock g_tsc;
+
+// detects, calibrates and validates the TSC; takes about a tenth of a second,
+// so do it at startup; later calls are no-ops
+// returns the source the clock ended up using
+int tsc_init();
+
+// how far the clock has drifted from CLOCK_MONOTONIC_RAW since calibration,
+// in parts per million; positive if we run fast
+double tsc_drift_ppm();
+
+const char *tsc_source_name(int source);
+
+// raw ticks: TSC cycles, or nanoseconds when falling back
+static inline uint64_t tsc_ticks()
+{
+#if defined(__x86_64__)
+	if (g_tsc.source == TSC_SOURCE_TSC)
+		return __rdtsc();
+#endif
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// NOTE: ticks from before tsc_init() are meaningless after it
+static inline uint64_t tsc_to_ns(uint64_t ticks)
+{
+	return (uint64_t)(((unsigned __int128)(ticks - g_tsc.base_ticks) * g_tsc.mult)
+		>> TSC_SHIFT);
+}
+
+// for durations, i.e. differences of ticks
+static inline uint64_t tsc_delta_to_ns(uint64_t ticks)
+{
+	return (uint64_t)(((unsigned __int128)ticks * g_tsc.mult) >> TSC_SHIFT);
+}
+
+static inline uint64_t tsc_ns_to_delta(uint64_t ns)
+{
+	return (uint64_t)(((unsigned __int128)ns * g_tsc.inv_mult) >> TSC_SHIFT);
+}
+
+// nanoseconds since tsc_init()
+static inline uint64_t tsc_now_ns()
+{
+	return tsc_to_ns(tsc_ticks());
+}
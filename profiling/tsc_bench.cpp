@@ -0,0 +1,78 @@
+// Benchmark of the TSC clock: cost per read against clock_gettime(), and drift
+// against CLOCK_MONOTONIC_RAW over time
+// To build:	make
+// To run:	./tsc_bench [seconds of drift measurement]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "tsc.h"
+
+#define NUM_READS	2000000
+
+static volatile uint64_t g_sink;
+
+
+// ============================================================================
+
+
+static double now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t read_clock(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define MEASURE(label, expr)	\
+	do	\
+	{	\
+		uint64_t sum = 0;	\
+		double start = now_ns();	\
+		for (int i = 0; i < NUM_READS; ++i)	\
+			sum += (expr);	\
+		g_sink = sum;	\
+		printf("  %-32s %6.1f ns\n", label, (now_ns() - start) / NUM_READS);	\
+	} while (0)
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : 5;
+	
+	int source = tsc_init();
+	printf("Clock source: %s", tsc_source_name(source));
+	if (source == TSC_SOURCE_TSC)
+		printf(", %.6f ticks/ns, mult %llu >> %d, %d CPUs checked, max warp %lld\n",
+			g_tsc.ticks_per_ns, (unsigned long long)g_tsc.mult, TSC_SHIFT,
+			g_tsc.num_cpus_checked, (long long)g_tsc.max_warp);
+	else
+		printf("\n");
+	
+	printf("Cost per read:\n");
+	MEASURE("tsc_ticks()", tsc_ticks());
+	MEASURE("tsc_now_ns()", tsc_now_ns());
+	MEASURE("tsc_delta_to_ns()", tsc_delta_to_ns(i));
+	MEASURE("clock_gettime(MONOTONIC)", read_clock(CLOCK_MONOTONIC));
+	MEASURE("clock_gettime(MONOTONIC_RAW)", read_clock(CLOCK_MONOTONIC_RAW));
+	MEASURE("clock_gettime(MONOTONIC_COARSE)", read_clock(CLOCK_MONOTONIC_COARSE));
+	MEASURE("clock_gettime(PROCESS_CPUTIME)", read_clock(CLOCK_PROCESS_CPUTIME_ID));
+	
+	if (source != TSC_SOURCE_TSC || seconds <= 0)
+		return 0;
+	printf("Drift against CLOCK_MONOTONIC_RAW:\n");
+	for (int i = 1; i <= seconds; ++i)
+	{
+		struct timespec ts = {1, 0};
+		nanosleep(&ts, NULL);
+		double drift = tsc_drift_ppm();
+		printf("  after %3d s: %+8.3f ppm (%+.1f us)\n", i, drift, drift * i);
+	}
+	return 0;
+}
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>			// for getenv() and friends
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>			// for fcntl() and the F_SEAL_* flags
+#include <unistd.h>			// for ftruncate()
+#include <sys/mman.h>		// for memfd_create() and mmap()
+#include <sys/stat.h>		// for fstat()
+#include <algorithm>		// for std::min and std::max
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC	0x54504b43	// "CKPT"
+
+// size of the header rounded up to whole blocks, so that slots are aligned
+#define CHECKPOINT_HEADER_SIZE	\
+	((sizeof(struct checkpoint_header) + CHECKPOINT_BLOCK_SIZE - 1)	\
+		& ~(size_t)(CHECKPOINT_BLOCK_SIZE - 1))
+
+static int g_checkpoint_fd = -1;
+static struct checkpoint_header *g_region = NULL;
+static uint64_t g_restored_generation = 0;
+// first free byte past the last slot
+static size_t g_used = 0;
+
+// process-local bookkeeping for the registered sections
+static struct
+{
+	uint32_t id;
+	char *ptr;		// the live state
+	size_t size;
+	size_t num_blocks;
+	// one bit per block per slot, set if the block was modified since the
+	// slot was last written
+	uint32_t *dirty[2];
+	// index into the header's section table
+	uint32_t section;
+} g_live[CHECKPOINT_MAX_SECTIONS];
+static size_t g_num_live = 0;
+
+
+// ============================================================================
+
+
+static size_t checkpoint_align(size_t size)
+{
+	return (size + CHECKPOINT_BLOCK_SIZE - 1) & ~(size_t)(CHECKPOINT_BLOCK_SIZE - 1);
+}
+
+static void checkpoint_format(size_t capacity)
+{
+	memset(g_region, 0, CHECKPOINT_HEADER_SIZE);
+	g_region->magic = CHECKPOINT_MAGIC;
+	g_region->format_version = CHECKPOINT_FORMAT_VERSION;
+	g_region->capacity = capacity;
+	g_used = CHECKPOINT_HEADER_SIZE;
+}
+
+// maps the memfd and validates its contents; returns 0 on success
+static int checkpoint_map(size_t capacity)
+{
+	void *p = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+		g_checkpoint_fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	g_region = (struct checkpoint_header *)p;
+	return 0;
+}
+
+static int checkpoint_find_live(uint32_t id)
+{
+	for (size_t i = 0; i < g_num_live; ++i)
+	{
+		if (g_live[i].id == id)
+			return (int)i;
+	}
+	return -1;
+}
+
+
+// ============================================================================
+
+
+int checkpoint_init(size_t capacity)
+{
+	capacity = checkpoint_align(std::max(capacity, CHECKPOINT_HEADER_SIZE));
+	
+	// were we restarted by the watchdog?
+	const char *env = getenv(CHECKPOINT_FD_ENV);
+	if (env)
+	{
+		g_checkpoint_fd = atoi(env);
+		// don't leak it into processes we may spawn ourselves
+		unsetenv(CHECKPOINT_FD_ENV);
+		
+		struct stat st;
+		if (fstat(g_checkpoint_fd, &st) == 0 && checkpoint_map(st.st_size) == 0)
+		{
+			if (g_region->magic == CHECKPOINT_MAGIC
+				&& g_region->format_version == CHECKPOINT_FORMAT_VERSION
+				&& g_region->capacity == (uint64_t)st.st_size)
+			{
+				g_restored_generation = g_region->generation;
+				// new slots go past the existing ones
+				g_used = CHECKPOINT_HEADER_SIZE;
+				for (uint32_t i = 0; i < g_region->num_sections; ++i)
+				{
+					const struct checkpoint_section *s = &g_region->sections[i];
+					g_used = std::max(g_used,
+						(size_t)s->offset[1] + checkpoint_align(s->size));
+				}
+				printf("[Checkpoint] Re-attached to region, generation %llu\n",
+					(unsigned long long)g_restored_generation);
+			}
+			else
+			{
+				// a stale or foreign format, we can only start over
+				printf("[Checkpoint] Region format mismatch, discarding it\n");
+				checkpoint_format(st.st_size);
+			}
+			return 0;
+		}
+		fprintf(stderr, "[Checkpoint] Failed to re-attach to fd %d: %s\n",
+			g_checkpoint_fd, strerror(errno));
+		close(g_checkpoint_fd);
+		g_checkpoint_fd = -1;
+		g_region = NULL;
+		// fall through to a cold start
+	}
+	
+	// NOTE: no MFD_CLOEXEC - the descriptor must survive the watchdog
+	// exec()-ing the restarted game
+	g_checkpoint_fd = memfd_create("checkpoint", MFD_ALLOW_SEALING);
+	if (g_checkpoint_fd < 0)
+		return -1;
+	if (ftruncate(g_checkpoint_fd, capacity) != 0
+		// the size never changes from now on, so make sure nobody can pull
+		// the pages from under our mapping
+		|| fcntl(g_checkpoint_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0
+		|| checkpoint_map(capacity) != 0)
+	{
+		int err = errno;
+		close(g_checkpoint_fd);
+		g_checkpoint_fd = -1;
+		errno = err;
+		return -1;
+	}
+	checkpoint_format(capacity);
+	return 0;
+}
+
+void checkpoint_cleanup()
+{
+	for (size_t i = 0; i < g_num_live; ++i)
+	{
+		free(g_live[i].dirty[0]);
+		free(g_live[i].dirty[1]);
+	}
+	g_num_live = 0;
+	if (g_region)
+		munmap(g_region, g_region->capacity);
+	g_region = NULL;
+	if (g_checkpoint_fd >= 0)
+		close(g_checkpoint_fd);
+	g_checkpoint_fd = -1;
+}
+
+int checkpoint_fd()
+{
+	return g_checkpoint_fd;
+}
+
+uint64_t checkpoint_restored_generation()
+{
+	return g_restored_generation;
+}
+
+int checkpoint_register(uint32_t id, uint32_t version, void *ptr, size_t size)
+{
+	if (!g_region || g_num_live >= CHECKPOINT_MAX_SECTIONS
+		|| checkpoint_find_live(id) >= 0)
+		return -1;
+	
+	// look for the section in the region first
+	uint32_t index;
+	for (index = 0; index < g_region->num_sections; ++index)
+	{
+		if (g_region->sections[index].id == id)
+			break;
+	}
+	struct checkpoint_section *s = &g_region->sections[index];
+	
+	int restored = 0;
+	uint64_t generation = g_region->generation;
+	if (index < g_region->num_sections && s->version == version && s->size == size)
+	{
+		// a section can only be restored once it's been through a commit, and
+		// only from the checkpoint we were started with
+		if (generation >= s->valid_from && generation == g_restored_generation)
+		{
+			memcpy(ptr, (char *)g_region + s->offset[generation & 1], size);
+			restored = 1;
+		}
+	}
+	else
+	{
+		// new section, or one whose layout has changed - either way it needs
+		// fresh slots
+		size_t slot_size = checkpoint_align(size);
+		if (g_used + 2 * slot_size > g_region->capacity
+			|| (index == g_region->num_sections && index >= CHECKPOINT_MAX_SECTIONS))
+			return -1;
+		s->id = id;
+		s->version = version;
+		s->size = size;
+		s->offset[0] = g_used;
+		s->offset[1] = g_used + slot_size;
+		s->valid_from = generation + 1;
+		g_used += 2 * slot_size;
+		if (index == g_region->num_sections)
+			__atomic_store_n(&g_region->num_sections, index + 1, __ATOMIC_RELEASE);
+	}
+	
+	size_t num_blocks = (size + CHECKPOINT_BLOCK_SIZE - 1) / CHECKPOINT_BLOCK_SIZE;
+	size_t num_words = (num_blocks + 31) / 32;
+	uint32_t *dirty[2] =
+	{
+		(uint32_t *)calloc(num_words, sizeof(uint32_t)),
+		(uint32_t *)calloc(num_words, sizeof(uint32_t))
+	};
+	if (!dirty[0] || !dirty[1])
+	{
+		free(dirty[0]);
+		free(dirty[1]);
+		return -1;
+	}
+	// both slots need a full copy, except for the one we just restored from,
+	// which is identical to the live state already
+	for (int slot = 0; slot < 2; ++slot)
+	{
+		if (restored && slot == (int)(generation & 1))
+			continue;
+		for (size_t b = 0; b < num_blocks; ++b)
+			dirty[slot][b / 32] |= 1u << (b % 32);
+	}
+	
+	g_live[g_num_live].id = id;
+	g_live[g_num_live].ptr = (char *)ptr;
+	g_live[g_num_live].size = size;
+	g_live[g_num_live].num_blocks = num_blocks;
+	g_live[g_num_live].dirty[0] = dirty[0];
+	g_live[g_num_live].dirty[1] = dirty[1];
+	g_live[g_num_live].section = index;
+	++g_num_live;
+	
+	return restored;
+}
+
+void checkpoint_mark_dirty(uint32_t id, size_t offset, size_t len)
+{
+	int i = checkpoint_find_live(id);
+	if (i < 0 || len == 0 || offset >= g_live[i].size)
+		return;
+	size_t first = offset / CHECKPOINT_BLOCK_SIZE;
+	size_t last = std::min(offset + len - 1, g_live[i].size - 1) / CHECKPOINT_BLOCK_SIZE;
+	for (size_t b = first; b <= last; ++b)
+	{
+		uint32_t bit = 1u << (b % 32);
+		__atomic_fetch_or(&g_live[i].dirty[0][b / 32], bit, __ATOMIC_RELAXED);
+		__atomic_fetch_or(&g_live[i].dirty[1][b / 32], bit, __ATOMIC_RELAXED);
+	}
+}
+
+uint64_t checkpoint_commit()
+{
+	if (!g_region)
+		return 0;
+	
+	uint64_t generation = g_region->generation + 1;
+	int slot = (int)(generation & 1);
+	
+	for (size_t i = 0; i < g_num_live; ++i)
+	{
+		const struct checkpoint_section *s = &g_region->sections[g_live[i].section];
+		char *dst = (char *)g_region + s->offset[slot];
+		uint32_t *dirty = g_live[i].dirty[slot];
+		for (size_t w = 0; w < (g_live[i].num_blocks + 31) / 32; ++w)
+		{
+			// clear the bits before copying, so that a concurrent
+			// checkpoint_mark_dirty() doesn't get lost
+			uint32_t bits = __atomic_exchange_n(&dirty[w], 0u, __ATOMIC_ACQUIRE);
+			while (bits)
+			{
+				size_t b = w * 32 + __builtin_ctz(bits);
+				bits &= bits - 1;
+				size_t off = b * CHECKPOINT_BLOCK_SIZE;
+				memcpy(dst + off, g_live[i].ptr + off,
+					std::min((size_t)CHECKPOINT_BLOCK_SIZE, g_live[i].size - off));
+			}
+		}
+	}
+	
+	// publish; everything written above becomes the consistent checkpoint
+	// with this single store
+	__atomic_store_n(&g_region->generation, generation, __ATOMIC_RELEASE);
+	return generation;
+}
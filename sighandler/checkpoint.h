@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>	// for size_t
+#include <stdint.h>
+
+// name of the environment variable the watchdog uses to hand the checkpoint
+// memfd over to a restarted game
+#define CHECKPOINT_FD_ENV	"SIGHANDLER_CHECKPOINT_FD"
+
+// max number of separately registered pieces of state
+#define CHECKPOINT_MAX_SECTIONS	16
+
+// granularity of dirty tracking
+#define CHECKPOINT_BLOCK_SIZE	4096
+
+// bump whenever the layout of the structs below changes
+#define CHECKPOINT_FORMAT_VERSION	1
+
+// one registered piece of state; each section has room for two copies (slots)
+// so that there is always one consistent copy, even if we crash mid-commit
+struct checkpoint_section
+{
+	uint32_t id;		// caller-chosen identifier
+	uint32_t version;	// caller-chosen schema version of the data
+	uint64_t size;		// size of the data in bytes
+	uint64_t offset[2];	// offsets of both slots from the start of the region
+	uint64_t valid_from;	// generation of the first commit holding this section
+};
+
+// lives at the very start of the shared region
+struct checkpoint_header
+{
+	uint32_t magic;
+	uint32_t format_version;
+	uint64_t capacity;	// total size of the region, header included
+	// number of committed checkpoints; the last consistent one lives in slot
+	// (generation & 1), and 0 means there is none yet
+	// NOTE: this is the only field written at commit time, and a single
+	// aligned 64-bit store is atomic, which is what makes commits consistent
+	uint64_t generation;
+	uint32_t num_sections;
+	uint32_t padding;
+	struct checkpoint_section sections[CHECKPOINT_MAX_SECTIONS];
+};
+
+// creates the memfd-backed checkpoint region of given capacity in bytes, or
+// re-attaches to the one handed over by the watchdog after a restart
+// must be called *before* sighandler_install() so that the watchdog inherits
+// the descriptor
+int checkpoint_init(size_t capacity);
+
+void checkpoint_cleanup();
+
+// the memfd backing the region, or -1 if checkpointing is not set up
+int checkpoint_fd();
+
+// generation of the checkpoint we resumed from, 0 after a cold start
+uint64_t checkpoint_restored_generation();
+
+// registers a piece of live state under given id; if the region holds a
+// consistent checkpoint of a section with the same id, version and size, its
+// contents are copied into ptr first
+// returns 1 if the state was restored, 0 if not, -1 on error
+int checkpoint_register(uint32_t id, uint32_t version, void *ptr, size_t size);
+
+// marks a byte range of a registered section as modified since the last
+// commit; safe to call from any thread
+void checkpoint_mark_dirty(uint32_t id, size_t offset, size_t len);
+
+// copies the blocks modified since the inactive slot was last written into it
+// and then publishes it as the new consistent checkpoint
+// the caller must ensure the live state isn't being modified meanwhile, e.g.
+// by calling this at the end of a frame
+// returns the new generation, or 0 on error
+uint64_t checkpoint_commit();
@@ -0,0 +1,354 @@
+#include <signal.h>			// for sig_atomic_t
+#include <stdio.h>
+#include <stdlib.h>			// for strtol() and friends
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>			// for mallopt()
+#include <unistd.h>			// for syscall()
+#include <sys/syscall.h>	// for SYS_gettid
+#include <sys/resource.h>	// for setpriority()
+
+#include "config.h"
+
+// max number of threads that may hold a snapshot at the same time
+#define CONFIG_MAX_READERS	64
+// max number of old snapshots waiting for their readers to move on
+#define CONFIG_MAX_RETIRED	8
+
+// the current snapshot; only ever swapped as a whole
+static struct config *g_config = NULL;
+
+// global epoch, bumped after every publish; 0 is reserved for "slot unused"
+static unsigned long g_epoch = 1;
+
+// last epoch observed by each reader thread at its safe point; 0 means the
+// slot is free
+static unsigned long g_reader_epoch[CONFIG_MAX_READERS];
+
+// snapshots replaced by newer ones, along with the epoch that readers need to
+// reach before it's safe to free them; only touched by the polling thread
+static struct
+{
+	struct config *snapshot;
+	unsigned long epoch;
+} g_retired[CONFIG_MAX_RETIRED];
+static size_t g_num_retired = 0;
+
+// set from the signal handler, serviced by config_poll()
+static volatile sig_atomic_t g_reload_requested = 0;
+
+static char g_path[256];
+
+// per-thread reader state
+static __thread int t_slot = -1;
+static __thread int t_role = CONFIG_ROLE_NONE;
+static __thread const struct config *t_config = NULL;
+
+
+// ============================================================================
+
+
+static const char *g_role_keys[CONFIG_NUM_ROLES] =
+{
+	"nice_main",
+	"nice_render",
+	"nice_worker",
+	"nice_background"
+};
+
+static const char *g_log_level_names[] =
+{
+	"debug",
+	"info",
+	"warn",
+	"error"
+};
+
+static void config_defaults(struct config *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->log_level = CONFIG_LOG_INFO;
+}
+
+static int config_parse_size(const char *value, size_t *out)
+{
+	char *end;
+	errno = 0;
+	unsigned long long v = strtoull(value, &end, 0);
+	if (errno != 0 || end == value || *end != 0)
+		return -1;
+	*out = (size_t)v;
+	return 0;
+}
+
+// parses the whole file into cfg; any error rejects the entire file so that a
+// typo never leaves us with a half-applied config
+static int config_parse(FILE *f, struct config *cfg)
+{
+	char line[256], key[64], value[64];
+	int lineno = 0;
+	while (fgets(line, sizeof(line), f))
+	{
+		++lineno;
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = 0;
+		int n = sscanf(line, " %63[^= \t] = %63s", key, value);
+		if (n <= 0)
+			continue;	// blank line
+		if (n != 2)
+		{
+			fprintf(stderr, "[Config] %s:%d: expected 'key = value'\n",
+				g_path, lineno);
+			return -1;
+		}
+		
+		bool ok = false;
+		if (strcmp(key, "log_level") == 0)
+		{
+			for (size_t i = 0; i < sizeof(g_log_level_names) / sizeof(g_log_level_names[0]); ++i)
+			{
+				if (strcmp(value, g_log_level_names[i]) == 0)
+				{
+					cfg->log_level = (int)i;
+					ok = true;
+				}
+			}
+		}
+		else if (strcmp(key, "malloc_trim_threshold") == 0)
+			ok = config_parse_size(value, &cfg->malloc_trim_threshold) == 0;
+		else if (strcmp(key, "malloc_mmap_threshold") == 0)
+			ok = config_parse_size(value, &cfg->malloc_mmap_threshold) == 0;
+		else
+		{
+			for (int i = 0; i < CONFIG_NUM_ROLES; ++i)
+			{
+				if (strcmp(key, g_role_keys[i]) == 0)
+				{
+					char *end;
+					long v = strtol(value, &end, 10);
+					ok = end != value && *end == 0 && v >= -20 && v <= 19;
+					cfg->thread_nice[i] = (int)v;
+				}
+			}
+		}
+		
+		if (!ok)
+		{
+			fprintf(stderr, "[Config] %s:%d: bad key or value '%s = %s'\n",
+				g_path, lineno, key, value);
+			return -1;
+		}
+	}
+	return ferror(f) ? -1 : 0;
+}
+
+// settings that apply to the whole process rather than to a thread
+static void config_apply_process(const struct config *cfg)
+{
+	// mallopt() returns 1 on success, 0 on error
+	if (cfg->malloc_trim_threshold != 0
+		&& mallopt(M_TRIM_THRESHOLD, (int)cfg->malloc_trim_threshold) != 1)
+		fprintf(stderr, "[Config] Failed to set malloc trim threshold\n");
+	if (cfg->malloc_mmap_threshold != 0
+		&& mallopt(M_MMAP_THRESHOLD, (int)cfg->malloc_mmap_threshold) != 1)
+		fprintf(stderr, "[Config] Failed to set malloc mmap threshold\n");
+}
+
+// settings that apply to the calling thread only
+static void config_apply_thread(const struct config *cfg)
+{
+	if (!cfg || t_role < 0 || t_role >= CONFIG_NUM_ROLES)
+		return;
+	// in Linux, PRIO_PROCESS with a TID only affects that single thread
+	// NOTE: negative values need RLIMIT_NICE raised, see priority/niceness.c
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	if (setpriority(PRIO_PROCESS, tid, cfg->thread_nice[t_role]) != 0)
+		fprintf(stderr, "[Config] Failed to set niceness %d for thread %d: %s\n",
+			cfg->thread_nice[t_role], tid, strerror(errno));
+}
+
+// loads a fresh snapshot from disk; returns NULL on error
+static struct config *config_load(unsigned generation)
+{
+	struct config *cfg = (struct config *)malloc(sizeof(*cfg));
+	if (!cfg)
+		return NULL;
+	config_defaults(cfg);
+	cfg->generation = generation;
+	
+	FILE *f = fopen(g_path, "r");
+	if (!f)
+	{
+		// no file means defaults on startup, but a reload with the file gone
+		// is much more likely a mistake, so keep the old snapshot then
+		if (errno == ENOENT && generation == 0)
+			return cfg;
+		fprintf(stderr, "[Config] Cannot open %s: %s\n", g_path, strerror(errno));
+		free(cfg);
+		return NULL;
+	}
+	int retval = config_parse(f, cfg);
+	fclose(f);
+	if (retval != 0)
+	{
+		free(cfg);
+		return NULL;
+	}
+	return cfg;
+}
+
+// frees the retired snapshots that no reader can be holding anymore
+static void config_reclaim()
+{
+	// find the oldest epoch still observed by an online reader
+	unsigned long min_epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+	for (size_t i = 0; i < CONFIG_MAX_READERS; ++i)
+	{
+		unsigned long e = __atomic_load_n(&g_reader_epoch[i], __ATOMIC_SEQ_CST);
+		if (e != 0 && e < min_epoch)
+			min_epoch = e;
+	}
+	
+	size_t kept = 0;
+	for (size_t i = 0; i < g_num_retired; ++i)
+	{
+		if (g_retired[i].epoch <= min_epoch)
+			free(g_retired[i].snapshot);
+		else
+			g_retired[kept++] = g_retired[i];
+	}
+	g_num_retired = kept;
+}
+
+
+// ============================================================================
+
+
+int config_init(const char *path)
+{
+	snprintf(g_path, sizeof(g_path), "%s", path);
+	int retval = 0;
+	struct config *cfg = config_load(0);
+	if (!cfg)
+	{
+		// a bad file still leaves the readers a snapshot to look at
+		retval = -1;
+		cfg = (struct config *)malloc(sizeof(*cfg));
+		if (!cfg)
+			return -1;
+		config_defaults(cfg);
+		cfg->generation = 0;
+	}
+	config_apply_process(cfg);
+	__atomic_store_n(&g_config, cfg, __ATOMIC_SEQ_CST);
+	return retval;
+}
+
+void config_cleanup()
+{
+	// all readers must be gone by now
+	for (size_t i = 0; i < g_num_retired; ++i)
+		free(g_retired[i].snapshot);
+	g_num_retired = 0;
+	free(__atomic_exchange_n(&g_config, (struct config *)NULL, __ATOMIC_SEQ_CST));
+}
+
+void config_register_thread(int role)
+{
+	unsigned long epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < CONFIG_MAX_READERS; ++i)
+	{
+		unsigned long expected = 0;
+		if (__atomic_compare_exchange_n(&g_reader_epoch[i], &expected, epoch,
+			false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		{
+			t_slot = i;
+			t_role = role;
+			t_config = __atomic_load_n(&g_config, __ATOMIC_SEQ_CST);
+			config_apply_thread(t_config);
+			return;
+		}
+	}
+	// this is a programming error - bump CONFIG_MAX_READERS
+	fprintf(stderr, "[Config] Out of reader slots!\n");
+	abort();
+}
+
+void config_unregister_thread()
+{
+	if (t_slot < 0)
+		return;
+	t_config = NULL;
+	__atomic_store_n(&g_reader_epoch[t_slot], 0UL, __ATOMIC_SEQ_CST);
+	t_slot = -1;
+}
+
+const struct config *config_get()
+{
+	return t_config;
+}
+
+const struct config *config_quiescent()
+{
+	if (t_slot < 0)
+		return NULL;	// not a registered reader
+	
+	// read the epoch *before* the pointer: the publisher swaps the pointer
+	// before bumping the epoch, so having seen epoch E guarantees we also see
+	// the snapshot published with it
+	unsigned long epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+	const struct config *cfg = __atomic_load_n(&g_config, __ATOMIC_SEQ_CST);
+	if (cfg != t_config)
+	{
+		t_config = cfg;
+		config_apply_thread(cfg);
+	}
+	// from now on we don't reference anything older than this epoch
+	__atomic_store_n(&g_reader_epoch[t_slot], epoch, __ATOMIC_SEQ_CST);
+	return cfg;
+}
+
+void config_request_reload()
+{
+	g_reload_requested = 1;
+}
+
+int config_poll()
+{
+	config_reclaim();
+	
+	if (!g_reload_requested)
+		return 0;
+	
+	if (g_num_retired == CONFIG_MAX_RETIRED)
+	{
+		// some reader isn't reaching its safe points; leave the request
+		// pending and try again next time
+		return 0;
+	}
+	g_reload_requested = 0;
+	
+	struct config *old = __atomic_load_n(&g_config, __ATOMIC_SEQ_CST);
+	struct config *cfg = config_load(old ? old->generation + 1 : 1);
+	if (!cfg)
+	{
+		fprintf(stderr, "[Config] Reload failed, keeping generation %u\n",
+			old ? old->generation : 0);
+		return 0;
+	}
+	config_apply_process(cfg);
+	
+	// publish: swap the pointer first, then bump the epoch
+	__atomic_store_n(&g_config, cfg, __ATOMIC_SEQ_CST);
+	unsigned long epoch = __atomic_add_fetch(&g_epoch, 1, __ATOMIC_SEQ_CST);
+	if (old)
+	{
+		g_retired[g_num_retired].snapshot = old;
+		g_retired[g_num_retired].epoch = epoch;
+		++g_num_retired;
+	}
+	
+	printf("[Config] Reloaded %s, generation %u\n", g_path, cfg->generation);
+	return 1;
+}
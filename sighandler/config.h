@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>	// for size_t
+
+// thread roles that get their own niceness from the config file
+enum config_role
+{
+	CONFIG_ROLE_MAIN,
+	CONFIG_ROLE_RENDER,
+	CONFIG_ROLE_WORKER,
+	CONFIG_ROLE_BACKGROUND,
+	CONFIG_NUM_ROLES,
+	// pass this to config_register_thread() to never touch the priority
+	CONFIG_ROLE_NONE = -1
+};
+
+enum config_log_level
+{
+	CONFIG_LOG_DEBUG,
+	CONFIG_LOG_INFO,
+	CONFIG_LOG_WARN,
+	CONFIG_LOG_ERROR
+};
+
+// immutable config snapshot; once published, it's never written to again, so
+// it's safe to read without any locking
+struct config
+{
+	unsigned generation;	// bumped on every successful reload
+	int log_level;			// one of config_log_level
+	// allocator thresholds in bytes, passed to mallopt(); 0 means "leave the
+	// allocator default alone"
+	size_t malloc_trim_threshold;
+	size_t malloc_mmap_threshold;
+	// niceness per thread role, in the [-20, 19] range
+	int thread_nice[CONFIG_NUM_ROLES];
+};
+
+// loads the initial snapshot from given file; a missing file is not an error,
+// we just run with the defaults then
+// returns -1 if the file could not be parsed; the defaults are published
+// anyway, unless we ran out of memory, in which case config_get() gives NULL
+// the path is kept around for reloads
+int config_init(const char *path);
+
+void config_cleanup();
+
+// registers the calling thread as a config reader; role tells which niceness
+// to apply whenever a new snapshot is picked up
+// must be called before config_get() or config_quiescent() on that thread
+void config_register_thread(int role = CONFIG_ROLE_NONE);
+
+// unregisters the calling thread; it must not touch its snapshot afterwards
+void config_unregister_thread();
+
+// returns the snapshot the calling thread currently holds; the pointer stays
+// valid until the thread's next call to config_quiescent()
+const struct config *config_get();
+
+// safe point: the calling thread declares it holds no references into its old
+// snapshot and picks up the newest one
+// call this once per frame/job from every registered thread
+const struct config *config_quiescent();
+
+// async-signal-safe; only sets a flag which is serviced by config_poll()
+// NOTE: the game signal handler calls this on SIGHUP
+void config_request_reload();
+
+// services pending reload requests: parses the file into a new snapshot,
+// publishes it and frees the old snapshots every reader has moved on from
+// must be called regularly from a single thread, e.g. the main loop
+// returns 1 if a new snapshot was published, 0 otherwise
+int config_poll();
@@ -4,6 +4,18 @@
 #include <unistd.h>	// for usleep()
 
 #include "sighandler.h"
+#include "config.h"
+#include "checkpoint.h"
+
+// some state we'd rather not rebuild from scratch after a crash
+struct game_state
+{
+	unsigned runs;
+	// ...player sessions, caches etc. would go here
+};
+#define GAME_STATE_ID		1
+#define GAME_STATE_VERSION	1
+static struct game_state g_state;
 
 void *segfault(void *arg = NULL)
 {
@@ -18,6 +30,12 @@ int main(int argc, char *argv[])
 {
 	int retval = 0;
 	
+	// the checkpoint region needs to exist before the watchdog is started so
+	// that it can hold on to it for a warm restart; it's only a memfd and an
+	// untouched mapping, so it doesn't grow our image much
+	if (checkpoint_init(1 << 20) != 0)
+		printf("[Game] Failed to set up checkpointing, crashes will be cold\n");
+	
 	// set up signal handling as the very first thing after start!
 	retval = sighandler_install();
 	if (retval != 0)
@@ -26,6 +44,27 @@ int main(int argc, char *argv[])
 		return retval;
 	}
 	
+	// load the tunables; from now on, `kill -HUP <pid>` reloads them
+	// NOTE: a real game would call config_poll() once per frame on the main
+	// thread and config_quiescent() at the top of every thread's frame/job
+	if (config_init("game.cfg") != 0)
+		printf("[Game] Bad config file, running with defaults\n");
+	config_register_thread(CONFIG_ROLE_MAIN);
+	const struct config *cfg = config_get();
+	if (cfg)
+		printf("[Game] Config generation %u, log level %d\n",
+			cfg->generation, cfg->log_level);
+	
+	// resume from the last consistent checkpoint if the watchdog restarted us
+	if (checkpoint_register(GAME_STATE_ID, GAME_STATE_VERSION, &g_state,
+		sizeof(g_state)) == 1)
+		printf("[Game] Warm restart from checkpoint %llu\n",
+			(unsigned long long)checkpoint_restored_generation());
+	++g_state.runs;
+	checkpoint_mark_dirty(GAME_STATE_ID, 0, sizeof(g_state));
+	checkpoint_commit();
+	printf("[Game] Run #%u\n", g_state.runs);
+	
 	printf("[Game] Init done, attempting segfault\n");
 	
 	// spawn some segfaulting threads to try competing for the handler
@@ -41,7 +80,10 @@ int main(int argc, char *argv[])
 	segfault();
 	
 	// we never reach here, but this is what needs to be done for proper cleanup
+	config_unregister_thread();
+	config_cleanup();
 	sighandler_cleanup();
+	checkpoint_cleanup();
 	
 	return retval;
 }
\ No newline at end of file
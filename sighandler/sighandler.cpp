@@ -8,9 +8,18 @@
 #include <errno.h>			// for EBUSY
 #include <sys/wait.h>		// for waitpid()
 #include <sys/resource.h>	// for struct rlimit
-#include <algorithm>		// for std::min
+#include <fcntl.h>			// for fcntl()
+#include <limits.h>			// for PATH_MAX
+#include <spawn.h>			// for posix_spawn()
+#include <ucontext.h>		// for ucontext_t
+#include <sys/uio.h>		// for process_vm_readv()
+#include <sys/select.h>		// for pselect()
+#include <algorithm>		// for std::min and std::max
 
 #include "watchdog.h"
+#include "topology.h"
+#include "config.h"
+#include "checkpoint.h"
 
 // list of signals we care about
 static const int g_interest[] =
@@ -31,9 +40,11 @@ static const size_t g_num_interest = sizeof(g_interest) / sizeof(g_interest[0]);
 // list of signals we ignore
 static const int g_ignore[] =
 {
-	// NOTE: in the real world, these two might be worth catching – could mean
-	// something happened to a child process, e.g. the watchdog
-	SIGCHLD,
+	// NOTE: in the real world, this might be worth catching – could mean
+	// something happened to the watchdog
+	// NOTE: SIGCHLD is deliberately not here: its default action is to be
+	// ignored anyway, but explicitly setting SIG_IGN makes the kernel reap our
+	// children on its own, and then we can't waitpid() for the snapshot ones
 	SIGPIPE
 };
 static const size_t g_num_ignore = sizeof(g_ignore) / sizeof(g_ignore[0]);
@@ -46,12 +57,86 @@ static struct sigaction g_default_actions[g_num_interest];
 
 static pid_t g_watchdog_pid = (pid_t)-1;
 
+// how many bytes of stack memory above the stack pointer go into the report
+static size_t g_stack_window = 512;
+
 
 // ============================================================================
 
 
+// copies the registers and a window of stack memory from the signal context
+// NOTE: this runs in the signal handler, so it's all plain copies and syscalls
+static void sighandler_capture_context(struct watchdog_data *wd,
+	const ucontext_t *uc, char *stack_mem)
+{
+	wd->num_regs = 0;
+	wd->pc = wd->sp = 0;
+	wd->stack_addr = 0;
+	wd->stack_size = 0;
+	if (!uc)
+		return;
+	
+#if defined(__x86_64__)
+	for (int i = 0; i < WATCHDOG_NUM_REGS; ++i)
+		wd->regs[i] = (uint64_t)uc->uc_mcontext.gregs[i];
+	wd->pc = (uint64_t)uc->uc_mcontext.gregs[REG_RIP];
+	wd->sp = (uint64_t)uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__i386__)
+	for (int i = 0; i < WATCHDOG_NUM_REGS; ++i)
+		wd->regs[i] = (uint32_t)uc->uc_mcontext.gregs[i];
+	wd->pc = (uint32_t)uc->uc_mcontext.gregs[REG_EIP];
+	wd->sp = (uint32_t)uc->uc_mcontext.gregs[REG_ESP];
+#elif defined(__aarch64__)
+	for (int i = 0; i < 31; ++i)
+		wd->regs[i] = uc->uc_mcontext.regs[i];
+	wd->regs[31] = uc->uc_mcontext.sp;
+	wd->regs[32] = uc->uc_mcontext.pc;
+	wd->regs[33] = uc->uc_mcontext.pstate;
+	wd->pc = uc->uc_mcontext.pc;
+	wd->sp = uc->uc_mcontext.sp;
+#else
+	return;
+#endif
+	wd->num_regs = WATCHDOG_NUM_REGS;
+	
+	// the stack pointer may well be garbage (think stack overflow), so we
+	// can't just memcpy(); process_vm_readv() on ourselves fails gracefully
+	// with EFAULT instead of faulting
+	// NOTE: it won't split an iovec on a partial read, so give it one per
+	// page, and we get everything up to the first unmapped page
+	static const size_t page = 4096;
+	uint64_t addr = wd->sp - WATCHDOG_RED_ZONE;
+	size_t size = g_stack_window + WATCHDOG_RED_ZONE;
+	if (size > WATCHDOG_MAX_STACK_WINDOW)
+		size = WATCHDOG_MAX_STACK_WINDOW;
+	struct iovec local = {stack_mem, size};
+	struct iovec remote[WATCHDOG_MAX_STACK_WINDOW / page + 1];
+	int num_remote = 0;
+	for (uint64_t p = addr, end = addr + size; p < end; ++num_remote)
+	{
+		uint64_t next = std::min((p & ~(uint64_t)(page - 1)) + page, end);
+		remote[num_remote].iov_base = (void *)p;
+		remote[num_remote].iov_len = next - p;
+		p = next;
+	}
+	ssize_t read = process_vm_readv(getpid(), &local, 1, remote, num_remote, 0);
+	if (read > 0)
+	{
+		wd->stack_addr = addr;
+		wd->stack_size = (int)read;
+	}
+}
+
 void game_signal_handler(int signum, siginfo_t *info, void *context)
 {
+	// SIGHUP is the conventional "reload your config" request for daemons; it
+	// is not a fault, so just flag it for the main loop and get out
+	if (signum == SIGHUP)
+	{
+		config_request_reload();
+		return;
+	}
+	
 	// some of the signals are supposed to dump core
 	bool coredump	= signum == SIGSEGV
 				   || signum == SIGQUIT
@@ -63,22 +148,32 @@ void game_signal_handler(int signum, siginfo_t *info, void *context)
 	bool fatal		= signum != SIGCHLD && signum != SIGTERM && signum != SIGQUIT;
 	bool clean		= signum == SIGTERM;
 	
-	// spin to block concurrent faulting threads
-	// NOTE: if the contenting thread is of higher priority, we'll deadlock -
-	// it would be more robust to pthread_spin_trylock() and sleep with
-	// pselect() instead
-	pthread_spin_lock(&g_handler_lock);
+	// block concurrent faulting threads
+	// NOTE: spinning outright would deadlock if the contending thread is of
+	// higher priority than the holder (e.g. SCHED_FIFO against a worker), so
+	// sleep between attempts to let the holder run; pselect() is
+	// async-signal-safe
+	while (pthread_spin_trylock(&g_handler_lock) == EBUSY)
+	{
+		struct timespec ts = {0, 1000000};	// 1 ms
+		pselect(0, NULL, NULL, NULL, &ts, NULL);
+	}
 	
-	// array is static to avoid runtime allocs
+	// arrays are static to avoid runtime allocs
 	static void *stack[64];	// max depth of stack that we'll walk is arbitrary
+	static char stack_mem[WATCHDOG_MAX_STACK_WINDOW];
 	
 	// dump the information down the pipe
 	// NOTE: printf() and friends are *NOT* safe! that's why the custom protocol
 	struct watchdog_data wd;
 	wd.siginfo	= *info;
+	// registers and raw stack memory of the faulting thread
+	sighandler_capture_context(&wd, (const ucontext_t *)context, stack_mem);
 	// actual stack walking happens here
 	wd.depth	= backtrace(stack, sizeof(stack) / sizeof(stack[0]));
 	write(g_watchdog_pipe[1], &wd, sizeof(wd));
+	if (wd.stack_size > 0)
+		write(g_watchdog_pipe[1], stack_mem, wd.stack_size);
 	
 	// push stack trace down the pipe
 	backtrace_symbols_fd(stack, wd.depth, g_watchdog_pipe[1]);
@@ -123,6 +218,113 @@ void game_signal_handler(int signum, siginfo_t *info, void *context)
 	}
 }
 
+#if !WATCHDOG_IS_PARENT
+// keeps the watchdog off the cores the game's latency-critical threads get;
+// it only wakes up when we crash anyway
+static void sighandler_place_watchdog(pid_t pid)
+{
+	static struct topology topo;
+	static struct topology_placement place;
+	if (topology_discover(&topo) != 0)
+		return;
+	topology_place(&topo, &place);
+	if (topology_apply_tid(pid, &place.housekeeping) != 0)
+		fprintf(stderr, "[Sighandler] Failed to pin the watchdog: %s\n",
+			strerror(errno));
+}
+
+// figures out where the watchdog executable is: either explicitly given in the
+// environment, or next to our own executable
+static int sighandler_watchdog_path(char *path, size_t size)
+{
+	const char *env = getenv(WATCHDOG_PATH_ENV);
+	if (env)
+		return snprintf(path, size, "%s", env) < (int)size ? 0 : -1;
+	
+	ssize_t len = readlink("/proc/self/exe", path, size - 1);
+	if (len <= 0)
+		return -1;
+	path[len] = 0;
+	char *slash = strrchr(path, '/');
+	size_t dir_len = slash ? slash - path + 1 : 0;
+	return snprintf(path + dir_len, size - dir_len, "%s", WATCHDOG_EXE)
+		< (int)(size - dir_len) ? 0 : -1;
+}
+
+// launches the watchdog as a separate, small executable
+// unlike fork(), posix_spawn() doesn't copy our page tables: glibc implements
+// it with clone(CLONE_VM | CLONE_VFORK), i.e. the child borrows our address
+// space until it exec()s, so the cost doesn't depend on how big we've grown,
+// and we never take copy-on-write faults afterwards
+static int sighandler_spawn_watchdog()
+{
+	char path[PATH_MAX];
+	if (sighandler_watchdog_path(path, sizeof(path)) != 0)
+	{
+		fprintf(stderr, "[Sighandler] Cannot locate the watchdog executable\n");
+		return -1;
+	}
+	
+	// the watchdog only gets the reading end; the writing end must not leak,
+	// or the watchdog would never see EOF when we die
+	fcntl(g_watchdog_pipe[1], F_SETFD, FD_CLOEXEC);
+	
+	// hand over the channel descriptors explicitly
+	char game[16], pipe_fd[16], checkpoint[16];
+	snprintf(game, sizeof(game), "%d", getpid());
+	snprintf(pipe_fd, sizeof(pipe_fd), "%d", g_watchdog_pipe[0]);
+	snprintf(checkpoint, sizeof(checkpoint), "%d", checkpoint_fd());
+	char *argv[] =
+	{
+		path,
+		(char *)"--game", game,
+		(char *)"--pipe", pipe_fd,
+		(char *)"--checkpoint", checkpoint,
+		NULL
+	};
+	
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	// NOTE: POSIX_SPAWN_USEVFORK is the default in modern glibc, but being
+	// explicit doesn't hurt older ones
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_USEVFORK);
+	
+	// nothing but the standard streams and the channels above gets inherited:
+	// whatever else we have open without FD_CLOEXEC (sockets, files, other
+	// pipes) would otherwise be held open by the watchdog for as long as it
+	// lives, and a peer would never see us go away
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	int keep_max = std::max(g_watchdog_pipe[0], checkpoint_fd());
+	for (int fd = STDERR_FILENO + 1; fd < keep_max; ++fd)
+	{
+		if (fd != g_watchdog_pipe[0] && fd != checkpoint_fd() && fcntl(fd, F_GETFD) != -1)
+			posix_spawn_file_actions_addclose(&actions, fd);
+	}
+	posix_spawn_file_actions_addclosefrom_np(&actions, keep_max + 1);
+	
+	pid_t pid;
+	int retval = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (retval != 0)
+	{
+		fprintf(stderr, "[Sighandler] Failed to spawn the watchdog %s: %s\n",
+			path, strerror(retval));
+		close(g_watchdog_pipe[0]);
+		close(g_watchdog_pipe[1]);
+		return retval;
+	}
+	g_watchdog_pid = pid;
+	sighandler_place_watchdog(pid);
+	
+	// the reading end is the watchdog's business now
+	close(g_watchdog_pipe[0]);
+	g_watchdog_pipe[0] = -1;
+	return 0;
+}
+#endif	// !WATCHDOG_IS_PARENT
+
 int sighandler_install(size_t max_core_size)
 {
 	int retval = 0;
@@ -132,6 +334,7 @@ int sighandler_install(size_t max_core_size)
 	if (retval != 0)
 		return retval;
 	
+#if WATCHDOG_IS_PARENT
 	// fork ASAP, before our process image grows big!
 	// NOTE:	the debugger (gdb) will by default follow the parent upon a
 	//			fork; if you want to debug the child process instead, you will
@@ -142,14 +345,16 @@ int sighandler_install(size_t max_core_size)
 	//			or simply run another gdb instance and attach to the child
 	//			process (the variable pid below will contain its PID)
 	g_watchdog_pid = fork();
-#if WATCHDOG_IS_PARENT
 	if (g_watchdog_pid != 0)
+	{
 		// we are the watchdog as parent
+		g_watchdog_checkpoint_fd = checkpoint_fd();
 		exit(watchdog(g_watchdog_pid));
+	}
 #else
-	if (g_watchdog_pid == 0)
-		// we are the watchdog as child
-		exit(watchdog(getppid()));
+	retval = sighandler_spawn_watchdog();
+	if (retval != 0)
+		return retval;
 #endif
 	
 	// enable core dumping
@@ -215,8 +420,29 @@ void sighandler_cleanup()
 {
 	while (pthread_spin_destroy(&g_handler_lock) == EBUSY)
 		usleep(10 * 1000);
-	close(g_watchdog_pipe[0]);
+	if (g_watchdog_pipe[0] >= 0)
+		close(g_watchdog_pipe[0]);
 	close(g_watchdog_pipe[1]);
 	// no need to wait for the watchdog – if it's the parent, it will react to
-	// SIGCHLD; if it's the child, it will die once orphaned
+	// SIGCHLD; if it's the child, it will see EOF on the pipe and exit
+}
+
+void sighandler_restore_defaults()
+{
+	for (size_t i = 0; i < g_num_interest; ++i)
+		sigaction(g_interest[i], &g_default_actions[i], NULL);
+	// make sure nothing we do can end up in the watchdog's pipe
+	if (g_watchdog_pid != (pid_t)-1)
+		close(g_watchdog_pipe[1]);
+}
+
+void sighandler_set_stack_window(size_t bytes)
+{
+	g_stack_window = std::min(bytes,
+		(size_t)(WATCHDOG_MAX_STACK_WINDOW - WATCHDOG_RED_ZONE));
+}
+
+pid_t sighandler_watchdog_pid()
+{
+	return g_watchdog_pid;
 }
\ No newline at end of file
@@ -1,8 +1,26 @@
 #pragma once
 
+#include <stddef.h>		// for size_t
+#include <sys/types.h>	// for pid_t
+
 // installs the signal handler and tries to enable core dumps of given max size
 // in bytes
 // all bits set to 1 (i.e. -1 cast to size_t) means unlimited
+// NOTE: if you want warm restarts, call checkpoint_init() before this
 int sighandler_install(size_t max_core_size = (size_t)-1);
 
 void sighandler_cleanup();
+
+// restores the default signal actions; meant for forked children (e.g. the
+// snapshot writer) so that their faults don't get reported as the game's
+// async-signal-safe
+void sighandler_restore_defaults();
+
+// sets how many bytes of stack memory above the stack pointer of the faulting
+// thread are sent to the watchdog, 512 by default; clamped to
+// WATCHDOG_MAX_STACK_WINDOW minus the red zone
+void sighandler_set_stack_window(size_t bytes);
+
+// PID of the watchdog process; sighandler_install() already pins it to the
+// housekeeping CPUs from priority/topology.h
+pid_t sighandler_watchdog_pid();
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>			// for open()
+#include <unistd.h>			// for fork() and friends
+#include <time.h>			// for clock_gettime()
+#include <sys/mman.h>		// for madvise() and mprotect()
+#include <sys/wait.h>		// for waitpid()
+
+#include "snapshot.h"
+#include "sighandler.h"
+
+// the writer child shouldn't compete with the game for CPU time
+#define SNAPSHOT_CHILD_NICE	10
+
+static pid_t g_snapshot_pid = (pid_t)-1;
+static struct snapshot_stats g_snapshot_stats;
+static uint64_t g_snapshot_start;
+static int g_snapshot_status = SNAPSHOT_IDLE;
+
+
+// ============================================================================
+
+
+static uint64_t snapshot_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// runs in the forked child; never returns
+static void snapshot_child(const char *path, snapshot_writer writer, void *arg)
+{
+	// from now on, everything we do must be async-signal-safe: other threads
+	// of the parent may have held locks (e.g. malloc's) at the time of fork()
+	sighandler_restore_defaults();
+	nice(SNAPSHOT_CHILD_NICE);
+	
+	// write to a temporary file first, so that the previous snapshot stays
+	// intact until the new one is complete
+	char tmp[256];
+	size_t len = strlen(path);
+	if (len + sizeof(".tmp") > sizeof(tmp))
+		_exit(1);
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+	
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		_exit(2);
+	int retval = writer(fd, arg);
+	if (retval == 0)
+		retval = fsync(fd) == 0 ? 0 : 3;
+	close(fd);
+	if (retval == 0)
+		retval = rename(tmp, path) == 0 ? 0 : 4;
+	else
+		unlink(tmp);
+	// NOTE: _exit(), not exit() - we mustn't run the parent's atexit handlers
+	// nor flush its duplicated stdio buffers
+	_exit(retval);
+}
+
+static int snapshot_reap(int options)
+{
+	if (g_snapshot_pid < 0)
+		return g_snapshot_status;
+	
+	int status;
+	pid_t pid;
+	do
+		pid = waitpid(g_snapshot_pid, &status, options);
+	while (pid < 0 && errno == EINTR);
+	if (pid == 0)
+		return SNAPSHOT_RUNNING;
+	
+	g_snapshot_stats.duration_ns = snapshot_now() - g_snapshot_start;
+	if (pid < 0)
+		g_snapshot_stats.exit_status = -1;
+	else if (WIFSIGNALED(status))
+		g_snapshot_stats.exit_status = -WTERMSIG(status);
+	else
+		g_snapshot_stats.exit_status = WEXITSTATUS(status);
+	g_snapshot_status = g_snapshot_stats.exit_status == 0
+		? SNAPSHOT_DONE : SNAPSHOT_FAILED;
+	g_snapshot_pid = (pid_t)-1;
+	return g_snapshot_status;
+}
+
+
+// ============================================================================
+
+
+int snapshot_mark_readonly(void *ptr, size_t len)
+{
+	if (mprotect(ptr, len, PROT_READ) != 0)
+		return -1;
+	return madvise(ptr, len, MADV_DONTFORK);
+}
+
+int snapshot_unmark_readonly(void *ptr, size_t len)
+{
+	if (madvise(ptr, len, MADV_DOFORK) != 0)
+		return -1;
+	return mprotect(ptr, len, PROT_READ | PROT_WRITE);
+}
+
+int snapshot_begin(const char *path, snapshot_writer writer, void *arg)
+{
+	if (snapshot_reap(WNOHANG) == SNAPSHOT_RUNNING)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	
+	// the parent is stalled for as long as it takes the kernel to copy our
+	// page tables - this is the number to keep an eye on
+	memset(&g_snapshot_stats, 0, sizeof(g_snapshot_stats));
+	g_snapshot_start = snapshot_now();
+	pid_t pid = fork();
+	if (pid == 0)
+		snapshot_child(path, writer, arg);
+	g_snapshot_stats.fork_ns = snapshot_now() - g_snapshot_start;
+	if (pid < 0)
+		return -1;
+	
+	g_snapshot_pid = pid;
+	g_snapshot_status = SNAPSHOT_RUNNING;
+	return 0;
+}
+
+int snapshot_poll(struct snapshot_stats *stats)
+{
+	int status = snapshot_reap(WNOHANG);
+	if (stats)
+		*stats = g_snapshot_stats;
+	return status;
+}
+
+int snapshot_wait(struct snapshot_stats *stats)
+{
+	int status = snapshot_reap(0);
+	if (stats)
+		*stats = g_snapshot_stats;
+	return status;
+}
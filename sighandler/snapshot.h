@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>	// for size_t
+#include <stdint.h>
+
+// background snapshots of the game state, Redis BGSAVE-style: we fork, and the
+// child gets a consistent copy-on-write view of the whole heap which it can
+// serialize at its leisure while the parent keeps running
+
+// serializes the state into given descriptor; runs in the forked child, so it
+// must stick to async-signal-safe calls (write() is fine, malloc() is not)
+// returns 0 on success
+typedef int (*snapshot_writer)(int fd, void *arg);
+
+enum snapshot_status
+{
+	SNAPSHOT_IDLE,		// nothing in flight
+	SNAPSHOT_RUNNING,	// the child is still writing
+	SNAPSHOT_DONE,		// the last snapshot was written successfully
+	SNAPSHOT_FAILED		// the last snapshot failed, see the stats
+};
+
+struct snapshot_stats
+{
+	uint64_t fork_ns;		// how long the parent was stalled in fork()
+	uint64_t duration_ns;	// fork to child exit
+	int exit_status;		// child's exit status, or -signal if it crashed
+};
+
+// marks a region of read-only data (e.g. assets that can be reloaded from
+// disk) as such: it's write-protected, so it never takes copy-on-write faults,
+// and excluded from the snapshot children with MADV_DONTFORK, so fork() needn't
+// copy its page tables
+// ptr must be page-aligned; the writer must never touch the region, because it
+// is simply not mapped in the child
+int snapshot_mark_readonly(void *ptr, size_t len);
+
+// undoes snapshot_mark_readonly(), e.g. before freeing or reusing the region
+int snapshot_unmark_readonly(void *ptr, size_t len);
+
+// forks a child that writes the snapshot into path via a temporary file and
+// an atomic rename; returns 0 once the child is running, -1 on error (e.g.
+// EBUSY if another snapshot is still in flight)
+int snapshot_begin(const char *path, snapshot_writer writer, void *arg);
+
+// non-blocking; reaps the child if it's done and fills in stats if not NULL
+int snapshot_poll(struct snapshot_stats *stats = NULL);
+
+// blocks until the snapshot in flight (if any) is done
+int snapshot_wait(struct snapshot_stats *stats = NULL);
@@ -0,0 +1,89 @@
+// Measures how long fork() stalls the parent for a background snapshot,
+// depending on the heap size and on how much of it is marked read-only
+// To run:	./snapshot_bench [heap size in MiB]...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>		// for sysconf()
+#include <sys/mman.h>	// for mmap()
+
+#include "sighandler.h"
+#include "snapshot.h"
+
+#define BENCH_REPEATS	5
+
+static const char *g_path = "/tmp/snapshot_bench.bin";
+
+// a real writer would serialize the world; we only care about the fork pause
+// here, so just write a tiny header
+static int bench_writer(int fd, void *arg)
+{
+	size_t size = *(size_t *)arg;
+	return write(fd, &size, sizeof(size)) == sizeof(size) ? 0 : -1;
+}
+
+// forks BENCH_REPEATS snapshots and returns the average fork pause in us
+static double bench_fork(size_t size)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < BENCH_REPEATS; ++i)
+	{
+		struct snapshot_stats stats;
+		if (snapshot_begin(g_path, bench_writer, &size) != 0
+			|| snapshot_wait(&stats) != SNAPSHOT_DONE)
+		{
+			printf("[Bench] Snapshot failed!\n");
+			return -1.0;
+		}
+		total += stats.fork_ns;
+	}
+	return total / 1000.0 / BENCH_REPEATS;
+}
+
+int main(int argc, char *argv[])
+{
+	// like in the game, this goes first
+	int retval = sighandler_install();
+	if (retval != 0)
+		return retval;
+	
+	static const size_t default_sizes[] = {64, 256, 1024};
+	size_t num_sizes = argc > 1 ? argc - 1 : sizeof(default_sizes) / sizeof(default_sizes[0]);
+	size_t page = sysconf(_SC_PAGESIZE);
+	
+	printf("%10s %14s %14s %20s\n", "heap MiB", "writable us", "75% ro us", "75% ro+DONTFORK us");
+	for (size_t i = 0; i < num_sizes; ++i)
+	{
+		size_t mib = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : default_sizes[i];
+		size_t size = mib << 20;
+		char *heap = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (heap == MAP_FAILED)
+		{
+			printf("[Bench] Failed to map %zu MiB\n", mib);
+			continue;
+		}
+		// fault everything in, so that there are page tables to copy
+		memset(heap, 0xab, size);
+		
+		double writable = bench_fork(size);
+		
+		// write-protecting alone doesn't save us from copying the page tables
+		size_t ro = (size / 4 * 3) & ~(page - 1);
+		mprotect(heap, ro, PROT_READ);
+		double readonly = bench_fork(size);
+		
+		// excluding the region from the child does
+		snapshot_mark_readonly(heap, ro);
+		double dontfork = bench_fork(size);
+		snapshot_unmark_readonly(heap, ro);
+		
+		printf("%10zu %14.1f %14.1f %20.1f\n", mib, writable, readonly, dontfork);
+		munmap(heap, size);
+	}
+	
+	unlink(g_path);
+	sighandler_cleanup();
+	return 0;
+}
@@ -4,13 +4,23 @@
 #include <unistd.h>		// for read()
 #include <assert.h>
 #include <errno.h>
+#include <stdlib.h>		// for getenv() and setenv()
+#include <limits.h>		// for PATH_MAX
+#include <fcntl.h>		// for open()
+#include <link.h>		// for ElfW()
+#include <cxxabi.h>		// for abi::__cxa_demangle()
+#include <sys/mman.h>	// for mmap()
+#include <sys/stat.h>	// for fstat()
 #include <sys/types.h>	// for pid_t
 
 #include "watchdog.h"
+#include "checkpoint.h"	// for CHECKPOINT_FD_ENV
 
 // file descriptors of both ends of the pipe - [0] for reading, [1] for writing
 int g_watchdog_pipe[2];
 
+int g_watchdog_checkpoint_fd = -1;
+
 // pid of the game process
 static pid_t g_game;
 
@@ -39,9 +49,326 @@ void watchdog_signal_handler(int signal, siginfo_t *info, void *context)
 	#define g_watchdog_exit	(g_game == getppid())
 #endif
 
-void watchdog_print(struct watchdog_data *wd, const char *stack)
+#if !WATCHDOG_IS_PARENT
+// everything needed to launch the game again, captured while it's still alive
+static char g_game_exe[PATH_MAX];
+static char g_game_cmdline[4096];
+static char *g_game_argv[64];
+
+void watchdog_capture_cmdline()
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/exe", g_game);
+	ssize_t len = readlink(path, g_game_exe, sizeof(g_game_exe) - 1);
+	g_game_exe[len > 0 ? len : 0] = 0;
+	
+	// cmdline is a sequence of NUL-terminated strings
+	snprintf(path, sizeof(path), "/proc/%d/cmdline", g_game);
+	int fd = open(path, O_RDONLY);
+	len = fd >= 0 ? read(fd, g_game_cmdline, sizeof(g_game_cmdline) - 1) : -1;
+	if (fd >= 0)
+		close(fd);
+	g_game_argv[0] = NULL;
+	if (len <= 0)
+		return;
+	g_game_cmdline[len] = 0;
+	size_t argc = 0;
+	for (char *p = g_game_cmdline;
+		p < g_game_cmdline + len
+			&& argc < sizeof(g_game_argv) / sizeof(g_game_argv[0]) - 1;
+		p += strlen(p) + 1)
+		g_game_argv[argc++] = p;
+	g_game_argv[argc] = NULL;
+}
+
+// replaces the watchdog with a fresh instance of the game, handing it the
+// checkpoint memfd; only returns on failure
+void watchdog_restart_game()
+{
+	int fd = g_watchdog_checkpoint_fd;
+	if (fd < 0 || !g_game_exe[0] || !g_game_argv[0])
+		return;
+	
+	// count the restarts so that a game crashing on startup doesn't loop forever
+	const char *env = getenv(WATCHDOG_RESTARTS_ENV);
+	int restarts = env ? atoi(env) : 0;
+	if (restarts >= WATCHDOG_MAX_RESTARTS)
+	{
+		printf("[Watchdog] Restart limit reached, not restarting the game\n");
+		return;
+	}
+	
+	char buf[16];
+	snprintf(buf, sizeof(buf), "%d", restarts + 1);
+	setenv(WATCHDOG_RESTARTS_ENV, buf, 1);
+	snprintf(buf, sizeof(buf), "%d", fd);
+	setenv(CHECKPOINT_FD_ENV, buf, 1);
+	
+	printf("[Watchdog] Restarting the game (%d/%d) from checkpoint fd %d\n",
+		restarts + 1, WATCHDOG_MAX_RESTARTS, fd);
+	fflush(stdout);
+	
+	// we simply become the new game; it will spawn a watchdog of its own
+	execv(g_game_exe, g_game_argv);
+	printf("[Watchdog] Failed to restart the game: %s\n", strerror(errno));
+}
+#endif	// !WATCHDOG_IS_PARENT
+
+// ============================================================================
+// symbol annotation of raw addresses from the report
+
+// names of the registers in watchdog_data::regs
+static const char *g_reg_names[] =
+{
+#if defined(__x86_64__)
+	"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rdi", "rsi", "rbp",
+	"rbx", "rdx", "rax", "rcx", "rsp", "rip", "eflags", "csgsfs", "err",
+	"trapno", "oldmask", "cr2"
+#elif defined(__i386__)
+	"gs", "fs", "es", "ds", "edi", "esi", "ebp", "esp", "ebx", "edx", "ecx",
+	"eax", "trapno", "err", "eip", "cs", "eflags", "uesp", "ss"
+#elif defined(__aarch64__)
+	"x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11",
+	"x12", "x13", "x14", "x15", "x16", "x17", "x18", "x19", "x20", "x21",
+	"x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29", "x30", "sp", "pc",
+	"pstate"
+#else
+	"?"
+#endif
+};
+
+// snapshot of the game's memory map, taken when a report comes in
+struct watchdog_mapping
+{
+	uint64_t start, end, offset;
+	bool exec;
+	char path[256];
+};
+static struct watchdog_mapping g_maps[512];
+static int g_num_maps = 0;
+
+// the last ELF file we looked symbols up in, kept mapped
+static struct
+{
+	char path[256];
+	const char *data;
+	size_t size;
+} g_elf;
+
+// NOTE: this has to happen while the game is still alive, i.e. while it's
+// still busy in its signal handler pushing the rest of the report to us
+void watchdog_read_maps()
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/maps", g_game);
+	g_num_maps = 0;
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return;
+	char line[512], perms[8];
+	while (fgets(line, sizeof(line), f)
+		&& g_num_maps < (int)(sizeof(g_maps) / sizeof(g_maps[0])))
+	{
+		struct watchdog_mapping *m = &g_maps[g_num_maps];
+		unsigned long long start, end, offset;
+		m->path[0] = 0;
+		if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %255s",
+			&start, &end, perms, &offset, m->path) < 4)
+			continue;
+		m->start = start;
+		m->end = end;
+		m->offset = offset;
+		m->exec = perms[2] == 'x';
+		++g_num_maps;
+	}
+	fclose(f);
+}
+
+static const struct watchdog_mapping *watchdog_find_mapping(uint64_t addr)
+{
+	for (int i = 0; i < g_num_maps; ++i)
+	{
+		if (addr >= g_maps[i].start && addr < g_maps[i].end)
+			return &g_maps[i];
+	}
+	return NULL;
+}
+
+static bool watchdog_load_elf(const char *path)
+{
+	if (g_elf.data && strcmp(g_elf.path, path) == 0)
+		return true;
+	if (g_elf.data)
+		munmap((void *)g_elf.data, g_elf.size);
+	g_elf.data = NULL;
+	
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	void *p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ElfW(Ehdr)))
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return false;
+	if (memcmp(p, ELFMAG, SELFMAG) != 0)
+	{
+		munmap(p, st.st_size);
+		return false;
+	}
+	snprintf(g_elf.path, sizeof(g_elf.path), "%s", path);
+	g_elf.data = (const char *)p;
+	g_elf.size = st.st_size;
+	return true;
+}
+
+// finds the function symbol containing addr in given file mapping; writes its
+// (demangled) name and the offset into it
+static bool watchdog_elf_symbol(const struct watchdog_mapping *map,
+	uint64_t addr, char *name, size_t size, uint64_t *offset)
+{
+	if (!map->path[0] || map->path[0] == '[' || !watchdog_load_elf(map->path))
+		return false;
+	
+	const ElfW(Ehdr) *eh = (const ElfW(Ehdr) *)g_elf.data;
+	if (eh->e_shoff == 0
+		|| eh->e_shoff + eh->e_shnum * sizeof(ElfW(Shdr)) > g_elf.size
+		|| eh->e_phoff + eh->e_phnum * sizeof(ElfW(Phdr)) > g_elf.size)
+		return false;
+	
+	// translate the runtime address into a link-time one: the module is
+	// loaded at the start of its mapping at file offset 0, and the first
+	// PT_LOAD segment tells us what virtual address that offset was linked at
+	uint64_t base = map->start - map->offset;
+	for (int i = 0; i < g_num_maps; ++i)
+	{
+		if (g_maps[i].offset == 0 && strcmp(g_maps[i].path, map->path) == 0)
+		{
+			base = g_maps[i].start;
+			break;
+		}
+	}
+	const ElfW(Phdr) *ph = (const ElfW(Phdr) *)(g_elf.data + eh->e_phoff);
+	uint64_t link_base = 0;
+	for (int i = 0; i < eh->e_phnum; ++i)
+	{
+		if (ph[i].p_type == PT_LOAD)
+		{
+			link_base = ph[i].p_vaddr - ph[i].p_offset;
+			break;
+		}
+	}
+	uint64_t rel = addr - base + link_base;
+	
+	// prefer the full symbol table, fall back to the dynamic one for stripped
+	// binaries
+	const ElfW(Shdr) *sh = (const ElfW(Shdr) *)(g_elf.data + eh->e_shoff);
+	const ElfW(Sym) *best = NULL;
+	const char *best_strtab = NULL;
+	for (int pass = 0; pass < 2 && !best; ++pass)
+	{
+		uint32_t type = pass == 0 ? SHT_SYMTAB : SHT_DYNSYM;
+		for (int i = 0; i < eh->e_shnum; ++i)
+		{
+			if (sh[i].sh_type != type || sh[i].sh_link >= eh->e_shnum
+				|| sh[i].sh_offset + sh[i].sh_size > g_elf.size)
+				continue;
+			const ElfW(Shdr) *strsh = &sh[sh[i].sh_link];
+			if (strsh->sh_offset + strsh->sh_size > g_elf.size)
+				continue;
+			const ElfW(Sym) *syms = (const ElfW(Sym) *)(g_elf.data + sh[i].sh_offset);
+			size_t num_syms = sh[i].sh_size / sizeof(ElfW(Sym));
+			for (size_t j = 0; j < num_syms; ++j)
+			{
+				if (ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC
+					|| syms[j].st_value > rel
+					|| rel >= syms[j].st_value + (syms[j].st_size ? syms[j].st_size : 1)
+					|| syms[j].st_name >= strsh->sh_size)
+					continue;
+				best = &syms[j];
+				best_strtab = g_elf.data + strsh->sh_offset;
+			}
+		}
+	}
+	if (!best)
+		return false;
+	
+	const char *mangled = best_strtab + best->st_name;
+	int status;
+	char *demangled = abi::__cxa_demangle(mangled, NULL, NULL, &status);
+	snprintf(name, size, "%s", demangled ? demangled : mangled);
+	free(demangled);
+	*offset = rel - best->st_value;
+	return true;
+}
+
+// describes where addr points to, e.g. "<game!main+0x1a>" or "[stack]"; leaves
+// buf empty for values that don't point anywhere interesting
+static void watchdog_annotate(uint64_t addr, char *buf, size_t size)
+{
+	buf[0] = 0;
+	const struct watchdog_mapping *map = watchdog_find_mapping(addr);
+	if (!map)
+		return;
+	if (!map->exec)
+	{
+		// data pointers are only worth naming if it's a special mapping
+		if (map->path[0] == '[')
+			snprintf(buf, size, "%s", map->path);
+		return;
+	}
+	
+	const char *module = strrchr(map->path, '/');
+	module = module ? module + 1 : map->path;
+	char name[256];
+	uint64_t offset;
+	if (watchdog_elf_symbol(map, addr, name, sizeof(name), &offset))
+		snprintf(buf, size, "<%s!%s+0x%llx>", module, name,
+			(unsigned long long)offset);
+	else
+		snprintf(buf, size, "<%s+0x%llx>", module,
+			(unsigned long long)(addr - map->start + map->offset));
+}
+
+void watchdog_print(struct watchdog_data *wd, const char *stack_mem,
+	const char *stack)
 {
+	char annotation[320];
 	psiginfo(&wd->siginfo, "[Watchdog] Game received signal");
+	
+	if (wd->num_regs > 0)
+	{
+		watchdog_annotate(wd->pc, annotation, sizeof(annotation));
+		printf("[Watchdog] PC 0x%016llx %s\n", (unsigned long long)wd->pc,
+			annotation);
+		printf("[Watchdog] Registers:\n");
+		for (int i = 0; i < wd->num_regs && i < WATCHDOG_NUM_REGS; ++i)
+		{
+			watchdog_annotate(wd->regs[i], annotation, sizeof(annotation));
+			printf("  %-8s 0x%016llx%s%s\n", g_reg_names[i],
+				(unsigned long long)wd->regs[i], annotation[0] ? " " : "",
+				annotation);
+		}
+	}
+	
+	if (stack_mem && wd->stack_size > 0)
+	{
+		printf("[Watchdog] Stack memory (%d bytes, SP at 0x%llx):\n",
+			wd->stack_size, (unsigned long long)wd->sp);
+		for (int i = 0; i + (int)sizeof(uint64_t) <= wd->stack_size;
+			i += sizeof(uint64_t))
+		{
+			uint64_t addr = wd->stack_addr + i;
+			uint64_t value;
+			memcpy(&value, stack_mem + i, sizeof(value));
+			watchdog_annotate(value, annotation, sizeof(annotation));
+			printf("  %c 0x%016llx: 0x%016llx%s%s\n", addr == wd->sp ? '>' : ' ',
+				(unsigned long long)addr, (unsigned long long)value,
+				annotation[0] ? " " : "", annotation);
+		}
+	}
+	
 	printf("[Watchdog] Stack trace (%d frames):\n%s\n", wd->depth, stack);
 }
 
@@ -71,10 +398,18 @@ int watchdog(pid_t game)
 	}
 #endif
 	
+#if !WATCHDOG_IS_PARENT
+	watchdog_capture_cmdline();
+#endif
+	
 	printf("[Watchdog] Running!\n");
 	
+	// set once the game reports a signal it won't survive
+	bool crashed = false;
+	
 	// now just keep reading that pipe and spewing it out
 	struct watchdog_data wd;
+	static char stack_mem[WATCHDOG_MAX_STACK_WINDOW];
 	char stack[1024], *s;
 	int left;
 	do
@@ -105,7 +440,7 @@ int watchdog(pid_t game)
 					snprintf(errinfo, sizeof(errinfo),
 						"Signal information incomplete! %s",
 						retval == 0 ? "EOF" : strerror(errno));
-					watchdog_print(&wd, errinfo);
+					watchdog_print(&wd, NULL, errinfo);
 					goto die;
 				}
 				else
@@ -117,6 +452,34 @@ int watchdog(pid_t game)
 			left -= retval;
 		}
 		
+		// the game is still alive while it's sending the report, so this is
+		// our chance to see its memory map for annotating addresses
+		watchdog_read_maps();
+		
+		// raw stack memory comes next
+		if (wd.stack_size < 0 || wd.stack_size > WATCHDOG_MAX_STACK_WINDOW)
+			wd.stack_size = 0;
+		left = wd.stack_size;
+		while (left > 0)
+		{
+			retval = read(g_watchdog_pipe[0],
+						  stack_mem + wd.stack_size - left,
+						  left);
+			if (retval < 0 && errno == EINTR)
+				continue;
+			if (retval <= 0)
+			{
+				char errinfo[128];
+				snprintf(errinfo, sizeof(errinfo),
+					"Stack memory incomplete! %s",
+					retval == 0 ? "EOF" : strerror(errno));
+				wd.stack_size -= left;
+				watchdog_print(&wd, stack_mem, errinfo);
+				goto die;
+			}
+			left -= retval;
+		}
+		
 		// OK, we now have the basic information, try reading the stack trace
 		// instead of bytes we'll be counting lines (LF characters)
 		left = wd.depth;
@@ -136,7 +499,7 @@ int watchdog(pid_t game)
 					char errinfo[128];
 					snprintf(errinfo, sizeof(errinfo),
 						"Signal information incomplete! %s", strerror(errno));
-					watchdog_print(&wd, errinfo);
+					watchdog_print(&wd, NULL, errinfo);
 					goto die;
 				}
 				else
@@ -157,7 +520,8 @@ int watchdog(pid_t game)
 		}
 		
 		// all information collected, print it
-		watchdog_print(&wd, stack);
+		watchdog_print(&wd, stack_mem, stack);
+		crashed = wd.siginfo.si_signo != SIGTERM && wd.siginfo.si_signo != SIGINT;
 		
 		// phew! info about one signal emitted, wait for another one
 	} while (true);
@@ -166,6 +530,13 @@ die:
 	
 	close(g_watchdog_pipe[0]);
 	
+#if !WATCHDOG_IS_PARENT
+	// the game is gone; if it crashed and left a checkpoint behind, warm
+	// restart it
+	if (crashed)
+		watchdog_restart_game();
+#endif
+	
 	printf("[Watchdog] Terminating\n");
 	
 	return 0;
@@ -1,21 +1,65 @@
 #pragma once
 
 #include <signal.h>		// for siginfo_t
+#include <stdint.h>		// for uint64_t
 #include <sys/types.h>	// for pid_t
 
 // define this to 1 to build with the watchdog running as the parent process;
 // can be useful for debugging it, for instance
 #define WATCHDOG_IS_PARENT	0
 
+// max number of times the watchdog restarts a crashed game, counted across
+// restarts in the environment variable below
+// NOTE: restarting is only supported with the watchdog as child and requires
+// the game to have set up checkpointing (see checkpoint.h)
+#define WATCHDOG_MAX_RESTARTS	3
+#define WATCHDOG_RESTARTS_ENV	"SIGHANDLER_RESTARTS"
+
+// unless the watchdog is the parent, it's a separate executable spawned by
+// sighandler_install(); it's looked up in the environment variable below, or
+// else next to the game executable
+#define WATCHDOG_EXE		"watchdog"
+#define WATCHDOG_PATH_ENV	"SIGHANDLER_WATCHDOG"
+
 // file descriptors of both ends of the pipe - [0] for reading, [1] for writing
 extern int g_watchdog_pipe[2];
 
+// the game's checkpoint memfd we keep alive for a warm restart, or -1
+extern int g_watchdog_checkpoint_fd;
+
 // watchdog process entry point
 int watchdog(pid_t game);
 
+// general purpose registers we forward from the signal context; the order is
+// that of the ucontext_t of the respective architecture
+#if defined(__x86_64__)
+	#define WATCHDOG_NUM_REGS	23	// NGREG
+	#define WATCHDOG_RED_ZONE	128	// leaf functions may use this below SP
+#elif defined(__i386__)
+	#define WATCHDOG_NUM_REGS	19	// NGREG
+	#define WATCHDOG_RED_ZONE	0
+#elif defined(__aarch64__)
+	#define WATCHDOG_NUM_REGS	34	// x0-x30, sp, pc, pstate
+	#define WATCHDOG_RED_ZONE	0
+#else
+	#define WATCHDOG_NUM_REGS	0	// unsupported, registers are skipped
+	#define WATCHDOG_RED_ZONE	0
+#endif
+
+// max size of the window of stack memory copied for the report
+#define WATCHDOG_MAX_STACK_WINDOW	4096
+
 // struct of the signal data we want to forward to the watchdog
+// NOTE: it's followed in the pipe by stack_size bytes of stack memory and then
+// by depth lines of symbolicated backtrace
 struct watchdog_data
 {
 	siginfo_t siginfo;
 	int depth;	// depth of backtrace
+	int num_regs;	// number of valid entries in regs, 0 if unsupported
+	uint64_t regs[WATCHDOG_NUM_REGS > 0 ? WATCHDOG_NUM_REGS : 1];
+	uint64_t pc;	// faulting instruction
+	uint64_t sp;	// stack pointer at the time of the fault
+	uint64_t stack_addr;	// address of the first byte of the stack window
+	int stack_size;	// size of the stack window in bytes
 };
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>		// for atoi()
+#include <string.h>
+#include <sys/types.h>	// for pid_t
+
+#include "watchdog.h"
+
+// standalone watchdog executable, spawned by sighandler_install() as:
+// watchdog --game <pid> --pipe <fd> [--checkpoint <fd>]
+int main(int argc, char *argv[])
+{
+	pid_t game = (pid_t)-1;
+	
+	// we only ever get the reading end of the pipe
+	g_watchdog_pipe[0] = -1;
+	g_watchdog_pipe[1] = -1;
+	
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--game") == 0)
+			game = (pid_t)atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--pipe") == 0)
+			g_watchdog_pipe[0] = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--checkpoint") == 0)
+			g_watchdog_checkpoint_fd = atoi(argv[i + 1]);
+		else
+			break;
+	}
+	
+	if (game <= 0 || g_watchdog_pipe[0] < 0)
+	{
+		fprintf(stderr, "Usage: %s --game <pid> --pipe <fd> [--checkpoint <fd>]\n"
+			"This is not meant to be run by hand, sighandler_install() spawns it.\n",
+			argv[0]);
+		return 1;
+	}
+	
+	return watchdog(game);
+}
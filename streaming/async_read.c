@@ -0,0 +1,787 @@
+// Asynchronous file reads ordered by I/O priority, see async_read.h
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>			// for posix_fadvise()
+#include <unistd.h>			// for syscall()
+#include <sys/mman.h>		// for the io_uring rings
+#include <sys/syscall.h>	// for SYS_gettid and the io_uring calls
+#include <sys/uio.h>		// for preadv()
+#include <linux/io_uring.h>
+
+#include "async_read.h"
+#include "thread_role.h"
+#include "memory_lock.h"
+
+// I/O class and level per request priority
+static const struct
+{
+	int io_class;
+	int io_level;
+} g_io_priorities[ASYNC_READ_NUM_PRIORITIES] =
+{
+	{IO_CLASS_BE,	0},	// urgent
+	{IO_CLASS_BE,	4},	// normal
+	{IO_CLASS_IDLE,	0}	// background
+};
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_work_cond = PTHREAD_COND_INITIALIZER;	// new requests
+static pthread_cond_t g_done_cond = PTHREAD_COND_INITIALIZER;	// completions
+// all of the below is protected by g_lock
+static struct async_read *g_queue_head[ASYNC_READ_NUM_PRIORITIES];
+static struct async_read *g_queue_tail[ASYNC_READ_NUM_PRIORITIES];
+static int g_foreground_active = 0;		// urgent and normal reads in flight
+static int g_background_active = 0;
+static struct async_read_stats g_stats;
+static int g_quit = 0;
+
+// recently read files, to tell sequential streams apart; protected by g_lock
+#define ASYNC_READ_STREAMS	16
+static struct
+{
+	int fd;
+	off_t next;			// where the last read ended
+	off_t hinted;		// up to where we've asked for readahead
+	int sequential;		// non-zero once a read followed on from the last one
+	uint64_t last_use;
+} g_streams[ASYNC_READ_STREAMS];
+static uint64_t g_stream_clock = 0;
+
+static pthread_t *g_threads = NULL;
+static int g_num_threads = 0;
+static int g_use_uring = 0;
+// non-zero with a single I/O thread, which then has to serve foreground reads
+// itself in between the chunks of a background one
+static int g_serve_inline = 0;
+// the request priority the calling I/O thread's I/O class matches, or -1
+static __thread int t_io_priority = -1;
+
+#define IOPRIO_CLASS_SHIFT		13
+#define IOPRIO_PRIO_VALUE(class, level)	(((class) << IOPRIO_CLASS_SHIFT) | (level))
+
+// requests read together, because they continue each other
+struct batch
+{
+	struct async_read *reqs[ASYNC_READ_MAX_MERGE];
+	struct iovec iov[ASYNC_READ_MAX_MERGE];
+	int count;
+	int priority;
+	int fd;
+	off_t offset;
+	size_t size;
+	ssize_t result;
+	int error;
+	// readahead to ask for before reading, if hint_size isn't 0
+	off_t hint_offset;
+	size_t hint_size;
+	int hint_sequential;	// non-zero for a newly found stream
+};
+
+struct uring
+{
+	int fd;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+
+// ============================================================================
+
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// call with g_lock held
+static int foreground_pending(void)
+{
+	return g_queue_head[ASYNC_READ_URGENT] || g_queue_head[ASYNC_READ_NORMAL]
+		|| g_foreground_active > 0;
+}
+
+// call with g_lock held; returns the highest priority request we may take, up
+// to and including max_priority
+static struct async_read *dequeue(int max_priority)
+{
+	for (int p = 0; p <= max_priority; ++p)
+	{
+		struct async_read *req = g_queue_head[p];
+		if (!req)
+			continue;
+		// a single background read at a time, so that the other threads
+		// are free for foreground ones
+		if (p == ASYNC_READ_BACKGROUND && g_background_active > 0)
+			return NULL;
+		g_queue_head[p] = req->next;
+		if (!g_queue_head[p])
+			g_queue_tail[p] = NULL;
+		req->next = NULL;
+		return req;
+	}
+	return NULL;
+}
+
+// call with g_lock held; prev is the request before req in its queue, or NULL
+static void unlink_queued(struct async_read *req, struct async_read *prev)
+{
+	if (prev)
+		prev->next = req->next;
+	else
+		g_queue_head[req->priority] = req->next;
+	if (g_queue_tail[req->priority] == req)
+		g_queue_tail[req->priority] = prev;
+	req->next = NULL;
+}
+
+// call with g_lock held; tracks the file's reads, and works out what to hint
+// to the kernel before reading the batch
+static void track_stream(struct batch *batch)
+{
+	int slot = 0;
+	for (int i = 0; i < ASYNC_READ_STREAMS; ++i)
+	{
+		if (g_streams[i].fd == batch->fd && g_streams[i].last_use)
+		{
+			slot = i;
+			break;
+		}
+		if (g_streams[i].last_use < g_streams[slot].last_use)
+			slot = i;
+	}
+	if (g_streams[slot].fd != batch->fd || !g_streams[slot].last_use)
+	{
+		g_streams[slot].fd = batch->fd;
+		g_streams[slot].next = -1;
+		g_streams[slot].sequential = 0;
+	}
+	g_streams[slot].last_use = ++g_stream_clock;
+
+	if (g_streams[slot].next != batch->offset)
+	{
+		// a seek; whatever we hinted is of no use anymore
+		g_streams[slot].sequential = 0;
+		g_streams[slot].hinted = 0;
+	}
+	else if (!g_streams[slot].sequential)
+	{
+		g_streams[slot].sequential = 1;
+		batch->hint_sequential = 1;
+	}
+	off_t end = batch->offset + (off_t)batch->size;
+	g_streams[slot].next = end;
+
+	// keep the window ahead of the stream topped up, but only once it's half
+	// used so that we don't make a syscall per read
+	if (g_streams[slot].sequential
+		&& g_streams[slot].hinted < end + ASYNC_READ_READAHEAD / 2)
+	{
+		off_t from = g_streams[slot].hinted > end ? g_streams[slot].hinted : end;
+		g_streams[slot].hinted = end + ASYNC_READ_READAHEAD;
+		batch->hint_offset = from;
+		batch->hint_size = (size_t)(g_streams[slot].hinted - from);
+		++g_stats.readaheads;
+	}
+}
+
+// call with g_lock held; takes the next request, along with queued ones that
+// continue it in the same file; returns 0 on success, -1 if there's nothing
+// up to and including max_priority
+static int dequeue_batch(struct batch *batch, int max_priority)
+{
+	struct async_read *req = dequeue(max_priority);
+	if (!req)
+		return -1;
+	batch->reqs[0] = req;
+	batch->count = 1;
+	batch->priority = req->priority;
+	batch->fd = req->fd;
+	batch->offset = req->offset;
+	batch->size = req->size;
+	batch->result = 0;
+	batch->error = 0;
+	batch->hint_size = 0;
+	batch->hint_sequential = 0;
+
+	// NOTE: only within the same priority, or merging would promote reads
+	while (batch->count < ASYNC_READ_MAX_MERGE)
+	{
+		struct async_read *next = g_queue_head[batch->priority], *prev = NULL;
+		off_t end = batch->offset + (off_t)batch->size;
+		while (next && !(next->fd == batch->fd && next->offset == end
+			&& batch->size + next->size <= ASYNC_READ_MAX_MERGE_SIZE))
+		{
+			prev = next;
+			next = next->next;
+		}
+		if (!next)
+			break;
+		unlink_queued(next, prev);
+		batch->reqs[batch->count++] = next;
+		batch->size += next->size;
+		++g_stats.merged;
+	}
+
+	for (int i = 0; i < batch->count; ++i)
+		batch->reqs[i]->state = ASYNC_READ_ACTIVE;
+	if (batch->priority == ASYNC_READ_BACKGROUND)
+		++g_background_active;
+	else
+		++g_foreground_active;
+	track_stream(batch);
+	return 0;
+}
+
+// fills in iov for size bytes of the batch from offset from on, spread over
+// the requests' buffers; returns the number of entries
+static int batch_iovecs(const struct batch *batch, size_t from, size_t size,
+	struct iovec *iov)
+{
+	int count = 0;
+	size_t start = 0;	// of the current request within the batch
+	for (int i = 0; i < batch->count && size > 0; ++i)
+	{
+		const struct async_read *req = batch->reqs[i];
+		size_t end = start + req->size;
+		if (from < end)
+		{
+			size_t len = end - from;
+			if (len > size)
+				len = size;
+			iov[count].iov_base = (char *)req->buffer + (from - start);
+			iov[count].iov_len = len;
+			++count;
+			from += len;
+			size -= len;
+		}
+		start = end;
+	}
+	return count;
+}
+
+// switches the calling thread's I/O class to the one of given priority
+static void match_io_priority(int priority)
+{
+	if (priority == t_io_priority)
+		return;
+	thread_role_set_io_priority((pid_t)syscall(SYS_gettid),
+		g_io_priorities[priority].io_class, g_io_priorities[priority].io_level);
+	t_io_priority = priority;
+}
+
+static void advise_batch(const struct batch *batch)
+{
+	if (batch->hint_sequential)
+		posix_fadvise(batch->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (batch->hint_size)
+		posix_fadvise(batch->fd, batch->hint_offset, (off_t)batch->hint_size,
+			POSIX_FADV_WILLNEED);
+}
+
+static void complete_batch(struct batch *batch);
+static ssize_t read_batch(struct batch *batch, size_t done);
+
+// call with g_lock held; reads all queued foreground requests right away, for
+// a background read that would otherwise wait for another thread to do so
+static void serve_foreground(void)
+{
+	struct batch batch;
+	while (!g_quit && dequeue_batch(&batch, ASYNC_READ_NORMAL) == 0)
+	{
+		pthread_mutex_unlock(&g_lock);
+		advise_batch(&batch);
+		match_io_priority(batch.priority);
+		batch.result = read_batch(&batch, 0);
+		batch.error = batch.result < 0 ? errno : 0;
+		pthread_mutex_lock(&g_lock);
+		complete_batch(&batch);
+	}
+	match_io_priority(ASYNC_READ_BACKGROUND);
+}
+
+// reads the rest of the batch from done on, or up to EOF; background reads go
+// in chunks, and stop between them while foreground reads are pending
+static ssize_t read_batch(struct batch *batch, size_t done)
+{
+	int background = batch->priority == ASYNC_READ_BACKGROUND;
+	while (done < batch->size)
+	{
+		if (background && done > 0)
+		{
+			pthread_mutex_lock(&g_lock);
+			if (foreground_pending() && !g_quit)
+			{
+				++g_stats.preempted;
+				if (__atomic_load_n(&g_serve_inline, __ATOMIC_RELAXED))
+					serve_foreground();
+				while (foreground_pending() && !g_quit)
+					pthread_cond_wait(&g_done_cond, &g_lock);
+			}
+			pthread_mutex_unlock(&g_lock);
+		}
+
+		size_t size = batch->size - done;
+		if (background && size > ASYNC_READ_CHUNK)
+			size = ASYNC_READ_CHUNK;
+		int count = batch_iovecs(batch, done, size, batch->iov);
+		ssize_t n = preadv(batch->fd, batch->iov, count, batch->offset + (off_t)done);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;	// EOF
+		done += n;
+	}
+	return (ssize_t)done;
+}
+
+// call with g_lock held; hands the results out to the batch's requests
+static void complete_batch(struct batch *batch)
+{
+	if (batch->priority == ASYNC_READ_BACKGROUND)
+		--g_background_active;
+	else
+		--g_foreground_active;
+	int64_t now = now_ns();
+	size_t start = 0;
+	for (int i = 0; i < batch->count; ++i)
+	{
+		struct async_read *req = batch->reqs[i];
+		if (batch->result < 0)
+		{
+			req->result = -1;
+			req->error = batch->error;
+		}
+		else
+		{
+			// short only for the ones reaching past EOF
+			size_t got = (size_t)batch->result > start ? (size_t)batch->result - start : 0;
+			req->result = (ssize_t)(got < req->size ? got : req->size);
+			req->error = 0;
+		}
+		start += req->size;
+
+		int64_t latency = now - req->submit_time;
+		++g_stats.completed[req->priority];
+		if (req->result > 0)
+			g_stats.bytes[req->priority] += req->result;
+		g_stats.latency_sum[req->priority] += latency;
+		if ((uint64_t)latency > g_stats.latency_max[req->priority])
+			g_stats.latency_max[req->priority] = latency;
+		// NOTE: the callback runs before waiters see the read as done, so
+		// that it may e.g. hand the buffer over first
+		if (req->done)
+		{
+			pthread_mutex_unlock(&g_lock);
+			req->done(req);
+			pthread_mutex_lock(&g_lock);
+		}
+		__atomic_store_n(&req->state, ASYNC_READ_DONE, __ATOMIC_RELEASE);
+	}
+	// wakes both the waiters and background reads held back for this one
+	pthread_cond_broadcast(&g_done_cond);
+	// a background read may have become eligible
+	pthread_cond_signal(&g_work_cond);
+}
+
+
+// ============================================================================
+// io_uring, through the raw syscalls rather than liburing
+
+
+#ifdef SYS_io_uring_setup
+
+static int uring_init(struct uring *ring, unsigned entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = (int)syscall(SYS_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+		return -1;
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	// with IORING_FEAT_SINGLE_MMAP, both rings share one mapping
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED)
+	{
+		close(ring->fd);
+		return -1;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->cq_ring = ring->sq_ring;
+	else
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED)
+		{
+			munmap(ring->sq_ring, ring->sq_ring_size);
+			close(ring->fd);
+			return -1;
+		}
+	}
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+	{
+		if (ring->cq_ring != ring->sq_ring)
+			munmap(ring->cq_ring, ring->cq_ring_size);
+		munmap(ring->sq_ring, ring->sq_ring_size);
+		close(ring->fd);
+		return -1;
+	}
+
+	char *sq = (char *)ring->sq_ring, *cq = (char *)ring->cq_ring;
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+static void uring_destroy(struct uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->fd);
+}
+
+// takes the completions posted so far; returns how many there were
+static int uring_reap(struct uring *ring, struct batch *batches)
+{
+	int count = 0;
+	unsigned head = *ring->cq_head;
+	while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		struct batch *batch = &batches[cqe->user_data];
+		batch->result = cqe->res < 0 ? -1 : cqe->res;
+		batch->error = cqe->res < 0 ? -cqe->res : 0;
+		++head;
+		++count;
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+// reads foreground batches all at once, each with its own I/O priority;
+// returns -1 if the ring turned out unusable, 0 otherwise; either way, the
+// batches are done
+static int uring_read_batches(struct uring *ring, struct batch *batches, int count)
+{
+	unsigned tail = *ring->sq_tail;
+	for (int i = 0; i < count; ++i)
+	{
+		struct batch *batch = &batches[i];
+		unsigned index = tail & *ring->sq_mask;
+		struct io_uring_sqe *sqe = &ring->sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = batch->fd;
+		sqe->off = (uint64_t)batch->offset;
+		sqe->addr = (uint64_t)(uintptr_t)batch->iov;
+		sqe->len = (unsigned)batch_iovecs(batch, 0, batch->size, batch->iov);
+		sqe->ioprio = IOPRIO_PRIO_VALUE(g_io_priorities[batch->priority].io_class,
+			g_io_priorities[batch->priority].io_level);
+		sqe->user_data = (uint64_t)i;
+		ring->sq_array[index] = index;
+		batch->result = -1;
+		batch->error = EINPROGRESS;
+		++tail;
+	}
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	int submitted = 0, completed = 0, retval = 0, error = 0;
+	while (completed < count)
+	{
+		int ret = (int)syscall(SYS_io_uring_enter, ring->fd, count - submitted,
+			count - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			// whatever hasn't completed gets read below
+			retval = -1;
+			error = errno;
+			break;
+		}
+		submitted += ret;
+		completed += uring_reap(ring, batches);
+	}
+	// the kernel still writes into the buffers of what it took, so that has
+	// to finish before we read them again or the ring gets unmapped; the
+	// completions get posted even if waiting for them keeps failing
+	while (completed < submitted)
+	{
+		if (syscall(SYS_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS,
+			NULL, 0) < 0 && errno != EINTR)
+			usleep(1000);
+		completed += uring_reap(ring, batches);
+	}
+
+	// short reads needn't mean EOF with io_uring, and failures may be worth
+	// a retry in the plain way, so finish those off synchronously
+	for (int i = 0; i < count; ++i)
+	{
+		struct batch *batch = &batches[i];
+		if (batch->result >= 0 && (size_t)batch->result == batch->size)
+			continue;
+		if (batch->result < 0 && batch->error != EINTR && batch->error != EAGAIN
+			&& batch->error != EINPROGRESS)
+			continue;
+		match_io_priority(batch->priority);
+		batch->result = read_batch(batch, batch->result > 0 ? (size_t)batch->result : 0);
+		batch->error = batch->result < 0 ? errno : 0;
+	}
+	errno = error;
+	return retval;
+}
+
+#else
+
+static int uring_init(struct uring *ring, unsigned entries)
+{
+	(void)ring;
+	(void)entries;
+	errno = ENOSYS;
+	return -1;
+}
+
+static void uring_destroy(struct uring *ring)
+{
+	(void)ring;
+}
+
+static int uring_read_batches(struct uring *ring, struct batch *batches, int count)
+{
+	(void)ring;
+	(void)batches;
+	(void)count;
+	return -1;
+}
+
+#endif
+
+
+// ============================================================================
+
+
+static void *io_thread_main(void *arg)
+{
+	(void)arg;
+	pthread_setname_np(pthread_self(), "async-read");
+	thread_role_apply(THREAD_ROLE_WORKER, NULL);
+	memory_lock_prefault_stack(0);
+	struct uring ring;
+	int have_ring = g_use_uring && uring_init(&ring, ASYNC_READ_URING_DEPTH) == 0;
+	struct batch batches[ASYNC_READ_URING_DEPTH];
+
+	pthread_mutex_lock(&g_lock);
+	while (!g_quit)
+	{
+		if (dequeue_batch(&batches[0], ASYNC_READ_BACKGROUND) != 0)
+		{
+			pthread_cond_wait(&g_work_cond, &g_lock);
+			continue;
+		}
+		int count = 1;
+		int foreground = batches[0].priority != ASYNC_READ_BACKGROUND;
+		// with a ring, take more foreground reads to have in flight together
+		while (have_ring && foreground && count < ASYNC_READ_URING_DEPTH
+			&& dequeue_batch(&batches[count], ASYNC_READ_NORMAL) == 0)
+			++count;
+		pthread_mutex_unlock(&g_lock);
+
+		for (int i = 0; i < count; ++i)
+			advise_batch(&batches[i]);
+		if (have_ring && foreground)
+		{
+			if (uring_read_batches(&ring, batches, count) != 0)
+			{
+				printf("[Streaming] io_uring failed (%s), reading with preadv()\n",
+					strerror(errno));
+				uring_destroy(&ring);
+				have_ring = 0;
+			}
+		}
+		else
+		{
+			match_io_priority(batches[0].priority);
+			batches[0].result = read_batch(&batches[0], 0);
+			batches[0].error = batches[0].result < 0 ? errno : 0;
+		}
+
+		pthread_mutex_lock(&g_lock);
+		for (int i = 0; i < count; ++i)
+			complete_batch(&batches[i]);
+	}
+	pthread_mutex_unlock(&g_lock);
+	if (have_ring)
+		uring_destroy(&ring);
+	return NULL;
+}
+
+
+// ============================================================================
+
+
+int async_read_init(int num_threads)
+{
+	if (num_threads < 1)
+		num_threads = 1;
+	g_threads = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+	if (!g_threads)
+		return -1;
+	g_quit = 0;
+	memset(&g_stats, 0, sizeof(g_stats));
+	memset(g_streams, 0, sizeof(g_streams));
+
+	// see if the kernel lets us have a ring, unless told not to bother
+	const char *env = getenv(ASYNC_READ_URING_ENV);
+	g_use_uring = 0;
+	if (!env || atoi(env) != 0)
+	{
+		struct uring ring;
+		if (uring_init(&ring, ASYNC_READ_URING_DEPTH) == 0)
+		{
+			uring_destroy(&ring);
+			g_use_uring = 1;
+		}
+		else
+			printf("[Streaming] No io_uring (%s), reading with preadv()\n",
+				strerror(errno));
+	}
+	__atomic_store_n(&g_serve_inline, num_threads < 2, __ATOMIC_RELAXED);
+	for (g_num_threads = 0; g_num_threads < num_threads; ++g_num_threads)
+	{
+		if (pthread_create(&g_threads[g_num_threads], NULL, io_thread_main, NULL) != 0)
+		{
+			printf("[Streaming] Failed to start I/O thread %d\n", g_num_threads);
+			break;
+		}
+	}
+	if (g_num_threads < 2)
+		__atomic_store_n(&g_serve_inline, 1, __ATOMIC_RELAXED);
+	return g_num_threads > 0 ? 0 : -1;
+}
+
+void async_read_shutdown(void)
+{
+	pthread_mutex_lock(&g_lock);
+	g_quit = 1;
+	pthread_cond_broadcast(&g_work_cond);
+	pthread_cond_broadcast(&g_done_cond);
+	pthread_mutex_unlock(&g_lock);
+	for (int i = 0; i < g_num_threads; ++i)
+		pthread_join(g_threads[i], NULL);
+	free(g_threads);
+	g_threads = NULL;
+	g_num_threads = 0;
+	memset(g_queue_head, 0, sizeof(g_queue_head));
+	memset(g_queue_tail, 0, sizeof(g_queue_tail));
+}
+
+void async_read_submit(struct async_read *req)
+{
+	if (req->priority < 0 || req->priority >= ASYNC_READ_NUM_PRIORITIES)
+		req->priority = ASYNC_READ_NORMAL;
+	req->result = 0;
+	req->error = 0;
+	req->submit_time = now_ns();
+	req->next = NULL;
+
+	pthread_mutex_lock(&g_lock);
+	req->state = ASYNC_READ_QUEUED;
+	if (g_queue_tail[req->priority])
+		g_queue_tail[req->priority]->next = req;
+	else
+		g_queue_head[req->priority] = req;
+	g_queue_tail[req->priority] = req;
+	pthread_cond_signal(&g_work_cond);
+	pthread_mutex_unlock(&g_lock);
+}
+
+int async_read_cancel(struct async_read *req)
+{
+	int retval = -1;
+	pthread_mutex_lock(&g_lock);
+	if (req->state == ASYNC_READ_QUEUED)
+	{
+		struct async_read *it = g_queue_head[req->priority], *prev = NULL;
+		while (it && it != req)
+		{
+			prev = it;
+			it = it->next;
+		}
+		if (it)
+		{
+			unlink_queued(req, prev);
+			req->state = ASYNC_READ_IDLE;
+			retval = 0;
+		}
+	}
+	pthread_mutex_unlock(&g_lock);
+	return retval;
+}
+
+ssize_t async_read_wait(struct async_read *req)
+{
+	pthread_mutex_lock(&g_lock);
+	while (req->state != ASYNC_READ_DONE && req->state != ASYNC_READ_IDLE && !g_quit)
+		pthread_cond_wait(&g_done_cond, &g_lock);
+	pthread_mutex_unlock(&g_lock);
+	return req->result;
+}
+
+int async_read_is_done(const struct async_read *req)
+{
+	return __atomic_load_n(&req->state, __ATOMIC_ACQUIRE) == ASYNC_READ_DONE;
+}
+
+void async_read_get_stats(struct async_read_stats *stats)
+{
+	pthread_mutex_lock(&g_lock);
+	*stats = g_stats;
+	pthread_mutex_unlock(&g_lock);
+}
+
+const char *async_read_backend(void)
+{
+	return g_use_uring ? "io_uring" : "preadv";
+}
@@ -0,0 +1,119 @@
+// Asynchronous file reads ordered by I/O priority
+// Requests are queued per priority and served by a small pool of I/O threads,
+// which switch their own I/O class to match the request (see thread_role.h)
+// before every read, so that the kernel's I/O scheduler orders them as well.
+// Background requests are read in chunks, and the service holds them back
+// between chunks while any foreground request is queued or in flight, so that
+// streaming never adds latency to loads the game is waiting for
+// Queued requests that continue each other in the same file are merged into a
+// single vectored read, straight into each request's own buffer; reads that
+// follow on from the previous one in a file are taken for a sequential stream,
+// and get the kernel reading ahead of them with posix_fadvise()
+// Where the kernel allows it, every I/O thread also keeps an io_uring, so that
+// it has several foreground reads in flight at once, each with its own I/O
+// priority; set ASYNC_READ_URING=0 in the environment to stick to preadv()
+// For C++20 coroutines on top of this, see async_task.h
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>	// for off_t and ssize_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum async_read_priority
+{
+	ASYNC_READ_URGENT,		// the frame is waiting for it; best-effort, level 0
+	ASYNC_READ_NORMAL,		// needed soon; best-effort, level 4
+	ASYNC_READ_BACKGROUND,	// streaming, prefetching; idle class
+	ASYNC_READ_NUM_PRIORITIES
+};
+
+enum async_read_state
+{
+	ASYNC_READ_IDLE,		// not submitted yet, or cancelled
+	ASYNC_READ_QUEUED,
+	ASYNC_READ_ACTIVE,
+	ASYNC_READ_DONE
+};
+
+// background requests are read in chunks of this size
+#define ASYNC_READ_CHUNK	(256 * 1024)
+// bounds of merged reads
+#define ASYNC_READ_MAX_MERGE		16
+#define ASYNC_READ_MAX_MERGE_SIZE	(1024 * 1024)
+// how far ahead of a sequential stream we ask the kernel to read
+#define ASYNC_READ_READAHEAD		(2 * 1024 * 1024)
+// foreground reads an I/O thread keeps in flight with io_uring
+#define ASYNC_READ_URING_DEPTH		8
+#define ASYNC_READ_URING_ENV		"ASYNC_READ_URING"
+
+struct async_read;
+// completion callback; runs on an I/O thread, so keep it short
+typedef void (*async_read_func)(struct async_read *req);
+
+// a read request; owned by the caller, and must stay alive until it's done
+struct async_read
+{
+	// filled in by the caller
+	int fd;
+	off_t offset;
+	size_t size;
+	void *buffer;
+	int priority;			// one of ASYNC_READ_*
+	async_read_func done;	// may be NULL
+	void *arg;				// for the callback's use
+	// filled in by the service
+	ssize_t result;			// bytes read (short only at EOF), or -1
+	int error;				// errno if result is -1
+	int state;				// one of the async_read_state values
+	int64_t submit_time;	// CLOCK_MONOTONIC ns, for the latency stats
+	struct async_read *next;
+};
+
+struct async_read_stats
+{
+	uint64_t completed[ASYNC_READ_NUM_PRIORITIES];
+	uint64_t bytes[ASYNC_READ_NUM_PRIORITIES];
+	// from submission to completion, in ns
+	uint64_t latency_sum[ASYNC_READ_NUM_PRIORITIES];
+	uint64_t latency_max[ASYNC_READ_NUM_PRIORITIES];
+	// times a background read was held back for foreground ones
+	uint64_t preempted;
+	uint64_t merged;		// requests served as part of an earlier one's read
+	uint64_t readaheads;	// readahead hints issued for sequential streams
+};
+
+// starts the I/O threads; a single one reads foreground requests itself in
+// between the chunks of a background read, which may then delay them by up to
+// a chunk; with more, one is always free for them; returns 0 on success
+int async_read_init(int num_threads);
+
+// stops and joins the I/O threads; requests still queued are not served
+void async_read_shutdown(void);
+
+// queues a read
+void async_read_submit(struct async_read *req);
+
+// removes a read from its queue if it hasn't been started yet
+// returns 0 if it was cancelled, -1 if it's too late
+int async_read_cancel(struct async_read *req);
+
+// blocks until the read is done; returns its result
+ssize_t async_read_wait(struct async_read *req);
+
+// non-zero if the read is done
+int async_read_is_done(const struct async_read *req);
+
+// copies out the stats so far
+void async_read_get_stats(struct async_read_stats *stats);
+
+// "io_uring" or "preadv", once initialized
+const char *async_read_backend(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+// C++20 coroutines on top of async_read.h
+// co_await async_read_co(...) suspends the coroutine until the read is done,
+// and resumes it on whichever thread drains the given resume queue, e.g. the
+// game thread once per frame; the I/O threads thus never run game code, and
+// the game code never needs to be thread-safe against itself
+// async_task is the fire-and-forget coroutine type to go with it: it starts
+// right away, and frees itself once it returns
+//
+//	async_task load(async_resume_queue *queue, int fd, char *buf)
+//	{
+//		ssize_t n = co_await async_read_co(queue, fd, 0, 4096, buf);
+//		...
+//	}
+//
+// NOTE: needs -std=c++20
+
+#pragma once
+
+#include <coroutine>
+#include <exception>	// for std::terminate()
+#include <pthread.h>
+
+#include "async_read.h"
+
+// coroutines waiting to be resumed on the thread that drains the queue
+struct async_resume_queue
+{
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+	struct async_read_op *head = nullptr;
+	struct async_read_op *tail = nullptr;
+
+	// resumes all the coroutines queued so far; returns how many
+	inline int run();
+	// same, but first blocks until there's at least one, e.g. for a loading
+	// screen with nothing else to do
+	inline int wait_and_run();
+};
+
+// the awaitable; it's the request itself, and lives in the coroutine's frame
+struct async_read_op
+{
+	struct async_read req = {};
+	async_resume_queue *queue;
+	std::coroutine_handle<> handle;
+	async_read_op *next = nullptr;
+
+	async_read_op(async_resume_queue *queue, int fd, off_t offset, size_t size,
+		void *buffer, int priority)
+		: queue(queue)
+	{
+		req.fd = fd;
+		req.offset = offset;
+		req.size = size;
+		req.buffer = buffer;
+		req.priority = priority;
+		req.done = on_done;
+	}
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		handle = h;
+		req.arg = this;
+		async_read_submit(&req);
+	}
+
+	// bytes read, or -1 with errno in req.error
+	ssize_t await_resume() const noexcept
+	{
+		return req.result;
+	}
+
+	static void on_done(struct async_read *req)
+	{
+		async_read_op *op = (async_read_op *)req->arg;
+		pthread_mutex_lock(&op->queue->lock);
+		if (op->queue->tail)
+			op->queue->tail->next = op;
+		else
+			op->queue->head = op;
+		op->queue->tail = op;
+		pthread_cond_signal(&op->queue->cond);
+		pthread_mutex_unlock(&op->queue->lock);
+	}
+};
+
+int async_resume_queue::run()
+{
+	pthread_mutex_lock(&lock);
+	async_read_op *op = head;
+	head = tail = nullptr;
+	pthread_mutex_unlock(&lock);
+
+	int count = 0;
+	while (op)
+	{
+		// resuming may well end up destroying op along with its frame
+		async_read_op *next = op->next;
+		// the service still marks the request done after the callback, which
+		// has to happen first; it's a matter of taking its lock once
+		async_read_wait(&op->req);
+		op->handle.resume();
+		op = next;
+		++count;
+	}
+	return count;
+}
+
+int async_resume_queue::wait_and_run()
+{
+	pthread_mutex_lock(&lock);
+	while (!head)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+	return run();
+}
+
+// reads size bytes at offset of fd into buffer; co_await it for the result,
+// which comes once the queue gets run
+inline async_read_op async_read_co(async_resume_queue *queue, int fd, off_t offset,
+	size_t size, void *buffer, int priority = ASYNC_READ_NORMAL)
+{
+	return async_read_op(queue, fd, offset, size, buffer, priority);
+}
+
+// fire-and-forget coroutine
+struct async_task
+{
+	struct promise_type
+	{
+		async_task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
@@ -0,0 +1,270 @@
+// Synchronous versus asynchronous asset loading from a set of files
+// Every file gets read in full, in chunks as an asset loader parsing it would:
+// first with plain pread() on the loading thread, then through async_read with
+// completion callbacks, and then with coroutines, one per file, resumed on the
+// loading thread. The page cache is dropped before each pass, and we measure
+// throughput and when each file became available
+// To build:	make
+// To run:	./io_bench [directory] [number of files]	# created if need be
+// ASYNC_READ_URING=0 in the environment compares against preadv() only
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>	// for std::sort
+
+#include "async_read.h"
+#include "async_task.h"
+
+#define CHUNK_SIZE		(64 * 1024)
+#define MIN_FILE_SIZE	(16 * 1024)
+#define MAX_FILE_SIZE	(2 * 1024 * 1024)
+
+struct asset
+{
+	int fd;
+	size_t size;
+	char *buffer;
+	int num_chunks;
+	struct async_read *chunks;
+	int pending;			// chunks not done yet
+	int64_t loaded;			// when it was complete, in ns since the start
+};
+
+static struct asset *g_assets = NULL;
+static int g_num_assets = 0;
+static int64_t g_start = 0;
+
+
+// ============================================================================
+
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int open_asset(const char *dir, int index, struct asset *asset)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/asset%03d.bin", dir, index);
+	asset->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (asset->fd < 0)
+		return -1;
+	// sizes skewed towards small files, as asset sets are
+	size_t wanted = MIN_FILE_SIZE;
+	unsigned roll = (unsigned)(index * 2654435761u) >> 16;
+	while (wanted < MAX_FILE_SIZE && roll % 3 != 0)
+	{
+		wanted *= 2;
+		roll /= 3;
+	}
+	wanted += (roll % 16) * 4096;
+
+	struct stat st;
+	if (fstat(asset->fd, &st) == 0 && st.st_size > 0)
+		asset->size = (size_t)st.st_size;
+	else
+	{
+		char *block = (char *)malloc(wanted);
+		for (size_t i = 0; i < wanted; ++i)
+			block[i] = (char)(i * 31 + index);
+		ssize_t n = pwrite(asset->fd, block, wanted, 0);
+		free(block);
+		if (n != (ssize_t)wanted)
+			return -1;
+		fsync(asset->fd);
+		asset->size = wanted;
+	}
+	asset->buffer = (char *)malloc(asset->size);
+	asset->num_chunks = (int)((asset->size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+	asset->chunks = (struct async_read *)calloc(asset->num_chunks, sizeof(struct async_read));
+	return asset->buffer && asset->chunks ? 0 : -1;
+}
+
+static void drop_caches(void)
+{
+	for (int i = 0; i < g_num_assets; ++i)
+	{
+		posix_fadvise(g_assets[i].fd, 0, 0, POSIX_FADV_DONTNEED);
+		g_assets[i].loaded = 0;
+		memset(g_assets[i].buffer, 0, g_assets[i].size);
+	}
+	g_start = now_ns();
+}
+
+static void report(const char *label)
+{
+	int64_t total = now_ns() - g_start;
+	size_t bytes = 0;
+	int64_t *loaded = (int64_t *)malloc(g_num_assets * sizeof(int64_t));
+	for (int i = 0; i < g_num_assets; ++i)
+	{
+		bytes += g_assets[i].size;
+		loaded[i] = g_assets[i].loaded;
+		// what we read has to be what was written
+		if (g_assets[i].buffer[g_assets[i].size - 1] != (char)((g_assets[i].size - 1) * 31 + i))
+			printf("[IOBench] %s: asset %d is corrupt!\n", label, i);
+	}
+	std::sort(loaded, loaded + g_num_assets);
+	printf("[IOBench] %-10s %7.1f MiB/s, files available after p50 %7.2f  p90 %7.2f  "
+		"max %7.2f ms\n", label, bytes / 1048576.0 / (total / 1e9),
+		loaded[g_num_assets / 2] / 1e6, loaded[g_num_assets * 9 / 10] / 1e6,
+		loaded[g_num_assets - 1] / 1e6);
+	free(loaded);
+}
+
+
+// ============================================================================
+// the three ways of loading
+
+
+static void load_sync(void)
+{
+	for (int i = 0; i < g_num_assets; ++i)
+	{
+		struct asset *asset = &g_assets[i];
+		for (size_t done = 0; done < asset->size; done += CHUNK_SIZE)
+		{
+			size_t size = std::min((size_t)CHUNK_SIZE, asset->size - done);
+			if (pread(asset->fd, asset->buffer + done, size, (off_t)done) != (ssize_t)size)
+				printf("[IOBench] Short read of asset %d\n", i);
+		}
+		asset->loaded = now_ns() - g_start;
+	}
+}
+
+static void chunk_done(struct async_read *req)
+{
+	struct asset *asset = (struct asset *)req->arg;
+	if (req->result != (ssize_t)req->size)
+		printf("[IOBench] Short read of asset %d\n", (int)(asset - g_assets));
+	if (__atomic_sub_fetch(&asset->pending, 1, __ATOMIC_ACQ_REL) == 0)
+		asset->loaded = now_ns() - g_start;
+}
+
+// everything submitted up front; adjacent chunks get merged
+static void load_callbacks(void)
+{
+	for (int i = 0; i < g_num_assets; ++i)
+	{
+		struct asset *asset = &g_assets[i];
+		asset->pending = asset->num_chunks;
+		for (int c = 0; c < asset->num_chunks; ++c)
+		{
+			struct async_read *req = &asset->chunks[c];
+			memset(req, 0, sizeof(*req));
+			req->fd = asset->fd;
+			req->offset = (off_t)c * CHUNK_SIZE;
+			req->size = std::min((size_t)CHUNK_SIZE, asset->size - (size_t)req->offset);
+			req->buffer = asset->buffer + req->offset;
+			req->priority = ASYNC_READ_NORMAL;
+			req->done = chunk_done;
+			req->arg = asset;
+			async_read_submit(req);
+		}
+	}
+	for (int i = 0; i < g_num_assets; ++i)
+		for (int c = 0; c < g_assets[i].num_chunks; ++c)
+			async_read_wait(&g_assets[i].chunks[c]);
+}
+
+static int g_tasks_pending = 0;
+
+// one chunk after another, as a parser that needs the header before it knows
+// what comes next would; the reads form a sequential stream
+static async_task load_asset(async_resume_queue *queue, struct asset *asset)
+{
+	for (size_t done = 0; done < asset->size; done += CHUNK_SIZE)
+	{
+		size_t size = std::min((size_t)CHUNK_SIZE, asset->size - done);
+		ssize_t n = co_await async_read_co(queue, asset->fd, (off_t)done, size,
+			asset->buffer + done);
+		if (n != (ssize_t)size)
+			printf("[IOBench] Short read of asset %d\n", (int)(asset - g_assets));
+	}
+	asset->loaded = now_ns() - g_start;
+	--g_tasks_pending;
+}
+
+static void load_coroutines(void)
+{
+	async_resume_queue queue;
+	g_tasks_pending = g_num_assets;
+	for (int i = 0; i < g_num_assets; ++i)
+		load_asset(&queue, &g_assets[i]);
+	while (g_tasks_pending > 0)
+		queue.wait_and_run();
+}
+
+
+// ============================================================================
+
+
+int main(int argc, char *argv[])
+{
+	const char *dir = argc > 1 ? argv[1] : "io_bench.d";
+	g_num_assets = argc > 2 ? atoi(argv[2]) : 64;
+	if (g_num_assets <= 0)
+	{
+		printf("Usage: %s [directory] [number of files]\n", argv[0]);
+		return 1;
+	}
+	mkdir(dir, 0755);
+	g_assets = (struct asset *)calloc(g_num_assets, sizeof(struct asset));
+	size_t total = 0;
+	for (int i = 0; i < g_num_assets; ++i)
+	{
+		if (open_asset(dir, i, &g_assets[i]) != 0)
+		{
+			perror("[IOBench] Failed to set up the files");
+			return 1;
+		}
+		total += g_assets[i].size;
+	}
+	if (async_read_init(2) != 0)
+	{
+		printf("[IOBench] Failed to start the I/O threads\n");
+		return 1;
+	}
+	printf("[IOBench] %d files, %.1f MiB, read in %d KiB chunks, backend %s\n",
+		g_num_assets, total / 1048576.0, CHUNK_SIZE / 1024, async_read_backend());
+
+	drop_caches();
+	load_sync();
+	report("sync");
+
+	drop_caches();
+	load_callbacks();
+	report("callbacks");
+
+	drop_caches();
+	load_coroutines();
+	report("coroutines");
+
+	struct async_read_stats stats;
+	async_read_get_stats(&stats);
+	printf("[IOBench] async: %llu reads, %llu merged into others, %llu readahead hints, "
+		"latency avg %.2f max %.2f ms\n",
+		(unsigned long long)stats.completed[ASYNC_READ_NORMAL],
+		(unsigned long long)stats.merged, (unsigned long long)stats.readaheads,
+		stats.latency_sum[ASYNC_READ_NORMAL] / 1e6
+			/ (stats.completed[ASYNC_READ_NORMAL] ? stats.completed[ASYNC_READ_NORMAL] : 1),
+		stats.latency_max[ASYNC_READ_NORMAL] / 1e6);
+
+	async_read_shutdown();
+	for (int i = 0; i < g_num_assets; ++i)
+	{
+		close(g_assets[i].fd);
+		free(g_assets[i].buffer);
+		free(g_assets[i].chunks);
+	}
+	free(g_assets);
+	return 0;
+}
@@ -0,0 +1,241 @@
+// Asset packs read in place through a memory mapping, see pack.h
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pack.h"
+
+struct pack
+{
+	const char *base;
+	size_t size;
+	const struct pack_header *header;
+	const struct pack_entry *entries;
+	const char *names;
+};
+
+
+// ============================================================================
+
+
+static size_t page_size(void)
+{
+	static size_t size = 0;
+	if (!size)
+		size = (size_t)sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+// madvise() wants page-aligned addresses; assets start on one, but a pack
+// built with a smaller alignment than our page size would break that
+static void advise(const struct pack_asset *asset, int advice)
+{
+	if (!asset->size)
+		return;
+	uintptr_t start = (uintptr_t)asset->data & ~(uintptr_t)(page_size() - 1);
+	uintptr_t end = (uintptr_t)asset->data + asset->size;
+	madvise((void *)start, end - start, advice);
+}
+
+// checks everything we're going to trust later, so that a corrupt pack fails
+// to open rather than crash us on a lookup
+static int validate(const struct pack *pack)
+{
+	const struct pack_header *header = pack->header;
+	if (pack->size < sizeof(*header) || memcmp(header->magic, PACK_MAGIC, 8) != 0
+		|| header->version != PACK_VERSION || header->file_size != pack->size)
+		return -1;
+	uint64_t toc_end = sizeof(*header) + (uint64_t)header->num_entries * sizeof(struct pack_entry);
+	if (toc_end > header->names_offset || header->names_offset > pack->size
+		|| header->names_size > pack->size - header->names_offset
+		|| header->data_offset < header->names_offset + header->names_size
+		|| header->data_offset > pack->size)
+		return -1;
+
+	for (uint32_t i = 0; i < header->num_entries; ++i)
+	{
+		const struct pack_entry *entry = &pack->entries[i];
+		if (entry->offset < header->data_offset || entry->offset > pack->size
+			|| entry->size > pack->size - entry->offset
+			|| (uint64_t)entry->name_offset + entry->name_size >= header->names_size
+			|| pack->names[entry->name_offset + entry->name_size] != 0
+			|| entry->hash != pack_hash(pack->names + entry->name_offset, entry->name_size))
+			return -1;
+		if (i > 0)
+		{
+			// sorted, or lookups would miss
+			const struct pack_entry *prev = &pack->entries[i - 1];
+			if (prev->hash > entry->hash || (prev->hash == entry->hash
+				&& strcmp(pack->names + prev->name_offset, pack->names + entry->name_offset) >= 0))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+static void fill_asset(const struct pack *pack, const struct pack_entry *entry,
+	struct pack_asset *asset)
+{
+	asset->data = pack->base + entry->offset;
+	asset->size = (size_t)entry->size;
+	asset->name = pack->names + entry->name_offset;
+}
+
+
+// ============================================================================
+
+
+uint64_t pack_hash(const char *name, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= (unsigned char)name[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+struct pack *pack_open(const char *path, int flags)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	struct pack *pack = (struct pack *)calloc(1, sizeof(*pack));
+	if (!pack)
+	{
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pack->size = (size_t)st.st_size;
+	// shared and read-only: the pages are the page cache's, and never dirty
+	void *base = pack->size ? mmap(NULL, pack->size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	int error = pack->size ? errno : EINVAL;
+	close(fd);	// the mapping keeps the file
+	if (base == MAP_FAILED)
+	{
+		free(pack);
+		errno = error;
+		return NULL;
+	}
+	pack->base = (const char *)base;
+	pack->header = (const struct pack_header *)base;
+	pack->entries = (const struct pack_entry *)(pack->header + 1);
+	pack->names = pack->base + (pack->size >= sizeof(struct pack_header)
+		? pack->header->names_offset : 0);
+	if (validate(pack) != 0)
+	{
+		printf("[Pack] %s is not a valid pack\n", path);
+		munmap(base, pack->size);
+		free(pack);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// the table of contents gets binary searched, i.e. hit all over
+	madvise(base, pack->header->data_offset, MADV_WILLNEED);
+	if (flags & PACK_PREFETCH)
+		madvise(base, pack->size, MADV_WILLNEED);
+	// a pack can be gigabytes of data we have on disk anyway
+	if (!(flags & PACK_DUMP))
+		madvise(base, pack->size, MADV_DONTDUMP);
+	return pack;
+}
+
+void pack_close(struct pack *pack)
+{
+	if (!pack)
+		return;
+	munmap((void *)pack->base, pack->size);
+	free(pack);
+}
+
+int pack_find(const struct pack *pack, const char *name, struct pack_asset *asset)
+{
+	size_t size = strlen(name);
+	uint64_t hash = pack_hash(name, size);
+	// the first entry with our hash
+	uint32_t lo = 0, hi = pack->header->num_entries;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (pack->entries[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < pack->header->num_entries && pack->entries[lo].hash == hash; ++lo)
+	{
+		const struct pack_entry *entry = &pack->entries[lo];
+		if (entry->name_size == size
+			&& memcmp(pack->names + entry->name_offset, name, size) == 0)
+		{
+			fill_asset(pack, entry, asset);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+uint32_t pack_count(const struct pack *pack)
+{
+	return pack->header->num_entries;
+}
+
+void pack_get(const struct pack *pack, uint32_t index, struct pack_asset *asset)
+{
+	fill_asset(pack, &pack->entries[index], asset);
+}
+
+void pack_prefetch(const struct pack_asset *asset)
+{
+	advise(asset, MADV_WILLNEED);
+}
+
+void pack_sequential(const struct pack_asset *asset)
+{
+	advise(asset, MADV_SEQUENTIAL);
+}
+
+void pack_evict(const struct pack_asset *asset)
+{
+	// NOTE: on a shared file mapping this only unmaps the pages from us, it
+	// never throws data away
+	advise(asset, MADV_DONTNEED);
+}
+
+size_t pack_mapped_size(const struct pack *pack)
+{
+	return pack->size;
+}
+
+size_t pack_resident_size(const struct pack *pack)
+{
+	size_t page = page_size();
+	size_t pages = (pack->size + page - 1) / page;
+	unsigned char *vec = (unsigned char *)malloc(pages);
+	if (!vec)
+		return 0;
+	size_t resident = 0;
+	if (mincore((void *)pack->base, pack->size, vec) == 0)
+	{
+		for (size_t i = 0; i < pages; ++i)
+			resident += vec[i] & 1;
+	}
+	free(vec);
+	return resident * page;
+}
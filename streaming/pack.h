@@ -0,0 +1,93 @@
+// Asset packs: many files in one, read in place through a memory mapping
+// Loading an asset by reading it into a malloc()ed buffer leaves its data in
+// memory twice, once in the page cache and once in the heap. A pack is mapped
+// read-only and shared instead, so that an asset's data is the page cache
+// itself: clean file pages, which the kernel can drop and read back at any
+// time rather than swap, which stay out of the heaps and their budgets (see
+// game/heap.h), and which we keep out of core dumps
+// Layout, all in native byte order:
+// - the header, at offset 0
+// - the table of contents, right after it: one entry per asset, sorted by the
+//   hash of the name and then by the name, so it's searched in place
+// - the names, NUL-terminated
+// - the assets' data, each starting on a page boundary, so that every asset
+//   can be advised, prefetched and evicted on its own
+// pack_build creates packs from a directory
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACK_MAGIC		"ASSETPK1"
+#define PACK_VERSION	1
+#define PACK_ALIGNMENT	4096
+
+struct pack_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_entries;
+	uint64_t names_offset;
+	uint64_t names_size;
+	uint64_t data_offset;
+	uint64_t file_size;
+};
+
+struct pack_entry
+{
+	uint64_t hash;		// pack_hash() of the name
+	uint64_t offset;	// of the data, from the start of the file
+	uint64_t size;
+	uint32_t name_offset;	// from names_offset
+	uint32_t name_size;		// without the NUL
+};
+
+// an asset in an open pack; data points into the mapping, and stays valid
+// until the pack is closed
+struct pack_asset
+{
+	const void *data;
+	size_t size;
+	const char *name;
+};
+
+// pack_open() flags
+#define PACK_PREFETCH	1	// start reading the whole pack in right away
+#define PACK_DUMP		2	// include the pack in core dumps after all
+
+struct pack;
+
+// 64-bit FNV-1a of a name, as used by the table of contents
+uint64_t pack_hash(const char *name, size_t size);
+
+// maps a pack and checks it; returns NULL on failure, with errno set
+struct pack *pack_open(const char *path, int flags);
+void pack_close(struct pack *pack);
+
+// looks an asset up by name; returns 0 if found, -1 otherwise
+int pack_find(const struct pack *pack, const char *name, struct pack_asset *asset);
+
+// number of assets, and the index-th of them in table order
+uint32_t pack_count(const struct pack *pack);
+void pack_get(const struct pack *pack, uint32_t index, struct pack_asset *asset);
+
+// hints for an asset's pages: prefetch starts reading them in the background;
+// sequential makes the kernel read ahead aggressively and drop pages behind;
+// evict drops them from our mapping (they stay in the page cache while the
+// kernel has room for them)
+void pack_prefetch(const struct pack_asset *asset);
+void pack_sequential(const struct pack_asset *asset);
+void pack_evict(const struct pack_asset *asset);
+
+// bytes of the pack mapped, and how much of that is resident in memory
+size_t pack_mapped_size(const struct pack *pack);
+size_t pack_resident_size(const struct pack *pack);
+
+#ifdef __cplusplus
+}
+#endif
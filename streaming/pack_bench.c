@@ -0,0 +1,201 @@
+// Loading assets by copying them into heap buffers versus reading them in
+// place from a pack
+// Loads every file under a directory with read() into malloc()ed buffers,
+// then every asset of the pack built from it through the mapping, with the
+// page cache dropped before each; compares the time, and what it costs in
+// anonymous (heap) versus file-backed memory
+// To build:	make
+// To run:	./pack_build <directory> <pack> && ./pack_bench <directory> <pack>
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pack.h"
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// RssAnon and RssFile from /proc/self/status, in KiB
+static void rss(long *anon, long *file)
+{
+	char line[256];
+	*anon = *file = 0;
+	FILE *status = fopen("/proc/self/status", "r");
+	if (!status)
+		return;
+	while (fgets(line, sizeof(line), status))
+	{
+		sscanf(line, "RssAnon: %ld", anon);
+		sscanf(line, "RssFile: %ld", file);
+	}
+	fclose(status);
+}
+
+// stands in for actually using the data; touches every page
+static unsigned checksum(const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	unsigned sum = 0;
+	for (size_t i = 0; i < size; i += 512)
+		sum += p[i];
+	return sum;
+}
+
+static void drop_cache(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+
+// ============================================================================
+
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		printf("Usage: %s <directory> <pack built from it>\n", argv[0]);
+		return 1;
+	}
+	struct pack *pack = pack_open(argv[2], 0);
+	if (!pack)
+	{
+		perror("[PackBench] Failed to open the pack");
+		return 1;
+	}
+	uint32_t count = pack_count(pack);
+	size_t total = 0;
+	char path[4096];
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		struct pack_asset asset;
+		pack_get(pack, i, &asset);
+		total += asset.size;
+		snprintf(path, sizeof(path), "%s/%s", argv[1], asset.name);
+		drop_cache(path);
+	}
+	printf("[PackBench] %u assets, %.1f MiB\n", count, total / 1048576.0);
+
+	// the way it's done without packs: a copy of every file on the heap
+	long anon_before, file_before, anon, file;
+	rss(&anon_before, &file_before);
+	void **copies = (void **)calloc(count, sizeof(void *));
+	if (count && !copies)
+	{
+		perror("[PackBench] Failed to allocate");
+		return 1;
+	}
+	unsigned sum_copies = 0;
+	int64_t start = now_ns();
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		struct pack_asset asset;
+		pack_get(pack, i, &asset);
+		snprintf(path, sizeof(path), "%s/%s", argv[1], asset.name);
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		copies[i] = malloc(asset.size ? asset.size : 1);
+		if (!copies[i])
+		{
+			perror("[PackBench] Failed to allocate");
+			return 1;
+		}
+		if (fd < 0 || read(fd, copies[i], asset.size) != (ssize_t)asset.size)
+			printf("[PackBench] Failed to read %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		sum_copies += checksum(copies[i], asset.size);
+	}
+	int64_t elapsed = now_ns() - start;
+	rss(&anon, &file);
+	printf("[PackBench] read():  %7.2f ms, heap +%7.1f MiB, file pages mapped +%7.1f MiB\n",
+		elapsed / 1e6, (anon - anon_before) / 1024.0, (file - file_before) / 1024.0);
+	for (uint32_t i = 0; i < count; ++i)
+		free(copies[i]);
+	free(copies);
+
+	// in place, from the pack's pages
+	pack_close(pack);
+	drop_cache(argv[2]);
+	pack = pack_open(argv[2], 0);
+	if (!pack)
+	{
+		perror("[PackBench] Failed to reopen the pack");
+		return 1;
+	}
+	rss(&anon_before, &file_before);
+	unsigned sum_pack = 0;
+	start = now_ns();
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		struct pack_asset asset;
+		pack_get(pack, i, &asset);
+		pack_sequential(&asset);
+		sum_pack += checksum(asset.data, asset.size);
+	}
+	elapsed = now_ns() - start;
+	rss(&anon, &file);
+	printf("[PackBench] pack:    %7.2f ms, heap +%7.1f MiB, file pages mapped +%7.1f MiB\n",
+		elapsed / 1e6, (anon - anon_before) / 1024.0, (file - file_before) / 1024.0);
+	if (sum_pack != sum_copies)
+		printf("[PackBench] The pack's data differs from the files!\n");
+
+	// lookups by name, straight off the mapped table of contents
+	char **names = (char **)calloc(count, sizeof(char *));
+	if (count && !names)
+	{
+		perror("[PackBench] Failed to allocate");
+		return 1;
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		struct pack_asset asset;
+		pack_get(pack, i, &asset);
+		names[i] = strdup(asset.name);
+	}
+	size_t found = 0;
+	start = now_ns();
+	for (int round = 0; round < 100; ++round)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			struct pack_asset asset;
+			found += pack_find(pack, names[(i * (size_t)7919) % count], &asset) == 0;
+		}
+	}
+	elapsed = now_ns() - start;
+	printf("[PackBench] lookups: %.0f ns each, %zu of %zu found; %.1f of %.1f MiB "
+		"resident\n", count ? (double)elapsed / (100.0 * count) : 0, found, 100 * (size_t)count,
+		pack_resident_size(pack) / 1048576.0, pack_mapped_size(pack) / 1048576.0);
+
+	// dropping our mapping of the pages doesn't throw the data away
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		struct pack_asset asset;
+		pack_get(pack, i, &asset);
+		pack_evict(&asset);
+	}
+	rss(&anon, &file);
+	printf("[PackBench] evicted: file pages mapped +%.1f MiB, %.1f MiB still in "
+		"the page cache\n", (file - file_before) / 1024.0,
+		pack_resident_size(pack) / 1048576.0);
+
+	for (uint32_t i = 0; i < count; ++i)
+		free(names[i]);
+	free(names);
+	pack_close(pack);
+	return 0;
+}
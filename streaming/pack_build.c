@@ -0,0 +1,216 @@
+// Builds an asset pack from all the files under a directory, see pack.h
+// Asset names are the paths relative to the directory
+// To build:	make
+// To run:	./pack_build <directory> <pack>
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pack.h"
+
+struct input
+{
+	char *path;		// to open it
+	const char *name;	// within path
+	size_t name_size;
+	uint64_t hash;
+	uint64_t size;
+};
+
+static struct input *g_inputs = NULL;
+static int g_num_inputs = 0;
+static int g_capacity = 0;
+static size_t g_root_size = 0;	// of the directory's path, with the slash
+
+
+// ============================================================================
+
+
+static int collect(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	(void)ftw;
+	if (type != FTW_F || !S_ISREG(st->st_mode))
+		return 0;
+	if (g_num_inputs == g_capacity)
+	{
+		g_capacity = g_capacity ? g_capacity * 2 : 256;
+		g_inputs = (struct input *)realloc(g_inputs, g_capacity * sizeof(struct input));
+		if (!g_inputs)
+			return -1;
+	}
+	struct input *input = &g_inputs[g_num_inputs++];
+	input->path = strdup(path);
+	if (!input->path)
+		return -1;
+	input->name = input->path + g_root_size;
+	input->name_size = strlen(input->name);
+	input->hash = pack_hash(input->name, input->name_size);
+	input->size = (uint64_t)st->st_size;
+	return 0;
+}
+
+// the order the table of contents gets searched in
+static int compare(const void *a, const void *b)
+{
+	const struct input *x = (const struct input *)a, *y = (const struct input *)b;
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return strcmp(x->name, y->name);
+}
+
+static uint64_t align(uint64_t offset)
+{
+	return (offset + PACK_ALIGNMENT - 1) & ~(uint64_t)(PACK_ALIGNMENT - 1);
+}
+
+// copies size bytes of the file at path to out at offset, in the kernel
+// where possible
+static int copy_data(const char *path, uint64_t size, int out, uint64_t offset)
+{
+	int in = open(path, O_RDONLY | O_CLOEXEC);
+	if (in < 0)
+		return -1;
+	loff_t in_offset = 0, out_offset = (loff_t)offset;
+	while ((uint64_t)in_offset < size)
+	{
+		ssize_t n = copy_file_range(in, &in_offset, out, &out_offset,
+			size - in_offset, 0);
+		if (n > 0)
+			continue;
+		if (n == 0)
+			break;	// the file shrank under us
+		if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+		{
+			close(in);
+			return -1;
+		}
+		// not supported between these files, so do it by hand
+		char buffer[1 << 16];
+		n = pread(in, buffer, sizeof(buffer), in_offset);
+		if (n == 0)
+			break;	// the file shrank under us
+		if (n < 0 || pwrite(out, buffer, n, out_offset) != n)
+		{
+			close(in);
+			return -1;
+		}
+		in_offset += n;
+		out_offset += n;
+	}
+	close(in);
+	if ((uint64_t)in_offset != size)
+	{
+		errno = ENODATA;
+		return -1;
+	}
+	return 0;
+}
+
+
+// ============================================================================
+
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3)
+	{
+		printf("Usage: %s <directory> <pack>\n", argv[0]);
+		return 1;
+	}
+	const char *root = argv[1];
+	g_root_size = strlen(root);
+	while (g_root_size > 1 && root[g_root_size - 1] == '/')
+		--g_root_size;
+	++g_root_size;	// the slash after it
+	if (nftw(root, collect, 64, FTW_PHYS) != 0)
+	{
+		printf("[Pack] Failed to scan %s: %s\n", root, strerror(errno));
+		return 1;
+	}
+	qsort(g_inputs, g_num_inputs, sizeof(struct input), compare);
+
+	// lay it all out first
+	struct pack_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+	header.version = PACK_VERSION;
+	header.num_entries = (uint32_t)g_num_inputs;
+	struct pack_entry *entries = (struct pack_entry *)calloc(g_num_inputs + 1,
+		sizeof(struct pack_entry));
+	if (!entries)
+	{
+		printf("[Pack] Out of memory for %d entries\n", g_num_inputs);
+		return 1;
+	}
+	header.names_offset = sizeof(header) + (uint64_t)g_num_inputs * sizeof(struct pack_entry);
+	uint64_t names_size = 0, data_size = 0;
+	for (int i = 0; i < g_num_inputs; ++i)
+	{
+		entries[i].hash = g_inputs[i].hash;
+		entries[i].size = g_inputs[i].size;
+		entries[i].name_offset = (uint32_t)names_size;
+		entries[i].name_size = (uint32_t)g_inputs[i].name_size;
+		names_size += g_inputs[i].name_size + 1;
+		data_size += g_inputs[i].size;
+	}
+	header.names_size = names_size;
+	header.data_offset = align(header.names_offset + names_size);
+	uint64_t offset = header.data_offset;
+	for (int i = 0; i < g_num_inputs; ++i)
+	{
+		entries[i].offset = offset;
+		offset = align(offset + entries[i].size);
+	}
+	header.file_size = offset;
+
+	// written under a temporary name, so that a running game never maps a
+	// half-written pack
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", argv[2]);
+	int out = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (out < 0 || ftruncate(out, (off_t)header.file_size) != 0)
+	{
+		printf("[Pack] Failed to create %s: %s\n", tmp, strerror(errno));
+		return 1;
+	}
+	int failed = pwrite(out, &header, sizeof(header), 0) != (ssize_t)sizeof(header);
+	size_t toc_size = g_num_inputs * sizeof(struct pack_entry);
+	failed |= pwrite(out, entries, toc_size, sizeof(header)) != (ssize_t)toc_size;
+	for (int i = 0; i < g_num_inputs && !failed; ++i)
+	{
+		off_t at = (off_t)(header.names_offset + entries[i].name_offset);
+		ssize_t size = (ssize_t)g_inputs[i].name_size + 1;
+		failed |= pwrite(out, g_inputs[i].name, size, at) != size;
+	}
+	for (int i = 0; i < g_num_inputs && !failed; ++i)
+	{
+		if (copy_data(g_inputs[i].path, entries[i].size, out, entries[i].offset) != 0)
+		{
+			printf("[Pack] Failed to copy %s: %s\n", g_inputs[i].path, strerror(errno));
+			failed = 1;
+		}
+	}
+	if (failed || fsync(out) != 0 || close(out) != 0 || rename(tmp, argv[2]) != 0)
+	{
+		printf("[Pack] Failed to write %s: %s\n", argv[2], strerror(errno));
+		unlink(tmp);
+		return 1;
+	}
+
+	printf("[Pack] %s: %d assets, %.1f MiB of data in %.1f MiB (%.1f%% padding)\n",
+		argv[2], g_num_inputs, data_size / 1048576.0, header.file_size / 1048576.0,
+		header.file_size ? 100.0 * (header.file_size - header.data_offset - data_size)
+			/ header.file_size : 0);
+	for (int i = 0; i < g_num_inputs; ++i)
+		free(g_inputs[i].path);
+	free(g_inputs);
+	free(entries);
+	return 0;
+}
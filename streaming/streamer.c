@@ -0,0 +1,143 @@
+// Example of foreground loads competing with background streaming for the disk
+// Measures the latency of small urgent reads alone, and then while the whole
+// file streams in the background at the idle I/O class
+// To build:	make
+// To run:	./streamer [file] [size in MiB]	# the file gets created if need be
+// NOTE: I/O classes are only honoured by I/O schedulers with priority support
+// (e.g. BFQ, see /sys/block/<dev>/queue/scheduler)
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "async_read.h"
+
+#define FOREGROUND_SIZE		(64 * 1024)
+#define FOREGROUND_READS	100
+#define BACKGROUND_SIZE		(4 * 1024 * 1024)
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int create_file(const char *path, off_t size)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= size)
+		return fd;
+
+	printf("[Streaming] Creating %s, %lld MiB\n", path, (long long)(size >> 20));
+	char *block = (char *)malloc(1 << 20);
+	for (int i = 0; i < (1 << 20); ++i)
+		block[i] = (char)rand();
+	for (off_t done = 0; done < size; done += 1 << 20)
+		if (pwrite(fd, block, 1 << 20, done) != 1 << 20)
+		{
+			free(block);
+			close(fd);
+			return -1;
+		}
+	free(block);
+	fsync(fd);
+	return fd;
+}
+
+// urgent reads at random offsets, one at a time as if the frame waited for
+// each; returns the average latency in us
+static double foreground(int fd, off_t size, double *max)
+{
+	static char buffer[FOREGROUND_SIZE];
+	int64_t sum = 0, worst = 0;
+	for (int i = 0; i < FOREGROUND_READS; ++i)
+	{
+		struct async_read req;
+		memset(&req, 0, sizeof(req));
+		req.fd = fd;
+		req.offset = ((off_t)rand() % (size / FOREGROUND_SIZE)) * FOREGROUND_SIZE;
+		req.size = FOREGROUND_SIZE;
+		req.buffer = buffer;
+		req.priority = ASYNC_READ_URGENT;
+		int64_t start = now_ns();
+		async_read_submit(&req);
+		async_read_wait(&req);
+		int64_t latency = now_ns() - start;
+		sum += latency;
+		if (latency > worst)
+			worst = latency;
+		usleep(2000);
+	}
+	*max = worst / 1000.0;
+	return sum / 1000.0 / FOREGROUND_READS;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : "streamer.dat";
+	off_t size = (off_t)(argc > 2 ? atoi(argv[2]) : 64) << 20;
+	if (size < BACKGROUND_SIZE)
+	{
+		printf("Usage: %s [file] [size in MiB, at least 4]\n", argv[0]);
+		return 1;
+	}
+	int fd = create_file(path, size);
+	if (fd < 0)
+	{
+		perror("[Streaming] Failed to create the file");
+		return 1;
+	}
+	async_read_init(2);
+
+	// drop the file from the page cache, so that we actually hit the disk
+	posix_fadvise(fd, 0, size, POSIX_FADV_DONTNEED);
+	double max, avg = foreground(fd, size, &max);
+	printf("[Streaming] urgent reads alone:         avg %8.1f us, max %8.1f us\n",
+		avg, max);
+
+	// stream the whole file in the background meanwhile
+	posix_fadvise(fd, 0, size, POSIX_FADV_DONTNEED);
+	int num_background = (int)(size / BACKGROUND_SIZE);
+	struct async_read *background = (struct async_read *)calloc(num_background,
+		sizeof(struct async_read));
+	char *buffer = (char *)malloc(BACKGROUND_SIZE);
+	for (int i = 0; i < num_background; ++i)
+	{
+		background[i].fd = fd;
+		background[i].offset = (off_t)i * BACKGROUND_SIZE;
+		background[i].size = BACKGROUND_SIZE;
+		background[i].buffer = buffer;	// we don't care about the contents
+		background[i].priority = ASYNC_READ_BACKGROUND;
+		async_read_submit(&background[i]);
+	}
+	avg = foreground(fd, size, &max);
+	printf("[Streaming] urgent reads, streaming on: avg %8.1f us, max %8.1f us\n",
+		avg, max);
+	for (int i = 0; i < num_background; ++i)
+		async_read_wait(&background[i]);
+
+	struct async_read_stats stats;
+	async_read_get_stats(&stats);
+	printf("[Streaming] background: %llu reads, %llu MiB, avg %.1f ms, "
+		"held back %llu times\n",
+		(unsigned long long)stats.completed[ASYNC_READ_BACKGROUND],
+		(unsigned long long)(stats.bytes[ASYNC_READ_BACKGROUND] >> 20),
+		stats.latency_sum[ASYNC_READ_BACKGROUND] / 1e6
+			/ (stats.completed[ASYNC_READ_BACKGROUND] ? stats.completed[ASYNC_READ_BACKGROUND] : 1),
+		(unsigned long long)stats.preempted);
+
+	async_read_shutdown();
+	free(buffer);
+	free(background);
+	close(fd);
+	return 0;
+}
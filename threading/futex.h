@@ -0,0 +1,29 @@
+// Bare futex wrappers; glibc doesn't export these, so we go through syscall()
+
+#pragma once
+
+#include <limits.h>			// for INT_MAX
+#include <unistd.h>			// for syscall()
+#include <sys/syscall.h>	// for SYS_futex
+#include <linux/futex.h>	// for FUTEX_WAIT_PRIVATE and friends
+#include <time.h>			// for struct timespec
+
+// sleeps as long as *addr == expected; returns 0 when woken, -1 with errno set
+// to EAGAIN if the value had already changed, or to EINTR/ETIMEDOUT
+// NOTE: timeout is relative, may be NULL to wait indefinitely
+static inline int futex_wait(int *addr, int expected, const struct timespec *timeout)
+{
+	return (int)syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout,
+		NULL, 0);
+}
+
+// wakes up to count threads sleeping on addr; returns the number woken
+static inline int futex_wake(int *addr, int count)
+{
+	return (int)syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static inline int futex_wake_all(int *addr)
+{
+	return futex_wake(addr, INT_MAX);
+}
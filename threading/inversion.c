@@ -0,0 +1,196 @@
+// Example of priority inversion, with a plain mutex and with a PI lock
+// A low-priority thread holds a lock, a medium-priority one hogs the CPU, and a
+// high-priority one wants the lock; all three share a CPU. With a plain mutex
+// the high-priority thread waits for the hog too; with priority inheritance
+// only for the holder's critical section
+// To build:				make
+// To grant capabilities – as root:	setcap cap_sys_nice+eip inversion
+// To run:				./inversion
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pi_lock.h"
+#include "queue.h"
+
+#define CRITICAL_SECTION_MS	20
+#define HOG_MS				100
+
+struct event
+{
+	struct mpsc_node node;	// first, so that we can cast
+	const char *what;
+	int64_t time;
+};
+
+static struct pi_lock g_pi_lock;
+static pthread_mutex_t g_plain_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_use_pi = 0;
+static int g_holding = 0;
+static int64_t g_start;
+
+// events from all threads to the main thread
+static struct mpsc_queue g_events;
+// the high-priority thread's wait time, to the main thread
+static struct spsc_queue g_results;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void busy(int ms)
+{
+	int64_t end = now_ns() + ms * 1000000LL;
+	while (now_ns() < end)
+		;
+}
+
+// NOTE: static events, since malloc() isn't something to do in a
+// high-priority thread
+static void post(struct event *event, const char *what)
+{
+	event->what = what;
+	event->time = now_ns() - g_start;
+	mpsc_queue_push(&g_events, &event->node);
+}
+
+static void lock(void)
+{
+	if (g_use_pi)
+		pi_lock_acquire(&g_pi_lock);
+	else
+		pthread_mutex_lock(&g_plain_lock);
+}
+
+static void unlock(void)
+{
+	if (g_use_pi)
+		pi_lock_release(&g_pi_lock);
+	else
+		pthread_mutex_unlock(&g_plain_lock);
+}
+
+static void *low_thread(void *arg)
+{
+	static struct event events[2];
+	(void)arg;
+	lock();
+	__atomic_store_n(&g_holding, 1, __ATOMIC_RELEASE);
+	post(&events[0], "low: locked");
+	busy(CRITICAL_SECTION_MS);
+	post(&events[1], "low: unlocking");
+	unlock();
+	return NULL;
+}
+
+static void *medium_thread(void *arg)
+{
+	static struct event events[2];
+	(void)arg;
+	post(&events[0], "medium: hogging");
+	busy(HOG_MS);
+	post(&events[1], "medium: done");
+	return NULL;
+}
+
+static void *high_thread(void *arg)
+{
+	static struct event events[2];
+	static int64_t wait;
+	(void)arg;
+	post(&events[0], "high: locking");
+	int64_t start = now_ns();
+	lock();
+	wait = now_ns() - start;
+	post(&events[1], "high: locked");
+	unlock();
+	spsc_queue_push(&g_results, &wait);
+	return NULL;
+}
+
+static pthread_t spawn(void *(*func)(void *), int priority)
+{
+	pthread_attr_t attr;
+	struct sched_param param;
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	param.sched_priority = priority;
+	pthread_attr_setschedparam(&attr, &param);
+	pthread_t thread;
+	if (pthread_create(&thread, &attr, func, NULL) != 0)
+	{
+		printf("[Locks] Failed to start a SCHED_FIFO thread, no CAP_SYS_NICE?\n");
+		exit(1);
+	}
+	pthread_attr_destroy(&attr);
+	return thread;
+}
+
+static void run(int use_pi)
+{
+	g_use_pi = use_pi;
+	g_holding = 0;
+	g_start = now_ns();
+	printf("[Locks] %s\n", use_pi ? "PI lock" : "plain mutex");
+
+	pthread_t low = spawn(low_thread, 10);
+	while (!__atomic_load_n(&g_holding, __ATOMIC_ACQUIRE))
+	{
+		struct timespec ts = {0, 100000};
+		nanosleep(&ts, NULL);
+	}
+	// we're above all of them, so nothing runs until we join
+	pthread_t medium = spawn(medium_thread, 20);
+	pthread_t high = spawn(high_thread, 30);
+	pthread_join(high, NULL);
+	pthread_join(medium, NULL);
+	pthread_join(low, NULL);
+
+	struct mpsc_node *node;
+	while ((node = mpsc_queue_pop(&g_events)))
+	{
+		struct event *event = (struct event *)node;
+		printf("[Locks] %8.1f ms  %s\n", event->time / 1e6, event->what);
+	}
+	int64_t *wait = (int64_t *)spsc_queue_pop(&g_results);
+	if (wait)
+		printf("[Locks] high-priority thread waited %.1f ms\n", *wait / 1e6);
+}
+
+int main(void)
+{
+	// one CPU for all, otherwise the hog doesn't get in the way
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(sched_getcpu(), &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	struct sched_param param;
+	param.sched_priority = 40;
+	if (sched_setscheduler(0, SCHED_FIFO, &param) != 0)
+	{
+		printf("[Locks] Failed to switch to SCHED_FIFO, no CAP_SYS_NICE?\n");
+		return 1;
+	}
+
+	pi_lock_init(&g_pi_lock, "demo");
+	mpsc_queue_init(&g_events);
+	spsc_queue_init(&g_results, 4);
+
+	run(0);
+	run(1);
+	pi_lock_report();
+
+	spsc_queue_destroy(&g_results);
+	pi_lock_destroy(&g_pi_lock);
+	return 0;
+}
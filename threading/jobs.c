@@ -0,0 +1,511 @@
+// Work-stealing job system, see jobs.h
+
+#define _GNU_SOURCE			// for pthread_setname_np() and cpu_set_t
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "futex.h"
+#include "thread_role.h"
+#include "memory_lock.h"
+#include "topology.h"
+
+// per-worker deque capacity; must be a power of 2
+#define JOBS_DEQUE_SIZE		1024
+// how many times an idle worker looks for work before parking on the futex
+#define JOBS_SPIN_ATTEMPTS	64
+// how many busy slots of the job pool we skip before resorting to malloc()
+#define JOBS_POOL_PROBES	8
+
+#define JOBS_CACHE_LINE		64
+
+struct job
+{
+	job_func func;
+	void *arg;
+	struct job_counter *counter;
+	struct job *next;		// for the injection queue and continuation lists
+	int lane;
+	int busy;				// a pool slot in use; cleared by whoever runs it
+	int pooled;				// from a thread's pool rather than malloc()
+};
+
+// Chase-Lev deque, after "Correct and Efficient Work-Stealing for Weak Memory
+// Models" by Le, Pop, Cohen and Zappa Nardelli
+// NOTE: no resizing; if it's full, jobs go to the lane's injection queue
+struct jobs_deque
+{
+	long top __attribute__((aligned(JOBS_CACHE_LINE)));		// stealers take here
+	long bottom __attribute__((aligned(JOBS_CACHE_LINE)));	// the owner works here
+	struct job *buffer[JOBS_DEQUE_SIZE];
+};
+
+struct jobs_worker
+{
+	struct jobs_deque deque;
+	pthread_t thread;
+	int lane;
+	int index;
+	unsigned rng;			// for picking steal victims
+} __attribute__((aligned(JOBS_CACHE_LINE)));
+
+struct jobs_lane
+{
+	struct jobs_worker *workers;
+	int num_workers;
+	int role;
+	// jobs submitted from threads that aren't workers of this lane
+	pthread_mutex_t inject_lock;
+	struct job *inject_head, *inject_tail;
+	int inject_count;
+	// eventcount for parking idle workers: bumped whenever work arrives while
+	// someone sleeps
+	int signal __attribute__((aligned(JOBS_CACHE_LINE)));
+	int sleepers;
+};
+
+static struct jobs_lane g_lanes[JOB_NUM_LANES];
+static const struct topology_placement *g_placement = NULL;
+static int g_quit = 0;
+
+static __thread struct jobs_worker *t_worker = NULL;
+// per-thread ring of job structs, see JOBS_POOL_SIZE
+static __thread struct job *t_pool = NULL;
+static __thread unsigned t_pool_next = 0;
+static __thread unsigned t_rng = 0;
+
+static const char *g_lane_names[JOB_NUM_LANES] =
+{
+	"frame",
+	"stream",
+	"bg"
+};
+
+
+// ============================================================================
+
+
+static inline void jobs_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static inline unsigned jobs_random(unsigned *state)
+{
+	// xorshift32
+	unsigned x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// owner only
+static int deque_push(struct jobs_deque *d, struct job *job)
+{
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	if (b - t > JOBS_DEQUE_SIZE - 1)
+		return 0;	// full
+	__atomic_store_n(&d->buffer[b & (JOBS_DEQUE_SIZE - 1)], job, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+// owner only
+static struct job *deque_take(struct jobs_deque *d)
+{
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+	struct job *job = NULL;
+	if (t <= b)
+	{
+		job = __atomic_load_n(&d->buffer[b & (JOBS_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+		if (t == b)
+		{
+			// last one, race the stealers for it
+			if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				job = NULL;
+			__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+		}
+	}
+	else
+		__atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+	return job;
+}
+
+// any thread; returns NULL if empty or if we lost a race
+static struct job *deque_steal(struct jobs_deque *d)
+{
+	long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return NULL;
+	struct job *job = __atomic_load_n(&d->buffer[t & (JOBS_DEQUE_SIZE - 1)],
+		__ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+		__ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+	return job;
+}
+
+static struct job *job_alloc(void)
+{
+	if (!t_pool)
+	{
+		// NOTE: never freed for threads other than the workers; there's
+		// usually only the main thread submitting from the outside anyway
+		t_pool = (struct job *)calloc(JOBS_POOL_SIZE, sizeof(struct job));
+		if (!t_pool)
+		{
+			fprintf(stderr, "[Jobs] Out of memory for the job pool\n");
+			abort();
+		}
+	}
+	// slots are mostly freed in the order they were handed out, so if the
+	// next few are still busy, the ring is full of jobs in flight
+	for (int i = 0; i < JOBS_POOL_PROBES; ++i)
+	{
+		struct job *job = &t_pool[t_pool_next++ & (JOBS_POOL_SIZE - 1)];
+		if (!__atomic_load_n(&job->busy, __ATOMIC_ACQUIRE))
+		{
+			job->busy = 1;
+			job->pooled = 1;
+			return job;
+		}
+	}
+	struct job *job = (struct job *)calloc(1, sizeof(struct job));
+	if (!job)
+	{
+		fprintf(stderr, "[Jobs] Out of memory for a job\n");
+		abort();
+	}
+	return job;
+}
+
+// any thread; the job must not be touched afterwards
+static void job_free(struct job *job)
+{
+	if (job->pooled)
+		__atomic_store_n(&job->busy, 0, __ATOMIC_RELEASE);
+	else
+		free(job);
+}
+
+static void jobs_notify(struct jobs_lane *lane)
+{
+	// pairs with the sleepers increment in jobs_worker_main(): either we see
+	// the sleeper, or it sees our job when it looks one last time
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&lane->sleepers, __ATOMIC_SEQ_CST) > 0)
+	{
+		__atomic_add_fetch(&lane->signal, 1, __ATOMIC_SEQ_CST);
+		futex_wake(&lane->signal, 1);
+	}
+}
+
+static void jobs_submit(struct job *job)
+{
+	struct jobs_lane *lane = &g_lanes[job->lane];
+	if (!t_worker || t_worker->lane != job->lane
+		|| !deque_push(&t_worker->deque, job))
+	{
+		job->next = NULL;
+		pthread_mutex_lock(&lane->inject_lock);
+		if (lane->inject_tail)
+			lane->inject_tail->next = job;
+		else
+			lane->inject_head = job;
+		lane->inject_tail = job;
+		__atomic_add_fetch(&lane->inject_count, 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&lane->inject_lock);
+	}
+	jobs_notify(lane);
+}
+
+// looks for work: our own deque first, then the injection queue, then the
+// other workers, starting from a random one
+static struct job *jobs_find(struct jobs_lane *lane, struct jobs_worker *self)
+{
+	struct job *job;
+	if (self && (job = deque_take(&self->deque)))
+		return job;
+
+	if (__atomic_load_n(&lane->inject_count, __ATOMIC_ACQUIRE) > 0)
+	{
+		pthread_mutex_lock(&lane->inject_lock);
+		job = lane->inject_head;
+		if (job)
+		{
+			lane->inject_head = job->next;
+			if (!lane->inject_head)
+				lane->inject_tail = NULL;
+			__atomic_sub_fetch(&lane->inject_count, 1, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&lane->inject_lock);
+		if (job)
+			return job;
+	}
+
+	if (lane->num_workers == 0)
+		return NULL;
+	unsigned *rng = self ? &self->rng : &t_rng;
+	if (*rng == 0)
+		*rng = (unsigned)(size_t)&rng | 1;
+	int start = (int)(jobs_random(rng) % lane->num_workers);
+	for (int i = 0; i < lane->num_workers; ++i)
+	{
+		struct jobs_worker *victim = &lane->workers[(start + i) % lane->num_workers];
+		if (victim != self && (job = deque_steal(&victim->deque)))
+			return job;
+	}
+	return NULL;
+}
+
+static void job_counter_done(struct job_counter *counter)
+{
+	// whoever waits on the counter may destroy it as soon as pending hits
+	// zero, so announce that we're still touching it until we're done
+	__atomic_add_fetch(&counter->finishing, 1, __ATOMIC_SEQ_CST);
+	struct job *job = NULL;
+	if (__atomic_sub_fetch(&counter->pending, 1, __ATOMIC_SEQ_CST) == 0)
+	{
+		job = __atomic_exchange_n(&counter->continuations, (struct job *)NULL,
+			__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&counter->waiters, __ATOMIC_SEQ_CST))
+			futex_wake_all(&counter->pending);
+	}
+	__atomic_sub_fetch(&counter->finishing, 1, __ATOMIC_SEQ_CST);
+	// only start the continuations once we're done with the counter: their
+	// completion may be all its owner waits for before dropping it
+	while (job)
+	{
+		struct job *next = job->next;
+		jobs_submit(job);
+		job = next;
+	}
+}
+
+static void jobs_execute(struct job *job)
+{
+	job_func func = job->func;
+	void *arg = job->arg;
+	struct job_counter *counter = job->counter;
+	job_free(job);
+	func(arg);
+	if (counter)
+		job_counter_done(counter);
+}
+
+static void *jobs_worker_main(void *arg)
+{
+	struct jobs_worker *self = (struct jobs_worker *)arg;
+	struct jobs_lane *lane = &g_lanes[self->lane];
+	t_worker = self;
+
+	char name[16];
+	snprintf(name, sizeof(name), "job-%s-%d", g_lane_names[self->lane], self->index);
+	pthread_setname_np(pthread_self(), name);
+	// the lane's scheduling class is what makes lanes preempt each other
+	thread_role_apply(lane->role, NULL);
+	if (g_placement)
+		topology_apply(g_placement, lane->role, self->index);
+	memory_lock_prefault_stack(0);
+
+	while (!__atomic_load_n(&g_quit, __ATOMIC_ACQUIRE))
+	{
+		struct job *job = NULL;
+		for (int i = 0; i < JOBS_SPIN_ATTEMPTS && !job; ++i)
+		{
+			job = jobs_find(lane, self);
+			if (!job)
+				jobs_pause();
+		}
+		if (job)
+		{
+			jobs_execute(job);
+			continue;
+		}
+
+		// nothing to do, park; announce ourselves first and look one last
+		// time, so that a job submitted in the meantime can't slip through
+		int signal = __atomic_load_n(&lane->signal, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&lane->sleepers, 1, __ATOMIC_SEQ_CST);
+		job = jobs_find(lane, self);
+		if (!job && !__atomic_load_n(&g_quit, __ATOMIC_ACQUIRE))
+			futex_wait(&lane->signal, signal, NULL);
+		__atomic_sub_fetch(&lane->sleepers, 1, __ATOMIC_SEQ_CST);
+		if (job)
+			jobs_execute(job);
+	}
+
+	free(t_pool);
+	t_pool = NULL;
+	return NULL;
+}
+
+
+// ============================================================================
+
+
+void jobs_default_config(struct jobs_config *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cpu_set_t allowed;
+	int num_cpus = sched_getaffinity(0, sizeof(allowed), &allowed) == 0
+		? CPU_COUNT(&allowed) : 1;
+	cfg->num_workers[JOB_LANE_FRAME] = num_cpus > 1 ? num_cpus - 1 : 1;
+	cfg->num_workers[JOB_LANE_STREAMING] = 1;
+	cfg->num_workers[JOB_LANE_BACKGROUND] = 1;
+	cfg->role[JOB_LANE_FRAME] = THREAD_ROLE_WORKER;
+	cfg->role[JOB_LANE_STREAMING] = THREAD_ROLE_COOKER;
+	cfg->role[JOB_LANE_BACKGROUND] = THREAD_ROLE_TELEMETRY;
+	cfg->placement = NULL;
+}
+
+int jobs_init(const struct jobs_config *cfg)
+{
+	g_quit = 0;
+	g_placement = cfg->placement;
+	for (int l = 0; l < JOB_NUM_LANES; ++l)
+	{
+		struct jobs_lane *lane = &g_lanes[l];
+		memset(lane, 0, sizeof(*lane));
+		pthread_mutex_init(&lane->inject_lock, NULL);
+		lane->role = cfg->role[l];
+		// a lane without workers would only ever be served by threads
+		// helping out in jobs_wait(), and only the frame lane gets that
+		int num_workers = cfg->num_workers[l] > 0 ? cfg->num_workers[l] : 1;
+		if (posix_memalign((void **)&lane->workers, JOBS_CACHE_LINE,
+			num_workers * sizeof(struct jobs_worker)) != 0)
+			return -1;
+		memset(lane->workers, 0, num_workers * sizeof(struct jobs_worker));
+		for (int i = 0; i < num_workers; ++i)
+		{
+			lane->workers[i].lane = l;
+			lane->workers[i].index = i;
+			lane->workers[i].rng = 0x9e3779b9u * (i + 1) + l;
+		}
+		// publish the count before starting anyone, since they steal from
+		// each other right away
+		lane->num_workers = num_workers;
+	}
+	for (int l = 0; l < JOB_NUM_LANES; ++l)
+	{
+		struct jobs_lane *lane = &g_lanes[l];
+		for (int i = 0; i < lane->num_workers; ++i)
+		{
+			int retval = pthread_create(&lane->workers[i].thread, NULL,
+				jobs_worker_main, &lane->workers[i]);
+			if (retval != 0)
+			{
+				fprintf(stderr, "[Jobs] Failed to start %s worker %d\n",
+					g_lane_names[l], i);
+				// keep the ones that did start
+				lane->num_workers = i;
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+void jobs_shutdown(void)
+{
+	__atomic_store_n(&g_quit, 1, __ATOMIC_RELEASE);
+	for (int l = 0; l < JOB_NUM_LANES; ++l)
+	{
+		struct jobs_lane *lane = &g_lanes[l];
+		__atomic_add_fetch(&lane->signal, 1, __ATOMIC_SEQ_CST);
+		futex_wake_all(&lane->signal);
+		for (int i = 0; i < lane->num_workers; ++i)
+			pthread_join(lane->workers[i].thread, NULL);
+		free(lane->workers);
+		pthread_mutex_destroy(&lane->inject_lock);
+		memset(lane, 0, sizeof(*lane));
+	}
+}
+
+void jobs_run(int lane, job_func func, void *arg, struct job_counter *counter)
+{
+	struct job *job = job_alloc();
+	job->func = func;
+	job->arg = arg;
+	job->counter = counter;
+	job->lane = lane;
+	if (counter)
+		__atomic_add_fetch(&counter->pending, 1, __ATOMIC_SEQ_CST);
+	jobs_submit(job);
+}
+
+void jobs_run_after(struct job_counter *dependency, int lane, job_func func,
+	void *arg, struct job_counter *counter)
+{
+	struct job *job = job_alloc();
+	job->func = func;
+	job->arg = arg;
+	job->counter = counter;
+	job->lane = lane;
+	if (counter)
+		__atomic_add_fetch(&counter->pending, 1, __ATOMIC_SEQ_CST);
+
+	// hold the dependency while adding ourselves to its list, so that it
+	// can't hit zero in the middle; if it's already done, dropping the hold
+	// is what schedules us
+	__atomic_add_fetch(&dependency->pending, 1, __ATOMIC_SEQ_CST);
+	struct job *head = __atomic_load_n(&dependency->continuations, __ATOMIC_RELAXED);
+	do
+		job->next = head;
+	while (!__atomic_compare_exchange_n(&dependency->continuations, &head, job,
+		1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+	job_counter_done(dependency);
+}
+
+void jobs_wait(struct job_counter *counter)
+{
+	// workers help out in their own lane, everyone else in the frame lane
+	struct jobs_lane *lane = &g_lanes[t_worker ? t_worker->lane : JOB_LANE_FRAME];
+	int idle = 0;
+	while (__atomic_load_n(&counter->pending, __ATOMIC_SEQ_CST) > 0)
+	{
+		struct job *job = jobs_find(lane, t_worker);
+		if (job)
+		{
+			jobs_execute(job);
+			idle = 0;
+			continue;
+		}
+		if (++idle < JOBS_SPIN_ATTEMPTS)
+		{
+			jobs_pause();
+			continue;
+		}
+
+		// nothing to help with, sleep until the counter changes
+		__atomic_store_n(&counter->waiters, 1, __ATOMIC_SEQ_CST);
+		int pending = __atomic_load_n(&counter->pending, __ATOMIC_SEQ_CST);
+		if (pending > 0)
+			futex_wait(&counter->pending, pending, NULL);
+		idle = 0;
+	}
+	// the last job may still be busy notifying us
+	while (__atomic_load_n(&counter->finishing, __ATOMIC_SEQ_CST) > 0)
+		jobs_pause();
+	counter->waiters = 0;
+}
+
+int jobs_num_workers(int lane)
+{
+	return lane >= 0 && lane < JOB_NUM_LANES ? g_lanes[lane].num_workers : 0;
+}
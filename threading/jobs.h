@@ -0,0 +1,83 @@
+// Work-stealing job system with priority lanes
+// Every worker owns a Chase-Lev deque: it pushes and pops jobs at the bottom,
+// while idle workers steal from the top of a randomly picked victim. Lanes are
+// separate pools of workers running under the scheduling class of a thread
+// role (see priority/thread_role.h), so that e.g. frame-critical jobs always
+// preempt asset streaming ones in the kernel's scheduler, and not just in
+// our queues
+// Dependencies are expressed with counters: jobs_wait() on a counter blocks
+// (helping out with other jobs meanwhile) until all jobs attached to it are
+// done, and jobs_run_after() schedules a job once a counter drops to zero,
+// which is all that's needed to build job graphs
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct topology_placement;
+
+enum job_lane
+{
+	JOB_LANE_FRAME,			// work that the current frame waits for
+	JOB_LANE_STREAMING,		// asset decompression, cooking and the like
+	JOB_LANE_BACKGROUND,	// anything that may as well never finish
+	JOB_NUM_LANES
+};
+
+typedef void (*job_func)(void *arg);
+
+// counts unfinished jobs; zero-initialize with JOB_COUNTER_INIT
+// NOTE: it must stay alive until jobs_wait() on it returns
+struct job_counter
+{
+	int pending;			// jobs attached and not done yet
+	int waiters;			// non-zero if someone is asleep on pending
+	int finishing;			// threads still touching the counter, see jobs.c
+	struct job *continuations;	// scheduled once pending drops to zero
+};
+#define JOB_COUNTER_INIT	{0, 0, 0, 0}
+
+struct jobs_config
+{
+	int num_workers[JOB_NUM_LANES];
+	int role[JOB_NUM_LANES];	// thread role per lane, from thread_role.h
+	// if not NULL, workers get pinned according to the placement from
+	// priority/topology.h
+	const struct topology_placement *placement;
+};
+
+// job structs come from a per-thread ring of this many; once a thread has more
+// than that in flight, the rest come from malloc()
+#define JOBS_POOL_SIZE	4096
+
+// fills in the defaults: a frame worker per CPU minus one (the main thread
+// helps out in jobs_wait()), on the worker role; one streaming worker on the
+// cooker role; and one background worker on the telemetry role
+void jobs_default_config(struct jobs_config *cfg);
+
+// starts the workers; returns 0 on success
+int jobs_init(const struct jobs_config *cfg);
+
+// stops and joins the workers; jobs still queued are dropped
+void jobs_shutdown(void);
+
+// schedules func(arg) on given lane; counter may be NULL
+void jobs_run(int lane, job_func func, void *arg, struct job_counter *counter);
+
+// schedules func(arg) once all jobs attached to dependency are done; the
+// dependency isn't touched anymore by then, so waiting on counter alone is
+// enough before dropping both
+void jobs_run_after(struct job_counter *dependency, int lane, job_func func,
+	void *arg, struct job_counter *counter);
+
+// waits for all jobs attached to counter, running other jobs meanwhile
+void jobs_wait(struct job_counter *counter);
+
+// number of workers in given lane
+int jobs_num_workers(int lane);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,107 @@
+// Benchmark of the job system: fork-join overhead per job, and scaling of a
+// CPU-bound workload from a single frame worker up to all cores
+// To build:	make
+// To run:	./jobs_bench [jobs per batch]
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "jobs.h"
+#include "thread_role.h"
+
+#define NUM_BATCHES		200
+#define NUM_WORK_JOBS	512
+#define WORK_ITERATIONS	20000
+
+static volatile unsigned g_sink;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void empty_job(void *arg)
+{
+	(void)arg;
+}
+
+static void work_job(void *arg)
+{
+	unsigned x = (unsigned)(size_t)arg | 1;
+	for (int i = 0; i < WORK_ITERATIONS; ++i)
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+	}
+	g_sink += x;
+}
+
+// spawns a batch, then a single job that only runs once the batch is done
+static double fork_join(int num_jobs)
+{
+	double start = now_ns();
+	for (int b = 0; b < NUM_BATCHES; ++b)
+	{
+		struct job_counter batch = JOB_COUNTER_INIT;
+		struct job_counter done = JOB_COUNTER_INIT;
+		for (int i = 0; i < num_jobs; ++i)
+			jobs_run(JOB_LANE_FRAME, empty_job, NULL, &batch);
+		jobs_run_after(&batch, JOB_LANE_FRAME, empty_job, NULL, &done);
+		jobs_wait(&done);
+	}
+	return (now_ns() - start) / ((double)NUM_BATCHES * (num_jobs + 1));
+}
+
+static double workload(void)
+{
+	double start = now_ns();
+	struct job_counter counter = JOB_COUNTER_INIT;
+	for (int i = 0; i < NUM_WORK_JOBS; ++i)
+		jobs_run(JOB_LANE_FRAME, work_job, (void *)(size_t)(i + 1), &counter);
+	jobs_wait(&counter);
+	return (now_ns() - start) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	int batch = argc > 1 ? atoi(argv[1]) : 1000;
+	if (batch < 1)
+	{
+		printf("Jobs per batch must be at least 1\n");
+		return 1;
+	}
+	thread_role_init();
+
+	cpu_set_t allowed;
+	int num_cpus = sched_getaffinity(0, sizeof(allowed), &allowed) == 0
+		? CPU_COUNT(&allowed) : 1;
+
+	struct jobs_config cfg;
+	jobs_default_config(&cfg);
+	jobs_init(&cfg);
+	printf("%d CPUs, %d frame workers\n", num_cpus, jobs_num_workers(JOB_LANE_FRAME));
+	printf("Fork-join of %d empty jobs: %.1f ns per job\n", batch, fork_join(batch));
+	jobs_shutdown();
+
+	// the main thread helps out in jobs_wait(), so N workers use N + 1 CPUs
+	double single = 0;
+	printf("\n%8s %10s %8s\n", "workers", "ms", "speedup");
+	for (int workers = 1; workers <= (num_cpus > 1 ? num_cpus - 1 : 1); ++workers)
+	{
+		cfg.num_workers[JOB_LANE_FRAME] = workers;
+		jobs_init(&cfg);
+		workload();		// warm-up
+		double ms = workload();
+		if (workers == 1)
+			single = ms;
+		printf("%8d %10.2f %7.2fx\n", workers, ms, single / ms);
+		jobs_shutdown();
+	}
+	return 0;
+}
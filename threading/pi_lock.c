@@ -0,0 +1,181 @@
+// Priority-inheritance locks, see pi_lock.h
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>			// for syscall()
+#include <sys/syscall.h>	// for SYS_gettid
+#include <sys/resource.h>
+
+#include "pi_lock.h"
+
+// ring of recent inversions
+static pthread_mutex_t g_inversions_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct pi_lock_inversion g_inversions[PI_LOCK_MAX_INVERSIONS];
+static uint64_t g_num_inversions = 0;
+
+
+
+// ============================================================================
+
+
+#ifdef PI_LOCK_DEBUG
+static __thread pid_t t_tid = 0;
+
+static pid_t gettid_cached(void)
+{
+	if (!t_tid)
+		t_tid = (pid_t)syscall(SYS_gettid);
+	return t_tid;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void record_inversion(const struct pi_lock_inversion *inversion)
+{
+	pthread_mutex_lock(&g_inversions_lock);
+	g_inversions[g_num_inversions % PI_LOCK_MAX_INVERSIONS] = *inversion;
+	++g_num_inversions;
+	pthread_mutex_unlock(&g_inversions_lock);
+}
+#endif
+
+
+// ============================================================================
+
+
+int pi_lock_init(struct pi_lock *lock, const char *name)
+{
+	memset(lock, 0, sizeof(*lock));
+	lock->name = name;
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	int retval = pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	if (retval == 0)
+		retval = pthread_mutex_init(&lock->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	if (retval != 0)
+	{
+		printf("[Locks] Failed to create PI mutex %s: %s\n", name ? name : "",
+			strerror(retval));
+		return -1;
+	}
+	return 0;
+}
+
+void pi_lock_destroy(struct pi_lock *lock)
+{
+	pthread_mutex_destroy(&lock->mutex);
+}
+
+void pi_lock_acquire(struct pi_lock *lock)
+{
+#ifdef PI_LOCK_DEBUG
+	if (pthread_mutex_trylock(&lock->mutex) == 0)
+	{
+		__atomic_store_n(&lock->owner, gettid_cached(), __ATOMIC_RELAXED);
+		return;
+	}
+	// contended: look at the holder before we block, since blocking is
+	// what boosts it
+	struct pi_lock_inversion inversion;
+	inversion.lock = lock->name;
+	inversion.waiter = gettid_cached();
+	inversion.owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+	inversion.waiter_priority = pi_lock_thread_priority(inversion.waiter);
+	inversion.owner_priority = inversion.owner
+		? pi_lock_thread_priority(inversion.owner) : -1;
+	int64_t start = now_ns();
+	pthread_mutex_lock(&lock->mutex);
+	__atomic_store_n(&lock->owner, inversion.waiter, __ATOMIC_RELAXED);
+	if (inversion.owner_priority >= 0
+		&& inversion.owner_priority < inversion.waiter_priority)
+	{
+		inversion.wait_time = now_ns() - start;
+		record_inversion(&inversion);
+	}
+#else
+	pthread_mutex_lock(&lock->mutex);
+#endif
+}
+
+int pi_lock_try(struct pi_lock *lock)
+{
+	if (pthread_mutex_trylock(&lock->mutex) != 0)
+		return -1;
+#ifdef PI_LOCK_DEBUG
+	__atomic_store_n(&lock->owner, gettid_cached(), __ATOMIC_RELAXED);
+#endif
+	return 0;
+}
+
+void pi_lock_release(struct pi_lock *lock)
+{
+#ifdef PI_LOCK_DEBUG
+	__atomic_store_n(&lock->owner, 0, __ATOMIC_RELAXED);
+#endif
+	pthread_mutex_unlock(&lock->mutex);
+}
+
+int pi_lock_thread_priority(pid_t tid)
+{
+	int policy = sched_getscheduler(tid);
+	if (policy < 0)
+		return -1;
+	policy &= ~SCHED_RESET_ON_FORK;
+	if (policy == SCHED_FIFO || policy == SCHED_RR)
+	{
+		struct sched_param param;
+		if (sched_getparam(tid, &param) != 0)
+			return -1;
+		return 100 + param.sched_priority;
+	}
+	if (policy == SCHED_IDLE)
+		return 0;
+	errno = 0;
+	int nice_value = getpriority(PRIO_PROCESS, tid);
+	return errno == 0 ? 20 - nice_value : -1;
+}
+
+int pi_lock_inversions(struct pi_lock_inversion *out, int max)
+{
+	pthread_mutex_lock(&g_inversions_lock);
+	uint64_t available = g_num_inversions < PI_LOCK_MAX_INVERSIONS
+		? g_num_inversions : PI_LOCK_MAX_INVERSIONS;
+	int count = (uint64_t)max < available ? max : (int)available;
+	for (int i = 0; i < count; ++i)
+		out[i] = g_inversions[(g_num_inversions - count + i) % PI_LOCK_MAX_INVERSIONS];
+	pthread_mutex_unlock(&g_inversions_lock);
+	return count;
+}
+
+uint64_t pi_lock_num_inversions(void)
+{
+	pthread_mutex_lock(&g_inversions_lock);
+	uint64_t count = g_num_inversions;
+	pthread_mutex_unlock(&g_inversions_lock);
+	return count;
+}
+
+void pi_lock_report(void)
+{
+	struct pi_lock_inversion inversions[PI_LOCK_MAX_INVERSIONS];
+	int count = pi_lock_inversions(inversions, PI_LOCK_MAX_INVERSIONS);
+	printf("[Locks] %llu priority inversions\n",
+		(unsigned long long)pi_lock_num_inversions());
+	for (int i = 0; i < count; ++i)
+		printf("[Locks] %s: thread %d (priority %d) waited %.1f us for "
+			"thread %d (priority %d)\n",
+			inversions[i].lock ? inversions[i].lock : "?", inversions[i].waiter,
+			inversions[i].waiter_priority, inversions[i].wait_time / 1000.0,
+			inversions[i].owner, inversions[i].owner_priority);
+}
@@ -0,0 +1,73 @@
+// Priority-inheritance locks
+// Once threads run at different priorities (see priority/thread_role.h), a
+// plain lock lets a low-priority holder get preempted by medium-priority work
+// while a high-priority thread waits for it – priority inversion. These locks
+// are pthread mutexes with PTHREAD_PRIO_INHERIT, i.e. PI futexes: the kernel
+// boosts the holder to the priority of its highest waiter until it unlocks
+// NOTE: inheritance only works for SCHED_FIFO/SCHED_RR waiters; for niceness
+// differences the kernel boosts nothing, so the inversion detector below is
+// the way to find those
+// Debug builds (PI_LOCK_DEBUG, on unless NDEBUG is defined) also record every
+// time a thread waits on a holder of lower priority than its own
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>	// for pid_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(PI_LOCK_DEBUG) && !defined(NDEBUG)
+	#define PI_LOCK_DEBUG	1
+#endif
+
+// how many inversions the detector remembers; older ones get overwritten
+#define PI_LOCK_MAX_INVERSIONS	64
+
+struct pi_lock
+{
+	pthread_mutex_t mutex;
+	const char *name;	// for the inversion reports
+	pid_t owner;		// TID of the holder, 0 if free; only kept in debug builds
+};
+
+struct pi_lock_inversion
+{
+	const char *lock;
+	pid_t waiter;
+	pid_t owner;
+	int waiter_priority;	// see pi_lock_thread_priority()
+	int owner_priority;
+	int64_t wait_time;		// in ns
+};
+
+// returns 0 on success
+int pi_lock_init(struct pi_lock *lock, const char *name);
+void pi_lock_destroy(struct pi_lock *lock);
+
+void pi_lock_acquire(struct pi_lock *lock);
+// returns 0 if the lock was taken
+int pi_lock_try(struct pi_lock *lock);
+void pi_lock_release(struct pi_lock *lock);
+
+// a single number to compare thread priorities by: 100 + the RT priority for
+// SCHED_FIFO/SCHED_RR, 20 - niceness for SCHED_OTHER/SCHED_BATCH, and 0 for
+// SCHED_IDLE; -1 on error
+int pi_lock_thread_priority(pid_t tid);
+
+// copies out up to max of the most recent inversions, oldest first; returns
+// how many were copied; always 0 unless PI_LOCK_DEBUG
+int pi_lock_inversions(struct pi_lock_inversion *out, int max);
+
+// total number of inversions seen, including the overwritten ones
+uint64_t pi_lock_num_inversions(void);
+
+// prints the recent inversions, for diagnostics
+void pi_lock_report(void);
+
+#ifdef __cplusplus
+}
+#endif
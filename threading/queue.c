@@ -0,0 +1,110 @@
+// Wait-free queues, see queue.h
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+
+
+// ============================================================================
+
+
+int spsc_queue_init(struct spsc_queue *queue, size_t capacity)
+{
+	memset(queue, 0, sizeof(*queue));
+	size_t size = 2;
+	while (size < capacity)
+		size <<= 1;
+	queue->slots = (void **)calloc(size, sizeof(void *));
+	if (!queue->slots)
+		return -1;
+	queue->mask = size - 1;
+	return 0;
+}
+
+void spsc_queue_destroy(struct spsc_queue *queue)
+{
+	free(queue->slots);
+	queue->slots = NULL;
+}
+
+int spsc_queue_push(struct spsc_queue *queue, void *item)
+{
+	size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	// only look at the consumer's cache line when we seem to be full
+	if (tail - queue->cached_head > queue->mask)
+	{
+		queue->cached_head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+		if (tail - queue->cached_head > queue->mask)
+			return -1;
+	}
+	queue->slots[tail & queue->mask] = item;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void *spsc_queue_pop(struct spsc_queue *queue)
+{
+	size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	if (head == queue->cached_tail)
+	{
+		queue->cached_tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+		if (head == queue->cached_tail)
+			return NULL;
+	}
+	void *item = queue->slots[head & queue->mask];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+	return item;
+}
+
+
+// ============================================================================
+
+
+void mpsc_queue_init(struct mpsc_queue *queue)
+{
+	memset(queue, 0, sizeof(*queue));
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+}
+
+void mpsc_queue_push(struct mpsc_queue *queue, struct mpsc_node *node)
+{
+	__atomic_store_n(&node->next, (struct mpsc_node *)NULL, __ATOMIC_RELAXED);
+	struct mpsc_node *prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+	// NOTE: until this store, the consumer can't see past prev
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+struct mpsc_node *mpsc_queue_pop(struct mpsc_queue *queue)
+{
+	struct mpsc_node *tail = queue->tail;
+	struct mpsc_node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (tail == &queue->stub)
+	{
+		// skip the stub
+		if (!next)
+			return NULL;
+		queue->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+	if (next)
+	{
+		queue->tail = next;
+		return tail;
+	}
+	// tail is the last node we can see; only hand it out if nobody is in the
+	// middle of pushing after it
+	if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+		return NULL;
+	// put the stub back behind it, so that the queue never runs empty
+	mpsc_queue_push(queue, &queue->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next)
+	{
+		queue->tail = next;
+		return tail;
+	}
+	return NULL;
+}
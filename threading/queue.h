@@ -0,0 +1,61 @@
+// Wait-free queues for handing work between threads of different priorities
+// Neither side of these ever blocks or retries on the other, so a high-priority
+// producer can't be held up by a preempted low-priority consumer, or the other
+// way round – unlike with a lock, PI or not
+// SPSC: bounded ring of pointers, one producer and one consumer thread
+// MPSC: unbounded intrusive list, after Dmitry Vyukov's intrusive MPSC
+// node-based queue; pushing is wait-free for any number of producers, but the
+// single consumer can transiently see the queue as empty while a push is
+// halfway through, so it isn't lock-free on that side
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QUEUE_CACHE_LINE	64
+
+struct spsc_queue
+{
+	size_t head __attribute__((aligned(QUEUE_CACHE_LINE)));	// consumer's
+	size_t cached_tail;		// consumer's last look at tail
+	size_t tail __attribute__((aligned(QUEUE_CACHE_LINE)));	// producer's
+	size_t cached_head;		// producer's last look at head
+	size_t mask __attribute__((aligned(QUEUE_CACHE_LINE)));
+	void **slots;
+};
+
+// capacity gets rounded up to a power of 2; returns 0 on success
+int spsc_queue_init(struct spsc_queue *queue, size_t capacity);
+void spsc_queue_destroy(struct spsc_queue *queue);
+// producer only; returns 0 on success, -1 if full
+int spsc_queue_push(struct spsc_queue *queue, void *item);
+// consumer only; returns NULL if empty
+void *spsc_queue_pop(struct spsc_queue *queue);
+
+// embed this in whatever gets queued, and use container_of() or put it first
+struct mpsc_node
+{
+	struct mpsc_node *next;
+};
+
+struct mpsc_queue
+{
+	struct mpsc_node *head __attribute__((aligned(QUEUE_CACHE_LINE)));	// producers'
+	struct mpsc_node *tail __attribute__((aligned(QUEUE_CACHE_LINE)));	// consumer's
+	struct mpsc_node stub;
+};
+
+void mpsc_queue_init(struct mpsc_queue *queue);
+// any thread; a single atomic exchange, so wait-free
+void mpsc_queue_push(struct mpsc_queue *queue, struct mpsc_node *node);
+// consumer only; returns NULL if empty, or if the next node's producer is
+// still between its two steps – it'll be there on a later call
+struct mpsc_node *mpsc_queue_pop(struct mpsc_queue *queue);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,336 @@
+// Adaptive spin-then-futex waiting primitives, see wait.h
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wait.h"
+#include "futex.h"
+
+// every so many waits, spin for the whole limit regardless of the estimate,
+// so that a primitive whose waits got shorter learns about it
+#define WAIT_PROBE_INTERVAL		16
+// how often the cached scheduling policy gets refreshed
+#define WAIT_REFRESH_INTERVAL	256
+// the estimate moves by 1/WAIT_LEARN_RATE of the difference per wait
+#define WAIT_LEARN_RATE			8
+#define WAIT_MAX_POLICIES		8
+#define WAIT_PARK_BUCKETS		64
+
+// max spin per scheduling policy, in ns: RT threads get woken promptly anyway
+// and must not starve a waker sharing their CPU, and background ones have no
+// business burning CPU
+static int g_spin_limits[WAIT_MAX_POLICIES] =
+{
+	20000,	// SCHED_OTHER
+	5000,	// SCHED_FIFO
+	5000,	// SCHED_RR
+	2000,	// SCHED_BATCH
+	0,		// 4 is unused
+	0,		// SCHED_IDLE
+	5000,	// SCHED_DEADLINE
+	0
+};
+static int g_num_cpus = 0;
+
+static __thread int t_policy = -1;
+static __thread unsigned t_waits = 0;
+
+struct wait_parked
+{
+	const void *addr;
+	int token;			// set to 1 when unparked
+	struct wait_parked *next;
+};
+
+struct wait_bucket
+{
+	pthread_mutex_t lock;
+	struct wait_parked *head, *tail;
+	struct wait_spin spin;
+};
+
+static struct wait_bucket g_buckets[WAIT_PARK_BUCKETS] =
+{
+	[0 ... WAIT_PARK_BUCKETS - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, {0, 0}}
+};
+
+
+// ============================================================================
+
+
+static inline void wait_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int spin_budget(struct wait_spin *spin)
+{
+	int limit = wait_spin_limit();
+	if (limit <= 0)
+		return 0;
+	unsigned waits = __atomic_fetch_add(&spin->waits, 1, __ATOMIC_RELAXED);
+	if (waits % WAIT_PROBE_INTERVAL == 0)
+		return limit;
+	int estimate = __atomic_load_n(&spin->estimate, __ATOMIC_RELAXED);
+	// waits longer than we'd spin anyway aren't worth spinning for at all
+	if (estimate > limit)
+		return 0;
+	return estimate * 2 < limit ? estimate * 2 : limit;
+}
+
+static void spin_learn(struct wait_spin *spin, int64_t waited)
+{
+	// NOTE: racy between threads, but it's only a heuristic
+	if (waited > 1000000)
+		waited = 1000000;
+	int estimate = __atomic_load_n(&spin->estimate, __ATOMIC_RELAXED);
+	estimate += ((int)waited - estimate) / WAIT_LEARN_RATE;
+	__atomic_store_n(&spin->estimate, estimate, __ATOMIC_RELAXED);
+}
+
+// spins while *addr == value, for up to budget ns; returns 1 if it changed
+static int spin_while(int *addr, int value, int budget)
+{
+	if (budget <= 0)
+		return 0;
+	int64_t end = now_ns() + budget;
+	for (;;)
+	{
+		// don't read the clock on every iteration
+		for (int i = 0; i < 64; ++i)
+		{
+			if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != value)
+				return 1;
+			wait_pause();
+		}
+		if (now_ns() >= end)
+			return 0;
+	}
+}
+
+static struct wait_bucket *bucket_for(const void *addr)
+{
+	uint64_t hash = ((uint64_t)(uintptr_t)addr >> 4) * 0x9e3779b97f4a7c15ULL;
+	return &g_buckets[hash >> (64 - 6)];	// 64 buckets
+}
+
+
+// ============================================================================
+
+
+int wait_set_spin_limit(int policy, int ns)
+{
+	if (policy < 0 || policy >= WAIT_MAX_POLICIES)
+		return -1;
+	int previous = g_spin_limits[policy];
+	g_spin_limits[policy] = ns;
+	return previous;
+}
+
+int wait_spin_limit(void)
+{
+	if (t_policy < 0 || ++t_waits % WAIT_REFRESH_INTERVAL == 0)
+		wait_refresh_thread();
+	if (__atomic_load_n(&g_num_cpus, __ATOMIC_RELAXED) <= 1
+		|| t_policy >= WAIT_MAX_POLICIES)
+		return 0;
+	return g_spin_limits[t_policy];
+}
+
+void wait_refresh_thread(void)
+{
+	if (__atomic_load_n(&g_num_cpus, __ATOMIC_RELAXED) == 0)
+	{
+		cpu_set_t allowed;
+		int num_cpus = sched_getaffinity(0, sizeof(allowed), &allowed) == 0
+			? CPU_COUNT(&allowed) : 1;
+		__atomic_store_n(&g_num_cpus, num_cpus, __ATOMIC_RELAXED);
+	}
+	int policy = sched_getscheduler(0);
+	t_policy = policy < 0 ? 0 : policy & ~SCHED_RESET_ON_FORK;
+}
+
+void wait_event_set(struct wait_event *event)
+{
+	__atomic_store_n(&event->state, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&event->waiters, __ATOMIC_SEQ_CST) > 0)
+		futex_wake_all(&event->state);
+}
+
+void wait_event_reset(struct wait_event *event)
+{
+	__atomic_store_n(&event->state, 0, __ATOMIC_SEQ_CST);
+}
+
+void wait_event_wait(struct wait_event *event)
+{
+	if (__atomic_load_n(&event->state, __ATOMIC_ACQUIRE))
+		return;
+	int64_t start = now_ns();
+	if (!spin_while(&event->state, 0, spin_budget(&event->spin)))
+	{
+		__atomic_add_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&event->state, __ATOMIC_SEQ_CST) == 0)
+			futex_wait(&event->state, 0, NULL);
+		__atomic_sub_fetch(&event->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+	spin_learn(&event->spin, now_ns() - start);
+}
+
+void wait_sem_post(struct wait_sem *sem, int count)
+{
+	__atomic_add_fetch(&sem->count, count, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0)
+		futex_wake(&sem->count, count);
+}
+
+int wait_sem_try(struct wait_sem *sem)
+{
+	int count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+	while (count > 0)
+		if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, 1,
+			__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return 0;
+	return -1;
+}
+
+void wait_sem_wait(struct wait_sem *sem)
+{
+	if (wait_sem_try(sem) == 0)
+		return;
+	int64_t start = now_ns();
+	int budget = spin_budget(&sem->spin);
+	for (;;)
+	{
+		// someone else may grab what we saw, so keep trying within the budget
+		int64_t left = budget - (now_ns() - start);
+		if (!spin_while(&sem->count, 0, (int)(left > 0 ? left : 0)))
+			break;
+		if (wait_sem_try(sem) == 0)
+		{
+			spin_learn(&sem->spin, now_ns() - start);
+			return;
+		}
+	}
+
+	__atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+	while (wait_sem_try(sem) != 0)
+		futex_wait(&sem->count, 0, NULL);
+	__atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+	spin_learn(&sem->spin, now_ns() - start);
+}
+
+int wait_barrier_wait(struct wait_barrier *barrier)
+{
+	int generation = __atomic_load_n(&barrier->generation, __ATOMIC_ACQUIRE);
+	if (__atomic_add_fetch(&barrier->arrived, 1, __ATOMIC_ACQ_REL) == barrier->threads)
+	{
+		// nobody can arrive for the next round before the generation changes
+		__atomic_store_n(&barrier->arrived, 0, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&barrier->generation, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&barrier->waiters, __ATOMIC_SEQ_CST) > 0)
+			futex_wake_all(&barrier->generation);
+		return 1;
+	}
+
+	int64_t start = now_ns();
+	if (!spin_while(&barrier->generation, generation, spin_budget(&barrier->spin)))
+	{
+		__atomic_add_fetch(&barrier->waiters, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&barrier->generation, __ATOMIC_SEQ_CST) == generation)
+			futex_wait(&barrier->generation, generation, NULL);
+		__atomic_sub_fetch(&barrier->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+	spin_learn(&barrier->spin, now_ns() - start);
+	return 0;
+}
+
+int wait_park(const void *addr, int (*validate)(void *arg), void *arg)
+{
+	struct wait_bucket *bucket = bucket_for(addr);
+	struct wait_parked self = {addr, 0, NULL};
+	pthread_mutex_lock(&bucket->lock);
+	if (validate && !validate(arg))
+	{
+		pthread_mutex_unlock(&bucket->lock);
+		return 0;
+	}
+	if (bucket->tail)
+		bucket->tail->next = &self;
+	else
+		bucket->head = &self;
+	bucket->tail = &self;
+	pthread_mutex_unlock(&bucket->lock);
+
+	int64_t start = now_ns();
+	if (!spin_while(&self.token, 0, spin_budget(&bucket->spin)))
+		while (__atomic_load_n(&self.token, __ATOMIC_ACQUIRE) == 0)
+			futex_wait(&self.token, 0, NULL);
+	spin_learn(&bucket->spin, now_ns() - start);
+	return 1;
+}
+
+static int unpark(const void *addr, int max)
+{
+	struct wait_bucket *bucket = bucket_for(addr);
+	struct wait_parked *woken = NULL, **woken_tail = &woken;
+	int count = 0;
+	pthread_mutex_lock(&bucket->lock);
+	struct wait_parked **link = &bucket->head, *prev = NULL;
+	while (*link && count < max)
+	{
+		struct wait_parked *parked = *link;
+		if (parked->addr != addr)
+		{
+			prev = parked;
+			link = &parked->next;
+			continue;
+		}
+		*link = parked->next;
+		if (bucket->tail == parked)
+			bucket->tail = prev;
+		parked->next = NULL;
+		*woken_tail = parked;
+		woken_tail = &parked->next;
+		++count;
+	}
+	pthread_mutex_unlock(&bucket->lock);
+
+	while (woken)
+	{
+		struct wait_parked *next = woken->next;
+		__atomic_store_n(&woken->token, 1, __ATOMIC_RELEASE);
+		// NOTE: the parked thread may already be gone, and its stack reused;
+		// at worst that's a spurious wakeup for some other futex, which all
+		// of them have to cope with anyway
+		futex_wake(&woken->token, 1);
+		woken = next;
+	}
+	return count;
+}
+
+int wait_unpark_one(const void *addr)
+{
+	return unpark(addr, 1);
+}
+
+int wait_unpark_all(const void *addr)
+{
+	return unpark(addr, INT_MAX);
+}
@@ -0,0 +1,91 @@
+// Adaptive spin-then-futex waiting primitives
+// Spinning on a flag burns a core for as long as the wait lasts; sleeping on a
+// condition variable adds the kernel's wakeup latency to every handoff, 50 us
+// or more. These spin with pause for about as long as recent waits on the same
+// primitive took, and only then sleep on a futex, so short handoffs stay
+// fast while long waits cost next to no CPU
+// How long a thread may spin at most depends on its scheduling class (see
+// priority/thread_role.h): background classes barely spin, and nobody spins on
+// a single CPU, where it could only delay whoever is going to wake us
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// learned spin duration of a single primitive
+struct wait_spin
+{
+	int estimate;		// of the wait time, in ns
+	unsigned waits;		// for the occasional probe, see wait.c
+};
+
+// manual-reset event: wait() returns while it's set
+struct wait_event
+{
+	int state;			// 0 or 1
+	int waiters;
+	struct wait_spin spin;
+};
+
+// counting semaphore
+struct wait_sem
+{
+	int count;
+	int waiters;
+	struct wait_spin spin;
+};
+
+// reusable barrier for a fixed number of threads
+struct wait_barrier
+{
+	int threads;
+	int arrived;
+	int generation;
+	int waiters;
+	struct wait_spin spin;
+};
+
+#define WAIT_EVENT_INIT		{0, 0, {0, 0}}
+#define WAIT_SEM_INIT(n)	{(n), 0, {0, 0}}
+#define WAIT_BARRIER_INIT(n)	{(n), 0, 0, 0, {0, 0}}
+
+// max spin per scheduling policy (SCHED_OTHER, SCHED_FIFO etc.), in ns;
+// returns the previous one
+int wait_set_spin_limit(int policy, int ns);
+
+// the calling thread's spin limit, as per its current policy
+// NOTE: the policy is cached per thread, and refreshed every so many waits;
+// call wait_refresh_thread() right after changing it
+int wait_spin_limit(void);
+void wait_refresh_thread(void);
+
+void wait_event_set(struct wait_event *event);
+void wait_event_reset(struct wait_event *event);
+void wait_event_wait(struct wait_event *event);
+
+void wait_sem_post(struct wait_sem *sem, int count);
+void wait_sem_wait(struct wait_sem *sem);
+// returns 0 if it got decremented
+int wait_sem_try(struct wait_sem *sem);
+
+// returns 1 in exactly one of the threads (the last to arrive), 0 in the rest
+int wait_barrier_wait(struct wait_barrier *barrier);
+
+// parking lot: lets any word in memory be waited on, without it having to be
+// futex-sized or having room for a waiter count; the parked threads queue up
+// in a global hash table keyed by address
+// parks the calling thread on addr, unless validate(arg) returns 0, which is
+// checked with the bucket locked so that unparks can't slip in between;
+// returns 1 if it got unparked, 0 if validation failed
+int wait_park(const void *addr, int (*validate)(void *arg), void *arg);
+// unpark the oldest or all threads parked on addr; return how many
+int wait_unpark_one(const void *addr);
+int wait_unpark_all(const void *addr);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,153 @@
+// Benchmark of the adaptive waits against a mutex + condition variable: two
+// threads play ping-pong through a pair of semaphores, with the pinger doing
+// some work between the handoffs, and we measure the round trip latency and
+// the CPU time it takes
+// To build:	make
+// To run:	./wait_bench [round trips]
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "wait.h"
+
+#define NUM_GAPS	3
+
+static const int g_gaps[NUM_GAPS] = {0, 20000, 200000};	// ns between pings
+
+struct cond_sem
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int count;
+};
+
+struct ping_pong
+{
+	int adaptive;
+	int rounds;
+	struct wait_sem ping, pong;
+	struct cond_sem cond_ping, cond_pong;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t cpu_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void cond_post(struct cond_sem *sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	++sem->count;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+static void cond_wait(struct cond_sem *sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	while (sem->count == 0)
+		pthread_cond_wait(&sem->cond, &sem->mutex);
+	--sem->count;
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+static void *ponger(void *arg)
+{
+	struct ping_pong *pp = arg;
+	for (int i = 0; i < pp->rounds; ++i)
+		if (pp->adaptive)
+		{
+			wait_sem_wait(&pp->ping);
+			wait_sem_post(&pp->pong, 1);
+		}
+		else
+		{
+			cond_wait(&pp->cond_ping);
+			cond_post(&pp->cond_pong);
+		}
+	return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run(int adaptive, int gap, int rounds, int64_t *samples)
+{
+	struct ping_pong pp =
+	{
+		adaptive, rounds, WAIT_SEM_INIT(0), WAIT_SEM_INIT(0),
+		{PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0},
+		{PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0}
+	};
+	pthread_t thread;
+	pthread_create(&thread, NULL, ponger, &pp);
+
+	int64_t cpu = cpu_ns(), wall = now_ns();
+	for (int i = 0; i < rounds; ++i)
+	{
+		// busy work, as the frame would be doing between handoffs
+		int64_t until = now_ns() + gap;
+		while (now_ns() < until)
+			;
+		int64_t start = now_ns();
+		if (adaptive)
+		{
+			wait_sem_post(&pp.ping, 1);
+			wait_sem_wait(&pp.pong);
+		}
+		else
+		{
+			cond_post(&pp.cond_ping);
+			cond_wait(&pp.cond_pong);
+		}
+		samples[i] = now_ns() - start;
+	}
+	pthread_join(thread, NULL);
+	wall = now_ns() - wall;
+	cpu = cpu_ns() - cpu;
+
+	int64_t sum = 0;
+	for (int i = 0; i < rounds; ++i)
+		sum += samples[i];
+	qsort(samples, rounds, sizeof(*samples), compare);
+	// CPU time beyond the pinger's own busy work is what the waiting cost
+	printf("%-9s gap %6d ns: avg %7.1f us, p99 %7.1f us, waiting cpu %5.1f%%\n",
+		adaptive ? "adaptive" : "condvar", gap, sum / (double)rounds / 1000,
+		samples[rounds * 99 / 100] / 1000.0,
+		100.0 * (cpu - (int64_t)gap * rounds) / wall);
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 20000;
+	if (rounds <= 0)
+	{
+		fprintf(stderr, "Usage: %s [round trips]\n", argv[0]);
+		return 1;
+	}
+	int64_t *samples = malloc(rounds * sizeof(*samples));
+
+	printf("Spin limit for this thread: %d ns\n", wait_spin_limit());
+	for (int i = 0; i < NUM_GAPS; ++i)
+	{
+		run(0, g_gaps[i], rounds, samples);
+		run(1, g_gaps[i], rounds, samples);
+	}
+	free(samples);
+	return 0;
+}